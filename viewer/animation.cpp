@@ -0,0 +1,255 @@
+#include "animation.h"
+
+#include "scene.h"
+#include "thread_pool.h"
+
+#include <cmath>
+#include <cassert>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define ANIMATION_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+// tracks per job handed to the thread pool
+static const int kTracksPerChunk = 256;
+
+void InitAnimation(
+    Animation& animation,
+    uint32_t keyCount,
+    float duration,
+    uint32_t trackCapacity)
+{
+    assert(keyCount >= 2);
+
+    animation.KeyCount = keyCount;
+    animation.Duration = duration;
+    animation.TrackCount = 0;
+    animation.TrackCapacity = (trackCapacity + 3) & ~3;
+
+    animation.TransformIDs.assign(animation.TrackCapacity, -1);
+    animation.TimeOffsets.assign(animation.TrackCapacity, 0.0f);
+    animation.Speeds.assign(animation.TrackCapacity, 0.0f);
+
+    size_t numKeys = (size_t)animation.TrackCapacity * keyCount;
+    animation.TranslationX.assign(numKeys, 0.0f);
+    animation.TranslationY.assign(numKeys, 0.0f);
+    animation.TranslationZ.assign(numKeys, 0.0f);
+    animation.RotationX.assign(numKeys, 0.0f);
+    animation.RotationY.assign(numKeys, 0.0f);
+    animation.RotationZ.assign(numKeys, 0.0f);
+    animation.RotationW.assign(numKeys, 1.0f);
+}
+
+uint32_t AddAnimationTrack(
+    Animation& animation,
+    uint32_t transformID,
+    float timeOffset,
+    float speed)
+{
+    if (animation.TrackCount == animation.TrackCapacity)
+    {
+        return -1;
+    }
+
+    uint32_t trackIndex = animation.TrackCount++;
+    animation.TransformIDs[trackIndex] = transformID;
+    animation.TimeOffsets[trackIndex] = timeOffset;
+    animation.Speeds[trackIndex] = speed;
+    return trackIndex;
+}
+
+void SetAnimationKey(
+    Animation& animation,
+    uint32_t trackIndex,
+    uint32_t keyIndex,
+    const glm::vec3& translation,
+    const glm::quat& rotation)
+{
+    size_t i = (size_t)keyIndex * animation.TrackCapacity + trackIndex;
+    animation.TranslationX[i] = translation.x;
+    animation.TranslationY[i] = translation.y;
+    animation.TranslationZ[i] = translation.z;
+    animation.RotationX[i] = rotation.x;
+    animation.RotationY[i] = rotation.y;
+    animation.RotationZ[i] = rotation.z;
+    animation.RotationW[i] = rotation.w;
+}
+
+// Slerp is approximated by a normalized lerp with a corrected interpolation parameter,
+// which avoids the trigonometry and the division by sin(theta) of an exact slerp.
+// See "Approximating slerp" by Arseny Kapoulkine. The coefficients come from a least-squares fit.
+static float SlerpCorrectedT(float t, float absCosTheta)
+{
+    float d = absCosTheta;
+    float A = 1.0904f + d * (-3.2452f + d * (3.55645f - d * 1.43519f));
+    float B = 0.848013f + d * (-1.06021f + d * 0.215638f);
+    float k = A * (t - 0.5f) * (t - 0.5f) + B;
+    return t + t * (t - 0.5f) * (t - 1.0f) * k;
+}
+
+// Finds the two keys to interpolate between for each track, and the interpolation factor.
+static void LocateKeys(const Animation& animation, uint32_t track, float timeSeconds, uint32_t* key0, uint32_t* key1, float* t)
+{
+    float localTime = timeSeconds * animation.Speeds[track] + animation.TimeOffsets[track];
+    float keyTime = localTime / animation.Duration * animation.KeyCount;
+    keyTime -= floorf(keyTime / animation.KeyCount) * animation.KeyCount;
+
+    uint32_t k = (uint32_t)keyTime;
+    if (k >= animation.KeyCount)
+    {
+        // can happen from rounding
+        k = animation.KeyCount - 1;
+    }
+
+    *key0 = k;
+    *key1 = k + 1 == animation.KeyCount ? 0 : k + 1;
+    *t = keyTime - (float)k;
+}
+
+static void WriteTransform(Scene& scene, uint32_t transformID, float tx, float ty, float tz, float qx, float qy, float qz, float qw)
+{
+    Transform& transform = scene.Transforms[transformID];
+    transform.Translation = glm::vec3(tx, ty, tz);
+    transform.Rotation = glm::quat(qw, qx, qy, qz);
+}
+
+static void EvaluateTracksScalar(const Animation& animation, Scene& scene, float timeSeconds, uint32_t begin, uint32_t end)
+{
+    uint32_t stride = animation.TrackCapacity;
+
+    for (uint32_t track = begin; track < end; track++)
+    {
+        uint32_t key0, key1;
+        float t;
+        LocateKeys(animation, track, timeSeconds, &key0, &key1, &t);
+
+        size_t i0 = (size_t)key0 * stride + track;
+        size_t i1 = (size_t)key1 * stride + track;
+
+        float tx = animation.TranslationX[i0] + (animation.TranslationX[i1] - animation.TranslationX[i0]) * t;
+        float ty = animation.TranslationY[i0] + (animation.TranslationY[i1] - animation.TranslationY[i0]) * t;
+        float tz = animation.TranslationZ[i0] + (animation.TranslationZ[i1] - animation.TranslationZ[i0]) * t;
+
+        float ax = animation.RotationX[i0], ay = animation.RotationY[i0], az = animation.RotationZ[i0], aw = animation.RotationW[i0];
+        float bx = animation.RotationX[i1], by = animation.RotationY[i1], bz = animation.RotationZ[i1], bw = animation.RotationW[i1];
+
+        // take the shortest path
+        float cosTheta = ax * bx + ay * by + az * bz + aw * bw;
+        float sign = cosTheta < 0.0f ? -1.0f : 1.0f;
+        float ct = SlerpCorrectedT(t, fabsf(cosTheta));
+        float wa = 1.0f - ct;
+        float wb = ct * sign;
+
+        float qx = ax * wa + bx * wb;
+        float qy = ay * wa + by * wb;
+        float qz = az * wa + bz * wb;
+        float qw = aw * wa + bw * wb;
+        float rcpLen = 1.0f / sqrtf(qx * qx + qy * qy + qz * qz + qw * qw);
+
+        WriteTransform(scene, animation.TransformIDs[track], tx, ty, tz, qx * rcpLen, qy * rcpLen, qz * rcpLen, qw * rcpLen);
+    }
+}
+
+#ifdef ANIMATION_USE_SSE2
+// gathers the values of 4 tracks that each use a different key
+static inline __m128 Gather4(const float* keys, const size_t indices[4])
+{
+    return _mm_setr_ps(keys[indices[0]], keys[indices[1]], keys[indices[2]], keys[indices[3]]);
+}
+
+static inline __m128 Lerp4(__m128 a, __m128 b, __m128 t)
+{
+    return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+}
+
+// evaluates 4 tracks at a time. begin must be a multiple of 4.
+static void EvaluateTracksSSE2(const Animation& animation, Scene& scene, float timeSeconds, uint32_t begin, uint32_t end)
+{
+    uint32_t stride = animation.TrackCapacity;
+
+    uint32_t batchEnd = begin + ((end - begin) & ~3u);
+    for (uint32_t track = begin; track < batchEnd; track += 4)
+    {
+        size_t i0[4], i1[4];
+        alignas(16) float t[4];
+        for (uint32_t lane = 0; lane < 4; lane++)
+        {
+            uint32_t key0, key1;
+            LocateKeys(animation, track + lane, timeSeconds, &key0, &key1, &t[lane]);
+            i0[lane] = (size_t)key0 * stride + track + lane;
+            i1[lane] = (size_t)key1 * stride + track + lane;
+        }
+
+        __m128 vt = _mm_load_ps(t);
+
+        alignas(16) float tx[4], ty[4], tz[4];
+        _mm_store_ps(tx, Lerp4(Gather4(animation.TranslationX.data(), i0), Gather4(animation.TranslationX.data(), i1), vt));
+        _mm_store_ps(ty, Lerp4(Gather4(animation.TranslationY.data(), i0), Gather4(animation.TranslationY.data(), i1), vt));
+        _mm_store_ps(tz, Lerp4(Gather4(animation.TranslationZ.data(), i0), Gather4(animation.TranslationZ.data(), i1), vt));
+
+        __m128 ax = Gather4(animation.RotationX.data(), i0), bx = Gather4(animation.RotationX.data(), i1);
+        __m128 ay = Gather4(animation.RotationY.data(), i0), by = Gather4(animation.RotationY.data(), i1);
+        __m128 az = Gather4(animation.RotationZ.data(), i0), bz = Gather4(animation.RotationZ.data(), i1);
+        __m128 aw = Gather4(animation.RotationW.data(), i0), bw = Gather4(animation.RotationW.data(), i1);
+
+        __m128 cosTheta = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+
+        // take the shortest path: flip b's sign where the dot product is negative
+        __m128 signMask = _mm_and_ps(cosTheta, _mm_set1_ps(-0.0f));
+        __m128 d = _mm_andnot_ps(_mm_set1_ps(-0.0f), cosTheta);
+
+        // vectorized SlerpCorrectedT
+        __m128 one = _mm_set1_ps(1.0f);
+        __m128 half = _mm_set1_ps(0.5f);
+        __m128 A = _mm_add_ps(_mm_set1_ps(1.0904f), _mm_mul_ps(d, _mm_add_ps(_mm_set1_ps(-3.2452f), _mm_mul_ps(d, _mm_sub_ps(_mm_set1_ps(3.55645f), _mm_mul_ps(d, _mm_set1_ps(1.43519f)))))));
+        __m128 B = _mm_add_ps(_mm_set1_ps(0.848013f), _mm_mul_ps(d, _mm_add_ps(_mm_set1_ps(-1.06021f), _mm_mul_ps(d, _mm_set1_ps(0.215638f)))));
+        __m128 tMinusHalf = _mm_sub_ps(vt, half);
+        __m128 k = _mm_add_ps(_mm_mul_ps(A, _mm_mul_ps(tMinusHalf, tMinusHalf)), B);
+        __m128 ct = _mm_add_ps(vt, _mm_mul_ps(_mm_mul_ps(vt, _mm_mul_ps(tMinusHalf, _mm_sub_ps(vt, one))), k));
+
+        __m128 wa = _mm_sub_ps(one, ct);
+        __m128 wb = _mm_xor_ps(ct, signMask);
+
+        __m128 qx = _mm_add_ps(_mm_mul_ps(ax, wa), _mm_mul_ps(bx, wb));
+        __m128 qy = _mm_add_ps(_mm_mul_ps(ay, wa), _mm_mul_ps(by, wb));
+        __m128 qz = _mm_add_ps(_mm_mul_ps(az, wa), _mm_mul_ps(bz, wb));
+        __m128 qw = _mm_add_ps(_mm_mul_ps(aw, wa), _mm_mul_ps(bw, wb));
+
+        // normalize (full precision sqrt, rsqrt's error is visible as wobble)
+        __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(qx, qx), _mm_mul_ps(qy, qy)), _mm_add_ps(_mm_mul_ps(qz, qz), _mm_mul_ps(qw, qw)));
+        __m128 rcpLen = _mm_div_ps(one, _mm_sqrt_ps(len2));
+
+        alignas(16) float rx[4], ry[4], rz[4], rw[4];
+        _mm_store_ps(rx, _mm_mul_ps(qx, rcpLen));
+        _mm_store_ps(ry, _mm_mul_ps(qy, rcpLen));
+        _mm_store_ps(rz, _mm_mul_ps(qz, rcpLen));
+        _mm_store_ps(rw, _mm_mul_ps(qw, rcpLen));
+
+        // scatter into the scene
+        for (uint32_t lane = 0; lane < 4; lane++)
+        {
+            WriteTransform(scene, animation.TransformIDs[track + lane], tx[lane], ty[lane], tz[lane], rx[lane], ry[lane], rz[lane], rw[lane]);
+        }
+    }
+
+    // leftover tracks
+    EvaluateTracksScalar(animation, scene, timeSeconds, batchEnd, end);
+}
+#endif
+
+void EvaluateAnimation(
+    const Animation& animation,
+    Scene& scene,
+    float timeSeconds)
+{
+    // chunks are multiples of 4 tracks, so every chunk starts at a SIMD batch boundary
+    ParallelFor((int)animation.TrackCount, kTracksPerChunk, [&](int begin, int end)
+    {
+#ifdef ANIMATION_USE_SSE2
+        EvaluateTracksSSE2(animation, scene, timeSeconds, (uint32_t)begin, (uint32_t)end);
+#else
+        EvaluateTracksScalar(animation, scene, timeSeconds, (uint32_t)begin, (uint32_t)end);
+#endif
+    });
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <vector>
+#include <cstdint>
+
+class Scene;
+
+// A set of keyframed transform animations, one track per animated transform.
+// Designed for evaluating thousands of tracks per frame:
+// * Keys are stored structure-of-arrays, indexed by [key * TrackCapacity + track],
+//   so that a batch of 4 tracks can be evaluated together with SIMD.
+// * All tracks have KeyCount keys uniformly spaced over Duration, and loop.
+//   Tracks are desynchronized with their own time offset and playback speed.
+struct Animation
+{
+    uint32_t KeyCount;
+    float Duration;
+
+    // number of tracks in use
+    uint32_t TrackCount;
+    // number of tracks the key arrays are laid out for (multiple of 4)
+    uint32_t TrackCapacity;
+
+    // per track
+    std::vector<uint32_t> TransformIDs;
+    std::vector<float> TimeOffsets;
+    std::vector<float> Speeds;
+
+    // per track and per key
+    std::vector<float> TranslationX, TranslationY, TranslationZ;
+    std::vector<float> RotationX, RotationY, RotationZ, RotationW;
+};
+
+void InitAnimation(
+    Animation& animation,
+    uint32_t keyCount,
+    float duration,
+    uint32_t trackCapacity);
+
+// Returns the new track's index, or -1 if the animation is full.
+// The keys are left uninitialized, use SetAnimationKey to fill them.
+uint32_t AddAnimationTrack(
+    Animation& animation,
+    uint32_t transformID,
+    float timeOffset,
+    float speed);
+
+void SetAnimationKey(
+    Animation& animation,
+    uint32_t trackIndex,
+    uint32_t keyIndex,
+    const glm::vec3& translation,
+    const glm::quat& rotation);
+
+// Samples every track at the given time, and writes the result into the translation and rotation of the scene's transforms.
+// Tracks are interpolated linearly (translation) and with an approximated slerp (rotation), 4 at a time, and in parallel.
+void EvaluateAnimation(
+    const Animation& animation,
+    Scene& scene,
+    float timeSeconds);
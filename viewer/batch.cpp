@@ -0,0 +1,304 @@
+#include "batch.h"
+
+#include "scene.h"
+#include "renderer.h"
+
+#include <SDL.h>
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <cstdio>
+#include <cctype>
+#include <cstdlib>
+
+void InitBatchJob(BatchJob& job)
+{
+    job.LineNumber = 0;
+    job.SceneFiles.clear();
+    job.Eye = glm::vec3(3.0f);
+    job.Target = glm::vec3(0.0f);
+    job.Up = glm::vec3(0.0f, 1.0f, 0.0f);
+    job.FovYDegrees = 70.0f;
+    job.FocusDepth = 5.0f;
+    job.Width = 1920;
+    job.Height = 1080;
+    job.TileSize = 4096;
+    job.Output.clear();
+}
+
+bool ParseBatchJob(const std::string& line, BatchJob& job)
+{
+    std::istringstream tokens(line);
+    std::string token;
+    while (tokens >> token)
+    {
+        size_t equals = token.find('=');
+        if (equals == std::string::npos)
+        {
+            return false;
+        }
+
+        std::string key = token.substr(0, equals);
+        const char* value = token.c_str() + equals + 1;
+
+        bool ok = false;
+        if (key == "scene")
+        {
+            job.SceneFiles = value;
+            ok = !job.SceneFiles.empty();
+        }
+        else if (key == "eye")
+        {
+            ok = sscanf(value, "%f,%f,%f", &job.Eye.x, &job.Eye.y, &job.Eye.z) == 3;
+        }
+        else if (key == "target")
+        {
+            ok = sscanf(value, "%f,%f,%f", &job.Target.x, &job.Target.y, &job.Target.z) == 3;
+        }
+        else if (key == "up")
+        {
+            ok = sscanf(value, "%f,%f,%f", &job.Up.x, &job.Up.y, &job.Up.z) == 3;
+        }
+        else if (key == "fovy")
+        {
+            ok = sscanf(value, "%f", &job.FovYDegrees) == 1;
+        }
+        else if (key == "focus")
+        {
+            ok = sscanf(value, "%f", &job.FocusDepth) == 1;
+        }
+        else if (key == "size")
+        {
+            ok = sscanf(value, "%dx%d", &job.Width, &job.Height) == 2 && job.Width > 0 && job.Height > 0;
+        }
+        else if (key == "tile")
+        {
+            ok = sscanf(value, "%d", &job.TileSize) == 1 && job.TileSize > 0;
+        }
+        else if (key == "out")
+        {
+            job.Output = value;
+            ok = !job.Output.empty();
+        }
+
+        if (!ok)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Replaces a %d (with optional zero padding width) in the pattern with the job index.
+// Anything else that looks like a format specifier is left alone, the pattern comes from a file.
+static std::string FormatBatchOutput(const std::string& pattern, int jobIndex)
+{
+    size_t percent = pattern.find('%');
+    if (percent == std::string::npos)
+    {
+        return pattern;
+    }
+
+    size_t end = percent + 1;
+    while (end < pattern.size() && isdigit((unsigned char)pattern[end]))
+    {
+        end++;
+    }
+
+    if (end >= pattern.size() || pattern[end] != 'd')
+    {
+        return pattern;
+    }
+
+    int width = atoi(pattern.substr(percent + 1, end - percent - 1).c_str());
+    char index[32];
+    snprintf(index, sizeof(index), "%0*d", width, jobIndex);
+
+    return pattern.substr(0, percent) + index + pattern.substr(end + 1);
+}
+
+std::string FormatBatchJob(const BatchJob& job)
+{
+    // %.9g round-trips floats exactly
+    char line[8192];
+    snprintf(line, sizeof(line),
+        "scene=%s eye=%.9g,%.9g,%.9g target=%.9g,%.9g,%.9g up=%.9g,%.9g,%.9g fovy=%.9g focus=%.9g size=%dx%d tile=%d out=%s",
+        job.SceneFiles.c_str(),
+        job.Eye.x, job.Eye.y, job.Eye.z,
+        job.Target.x, job.Target.y, job.Target.z,
+        job.Up.x, job.Up.y, job.Up.z,
+        job.FovYDegrees, job.FocusDepth,
+        job.Width, job.Height, job.TileSize,
+        job.Output.c_str());
+    return line;
+}
+
+// Binary glTF files are placed by their nodes, other files get one instance per mesh
+static bool IsGLBFile(const std::string& file)
+{
+    return file.size() >= 4 && file.compare(file.size() - 4, 4, ".glb") == 0;
+}
+
+// Replaces the scene's instances with one instance of every mesh of the files, loading files that weren't loaded yet.
+static void SetBatchScene(Scene& scene, const std::string& sceneFiles, BatchAssets& assets)
+{
+    std::vector<uint32_t> instanceIDs;
+    for (uint32_t instanceID : scene.Instances)
+    {
+        instanceIDs.push_back(instanceID);
+    }
+    for (uint32_t instanceID : instanceIDs)
+    {
+        RemoveInstance(scene, instanceID);
+    }
+
+    std::istringstream files(sceneFiles);
+    std::string file;
+    while (std::getline(files, file, '+'))
+    {
+        if (IsGLBFile(file))
+        {
+            auto foundPlacements = assets.LoadedPlacements.find(file);
+            if (foundPlacements == assets.LoadedPlacements.end())
+            {
+                foundPlacements = assets.LoadedPlacements.emplace(file, std::vector<MeshPlacement>()).first;
+                LoadGLB(scene, file, NULL, &foundPlacements->second);
+            }
+
+            for (const MeshPlacement& placement : foundPlacements->second)
+            {
+                AddPlacedInstance(scene, placement, NULL);
+            }
+            continue;
+        }
+
+        auto found = assets.LoadedMeshIDs.find(file);
+        if (found == assets.LoadedMeshIDs.end())
+        {
+            found = assets.LoadedMeshIDs.emplace(file, std::vector<uint32_t>()).first;
+            LoadMeshes(scene, file, &found->second);
+        }
+
+        for (uint32_t meshID : found->second)
+        {
+            AddInstance(scene, meshID, NULL);
+        }
+    }
+}
+
+void SetupBatchJob(Scene& scene, IRenderer* renderer, BatchAssets& assets, const BatchJob& job)
+{
+    if (job.SceneFiles != assets.SceneFiles)
+    {
+        SetBatchScene(scene, job.SceneFiles, assets);
+        assets.SceneFiles = job.SceneFiles;
+    }
+
+    if (scene.Cameras.empty())
+    {
+        Camera camera;
+        scene.MainCameraID = scene.Cameras.insert(camera);
+    }
+
+    Camera& camera = scene.Cameras[scene.MainCameraID];
+    camera.Eye = job.Eye;
+    camera.Target = job.Target;
+    camera.Up = job.Up;
+    camera.FovY = glm::radians(job.FovYDegrees);
+    camera.Aspect = (float)job.Width / job.Height;
+    camera.ZNear = kCameraZNear;
+
+    renderer->SetFocusDepth(job.FocusDepth);
+}
+
+bool LoadBatchJobList(const char* jobListFilename, std::vector<BatchJob>* jobs, int* invalidJobCount)
+{
+    FILE* jobList = fopen(jobListFilename, "r");
+    if (!jobList)
+    {
+        fprintf(stderr, "fopen(%s): failed\n", jobListFilename);
+        return false;
+    }
+
+    BatchJob job;
+    InitBatchJob(job);
+
+    // the output pattern is inherited by the following jobs, not its formatted name
+    std::string outputPattern;
+
+    int jobIndex = 0;
+    *invalidJobCount = 0;
+
+    char lineBuffer[4096];
+    for (int lineNumber = 1; fgets(lineBuffer, sizeof(lineBuffer), jobList); lineNumber++)
+    {
+        std::string line = lineBuffer;
+        size_t firstChar = line.find_first_not_of(" \t\r\n");
+        if (firstChar == std::string::npos || line[firstChar] == '#')
+        {
+            continue;
+        }
+
+        job.Output = outputPattern;
+        bool valid = ParseBatchJob(line, job) && !job.SceneFiles.empty() && !job.Output.empty();
+        outputPattern = job.Output;
+
+        if (!valid)
+        {
+            fprintf(stderr, "%s:%d: invalid job (needs scene= and out=)\n", jobListFilename, lineNumber);
+            (*invalidJobCount)++;
+        }
+        else
+        {
+            BatchJob formatted = job;
+            formatted.LineNumber = lineNumber;
+            formatted.Output = FormatBatchOutput(outputPattern, jobIndex);
+            jobs->push_back(formatted);
+        }
+
+        jobIndex++;
+    }
+
+    fclose(jobList);
+
+    return true;
+}
+
+int RunBatch(const char* jobListFilename, Scene* scene, IRenderer* renderer)
+{
+    std::vector<BatchJob> jobs;
+    int invalidJobCount;
+    if (!LoadBatchJobList(jobListFilename, &jobs, &invalidJobCount))
+    {
+        return 1;
+    }
+
+    int failedJobCount = invalidJobCount;
+
+    BatchAssets assets;
+
+    Uint64 startTicks = SDL_GetPerformanceCounter();
+
+    for (const BatchJob& job : jobs)
+    {
+        SetupBatchJob(*scene, renderer, assets, job);
+
+        if (!renderer->RenderStill(job.Output.c_str(), job.Width, job.Height, job.TileSize))
+        {
+            fprintf(stderr, "%s:%d: failed to render %s\n", jobListFilename, job.LineNumber, job.Output.c_str());
+            failedJobCount++;
+        }
+
+        FlushGLDeletions(*scene);
+    }
+
+    double seconds = (double)(SDL_GetPerformanceCounter() - startTicks) / SDL_GetPerformanceFrequency();
+    int jobCount = (int)jobs.size() + invalidJobCount;
+    printf("Batch: %d jobs (%d failed) in %.2f seconds, %.2f jobs/second\n",
+        jobCount, failedJobCount, seconds, seconds > 0.0 ? jobCount / seconds : 0.0);
+
+    return failedJobCount;
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "scene.h"
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+class IRenderer;
+
+struct BatchJob
+{
+    // line of the job list, for error messages
+    int LineNumber;
+
+    std::string SceneFiles;
+    glm::vec3 Eye;
+    glm::vec3 Target;
+    glm::vec3 Up;
+    float FovYDegrees;
+    float FocusDepth;
+    int Width;
+    int Height;
+    int TileSize;
+    std::string Output;
+};
+
+// Meshes loaded by jobs so far, so each mesh file is only loaded once per run
+struct BatchAssets
+{
+    std::map<std::string, std::vector<uint32_t>> LoadedMeshIDs;
+    // where the nodes of the .glb files place their meshes
+    std::map<std::string, std::vector<MeshPlacement>> LoadedPlacements;
+    // files of the scene that is currently instanced
+    std::string SceneFiles;
+};
+
+// Renders every job of a job list to an image, in one run.
+// The GL context, the shaders and the loaded meshes are reused across jobs, and each mesh file is loaded only once.
+//
+// The job list has one job per line, as space-separated key=value pairs.
+// Keys that are left out keep their value from the previous job, so sweeps only need to list what changes.
+// Empty lines and lines starting with # are ignored.
+//   scene=a.obj+b.glb          mesh files to show (one instance of each .obj mesh, the nodes of each .glb)
+//   eye=x,y,z target=x,y,z up=x,y,z
+//   fovy=degrees
+//   focus=depth
+//   size=WxH tile=N            output resolution, and tile size for resolutions beyond the texture limits
+//   out=file.png               .png or .ppm. A %d (or %04d, ...) is replaced by the job's index.
+//
+// Returns the number of jobs that failed.
+int RunBatch(const char* jobListFilename, Scene* scene, IRenderer* renderer);
+
+// Reads the jobs of a job list, with the keys left out filled in and the outputs' %d replaced.
+// Invalid lines are reported and counted, but don't stop the rest of the list from being read.
+// Returns false if the job list can't be opened.
+bool LoadBatchJobList(const char* jobListFilename, std::vector<BatchJob>* jobs, int* invalidJobCount);
+
+// The values of the keys before the first line of a job list
+void InitBatchJob(BatchJob& job);
+
+// Updates the job with the keys of a job list line. Returns false for malformed lines.
+bool ParseBatchJob(const std::string& line, BatchJob& job);
+
+// Formats all keys of the job as a job list line
+std::string FormatBatchJob(const BatchJob& job);
+
+// Sets up the scene's instances, the main camera and the renderer for rendering the job
+void SetupBatchJob(Scene& scene, IRenderer* renderer, BatchAssets& assets, const BatchJob& job);
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// The clip space position and interpolation of the vertices that ClipPolygon clips.
+// Vertex types with attributes have a Clip member and their own LerpVertex next to them.
+inline const glm::vec4& ClipPosition(const glm::vec4& v) { return v; }
+template<class Vertex> const glm::vec4& ClipPosition(const Vertex& v) { return v.Clip; }
+
+inline glm::vec4 LerpVertex(const glm::vec4& a, const glm::vec4& b, float t) { return a + (b - a) * t; }
+
+// Clips a polygon against the plane dot(plane, clip) >= 0. Returns the new vertex count (at most count + 1).
+template<class Vertex>
+int ClipPolygon(const Vertex* in, int count, const glm::vec4& plane, Vertex* out)
+{
+    int outCount = 0;
+    for (int i = 0; i < count; i++)
+    {
+        const Vertex& a = in[i];
+        const Vertex& b = in[(i + 1) % count];
+        float da = dot(plane, ClipPosition(a));
+        float db = dot(plane, ClipPosition(b));
+
+        if (da >= 0.0f)
+        {
+            out[outCount++] = a;
+        }
+        if ((da >= 0.0f) != (db >= 0.0f))
+        {
+            out[outCount++] = LerpVertex(a, b, da / (da - db));
+        }
+    }
+    return outCount;
+}
\ No newline at end of file
@@ -0,0 +1,386 @@
+#include "cpu_dof.h"
+
+#include "thread_pool.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CPU_DOF_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    // Rows are summed and filtered in blocks of this many, which is also how far the ring reaches past the radius.
+    const int kBlockRows = 64;
+    // Tiles that the filtering of a block is split into
+    const int kTileRows = 16;
+    const int kTileColumns = 256;
+    // Width in pixels of the column strips that the vertical sums are split into
+    const int kColumnStrip = 256;
+    // Steps per 8-bit unit in the table that encodes blurred linear values back to sRGB
+    const int kEncodeScale = 64;
+
+    float SRGBToLinear(float c)
+    {
+        return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    uint8_t LinearToSRGB8(float c)
+    {
+        c = std::min(std::max(c, 0.0f), 1.0f);
+        c = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+        return (uint8_t)(c * 255.0f + 0.5f);
+    }
+}
+
+class CPUDepthOfField : public ICPUDepthOfField
+{
+public:
+    CPUDoFParameters mParams;
+    int mWidth;
+    int mHeight;
+    CPUDoFRowSink mSink;
+
+    // radius that the ring is sized for: the maximum radius, or less if it's beyond the image anyway
+    int mRadius;
+    int mRingRows;
+    int mPushedRows;
+    int mFinishedRows;
+
+    // rings of rows, row r at r % mRingRows.
+    // The SAT holds 4 uint32 sums per pixel, which wrap around for big images, but the differences of the box filter
+    // don't, as long as the box itself sums to less than 2^32.
+    std::vector<uint32_t> mSummedAreaTable;
+    std::vector<uint8_t> mColor;
+    // eye space depth, 0 for background
+    std::vector<float> mDepth;
+
+    // finished rows of a block, handed to the sink
+    std::vector<uint8_t> mOutput;
+
+    // 8-bit color to the values that are summed, and the blurred values (times kEncodeScale) back to 8-bit
+    uint32_t mDecode[256];
+    std::vector<uint8_t> mEncode;
+    bool mEncodeIsSRGB;
+
+    CPUDepthOfField()
+    {
+        mWidth = mHeight = 0;
+        mRadius = mRingRows = 0;
+        mPushedRows = mFinishedRows = 0;
+        mEncodeIsSRGB = false;
+        for (int i = 0; i < 256; i++)
+        {
+            mDecode[i] = i;
+        }
+    }
+
+    void Begin(const CPUDoFParameters& params, int width, int height, const CPUDoFRowSink& sink) override
+    {
+        mParams = params;
+        mWidth = width;
+        mHeight = height;
+        mSink = sink;
+
+        // beyond the size of the image, any radius blurs the whole image the same way
+        mRadius = std::min(std::max(params.MaxRadius, 0), std::max(width, height));
+        // holds the rows from the SAT row above the oldest unfinished row's box, to the rows of the block being pushed
+        mRingRows = std::min(2 * mRadius + 2 + kBlockRows, height);
+        mPushedRows = 0;
+        mFinishedRows = 0;
+
+        size_t ringPixels = (size_t)mRingRows * width;
+        if (mSummedAreaTable.size() < ringPixels * 4)
+        {
+            mSummedAreaTable.resize(ringPixels * 4);
+            mColor.resize(ringPixels * 4);
+            mDepth.resize(ringPixels);
+        }
+        if (mOutput.size() < (size_t)kBlockRows * width * 4)
+        {
+            mOutput.resize((size_t)kBlockRows * width * 4);
+        }
+
+        if (params.SRGB != mEncodeIsSRGB || mEncode.empty())
+        {
+            mEncodeIsSRGB = params.SRGB;
+            mEncode.resize(255 * kEncodeScale + 1);
+            for (int i = 0; i < 256; i++)
+            {
+                // the same truncation as the GL renderer's SAT input
+                mDecode[i] = params.SRGB ? (uint32_t)(SRGBToLinear(i / 255.0f) * 255.0f) : i;
+            }
+            for (int i = 0; i < (int)mEncode.size(); i++)
+            {
+                float value = (float)i / kEncodeScale;
+                mEncode[i] = params.SRGB ? LinearToSRGB8(value / 255.0f) : (uint8_t)(value + 0.5f);
+            }
+        }
+    }
+
+    uint32_t* GetSATRow(int row)
+    {
+        return &mSummedAreaTable[(size_t)(row % mRingRows) * mWidth * 4];
+    }
+
+    uint8_t* GetColorRow(int row)
+    {
+        return &mColor[(size_t)(row % mRingRows) * mWidth * 4];
+    }
+
+    float* GetDepthRow(int row)
+    {
+        return &mDepth[(size_t)(row % mRingRows) * mWidth];
+    }
+
+    // Adds rows [firstRow, firstRow + rowCount) to the ring, and sums them into the SAT.
+    void SumRows(const uint8_t* rgba, ptrdiff_t rgbaStride, const float* depth, ptrdiff_t depthStride, int firstRow, int rowCount)
+    {
+        int width = mWidth;
+        float zNear = mParams.ZNear;
+        bool depthIsLinear = mParams.DepthIsLinear;
+        bool decode = mParams.SRGB;
+
+        // sum the rows
+        ParallelFor(rowCount, 4, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+            {
+                int row = firstRow + i;
+                const uint8_t* srcColor = rgba + rgbaStride * i;
+                const float* srcDepth = (const float*)((const uint8_t*)depth + depthStride * i);
+
+                uint8_t* color = GetColorRow(row);
+                memcpy(color, srcColor, (size_t)width * 4);
+
+                float* rowDepth = GetDepthRow(row);
+                for (int x = 0; x < width; x++)
+                {
+                    float d = srcDepth[x];
+                    rowDepth[x] = (depthIsLinear || d == 0.0f) ? d : zNear / d;
+                }
+
+                uint32_t* sat = GetSATRow(row);
+#ifdef CPU_DOF_SSE2
+                __m128i sum = _mm_setzero_si128();
+                __m128i zero = _mm_setzero_si128();
+                for (int x = 0; x < width; x++)
+                {
+                    const uint8_t* c = &color[x * 4];
+                    __m128i value;
+                    if (decode)
+                    {
+                        value = _mm_setr_epi32(mDecode[c[0]], mDecode[c[1]], mDecode[c[2]], c[3]);
+                    }
+                    else
+                    {
+                        int packed;
+                        memcpy(&packed, c, 4);
+                        value = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+                    }
+                    sum = _mm_add_epi32(sum, value);
+                    _mm_storeu_si128((__m128i*)&sat[x * 4], sum);
+                }
+#else
+                uint32_t sum[4] = { 0, 0, 0, 0 };
+                for (int x = 0; x < width; x++)
+                {
+                    const uint8_t* c = &color[x * 4];
+                    sum[0] += mDecode[c[0]];
+                    sum[1] += mDecode[c[1]];
+                    sum[2] += mDecode[c[2]];
+                    sum[3] += c[3];
+                    memcpy(&sat[x * 4], sum, sizeof(sum));
+                }
+#endif
+            }
+        });
+
+        // sum the columns, in strips of columns so each thread walks memory row by row
+        ParallelFor((width + kColumnStrip - 1) / kColumnStrip, 1, [&](int begin, int end)
+        {
+            int col0 = begin * kColumnStrip, col1 = std::min(width, end * kColumnStrip);
+            for (int row = std::max(firstRow, 1); row < firstRow + rowCount; row++)
+            {
+                uint32_t* dst = GetSATRow(row);
+                const uint32_t* src = GetSATRow(row - 1);
+#ifdef CPU_DOF_SSE2
+                for (int col = col0; col < col1; col++)
+                {
+                    __m128i* d = (__m128i*)&dst[col * 4];
+                    _mm_storeu_si128(d, _mm_add_epi32(_mm_loadu_si128(d), _mm_loadu_si128((const __m128i*)&src[col * 4])));
+                }
+#else
+                for (int i = col0 * 4; i < col1 * 4; i++)
+                {
+                    dst[i] += src[i];
+                }
+#endif
+            }
+        });
+    }
+
+    // The same taps, clamping and box area as dof.frag, for one pixel.
+    void FilterPixel(int x, int y, uint8_t* out)
+    {
+        const float* depthRow = GetDepthRow(y);
+        float depth = depthRow[x];
+        if (depth == 0.0f)
+        {
+            // "infinitely far", so background.
+            memcpy(out, &GetColorRow(y)[x * 4], 4);
+            return;
+        }
+
+        int s = std::min((int)(fabsf(depth - mParams.FocusDepth) * mParams.RadiusScale), mRadius);
+
+        enum { UR, UL, LR, LL };
+        const int tapOffsetX[4] = { 0, 1, 0, 1 };
+        const int tapOffsetY[4] = { 0, 0, 1, 1 };
+        int tapX[4] = { x + s, x - s - 1, x + s, x - s - 1 };
+        int tapY[4] = { y + s, y + s, y - s - 1, y - s - 1 };
+
+        const uint32_t* sat[4];
+        static const uint32_t kZero[4] = { 0, 0, 0, 0 };
+        for (int i = 0; i < 4; i++)
+        {
+            if (tapX[i] < 0 || tapY[i] < 0)
+            {
+                sat[i] = kZero;
+            }
+            else
+            {
+                sat[i] = &GetSATRow(std::min(tapY[i], mHeight - 1))[std::min(tapX[i], mWidth - 1) * 4];
+            }
+
+            int clampedX = std::min(std::max(tapX[i], 0), mWidth - 1);
+            int clampedY = std::min(std::max(tapY[i], 0), mHeight - 1);
+            if (clampedX != tapX[i] || clampedY != tapY[i])
+            {
+                tapX[i] = clampedX;
+                tapY[i] = clampedY;
+            }
+            else
+            {
+                tapX[i] += tapOffsetX[i];
+                tapY[i] += tapOffsetY[i];
+            }
+        }
+
+        // the area of the blur might have changed from the clamping of the box
+        int boxsz = (tapX[UR] + 1 - tapX[LL]) * (tapY[UR] + 1 - tapY[LL]);
+        float scale = (float)kEncodeScale / boxsz;
+
+        float box[4];
+#ifdef CPU_DOF_SSE2
+        __m128i sum = _mm_sub_epi32(
+            _mm_add_epi32(_mm_loadu_si128((const __m128i*)sat[UR]), _mm_loadu_si128((const __m128i*)sat[LL])),
+            _mm_add_epi32(_mm_loadu_si128((const __m128i*)sat[UL]), _mm_loadu_si128((const __m128i*)sat[LR])));
+        // the sums are unsigned, and can be beyond what the signed conversion handles
+        __m128 hi = _mm_cvtepi32_ps(_mm_srli_epi32(sum, 16));
+        __m128 lo = _mm_cvtepi32_ps(_mm_and_si128(sum, _mm_set1_epi32(0xFFFF)));
+        __m128 value = _mm_add_ps(_mm_mul_ps(hi, _mm_set1_ps(65536.0f)), lo);
+        _mm_storeu_ps(box, _mm_mul_ps(value, _mm_set1_ps(scale)));
+#else
+        for (int c = 0; c < 4; c++)
+        {
+            box[c] = (float)(sat[UR][c] - sat[UL][c] - sat[LR][c] + sat[LL][c]) * scale;
+        }
+#endif
+
+        int maxIndex = (int)mEncode.size() - 1;
+        for (int c = 0; c < 3; c++)
+        {
+            out[c] = mEncode[std::min((int)(box[c] + 0.5f), maxIndex)];
+        }
+        out[3] = (uint8_t)std::min(box[3] / kEncodeScale + 0.5f, 255.0f);
+    }
+
+    // Filters the rows whose boxes are summed already, and passes them to the sink.
+    void FinishReadyRows()
+    {
+        int readyRows = mPushedRows == mHeight ? mHeight : std::max(0, mPushedRows - mRadius);
+        while (mFinishedRows < readyRows)
+        {
+            int firstRow = mFinishedRows;
+            int rowCount = std::min(readyRows - firstRow, kBlockRows);
+
+            int tilesX = (mWidth + kTileColumns - 1) / kTileColumns;
+            int tilesY = (rowCount + kTileRows - 1) / kTileRows;
+            ParallelFor(tilesX * tilesY, 1, [&](int begin, int end)
+            {
+                for (int tile = begin; tile < end; tile++)
+                {
+                    int x0 = tile % tilesX * kTileColumns, x1 = std::min(x0 + kTileColumns, mWidth);
+                    int y0 = tile / tilesX * kTileRows, y1 = std::min(y0 + kTileRows, rowCount);
+                    for (int y = y0; y < y1; y++)
+                    {
+                        uint8_t* out = &mOutput[(size_t)y * mWidth * 4];
+                        for (int x = x0; x < x1; x++)
+                        {
+                            FilterPixel(x, firstRow + y, &out[x * 4]);
+                        }
+                    }
+                }
+            });
+
+            mSink(firstRow, rowCount, mOutput.data(), (ptrdiff_t)mWidth * 4);
+            mFinishedRows += rowCount;
+        }
+    }
+
+    void PushRows(const uint8_t* rgba, ptrdiff_t rgbaStride, const float* depth, ptrdiff_t depthStride, int rowCount) override
+    {
+        rowCount = std::min(rowCount, mHeight - mPushedRows);
+        while (rowCount > 0)
+        {
+            // a block at a time, so the ring never has to hold more than that beyond the radius
+            int blockRows = std::min(rowCount, kBlockRows);
+            SumRows(rgba, rgbaStride, depth, depthStride, mPushedRows, blockRows);
+            mPushedRows += blockRows;
+
+            FinishReadyRows();
+
+            rgba += rgbaStride * blockRows;
+            depth = (const float*)((const uint8_t*)depth + depthStride * blockRows);
+            rowCount -= blockRows;
+        }
+    }
+};
+
+void InitCPUDoFParameters(CPUDoFParameters& params)
+{
+    params.FocusDepth = 5.0f;
+    params.RadiusScale = 1.0f;
+    params.MaxRadius = 64;
+    params.DepthIsLinear = true;
+    params.ZNear = 0.01f;
+    params.SRGB = true;
+}
+
+ICPUDepthOfField* NewCPUDepthOfField()
+{
+    return new CPUDepthOfField();
+}
+
+void ApplyCPUDepthOfField(
+    const CPUDoFParameters& params, int width, int height,
+    const uint8_t* rgba, ptrdiff_t rgbaStride,
+    const float* depth, ptrdiff_t depthStride,
+    uint8_t* output, ptrdiff_t outputStride)
+{
+    CPUDepthOfField dof;
+    // rows are only finished after everything they read was copied into the ring, so writing in place is safe
+    dof.Begin(params, width, height, [&](int firstRow, int rowCount, const uint8_t* rows, ptrdiff_t rowStride)
+    {
+        for (int i = 0; i < rowCount; i++)
+        {
+            memcpy(output + outputStride * (firstRow + i), rows + rowStride * i, (size_t)width * 4);
+        }
+    });
+    dof.PushRows(rgba, rgbaStride, depth, depthStride, height);
+}
\ No newline at end of file
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+// The depth of field of dof.frag (a box filter read from a summed area table), on the CPU, for images in host memory.
+// Meant for post-processing frames of other renderers (or of the software renderer) without a GPU.
+//
+// The image is processed as a stream of rows: each row only needs the SAT rows within the maximum radius of it, so
+// only those are kept around, in a ring. Rows can be fed as they are produced (tiles of a still, slices of a file),
+// and the blurred rows come out as soon as every row they depend on was fed.
+// Rows are fed bottom-up, like GL reads them back. Top-down images work too, but the clamping of dof.frag at the
+// image's edges isn't symmetric, so their edges come out slightly different than the GL renderer's.
+//
+// The SAT is summed with SSE2 one pixel (4 channels) per vector, and both the summing and the filtering are split
+// over the thread pool, the filtering in tiles.
+
+struct CPUDoFParameters
+{
+    // Eye space depth of the plane in focus
+    float FocusDepth;
+    // Pixels of blur radius per unit of distance from the focus plane
+    float RadiusScale;
+    // Radius in pixels that the blur is clamped to. Bounds the rows kept in memory (2 * MaxRadius + a block).
+    int MaxRadius;
+    // If set, depth is eye space depth (0 for background), otherwise reversed-Z depth, converted with ZNear.
+    bool DepthIsLinear;
+    float ZNear;
+    // If set, the color is sRGB-encoded, and blurred in linear space like the GL renderer does with its sRGB targets.
+    // Alpha is always linear.
+    bool SRGB;
+};
+
+void InitCPUDoFParameters(CPUDoFParameters& params);
+
+// Receives rowCount finished RGBA8 rows starting at row firstRow. The rows are only valid during the call.
+typedef std::function<void(int firstRow, int rowCount, const uint8_t* rgba, ptrdiff_t rowStride)> CPUDoFRowSink;
+
+class ICPUDepthOfField
+{
+public:
+    virtual ~ICPUDepthOfField() { }
+
+    // Starts a new image. The buffers are kept from one image to the next, as long as they are big enough.
+    virtual void Begin(const CPUDoFParameters& params, int width, int height, const CPUDoFRowSink& sink) = 0;
+
+    // Feeds the next rowCount rows of the image: RGBA8 color and one float of depth per pixel.
+    // Strides are in bytes, and can be negative. Finished rows are passed to the sink before this returns,
+    // and the last of them once the last row of the image is fed.
+    virtual void PushRows(const uint8_t* rgba, ptrdiff_t rgbaStride, const float* depth, ptrdiff_t depthStride, int rowCount) = 0;
+};
+
+ICPUDepthOfField* NewCPUDepthOfField();
+
+// Blurs a whole image in one call. output can be the same buffer as rgba.
+// Convenience for one-off images, a persistent ICPUDepthOfField keeps its buffers from one image to the next.
+void ApplyCPUDepthOfField(
+    const CPUDoFParameters& params, int width, int height,
+    const uint8_t* rgba, ptrdiff_t rgbaStride,
+    const float* depth, ptrdiff_t depthStride,
+    uint8_t* output, ptrdiff_t outputStride);
\ No newline at end of file
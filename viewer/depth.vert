@@ -0,0 +1,15 @@
+// Depth-only pre-pass, from the positions only.
+// gl_Position is invariant here and in scene.vert, so the color pass can test against this depth with GL_EQUAL.
+
+layout(location = SCENE_POSITION_ATTRIB_LOCATION)
+in vec4 Position;
+
+layout(location = SCENE_MVP_UNIFORM_LOCATION)
+uniform mat4 MVP;
+
+invariant gl_Position;
+
+void main()
+{
+    gl_Position = MVP * Position;
+}
\ No newline at end of file
@@ -1,8 +1,24 @@
-layout(binding = DOF_SAT_TEXTURE_BINDING) uniform usampler2D SAT;
+// With blit_layered.geom, each layer is one view, which gl_Layer selects (0 without it).
+layout(binding = DOF_SAT_TEXTURE_BINDING) uniform usampler2DArray SAT;
 layout(binding = DOF_DEPTH_TEXTURE_BINDING) uniform sampler2D Depth;
+layout(binding = DOF_COLOR_TEXTURE_BINDING) uniform sampler2D Color;
+layout(binding = DOF_DEPTH_ARRAY_TEXTURE_BINDING) uniform sampler2DArray DepthArray;
+layout(binding = DOF_COLOR_ARRAY_TEXTURE_BINDING) uniform sampler2DArray ColorArray;
 
-layout(location = DOF_ZNEAR_UNIFORM_LOCATION) uniform float ZNear;
+layout(location = DOF_ZNEAR_UNIFORM_LOCATION) uniform float ZNear[MULTIVIEW_MAX_VIEWS];
 layout(location = DOF_FOCUS_UNIFORM_LOCATION) uniform float Focus;
+// the SAT can be bigger than the rendered region (padding, dynamic resolution)
+layout(location = DOF_RENDER_SIZE_UNIFORM_LOCATION) uniform ivec2 RenderSize;
+// if set, Depth already holds eye space depth (0 for background), otherwise reversed-Z NDC depth
+layout(location = DOF_DEPTH_IS_LINEAR_UNIFORM_LOCATION) uniform int DepthIsLinear;
+// converts the radius to pixels of the rendered image (for rendering at a different resolution than the window)
+layout(location = DOF_RADIUS_SCALE_UNIFORM_LOCATION) uniform float RadiusScale;
+// in pixels of the rendered image. Tiles are rendered with a margin of at least this much.
+layout(location = DOF_MAX_RADIUS_UNIFORM_LOCATION) uniform int MaxRadius;
+// if set, the background is copied from Color. Otherwise it's left as it is, for blurring in place.
+layout(location = DOF_COPY_BACKGROUND_UNIFORM_LOCATION) uniform int CopyBackground;
+// if set, Depth and Color are read from the arrays
+layout(location = DOF_READ_ARRAY_INPUTS_UNIFORM_LOCATION) uniform int ReadArrayInputs;
 
 out vec4 FragColor;
 
@@ -13,24 +29,37 @@ out vec4 FragColor;
 
 void main()
 {
-    ivec2 sz = textureSize(SAT, 0);
+    ivec2 sz = RenderSize;
 
     // radius of SAT blur
     int sw, sh;
     
-    // sample ndc depth
-    float depth = texelFetch(Depth, ivec2(gl_FragCoord.xy), 0).x;
+    // sample depth
+    ivec3 px = ivec3(gl_FragCoord.xy, gl_Layer);
+    float depth;
+    if (ReadArrayInputs != 0) {
+        depth = texelFetch(DepthArray, px, 0).x;
+    }
+    else {
+        depth = texelFetch(Depth, px.xy, 0).x;
+    }
 
     if (depth == 0.0)
     {
         // "infinitely far", so background.
+        if (CopyBackground != 0) {
+            FragColor = ReadArrayInputs != 0 ? texelFetch(ColorArray, px, 0) : texelFetch(Color, px.xy, 0);
+            return;
+        }
         discard;
     }
 
     // convert to eye space depth
-    depth = ZNear / depth;
+    if (DepthIsLinear == 0) {
+        depth = ZNear[gl_Layer] / depth;
+    }
 
-    sw = sh = int(abs(depth - Focus));
+    sw = sh = min(int(abs(depth - Focus) * RadiusScale), MaxRadius);
 
     // each tap is offset from the box filter differently
     ivec2 tap_offsets[4];
@@ -56,10 +85,10 @@ void main()
             sat[i] = uvec4(0);
         }
         else if (any(greaterThanEqual(taps[i], sz))) {
-            sat[i] = texelFetch(SAT, min(taps[i], sz - ivec2(1)), 0);
+            sat[i] = texelFetch(SAT, ivec3(min(taps[i], sz - ivec2(1)), gl_Layer), 0);
         }
         else {
-            sat[i] = texelFetch(SAT, taps[i], 0);
+            sat[i] = texelFetch(SAT, ivec3(taps[i], gl_Layer), 0);
         }
 
         // translate taps to be within the corners of the box filter's rectangle
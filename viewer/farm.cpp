@@ -0,0 +1,593 @@
+#include "farm.h"
+
+#include "batch.h"
+#include "renderer.h"
+#include "image_write.h"
+
+#include <SDL.h>
+
+#include <cstdio>
+
+#ifdef _WIN32
+
+int RunFarmCoordinator(const char* jobListFilename, int workerCount, bool softwareRenderer)
+{
+    fprintf(stderr, "The render farm is only supported on Linux\n");
+    return 1;
+}
+
+int RunFarmWorker(int socketFD, Scene* scene, IRenderer* renderer)
+{
+    fprintf(stderr, "The render farm is only supported on Linux\n");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <cstring>
+
+// attempts at rendering a rectangle before its job is given up on
+static const int kMaxFarmAttempts = 3;
+
+struct FarmRequest
+{
+    int32_t RectX;
+    int32_t RectY;
+    int32_t RectWidth;
+    int32_t RectHeight;
+    // the job's keys, as a job list line
+    char Job[4096];
+};
+
+struct FarmResponse
+{
+    int32_t OK;
+};
+
+// sends the message, with a file descriptor attached
+static bool SendFarmMessage(int socketFD, const void* message, size_t size, int attachedFD)
+{
+    iovec iov;
+    iov.iov_base = (void*)message;
+    iov.iov_len = size;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (attachedFD != -1)
+    {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &attachedFD, sizeof(int));
+    }
+
+    // a dead peer shows up as an error, not as SIGPIPE
+    return sendmsg(socketFD, &msg, MSG_NOSIGNAL) == (ssize_t)size;
+}
+
+// receives a whole message, and the file descriptor attached to it (-1 if none).
+// Returns false when the peer is gone.
+static bool ReceiveFarmMessage(int socketFD, void* message, size_t size, int* attachedFD)
+{
+    iovec iov;
+    iov.iov_base = message;
+    iov.iov_len = size;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t received = recvmsg(socketFD, &msg, MSG_CMSG_CLOEXEC);
+
+    int fd = -1;
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); received > 0 && cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+
+    if (attachedFD)
+    {
+        *attachedFD = fd;
+    }
+    else if (fd != -1)
+    {
+        close(fd);
+    }
+
+    return received == (ssize_t)size;
+}
+
+int RunFarmWorker(int socketFD, Scene* scene, IRenderer* renderer)
+{
+    BatchAssets assets;
+
+    FarmRequest request;
+    int pixelsFD;
+    while (ReceiveFarmMessage(socketFD, &request, sizeof(request), &pixelsFD))
+    {
+        request.Job[sizeof(request.Job) - 1] = '\0';
+
+        BatchJob job;
+        InitBatchJob(job);
+        bool ok = ParseBatchJob(request.Job, job) && pixelsFD != -1;
+
+        if (ok)
+        {
+            size_t pixelsSize = (size_t)request.RectWidth * request.RectHeight * 4;
+            void* pixels = mmap(NULL, pixelsSize, PROT_READ | PROT_WRITE, MAP_SHARED, pixelsFD, 0);
+            ok = pixels != MAP_FAILED;
+            if (ok)
+            {
+                SetupBatchJob(*scene, renderer, assets, job);
+                ok = renderer->RenderStillRect(
+                    job.Width, job.Height,
+                    request.RectX, request.RectY, request.RectWidth, request.RectHeight,
+                    job.TileSize,
+                    (uint8_t*)pixels);
+                munmap(pixels, pixelsSize);
+
+                FlushGLDeletions(*scene);
+            }
+        }
+
+        if (pixelsFD != -1)
+        {
+            close(pixelsFD);
+        }
+
+        FarmResponse response;
+        response.OK = ok;
+        if (!SendFarmMessage(socketFD, &response, sizeof(response), -1))
+        {
+            break;
+        }
+    }
+
+    close(socketFD);
+    return 0;
+}
+
+namespace
+{
+    struct FarmRect
+    {
+        int JobIndex;
+        int X, Y, Width, Height;
+        int Attempts;
+    };
+
+    // output image of a job, assembled from its rectangles
+    struct FarmOutput
+    {
+        int RemainingRects;
+        bool Failed;
+        bool PNG;
+        // PPM images are streamed to disk, PNG images are assembled in memory (bottom-up RGBA)
+        bool Opened;
+        TiledImageFile PPM;
+        std::vector<uint8_t> PNGPixels;
+    };
+
+    struct FarmWorker
+    {
+        pid_t PID;
+        int Socket;
+        // rectangle being rendered (-1 if idle), and the shared memory its pixels are written to
+        int RectIndex;
+        int PixelsFD;
+    };
+
+    bool SpawnFarmWorker(FarmWorker& worker, bool softwareRenderer)
+    {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0)
+        {
+            perror("socketpair");
+            return false;
+        }
+
+        pid_t pid = fork();
+        if (pid == -1)
+        {
+            perror("fork");
+            close(fds[0]);
+            close(fds[1]);
+            return false;
+        }
+
+        if (pid == 0)
+        {
+            // only the worker's end of the socket survives the exec
+            fcntl(fds[1], F_SETFD, 0);
+
+            char socketArg[16];
+            snprintf(socketArg, sizeof(socketArg), "%d", fds[1]);
+            if (softwareRenderer)
+            {
+                execl("/proc/self/exe", "viewer", "--software", "--farm-worker", socketArg, (char*)NULL);
+            }
+            else
+            {
+                execl("/proc/self/exe", "viewer", "--farm-worker", socketArg, (char*)NULL);
+            }
+            _exit(127);
+        }
+
+        close(fds[1]);
+
+        worker.PID = pid;
+        worker.Socket = fds[0];
+        worker.RectIndex = -1;
+        worker.PixelsFD = -1;
+        return true;
+    }
+
+    void StopFarmWorker(FarmWorker& worker)
+    {
+        // the worker exits when its socket is closed
+        close(worker.Socket);
+        worker.Socket = -1;
+        waitpid(worker.PID, NULL, 0);
+
+        if (worker.PixelsFD != -1)
+        {
+            close(worker.PixelsFD);
+            worker.PixelsFD = -1;
+        }
+    }
+
+    // copies the rectangle's pixels into the job's output
+    bool AssembleFarmRect(FarmOutput& output, const BatchJob& job, const FarmRect& rect, const uint8_t* pixels)
+    {
+        if (!output.Opened)
+        {
+            output.Opened = true;
+            if (output.PNG)
+            {
+                output.PNGPixels.resize((size_t)job.Width * job.Height * 4);
+            }
+            else if (!OpenTiledPPM(output.PPM, job.Output.c_str(), job.Width, job.Height))
+            {
+                return false;
+            }
+        }
+
+        std::vector<uint8_t> rgb(rect.Width * 3);
+        for (int row = 0; row < rect.Height; row++)
+        {
+            const uint8_t* src = pixels + (size_t)row * rect.Width * 4;
+            if (output.PNG)
+            {
+                memcpy(&output.PNGPixels[((size_t)(rect.Y + row) * job.Width + rect.X) * 4], src, rect.Width * 4);
+            }
+            else
+            {
+                for (int x = 0; x < rect.Width; x++)
+                {
+                    rgb[x * 3 + 0] = src[x * 4 + 0];
+                    rgb[x * 3 + 1] = src[x * 4 + 1];
+                    rgb[x * 3 + 2] = src[x * 4 + 2];
+                }
+
+                // rows are bottom-up
+                if (!WriteTiledPPMRect(output.PPM, rect.X, job.Height - 1 - (rect.Y + row), rect.Width, 1, rgb.data(), 0))
+                {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    // writes out the job's image once all of its rectangles are done. Returns false if the job failed.
+    bool FinishFarmOutput(FarmOutput& output, const BatchJob& job)
+    {
+        bool ok = !output.Failed;
+        if (output.PNG)
+        {
+            ok = ok && WritePNG(job.Output.c_str(), job.Width, job.Height,
+                &output.PNGPixels[(size_t)(job.Height - 1) * job.Width * 4], -(ptrdiff_t)job.Width * 4);
+            std::vector<uint8_t>().swap(output.PNGPixels);
+        }
+        else if (output.Opened)
+        {
+            ok = CloseTiledPPM(output.PPM) && ok;
+        }
+        return ok;
+    }
+}
+
+int RunFarmCoordinator(const char* jobListFilename, int workerCount, bool softwareRenderer)
+{
+    std::vector<BatchJob> jobs;
+    int invalidJobCount;
+    if (!LoadBatchJobList(jobListFilename, &jobs, &invalidJobCount))
+    {
+        return 1;
+    }
+
+    // split the jobs into rectangles, in order, so the rectangles of a job tend to finish together
+    std::vector<FarmRect> rects;
+    std::vector<FarmOutput> outputs(jobs.size());
+    for (int jobIndex = 0; jobIndex < (int)jobs.size(); jobIndex++)
+    {
+        const BatchJob& job = jobs[jobIndex];
+
+        FarmOutput& output = outputs[jobIndex];
+        output.RemainingRects = 0;
+        output.Failed = false;
+        output.Opened = false;
+        size_t outputLength = job.Output.size();
+        output.PNG = outputLength >= 4 && job.Output.compare(outputLength - 4, 4, ".png") == 0;
+
+        for (int y = 0; y < job.Height; y += job.TileSize)
+        {
+            for (int x = 0; x < job.Width; x += job.TileSize)
+            {
+                FarmRect rect;
+                rect.JobIndex = jobIndex;
+                rect.X = x;
+                rect.Y = y;
+                rect.Width = std::min(job.TileSize, job.Width - x);
+                rect.Height = std::min(job.TileSize, job.Height - y);
+                rect.Attempts = 0;
+                rects.push_back(rect);
+                output.RemainingRects++;
+            }
+        }
+    }
+
+    std::deque<int> pendingRects;
+    for (int i = 0; i < (int)rects.size(); i++)
+    {
+        pendingRects.push_back(i);
+    }
+
+    workerCount = std::max(1, workerCount);
+    std::vector<FarmWorker> workers(workerCount);
+    for (FarmWorker& worker : workers)
+    {
+        if (!SpawnFarmWorker(worker, softwareRenderer))
+        {
+            return 1;
+        }
+    }
+
+    // bounds the restarts if workers can't start at all
+    int restartsLeft = workerCount * kMaxFarmAttempts;
+
+    int failedJobCount = invalidJobCount;
+    int finishedJobCount = 0;
+
+    Uint64 startTicks = SDL_GetPerformanceCounter();
+
+    auto finishRect = [&](int rectIndex, bool ok)
+    {
+        FarmRect& rect = rects[rectIndex];
+        FarmOutput& output = outputs[rect.JobIndex];
+        const BatchJob& job = jobs[rect.JobIndex];
+
+        if (!ok && !output.Failed && rect.Attempts < kMaxFarmAttempts)
+        {
+            pendingRects.push_front(rectIndex);
+            return;
+        }
+
+        if (!ok && !output.Failed)
+        {
+            fprintf(stderr, "%s:%d: gave up on a %dx%d rectangle after %d attempts\n", jobListFilename, job.LineNumber, rect.Width, rect.Height, rect.Attempts);
+            output.Failed = true;
+        }
+
+        output.RemainingRects--;
+        if (output.RemainingRects == 0)
+        {
+            finishedJobCount++;
+            if (FinishFarmOutput(output, job))
+            {
+                printf("[%d/%d] %s\n", finishedJobCount, (int)jobs.size(), job.Output.c_str());
+            }
+            else
+            {
+                fprintf(stderr, "%s:%d: failed to render %s\n", jobListFilename, job.LineNumber, job.Output.c_str());
+                failedJobCount++;
+            }
+        }
+    };
+
+    while (finishedJobCount < (int)jobs.size())
+    {
+        // hand out rectangles to the idle workers
+        for (FarmWorker& worker : workers)
+        {
+            if (worker.Socket == -1 || worker.RectIndex != -1 || pendingRects.empty())
+            {
+                continue;
+            }
+
+            int rectIndex = pendingRects.front();
+            pendingRects.pop_front();
+
+            FarmRect& rect = rects[rectIndex];
+            rect.Attempts++;
+
+            // the rectangles of jobs that already failed aren't worth rendering
+            if (outputs[rect.JobIndex].Failed)
+            {
+                finishRect(rectIndex, false);
+                continue;
+            }
+
+            FarmRequest request;
+            memset(&request, 0, sizeof(request));
+            request.RectX = rect.X;
+            request.RectY = rect.Y;
+            request.RectWidth = rect.Width;
+            request.RectHeight = rect.Height;
+            snprintf(request.Job, sizeof(request.Job), "%s", FormatBatchJob(jobs[rect.JobIndex]).c_str());
+
+            int pixelsFD = memfd_create("farm-rect", MFD_CLOEXEC);
+            if (pixelsFD == -1 || ftruncate(pixelsFD, (off_t)rect.Width * rect.Height * 4) != 0)
+            {
+                perror("memfd_create");
+                if (pixelsFD != -1)
+                {
+                    close(pixelsFD);
+                }
+                finishRect(rectIndex, false);
+                continue;
+            }
+
+            worker.RectIndex = rectIndex;
+            worker.PixelsFD = pixelsFD;
+
+            // a failed send means the worker is gone, which the poll below notices
+            SendFarmMessage(worker.Socket, &request, sizeof(request), pixelsFD);
+        }
+
+        std::vector<pollfd> pollFDs;
+        std::vector<int> pollWorkers;
+        for (int i = 0; i < workerCount; i++)
+        {
+            if (workers[i].Socket != -1 && workers[i].RectIndex != -1)
+            {
+                pollfd pfd;
+                pfd.fd = workers[i].Socket;
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                pollFDs.push_back(pfd);
+                pollWorkers.push_back(i);
+            }
+        }
+
+        if (pollFDs.empty())
+        {
+            // nothing in flight: either rectangles were just given up on, or all workers are gone
+            bool anyWorker = false;
+            for (const FarmWorker& worker : workers)
+            {
+                anyWorker = anyWorker || worker.Socket != -1;
+            }
+
+            if (!anyWorker)
+            {
+                fprintf(stderr, "Farm: no workers left\n");
+                break;
+            }
+
+            continue;
+        }
+
+        if (poll(pollFDs.data(), pollFDs.size(), -1) < 0)
+        {
+            continue;
+        }
+
+        for (size_t p = 0; p < pollFDs.size(); p++)
+        {
+            if (!pollFDs[p].revents)
+            {
+                continue;
+            }
+
+            FarmWorker& worker = workers[pollWorkers[p]];
+            int rectIndex = worker.RectIndex;
+            const FarmRect& rect = rects[rectIndex];
+
+            FarmResponse response;
+            bool alive = ReceiveFarmMessage(worker.Socket, &response, sizeof(response), NULL);
+
+            bool ok = alive && response.OK;
+            if (ok)
+            {
+                size_t pixelsSize = (size_t)rect.Width * rect.Height * 4;
+                void* pixels = mmap(NULL, pixelsSize, PROT_READ, MAP_SHARED, worker.PixelsFD, 0);
+                ok = pixels != MAP_FAILED;
+                if (ok)
+                {
+                    FarmOutput& output = outputs[rect.JobIndex];
+                    if (!output.Failed && !AssembleFarmRect(output, jobs[rect.JobIndex], rect, (const uint8_t*)pixels))
+                    {
+                        // the output file is broken, retrying won't help
+                        output.Failed = true;
+                    }
+                    munmap(pixels, pixelsSize);
+                }
+            }
+
+            close(worker.PixelsFD);
+            worker.PixelsFD = -1;
+            worker.RectIndex = -1;
+
+            if (!alive)
+            {
+                fprintf(stderr, "Farm: worker %d died, restarting it\n", (int)worker.PID);
+                StopFarmWorker(worker);
+                if (restartsLeft > 0)
+                {
+                    restartsLeft--;
+                    SpawnFarmWorker(worker, softwareRenderer);
+                }
+            }
+
+            finishRect(rectIndex, ok);
+        }
+    }
+
+    for (FarmWorker& worker : workers)
+    {
+        if (worker.Socket != -1)
+        {
+            StopFarmWorker(worker);
+        }
+    }
+
+    // jobs that never finished (no workers left)
+    for (int jobIndex = 0; jobIndex < (int)jobs.size(); jobIndex++)
+    {
+        if (outputs[jobIndex].RemainingRects > 0)
+        {
+            outputs[jobIndex].Failed = true;
+            FinishFarmOutput(outputs[jobIndex], jobs[jobIndex]);
+            failedJobCount++;
+        }
+    }
+
+    double seconds = (double)(SDL_GetPerformanceCounter() - startTicks) / SDL_GetPerformanceFrequency();
+    int jobCount = (int)jobs.size() + invalidJobCount;
+    printf("Farm: %d jobs (%d failed) in %.2f seconds with %d workers, %.2f jobs/second\n",
+        jobCount, failedJobCount, seconds, workerCount, seconds > 0.0 ? jobCount / seconds : 0.0);
+
+    return failedJobCount;
+}
+
+#endif // _WIN32
\ No newline at end of file
@@ -0,0 +1,20 @@
+#pragma once
+
+class Scene;
+class IRenderer;
+
+// Local render farm, for using every core of one machine (Linux only).
+//
+// The coordinator splits the jobs of a job list (see batch.h) into rectangles of at most tile x tile pixels,
+// and hands them to worker processes, which are copies of this executable with their own GL context.
+// The coordinator and each worker talk over a Unix socket pair. The pixels of a rectangle go through a shared memory
+// file that the coordinator passes along with the request, so images are never copied through the socket.
+// Rectangles of workers that fail or crash are retried (crashed workers are restarted),
+// and the coordinator assembles the rectangles into the output images as they arrive.
+
+// Workers use the software renderer if softwareRenderer is set, which needs no GPU.
+// Returns the number of jobs that failed.
+int RunFarmCoordinator(const char* jobListFilename, int workerCount, bool softwareRenderer);
+
+// Main loop of a worker process, started by the coordinator with its end of the socket pair.
+int RunFarmWorker(int socketFD, Scene* scene, IRenderer* renderer);
\ No newline at end of file
@@ -0,0 +1,84 @@
+#include "frame_arena.h"
+
+#include <cstdlib>
+#include <algorithm>
+
+FrameArena::FrameArena(size_t initialCapacity)
+{
+    for (Buffer& buffer : mBuffers)
+    {
+        buffer.Base = (uint8_t*)malloc(initialCapacity);
+        buffer.Capacity = initialCapacity;
+        buffer.Used = 0;
+        buffer.OverflowUsed = 0;
+    }
+
+    mCurrentBuffer = 0;
+    mLastFrameUsage = 0;
+    mHighWaterMark = 0;
+}
+
+FrameArena::~FrameArena()
+{
+    for (Buffer& buffer : mBuffers)
+    {
+        ResetBuffer(buffer);
+        free(buffer.Base);
+    }
+}
+
+void* FrameArena::Allocate(size_t size, size_t alignment)
+{
+    Buffer& buffer = mBuffers[mCurrentBuffer];
+
+    size_t offset = (buffer.Used + alignment - 1) & ~(alignment - 1);
+    if (offset + size <= buffer.Capacity)
+    {
+        buffer.Used = offset + size;
+        return buffer.Base + offset;
+    }
+
+    // doesn't fit: from the heap until the buffer is reset (and grown)
+    void* overflow = malloc(size + alignment);
+    buffer.Overflow.push_back(overflow);
+    buffer.OverflowUsed += size + alignment;
+    return (void*)(((uintptr_t)overflow + alignment - 1) & ~(uintptr_t)(alignment - 1));
+}
+
+void FrameArena::ResetBuffer(Buffer& buffer)
+{
+    for (void* overflow : buffer.Overflow)
+    {
+        free(overflow);
+    }
+    buffer.Overflow.clear();
+
+    size_t usage = buffer.Used + buffer.OverflowUsed;
+    if (usage > buffer.Capacity)
+    {
+        // room for this usage next time, without growing by a little every frame
+        size_t newCapacity = buffer.Capacity;
+        while (newCapacity < usage)
+        {
+            newCapacity *= 2;
+        }
+
+        free(buffer.Base);
+        buffer.Base = (uint8_t*)malloc(newCapacity);
+        buffer.Capacity = newCapacity;
+    }
+
+    buffer.Used = 0;
+    buffer.OverflowUsed = 0;
+}
+
+void FrameArena::EndFrame()
+{
+    Buffer& current = mBuffers[mCurrentBuffer];
+    mLastFrameUsage = current.Used + current.OverflowUsed;
+    mHighWaterMark = std::max(mHighWaterMark, mLastFrameUsage);
+
+    // the previous frame's allocations were kept alive through this frame, now they can go
+    mCurrentBuffer = 1 - mCurrentBuffer;
+    ResetBuffer(mBuffers[mCurrentBuffer]);
+}
\ No newline at end of file
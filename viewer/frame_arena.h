@@ -0,0 +1,91 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+// A bump allocator for the temporaries of a frame: allocating is a pointer increment, nothing is freed on its own,
+// and everything is released at once when the frame ends.
+// Double-buffered: what a frame allocated stays valid until the end of the next frame, so it can be handed to work
+// that's still in flight while the next frame is recorded.
+// A frame that needs more than the buffer's capacity gets the rest from the heap, and the buffer grows to fit when
+// it's reused, so the arena settles on the size of the biggest frame.
+// Not thread-safe, it's for the thread that renders.
+class FrameArena
+{
+    struct Buffer
+    {
+        uint8_t* Base;
+        size_t Capacity;
+        size_t Used;
+        // allocations that didn't fit, freed when the buffer is reset
+        std::vector<void*> Overflow;
+        size_t OverflowUsed;
+    };
+
+    Buffer mBuffers[2];
+    int mCurrentBuffer;
+
+    size_t mLastFrameUsage;
+    size_t mHighWaterMark;
+
+    void ResetBuffer(Buffer& buffer);
+
+public:
+    explicit FrameArena(size_t initialCapacity = 64 * 1024);
+    ~FrameArena();
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    // Never fails (short of the heap failing). alignment must be a power of two.
+    void* Allocate(size_t size, size_t alignment);
+
+    // Ends the current frame. The buffer of the frame before it is reset and becomes the current one.
+    void EndFrame();
+
+    // bytes used by the last frame that ended, and the most any frame used
+    size_t GetLastFrameUsage() const { return mLastFrameUsage; }
+    size_t GetHighWaterMark() const { return mHighWaterMark; }
+    // bytes that a frame can use before it overflows to the heap
+    size_t GetCapacity() const { return mBuffers[mCurrentBuffer].Capacity; }
+};
+
+// STL allocator on a FrameArena, for containers that only live for a frame.
+// Deallocating does nothing, the memory is reclaimed when the frame ends.
+// Without an arena (default constructed), it allocates from the heap like std::allocator.
+template<class T>
+class FrameAllocator
+{
+    FrameArena* mArena;
+
+    template<class U> friend class FrameAllocator;
+
+public:
+    typedef T value_type;
+
+    FrameAllocator() : mArena(NULL) { }
+    explicit FrameAllocator(FrameArena* arena) : mArena(arena) { }
+    template<class U> FrameAllocator(const FrameAllocator<U>& other) : mArena(other.mArena) { }
+
+    T* allocate(size_t n)
+    {
+        if (mArena)
+        {
+            return (T*)mArena->Allocate(n * sizeof(T), alignof(T));
+        }
+        return (T*)::operator new(n * sizeof(T));
+    }
+
+    void deallocate(T* p, size_t /*n*/)
+    {
+        if (!mArena)
+        {
+            ::operator delete(p);
+        }
+    }
+
+    template<class U> bool operator==(const FrameAllocator<U>& other) const { return mArena == other.mArena; }
+    template<class U> bool operator!=(const FrameAllocator<U>& other) const { return mArena != other.mArena; }
+};
\ No newline at end of file
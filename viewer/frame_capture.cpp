@@ -0,0 +1,243 @@
+#include "frame_capture.h"
+
+#include "image_write.h"
+#include "thread_pool.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstdio>
+
+class FrameWriter : public IFrameWriter
+{
+public:
+    CaptureFormat mFormat;
+    std::string mBasePath;
+    int mWidth;
+    int mHeight;
+
+    // single output file of the Y4M and raw formats
+    FILE* mFile;
+
+    std::vector<std::unique_ptr<uint8_t[]>> mBuffers;
+
+    // protects the free and queued buffers, and mQuit
+    std::mutex mMutex;
+    std::condition_variable mFrameQueued;
+    std::vector<uint8_t*> mFreeFrames;
+    std::deque<uint8_t*> mQueuedFrames;
+    bool mQuit;
+
+    std::atomic<int> mFramesWritten;
+    std::atomic<bool> mFailed;
+
+    // only touched by the writer thread
+    std::vector<uint8_t> mPlanes;
+
+    std::thread mThread;
+
+    bool Init(CaptureFormat format, const char* basePath, int width, int height, int framesPerSecond, int bufferCount)
+    {
+        mFormat = format;
+        mBasePath = basePath;
+        mWidth = width;
+        mHeight = height;
+        mFile = NULL;
+        mQuit = false;
+        mFramesWritten = 0;
+        mFailed = false;
+
+        char filename[512];
+        if (mFormat == CaptureFormat_Y4M)
+        {
+            snprintf(filename, sizeof(filename), "%s.y4m", basePath);
+        }
+        else if (mFormat == CaptureFormat_Raw)
+        {
+            snprintf(filename, sizeof(filename), "%s_%dx%d.rgba", basePath, width, height);
+        }
+
+        if (mFormat != CaptureFormat_PNG)
+        {
+            mFile = fopen(filename, "wb");
+            if (!mFile)
+            {
+                fprintf(stderr, "fopen(%s): failed\n", filename);
+                return false;
+            }
+        }
+
+        if (mFormat == CaptureFormat_Y4M)
+        {
+            // full resolution chroma, so the frames don't need to be downsampled
+            fprintf(mFile, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, framesPerSecond);
+        }
+
+        for (int i = 0; i < bufferCount; i++)
+        {
+            mBuffers.emplace_back(new uint8_t[width * height * 4]);
+            mFreeFrames.push_back(mBuffers.back().get());
+        }
+
+        mThread = std::thread([this] { WriterMain(); });
+
+        return true;
+    }
+
+    ~FrameWriter()
+    {
+        if (mThread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mQuit = true;
+            }
+            mFrameQueued.notify_one();
+            mThread.join();
+        }
+
+        if (mFile)
+        {
+            fclose(mFile);
+        }
+    }
+
+    uint8_t* AcquireFrame() override
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mFreeFrames.empty())
+        {
+            return NULL;
+        }
+
+        uint8_t* frame = mFreeFrames.back();
+        mFreeFrames.pop_back();
+        return frame;
+    }
+
+    void SubmitFrame(uint8_t* frame) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mQueuedFrames.push_back(frame);
+        }
+        mFrameQueued.notify_one();
+    }
+
+    int GetFramesWritten() const override
+    {
+        return mFramesWritten;
+    }
+
+    bool HasFailed() const override
+    {
+        return mFailed;
+    }
+
+    void WriterMain()
+    {
+        while (true)
+        {
+            uint8_t* frame;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                // finish writing the queued frames before quitting
+                mFrameQueued.wait(lock, [&] { return !mQueuedFrames.empty() || mQuit; });
+                if (mQueuedFrames.empty())
+                {
+                    return;
+                }
+                frame = mQueuedFrames.front();
+                mQueuedFrames.pop_front();
+            }
+
+            if (!mFailed)
+            {
+                if (WriteFrame(frame))
+                {
+                    mFramesWritten++;
+                }
+                else
+                {
+                    fprintf(stderr, "FrameWriter: failed to write frame %d\n", mFramesWritten.load());
+                    mFailed = true;
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mFreeFrames.push_back(frame);
+            }
+        }
+    }
+
+    bool WriteFrame(const uint8_t* frame)
+    {
+        int rowSize = mWidth * 4;
+        // the frames are bottom-up, all formats are top-down
+        const uint8_t* top = frame + (mHeight - 1) * rowSize;
+
+        if (mFormat == CaptureFormat_PNG)
+        {
+            char filename[512];
+            snprintf(filename, sizeof(filename), "%s_%06d.png", mBasePath.c_str(), mFramesWritten.load());
+            return WritePNG(filename, mWidth, mHeight, top, -rowSize);
+        }
+        else if (mFormat == CaptureFormat_Raw)
+        {
+            for (int row = 0; row < mHeight; row++)
+            {
+                if (fwrite(top - row * rowSize, 1, rowSize, mFile) != (size_t)rowSize)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        else if (mFormat == CaptureFormat_Y4M)
+        {
+            // BT.601 studio range
+            size_t planeSize = (size_t)mWidth * mHeight;
+            mPlanes.resize(planeSize * 3);
+            uint8_t* planes = mPlanes.data();
+
+            ParallelFor(mHeight, 16, [&](int rowBegin, int rowEnd)
+            {
+                for (int row = rowBegin; row < rowEnd; row++)
+                {
+                    const uint8_t* src = top - row * rowSize;
+                    uint8_t* y = planes + row * mWidth;
+                    uint8_t* u = y + planeSize;
+                    uint8_t* v = u + planeSize;
+                    for (int x = 0; x < mWidth; x++)
+                    {
+                        int r = src[x * 4 + 0], g = src[x * 4 + 1], b = src[x * 4 + 2];
+                        y[x] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+                        u[x] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+                        v[x] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+                    }
+                }
+            });
+
+            return fputs("FRAME\n", mFile) >= 0 && fwrite(planes, 1, mPlanes.size(), mFile) == mPlanes.size();
+        }
+
+        return false;
+    }
+};
+
+IFrameWriter* NewFrameWriter(CaptureFormat format, const char* basePath, int width, int height, int framesPerSecond, int bufferCount)
+{
+    FrameWriter* writer = new FrameWriter();
+    if (!writer->Init(format, basePath, width, height, framesPerSecond, bufferCount))
+    {
+        delete writer;
+        return NULL;
+    }
+    return writer;
+}
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+
+enum CaptureFormat
+{
+    CaptureFormat_Y4M,
+    CaptureFormat_Raw,
+    CaptureFormat_PNG,
+    CaptureFormat_Count
+};
+
+// Writes a sequence of captured frames to disk on a background thread.
+// Frames are RGBA8 and bottom-up (as read back from GL), and live in a fixed pool of buffers.
+// When all buffers are waiting to be written, AcquireFrame fails, so the caller can drop the frame instead of stalling.
+class IFrameWriter
+{
+public:
+    // Waits for the queued frames to be written, then closes the output.
+    virtual ~IFrameWriter() { }
+
+    // Returns a free buffer of width * height * 4 bytes, or NULL if there is none.
+    virtual uint8_t* AcquireFrame() = 0;
+    // Queues a buffer returned by AcquireFrame for writing.
+    virtual void SubmitFrame(uint8_t* frame) = 0;
+
+    virtual int GetFramesWritten() const = 0;
+    // Set when writing to disk failed. Frames submitted after that are discarded.
+    virtual bool HasFailed() const = 0;
+};
+
+// Y4M and raw write all frames into one file (basePath.y4m, basePath_WxH.rgba), PNG writes basePath_000000.png, ...
+// Returns NULL if the output couldn't be created.
+IFrameWriter* NewFrameWriter(CaptureFormat format, const char* basePath, int width, int height, int framesPerSecond, int bufferCount);
\ No newline at end of file
@@ -0,0 +1,332 @@
+#include "frame_export.h"
+
+#include <cstdio>
+
+#ifdef _WIN32
+
+IFrameExporter* NewFrameExporter(const char* name, uint32_t planeMask, int slotCount, const int* maxWidth, const int* maxHeight)
+{
+    fprintf(stderr, "Frame export is only supported on Linux\n");
+    return NULL;
+}
+
+FrameExportReader* OpenFrameExport(const char* name)
+{
+    return NULL;
+}
+
+void CloseFrameExport(FrameExportReader* reader)
+{
+}
+
+bool IsFrameExportClosed(const FrameExportReader* reader)
+{
+    return true;
+}
+
+bool AcquireLatestFrame(const FrameExportReader* reader, FrameExportFrame* frame)
+{
+    return false;
+}
+
+bool ValidateFrame(const FrameExportReader* reader, const FrameExportFrame* frame)
+{
+    return false;
+}
+
+#else
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <new>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+static const int kPlaneBytesPerPixel[FrameExportPlane_Count] = { 4, 4, 4 };
+
+static size_t AlignToPage(size_t size)
+{
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    return (size + pageSize - 1) / pageSize * pageSize;
+}
+
+class FrameExporter : public IFrameExporter
+{
+public:
+    std::string mName;
+    FrameExportHeader* mHeader;
+    uint8_t* mMapped;
+    size_t mMappedSize;
+
+    bool Init(const char* name, uint32_t planeMask, int slotCount, const int* maxWidth, const int* maxHeight)
+    {
+        mName = name;
+        mHeader = NULL;
+        mMapped = NULL;
+        mMappedSize = 0;
+
+        if (slotCount < 1 || slotCount > FRAME_EXPORT_MAX_SLOTS)
+        {
+            fprintf(stderr, "Frame export: %d slots, must be 1 to %d\n", slotCount, FRAME_EXPORT_MAX_SLOTS);
+            return false;
+        }
+
+        // Every plane starts on a page, so each can be handed to GL as client memory on its own.
+        uint64_t planeOffset[FrameExportPlane_Count] = {};
+        size_t slotSize = 0;
+        for (int plane = 0; plane < FrameExportPlane_Count; plane++)
+        {
+            if (planeMask & FRAME_EXPORT_PLANE_BIT(plane))
+            {
+                planeOffset[plane] = slotSize;
+                slotSize += AlignToPage((size_t)maxWidth[plane] * maxHeight[plane] * kPlaneBytesPerPixel[plane]);
+            }
+        }
+
+        size_t dataOffset = AlignToPage(sizeof(FrameExportHeader));
+        mMappedSize = dataOffset + slotSize * slotCount;
+
+        // replace any export left behind by a previous run
+        shm_unlink(name);
+
+        int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd == -1)
+        {
+            fprintf(stderr, "shm_open(%s): %s\n", name, strerror(errno));
+            return false;
+        }
+
+        if (ftruncate(fd, (off_t)mMappedSize) != 0)
+        {
+            fprintf(stderr, "ftruncate(%s): %s\n", name, strerror(errno));
+            close(fd);
+            shm_unlink(name);
+            return false;
+        }
+
+        void* mapped = mmap(NULL, mMappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED)
+        {
+            fprintf(stderr, "mmap(%s): %s\n", name, strerror(errno));
+            shm_unlink(name);
+            return false;
+        }
+        mMapped = (uint8_t*)mapped;
+
+        mHeader = new (mMapped) FrameExportHeader();
+        mHeader->Version = FRAME_EXPORT_VERSION;
+        mHeader->PlaneMask = planeMask;
+        mHeader->SlotCount = slotCount;
+        mHeader->DataOffset = dataOffset;
+        mHeader->SlotSize = slotSize;
+        for (int plane = 0; plane < FrameExportPlane_Count; plane++)
+        {
+            if (planeMask & FRAME_EXPORT_PLANE_BIT(plane))
+            {
+                mHeader->PlaneOffset[plane] = planeOffset[plane];
+                mHeader->PlaneMaxWidth[plane] = maxWidth[plane];
+                mHeader->PlaneMaxHeight[plane] = maxHeight[plane];
+            }
+        }
+        mHeader->LatestSlot.store(-1, std::memory_order_relaxed);
+        mHeader->Closed.store(0, std::memory_order_relaxed);
+
+        // readers check the magic last, so they never see a half-initialized header
+        std::atomic_thread_fence(std::memory_order_release);
+        mHeader->Magic = FRAME_EXPORT_MAGIC;
+
+        return true;
+    }
+
+    ~FrameExporter()
+    {
+        if (mMapped)
+        {
+            mHeader->Closed.store(1, std::memory_order_release);
+            munmap(mMapped, mMappedSize);
+            shm_unlink(mName.c_str());
+        }
+    }
+
+    int GetSlotCount() const override
+    {
+        return mHeader->SlotCount;
+    }
+
+    uint8_t* GetSlotData(int slot) override
+    {
+        return mMapped + mHeader->DataOffset + mHeader->SlotSize * slot;
+    }
+
+    size_t GetSlotSize() const override
+    {
+        return mHeader->SlotSize;
+    }
+
+    size_t GetPlaneOffset(FrameExportPlane plane) const override
+    {
+        return mHeader->PlaneOffset[plane];
+    }
+
+    void BeginFrame(int slot) override
+    {
+        FrameExportSlot& s = mHeader->Slots[slot];
+        uint64_t sequence = s.Sequence.load(std::memory_order_relaxed);
+        if (sequence % 2 == 0)
+        {
+            s.Sequence.store(sequence + 1, std::memory_order_relaxed);
+        }
+        // the planes are written after this
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void PublishFrame(int slot, uint64_t frameIndex, const int* width, const int* height, float zNear, float focusDepth) override
+    {
+        FrameExportSlot& s = mHeader->Slots[slot];
+        s.FrameIndex = frameIndex;
+        for (int plane = 0; plane < FrameExportPlane_Count; plane++)
+        {
+            s.Width[plane] = width[plane];
+            s.Height[plane] = height[plane];
+        }
+        s.ZNear = zNear;
+        s.FocusDepth = focusDepth;
+
+        uint64_t sequence = s.Sequence.load(std::memory_order_relaxed);
+        s.Sequence.store(sequence + 1, std::memory_order_release);
+        mHeader->LatestSlot.store(slot, std::memory_order_release);
+    }
+};
+
+IFrameExporter* NewFrameExporter(const char* name, uint32_t planeMask, int slotCount, const int* maxWidth, const int* maxHeight)
+{
+    FrameExporter* exporter = new FrameExporter();
+    if (!exporter->Init(name, planeMask, slotCount, maxWidth, maxHeight))
+    {
+        delete exporter;
+        return NULL;
+    }
+    return exporter;
+}
+
+struct FrameExportReader
+{
+    const uint8_t* Mapped;
+    size_t MappedSize;
+    const FrameExportHeader* Header;
+};
+
+FrameExportReader* OpenFrameExport(const char* name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FrameExportHeader))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    void* mapped = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    const FrameExportHeader* header = (const FrameExportHeader*)mapped;
+    bool valid = header->Magic == FRAME_EXPORT_MAGIC;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    valid = valid &&
+        header->Version == FRAME_EXPORT_VERSION &&
+        header->SlotCount >= 1 && header->SlotCount <= FRAME_EXPORT_MAX_SLOTS &&
+        header->DataOffset + header->SlotSize * header->SlotCount <= (uint64_t)st.st_size;
+    if (!valid)
+    {
+        munmap(mapped, (size_t)st.st_size);
+        return NULL;
+    }
+
+    FrameExportReader* reader = new FrameExportReader();
+    reader->Mapped = (const uint8_t*)mapped;
+    reader->MappedSize = (size_t)st.st_size;
+    reader->Header = header;
+    return reader;
+}
+
+void CloseFrameExport(FrameExportReader* reader)
+{
+    if (reader)
+    {
+        munmap((void*)reader->Mapped, reader->MappedSize);
+        delete reader;
+    }
+}
+
+bool IsFrameExportClosed(const FrameExportReader* reader)
+{
+    return reader->Header->Closed.load(std::memory_order_acquire) != 0;
+}
+
+bool AcquireLatestFrame(const FrameExportReader* reader, FrameExportFrame* frame)
+{
+    const FrameExportHeader* header = reader->Header;
+
+    // retry while the renderer overwrites the latest slot under our feet, which takes a whole ring of frames to happen
+    for (int attempt = 0; attempt < 8; attempt++)
+    {
+        int slot = header->LatestSlot.load(std::memory_order_acquire);
+        if (slot < 0 || slot >= (int)header->SlotCount)
+        {
+            return false;
+        }
+
+        const FrameExportSlot& s = header->Slots[slot];
+        uint64_t sequence = s.Sequence.load(std::memory_order_acquire);
+        if (sequence % 2 != 0)
+        {
+            continue;
+        }
+
+        frame->Slot = slot;
+        frame->Sequence = sequence;
+        frame->FrameIndex = s.FrameIndex;
+        const uint8_t* slotData = reader->Mapped + header->DataOffset + header->SlotSize * slot;
+        for (int plane = 0; plane < FrameExportPlane_Count; plane++)
+        {
+            bool exported = (header->PlaneMask & FRAME_EXPORT_PLANE_BIT(plane)) != 0;
+            frame->Planes[plane] = exported ? slotData + header->PlaneOffset[plane] : NULL;
+            // clamped, so a torn read can't send the reader outside of the plane before ValidateFrame catches it
+            frame->Width[plane] = exported ? (int)std::min(s.Width[plane], header->PlaneMaxWidth[plane]) : 0;
+            frame->Height[plane] = exported ? (int)std::min(s.Height[plane], header->PlaneMaxHeight[plane]) : 0;
+        }
+        frame->ZNear = s.ZNear;
+        frame->FocusDepth = s.FocusDepth;
+
+        if (ValidateFrame(reader, frame))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ValidateFrame(const FrameExportReader* reader, const FrameExportFrame* frame)
+{
+    // the reads of the planes must not be reordered after the check
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return reader->Header->Slots[frame->Slot].Sequence.load(std::memory_order_relaxed) == frame->Sequence;
+}
+
+#endif // _WIN32
\ No newline at end of file
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+// Shared memory export of rendered frames, for other processes (compositors, encoders, vision tools) to consume
+// without copying them through a socket or a file (Linux only).
+//
+// The renderer owns a POSIX shared memory object holding a header followed by a ring of slots, each big enough for one
+// frame's planes. Frames are read back from GL straight into the slots, and published with a lock-free protocol:
+// - Each slot has a sequence number, which is odd while the slot is being written, and even once it's published.
+// - The header's LatestSlot points at the most recently published slot.
+// - Readers remember the sequence number, use the planes in place, then check that the sequence number didn't change.
+//   If it did, the renderer overwrote the slot in the meantime, and what was read has to be discarded.
+// There is a single writer, and any number of readers, which never block the renderer (and can't be blocked by it).
+//
+// When the renderer replaces the shared memory (the window was resized) or stops exporting, it sets Closed,
+// and readers should reopen the export by name.
+
+#define FRAME_EXPORT_MAGIC 0x50584644 // "DFXP"
+#define FRAME_EXPORT_VERSION 1
+#define FRAME_EXPORT_MAX_SLOTS 16
+
+enum FrameExportPlane
+{
+    // RGBA8, sRGB-encoded. The final image, without the GUI, at window resolution.
+    FrameExportPlane_Color,
+    // R32F eye space depth, 0 for the background. At render resolution (which can be below window resolution).
+    FrameExportPlane_LinearDepth,
+    // R32F radius in pixels of the DoF's box filter, at render resolution.
+    FrameExportPlane_CoC,
+    FrameExportPlane_Count
+};
+
+#define FRAME_EXPORT_PLANE_BIT(plane) (1u << (plane))
+
+// The atomics are accessed by several processes, so they must not fall back to (process-local) locks.
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "64-bit atomics must be lock-free for the frame export");
+
+struct FrameExportSlot
+{
+    // odd while the slot is being written
+    std::atomic<uint64_t> Sequence;
+    // the following are only valid while Sequence is even
+    uint64_t FrameIndex;
+    // rows are tightly packed and bottom-up (as read back from GL)
+    uint32_t Width[FrameExportPlane_Count];
+    uint32_t Height[FrameExportPlane_Count];
+    float ZNear;
+    float FocusDepth;
+};
+
+struct FrameExportHeader
+{
+    uint32_t Magic;
+    uint32_t Version;
+    // bit set of FRAME_EXPORT_PLANE_BIT
+    uint32_t PlaneMask;
+    uint32_t SlotCount;
+    // offset of the first slot's planes from the start of the shared memory, and the distance between slots.
+    // Both are multiples of the page size.
+    uint64_t DataOffset;
+    uint64_t SlotSize;
+    // offset of each plane in a slot, and the size it was allocated for
+    uint64_t PlaneOffset[FrameExportPlane_Count];
+    uint32_t PlaneMaxWidth[FrameExportPlane_Count];
+    uint32_t PlaneMaxHeight[FrameExportPlane_Count];
+
+    // -1 until the first frame is published
+    std::atomic<int32_t> LatestSlot;
+    std::atomic<uint32_t> Closed;
+
+    FrameExportSlot Slots[FRAME_EXPORT_MAX_SLOTS];
+};
+
+// Writer side, used by the renderer.
+class IFrameExporter
+{
+public:
+    // Marks the export as closed and removes its name.
+    virtual ~IFrameExporter() { }
+
+    virtual int GetSlotCount() const = 0;
+    // start of the slot's memory, page-aligned
+    virtual uint8_t* GetSlotData(int slot) = 0;
+    virtual size_t GetSlotSize() const = 0;
+    virtual size_t GetPlaneOffset(FrameExportPlane plane) const = 0;
+
+    // Marks the slot as being written. Readers skip it, or discard what they read from it, until it's published.
+    virtual void BeginFrame(int slot) = 0;
+    // Fills in the slot's metadata and makes it the latest frame. width and height are per plane.
+    virtual void PublishFrame(int slot, uint64_t frameIndex, const int* width, const int* height, float zNear, float focusDepth) = 0;
+};
+
+// name is a POSIX shared memory name ("/dof-frames"). An existing export of the same name is replaced.
+// maxWidth and maxHeight are per plane. Returns NULL if the shared memory couldn't be created.
+IFrameExporter* NewFrameExporter(const char* name, uint32_t planeMask, int slotCount, const int* maxWidth, const int* maxHeight);
+
+// Reader side. Only depends on this file and frame_export.cpp, so consumers can build them into their own programs.
+struct FrameExportReader;
+
+struct FrameExportFrame
+{
+    int Slot;
+    uint64_t Sequence;
+    uint64_t FrameIndex;
+    // NULL for planes that aren't exported
+    const uint8_t* Planes[FrameExportPlane_Count];
+    int Width[FrameExportPlane_Count];
+    int Height[FrameExportPlane_Count];
+    float ZNear;
+    float FocusDepth;
+};
+
+// Returns NULL if there is no export of that name (yet), or it's from an incompatible version.
+FrameExportReader* OpenFrameExport(const char* name);
+void CloseFrameExport(FrameExportReader* reader);
+
+// Set when the renderer has stopped exporting into this shared memory.
+bool IsFrameExportClosed(const FrameExportReader* reader);
+
+// Finds the latest published frame. Returns false if there is none yet.
+// The planes point straight into the shared memory: nothing is copied.
+bool AcquireLatestFrame(const FrameExportReader* reader, FrameExportFrame* frame);
+
+// Returns true if the frame wasn't overwritten since it was acquired, meaning that everything read from its planes
+// until now is consistent. Readers that hold on to a frame for long should copy what they need first.
+bool ValidateFrame(const FrameExportReader* reader, const FrameExportFrame* frame);
\ No newline at end of file
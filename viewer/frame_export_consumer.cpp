@@ -0,0 +1,167 @@
+// Sample consumer of the frame export (see frame_export.h), built separately from the viewer
+// by the frame_export_consumer target of CMakeLists.txt, or by hand:
+//   g++ -std=c++11 -O2 frame_export_consumer.cpp frame_export.cpp -o frame_export_consumer -lrt
+//
+// frame_export_consumer [shared memory name] [frames to dump]
+// Follows the latest frames, prints their average color, depth and blur once a second,
+// and writes the color of the first frames it sees to export_000000.ppm, ...
+// It reads the planes in place, so all it copies are the few frames it dumps.
+
+#include "frame_export.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <unistd.h>
+#include <time.h>
+
+static double GetSeconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* name = argc > 1 ? argv[1] : "/dof-frames";
+    int framesToDump = argc > 2 ? atoi(argv[2]) : 0;
+
+    FrameExportReader* reader = NULL;
+    uint64_t lastFrameIndex = 0;
+    bool seenFrame = false;
+
+    int framesRead = 0;
+    int framesTorn = 0;
+    int framesDumped = 0;
+    double lastReport = GetSeconds();
+
+    std::vector<uint8_t> dump;
+
+    while (true)
+    {
+        // the viewer recreates the export when its window is resized
+        if (reader && IsFrameExportClosed(reader))
+        {
+            CloseFrameExport(reader);
+            reader = NULL;
+        }
+
+        if (!reader)
+        {
+            reader = OpenFrameExport(name);
+            if (!reader)
+            {
+                usleep(100000);
+                continue;
+            }
+            printf("Opened %s\n", name);
+        }
+
+        FrameExportFrame frame;
+        if (!AcquireLatestFrame(reader, &frame) || (seenFrame && frame.FrameIndex == lastFrameIndex))
+        {
+            usleep(1000);
+            continue;
+        }
+
+        // averages over the frame, read straight from the shared memory
+        const uint8_t* color = frame.Planes[FrameExportPlane_Color];
+        int colorPixels = frame.Width[FrameExportPlane_Color] * frame.Height[FrameExportPlane_Color];
+        uint64_t colorSum[3] = { 0, 0, 0 };
+        for (int i = 0; i < colorPixels; i++)
+        {
+            colorSum[0] += color[i * 4 + 0];
+            colorSum[1] += color[i * 4 + 1];
+            colorSum[2] += color[i * 4 + 2];
+        }
+
+        double depthSum = 0.0;
+        int depthPixels = 0;
+        if (frame.Planes[FrameExportPlane_LinearDepth])
+        {
+            const float* depth = (const float*)frame.Planes[FrameExportPlane_LinearDepth];
+            int n = frame.Width[FrameExportPlane_LinearDepth] * frame.Height[FrameExportPlane_LinearDepth];
+            for (int i = 0; i < n; i++)
+            {
+                // skip the background
+                if (depth[i] != 0.0f)
+                {
+                    depthSum += depth[i];
+                    depthPixels++;
+                }
+            }
+        }
+
+        double cocSum = 0.0;
+        int cocPixels = 0;
+        if (frame.Planes[FrameExportPlane_CoC])
+        {
+            const float* coc = (const float*)frame.Planes[FrameExportPlane_CoC];
+            cocPixels = frame.Width[FrameExportPlane_CoC] * frame.Height[FrameExportPlane_CoC];
+            for (int i = 0; i < cocPixels; i++)
+            {
+                cocSum += coc[i];
+            }
+        }
+
+        bool dumpFrame = framesDumped < framesToDump;
+        if (dumpFrame)
+        {
+            dump.assign(color, color + colorPixels * 4);
+        }
+
+        // the viewer got around to overwriting the slot while we were reading it
+        if (!ValidateFrame(reader, &frame))
+        {
+            framesTorn++;
+            continue;
+        }
+
+        if (dumpFrame)
+        {
+            char filename[64];
+            snprintf(filename, sizeof(filename), "export_%06d.ppm", framesDumped);
+            FILE* f = fopen(filename, "wb");
+            if (f)
+            {
+                int w = frame.Width[FrameExportPlane_Color];
+                int h = frame.Height[FrameExportPlane_Color];
+                fprintf(f, "P6\n%d %d\n255\n", w, h);
+                // the rows are bottom-up
+                for (int y = h - 1; y >= 0; y--)
+                {
+                    for (int x = 0; x < w; x++)
+                    {
+                        fwrite(&dump[(y * w + x) * 4], 1, 3, f);
+                    }
+                }
+                fclose(f);
+            }
+            framesDumped++;
+        }
+
+        // frames skipped in between aren't an error, only the latest one matters
+        lastFrameIndex = frame.FrameIndex;
+        seenFrame = true;
+        framesRead++;
+
+        double now = GetSeconds();
+        if (now - lastReport >= 1.0)
+        {
+            printf("frame %llu (%dx%d): color %.1f %.1f %.1f, depth %.3f, CoC %.2f px, %.1f frames/s, %d torn\n",
+                (unsigned long long)frame.FrameIndex,
+                frame.Width[FrameExportPlane_Color], frame.Height[FrameExportPlane_Color],
+                colorPixels ? (double)colorSum[0] / colorPixels : 0.0,
+                colorPixels ? (double)colorSum[1] / colorPixels : 0.0,
+                colorPixels ? (double)colorSum[2] / colorPixels : 0.0,
+                depthPixels ? depthSum / depthPixels : 0.0,
+                cocPixels ? cocSum / cocPixels : 0.0,
+                framesRead / (now - lastReport), framesTorn);
+            framesRead = 0;
+            framesTorn = 0;
+            lastReport = now;
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,156 @@
+// Fast approximate anti-aliasing (after FXAA 3.11 "quality" by Timothy Lottes).
+// Used instead of MSAA when rendering with a single sample.
+
+layout(binding = FXAA_COLOR_TEXTURE_BINDING) uniform sampler2D Color;
+
+// the texture can be bigger than the rendered region (dynamic resolution)
+layout(location = FXAA_RENDER_SIZE_UNIFORM_LOCATION) uniform ivec2 RenderSize;
+
+out vec4 FragColor;
+
+// minimum local contrast required to apply the algorithm
+#define EDGE_THRESHOLD_MIN 0.0312
+#define EDGE_THRESHOLD_MAX 0.125
+#define SUBPIXEL_QUALITY 0.75
+#define ITERATIONS 12
+
+vec2 uv_max;
+vec2 rcp_size;
+
+vec3 color_at(vec2 uv)
+{
+    return textureLod(Color, min(uv, uv_max), 0.0).rgb;
+}
+
+// luma is computed in (approximately) perceptual space, since the input is linear
+float luma_at(vec2 uv)
+{
+    return sqrt(dot(color_at(uv), vec3(0.299, 0.587, 0.114)));
+}
+
+float quality(int i)
+{
+    return i < 5 ? 1.0 : (i == 5 ? 1.5 : (i < 10 ? 2.0 : (i == 10 ? 4.0 : 8.0)));
+}
+
+void main()
+{
+    rcp_size = 1.0 / vec2(textureSize(Color, 0));
+    uv_max = (vec2(RenderSize) - 0.5) * rcp_size;
+    vec2 uv = gl_FragCoord.xy * rcp_size;
+
+    vec3 colorCenter = color_at(uv);
+    float lumaCenter = sqrt(dot(colorCenter, vec3(0.299, 0.587, 0.114)));
+
+    float lumaDown = luma_at(uv + vec2(0.0, -1.0) * rcp_size);
+    float lumaUp = luma_at(uv + vec2(0.0, 1.0) * rcp_size);
+    float lumaLeft = luma_at(uv + vec2(-1.0, 0.0) * rcp_size);
+    float lumaRight = luma_at(uv + vec2(1.0, 0.0) * rcp_size);
+
+    float lumaMin = min(lumaCenter, min(min(lumaDown, lumaUp), min(lumaLeft, lumaRight)));
+    float lumaMax = max(lumaCenter, max(max(lumaDown, lumaUp), max(lumaLeft, lumaRight)));
+    float lumaRange = lumaMax - lumaMin;
+
+    // not an edge (or too dark to notice): pass through
+    if (lumaRange < max(EDGE_THRESHOLD_MIN, lumaMax * EDGE_THRESHOLD_MAX)) {
+        FragColor = vec4(colorCenter, 1.0);
+        return;
+    }
+
+    float lumaDownLeft = luma_at(uv + vec2(-1.0, -1.0) * rcp_size);
+    float lumaUpRight = luma_at(uv + vec2(1.0, 1.0) * rcp_size);
+    float lumaUpLeft = luma_at(uv + vec2(-1.0, 1.0) * rcp_size);
+    float lumaDownRight = luma_at(uv + vec2(1.0, -1.0) * rcp_size);
+
+    float lumaDownUp = lumaDown + lumaUp;
+    float lumaLeftRight = lumaLeft + lumaRight;
+    float lumaLeftCorners = lumaDownLeft + lumaUpLeft;
+    float lumaDownCorners = lumaDownLeft + lumaDownRight;
+    float lumaRightCorners = lumaDownRight + lumaUpRight;
+    float lumaUpCorners = lumaUpRight + lumaUpLeft;
+
+    // estimate whether the edge is horizontal or vertical
+    float edgeHorizontal = abs(-2.0 * lumaLeft + lumaLeftCorners) + abs(-2.0 * lumaCenter + lumaDownUp) * 2.0 + abs(-2.0 * lumaRight + lumaRightCorners);
+    float edgeVertical = abs(-2.0 * lumaUp + lumaUpCorners) + abs(-2.0 * lumaCenter + lumaLeftRight) * 2.0 + abs(-2.0 * lumaDown + lumaDownCorners);
+    bool isHorizontal = edgeHorizontal >= edgeVertical;
+
+    // pick the side of the edge with the steepest gradient
+    float luma1 = isHorizontal ? lumaDown : lumaLeft;
+    float luma2 = isHorizontal ? lumaUp : lumaRight;
+    float gradient1 = luma1 - lumaCenter;
+    float gradient2 = luma2 - lumaCenter;
+    bool is1Steepest = abs(gradient1) >= abs(gradient2);
+    float gradientScaled = 0.25 * max(abs(gradient1), abs(gradient2));
+
+    float stepLength = isHorizontal ? rcp_size.y : rcp_size.x;
+    float lumaLocalAverage;
+    if (is1Steepest) {
+        stepLength = -stepLength;
+        lumaLocalAverage = 0.5 * (luma1 + lumaCenter);
+    }
+    else {
+        lumaLocalAverage = 0.5 * (luma2 + lumaCenter);
+    }
+
+    // move half a pixel onto the edge
+    vec2 currentUv = uv;
+    if (isHorizontal) {
+        currentUv.y += stepLength * 0.5;
+    }
+    else {
+        currentUv.x += stepLength * 0.5;
+    }
+
+    // explore along the edge in both directions until reaching its ends
+    vec2 offset = isHorizontal ? vec2(rcp_size.x, 0.0) : vec2(0.0, rcp_size.y);
+    vec2 uv1 = currentUv - offset;
+    vec2 uv2 = currentUv + offset;
+
+    float lumaEnd1 = luma_at(uv1) - lumaLocalAverage;
+    float lumaEnd2 = luma_at(uv2) - lumaLocalAverage;
+    bool reached1 = abs(lumaEnd1) >= gradientScaled;
+    bool reached2 = abs(lumaEnd2) >= gradientScaled;
+
+    for (int i = 2; i < ITERATIONS && !(reached1 && reached2); i++)
+    {
+        if (!reached1) {
+            uv1 -= offset * quality(i);
+            lumaEnd1 = luma_at(uv1) - lumaLocalAverage;
+            reached1 = abs(lumaEnd1) >= gradientScaled;
+        }
+        if (!reached2) {
+            uv2 += offset * quality(i);
+            lumaEnd2 = luma_at(uv2) - lumaLocalAverage;
+            reached2 = abs(lumaEnd2) >= gradientScaled;
+        }
+    }
+
+    float distance1 = isHorizontal ? (uv.x - uv1.x) : (uv.y - uv1.y);
+    float distance2 = isHorizontal ? (uv2.x - uv.x) : (uv2.y - uv.y);
+    bool isDirection1 = distance1 < distance2;
+    float distanceFinal = min(distance1, distance2);
+    float edgeThickness = distance1 + distance2;
+
+    // only offset if the luma variation at the closest end is coherent with the center
+    bool isLumaCenterSmaller = lumaCenter < lumaLocalAverage;
+    bool correctVariation = ((isDirection1 ? lumaEnd1 : lumaEnd2) < 0.0) != isLumaCenterSmaller;
+    float pixelOffset = correctVariation ? (-distanceFinal / edgeThickness + 0.5) : 0.0;
+
+    // sub-pixel aliasing (thin lines, single pixels)
+    float lumaAverage = (1.0 / 12.0) * (2.0 * (lumaDownUp + lumaLeftRight) + lumaLeftCorners + lumaRightCorners);
+    float subPixelOffset1 = clamp(abs(lumaAverage - lumaCenter) / lumaRange, 0.0, 1.0);
+    float subPixelOffset2 = (-2.0 * subPixelOffset1 + 3.0) * subPixelOffset1 * subPixelOffset1;
+    float subPixelOffsetFinal = subPixelOffset2 * subPixelOffset2 * SUBPIXEL_QUALITY;
+
+    pixelOffset = max(pixelOffset, subPixelOffsetFinal);
+
+    vec2 finalUv = uv;
+    if (isHorizontal) {
+        finalUv.y += pixelOffset * stepLength;
+    }
+    else {
+        finalUv.x += pixelOffset * stepLength;
+    }
+
+    FragColor = vec4(color_at(finalUv), 1.0);
+}
@@ -0,0 +1,480 @@
+#include "gl_dof.h"
+
+#include "shaderset.h"
+
+#include "preamble.glsl"
+
+#include <cassert>
+#include <algorithm>
+
+static_assert(GLDOF_MAX_LAYERS == MULTIVIEW_MAX_VIEWS, "the layered box filter has one invocation per layer");
+static_assert(GLDOF_MAX_PATCH_SIZE == SAT_WORKGROUP_SIZE_X, "the patch's rows and columns are each summed by a workgroup");
+
+class GLDepthOfField : public IGLDepthOfField
+{
+public:
+    // set if the library has its own shaders, which it has to update itself
+    ShaderSet* mOwnShaders;
+    ShaderSet* mShaders;
+
+    GLuint* mSummedAreaTableUpsweepSP;
+    GLuint* mSummedAreaTableDownsweepSP;
+    GLuint* mTransposeSummedAreaTableSP;
+    GLuint* mPatchSummedAreaTableSP;
+    GLuint* mDepthOfFieldSP;
+    GLuint* mLayeredDepthOfFieldSP;
+
+    // empty VAO, for the attrib-less box filter pass
+    GLuint mNullVAO;
+    // the box filter renders to the target textures through this
+    GLuint mTargetFBO;
+
+    int mMaxWidth;
+    int mMaxHeight;
+    int mMaxLayerCount;
+    int mSummedAreaTableWidth;
+    int mSummedAreaTableHeight;
+    GLuint mSummedRowsTO; // also the SAT once it's complete
+    GLuint mSummedRowsWGSumsTO;
+    GLuint mSummedColsTO;
+    GLuint mSummedColsWGSumsTO;
+
+    void Init(ShaderSet* shaders)
+    {
+        mOwnShaders = NULL;
+        if (!shaders)
+        {
+            mOwnShaders = new ShaderSet();
+            mOwnShaders->SetVersion("440");
+            mOwnShaders->SetPreambleFile("preamble.glsl");
+            shaders = mOwnShaders;
+        }
+        mShaders = shaders;
+
+        mSummedAreaTableUpsweepSP = mShaders->AddProgramFromExts({ "sat_up.comp" });
+        mSummedAreaTableDownsweepSP = mShaders->AddProgramFromExts({ "sat_down.comp" });
+        mTransposeSummedAreaTableSP = mShaders->AddProgramFromExts({ "sat_transpose.comp" });
+        mPatchSummedAreaTableSP = mShaders->AddProgramFromExts({ "sat_patch.comp" });
+        mDepthOfFieldSP = mShaders->AddProgramFromExts({ "blit.vert", "dof.frag" });
+        mLayeredDepthOfFieldSP = mShaders->AddProgramFromExts({ "blit.vert", "blit_layered.geom", "dof.frag" });
+
+        glGenVertexArrays(1, &mNullVAO);
+        glBindVertexArray(mNullVAO);
+        glBindVertexArray(0);
+
+        glGenFramebuffers(1, &mTargetFBO);
+
+        mMaxWidth = mMaxHeight = mMaxLayerCount = 0;
+        mSummedAreaTableWidth = mSummedAreaTableHeight = 0;
+        mSummedRowsTO = mSummedRowsWGSumsTO = 0;
+        mSummedColsTO = mSummedColsWGSumsTO = 0;
+    }
+
+    ~GLDepthOfField()
+    {
+        GLuint textures[] = { mSummedRowsTO, mSummedRowsWGSumsTO, mSummedColsTO, mSummedColsWGSumsTO };
+        glDeleteTextures(4, textures);
+        glDeleteFramebuffers(1, &mTargetFBO);
+        glDeleteVertexArrays(1, &mNullVAO);
+        delete mOwnShaders;
+    }
+
+    void Reserve(int maxWidth, int maxHeight, int maxLayerCount) override
+    {
+        if (maxWidth == mMaxWidth && maxHeight == mMaxHeight && maxLayerCount == mMaxLayerCount)
+        {
+            return;
+        }
+
+        mMaxWidth = maxWidth;
+        mMaxHeight = maxHeight;
+        mMaxLayerCount = maxLayerCount;
+
+        mSummedAreaTableWidth = (mMaxWidth + SAT_WORKGROUP_SIZE_X - 1) & -SAT_WORKGROUP_SIZE_X;
+        mSummedAreaTableHeight = (mMaxHeight + SAT_WORKGROUP_SIZE_X - 1) & -SAT_WORKGROUP_SIZE_X;
+
+        // The workgroup sums need to be computed in a single workgroup
+        // could generalize this to an arbitrary number of iterations, but meh.
+        assert(mSummedAreaTableWidth / SAT_WORKGROUP_SIZE_X <= SAT_WORKGROUP_SIZE_X);
+        assert(mSummedAreaTableHeight / SAT_WORKGROUP_SIZE_X <= SAT_WORKGROUP_SIZE_X);
+
+        // The textures aren't padded to the workgroups, which would take several times the memory of small views:
+        // the passes dispatch whole workgroups, and their out of bounds loads return 0 and stores are discarded.
+        int wgSumsWidth = mSummedAreaTableWidth / SAT_WORKGROUP_SIZE_X;
+        int wgSumsHeight = mSummedAreaTableHeight / SAT_WORKGROUP_SIZE_X;
+
+        // Integer textures are incomplete with the default (linear) filters, and texelFetch from them returns 0.
+        struct { GLuint* TO; int Width, Height; } textures[] = {
+            { &mSummedRowsTO, mMaxWidth, mMaxHeight },
+            { &mSummedRowsWGSumsTO, wgSumsWidth, mMaxHeight },
+            { &mSummedColsTO, mMaxHeight, mMaxWidth },
+            { &mSummedColsWGSumsTO, wgSumsHeight, mMaxWidth },
+        };
+        for (auto& texture : textures)
+        {
+            glDeleteTextures(1, texture.TO);
+            glGenTextures(1, texture.TO);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, *texture.TO);
+            glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA32UI, texture.Width, texture.Height, mMaxLayerCount);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        }
+    }
+
+    bool Apply(const GLDoFImage* images, int imageCount) override
+    {
+        if (mOwnShaders)
+        {
+            mOwnShaders->UpdatePrograms();
+        }
+
+        // one allocation for the whole batch
+        int maxWidth = mMaxWidth, maxHeight = mMaxHeight;
+        for (int i = 0; i < imageCount; i++)
+        {
+            maxWidth = std::max(maxWidth, images[i].Width);
+            maxHeight = std::max(maxHeight, images[i].Height);
+        }
+        Reserve(maxWidth, maxHeight, std::max(mMaxLayerCount, 1));
+
+        for (int i = 0; i < imageCount; i++)
+        {
+            if (!ComputeSummedAreaTable(images[i].ColorTO, images[i].Width, images[i].Height, false) ||
+                !ApplyBoxFilter(images[i]))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool ApplyLayered(const GLDoFLayeredImage& image) override
+    {
+        if (mOwnShaders)
+        {
+            mOwnShaders->UpdatePrograms();
+        }
+
+        assert(image.LayerCount >= 1 && image.LayerCount <= GLDOF_MAX_LAYERS);
+
+        Reserve(
+            std::max(mMaxWidth, image.Width),
+            std::max(mMaxHeight, image.Height),
+            std::max(mMaxLayerCount, image.LayerCount));
+
+        if (!ComputeSummedAreaTables(image.ColorTO, true, image.Width, image.Height, image.LayerCount, false))
+        {
+            return false;
+        }
+
+        return DrawBoxFilter(
+            image.ColorTO, image.DepthTO, image.TargetTO, true, image.DepthIsLinear,
+            image.Width, image.Height, image.LayerCount, image.ZNear,
+            image.FocusDepth, image.RadiusScale, image.MaxRadius);
+    }
+
+    GLuint GetSummedAreaTableTexture() const override
+    {
+        return mSummedRowsTO;
+    }
+
+    bool ComputeSummedAreaTable(GLuint colorTO, int width, int height, bool rowsSummed) override
+    {
+        return ComputeSummedAreaTables(colorTO, false, width, height, 1, rowsSummed);
+    }
+
+    bool PatchSummedAreaTable(GLuint colorTO, int width, int height, int x0, int y0, int x1, int y1) override
+    {
+        if (!*mPatchSummedAreaTableSP)
+        {
+            return false;
+        }
+
+        assert(x0 >= 0 && y0 >= 0 && x1 <= width && y1 <= height);
+        assert(x1 - x0 <= GLDOF_MAX_PATCH_SIZE && y1 - y0 <= GLDOF_MAX_PATCH_SIZE);
+
+        // nothing changed
+        if (x0 >= x1 || y0 >= y1)
+        {
+            return true;
+        }
+
+        glUseProgram(*mPatchSummedAreaTableSP);
+
+        // the region's change is summed in the columns' texture, which is only scratch between SATs.
+        // It's transposed there, so it fits the region whatever the aspect ratio of the SAT.
+        glBindTextures(SAT_PATCH_COLOR_TEXTURE_BINDING, 1, &colorTO);
+        glBindImageTexture(SAT_PATCH_SAT_IMAGE_BINDING, mSummedRowsTO, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA32UI);
+        glBindImageTexture(SAT_PATCH_DELTAS_IMAGE_BINDING, mSummedColsTO, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA32UI);
+
+        glUniform2i(SAT_PATCH_RECT_MIN_UNIFORM_LOCATION, x0, y0);
+        glUniform2i(SAT_PATCH_RECT_MAX_UNIFORM_LOCATION, x1, y1);
+        glUniform2i(SAT_PATCH_RENDER_SIZE_UNIFORM_LOCATION, width, height);
+
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+        glUniform1i(SAT_PATCH_PASS_UNIFORM_LOCATION, SAT_PATCH_PASS_DELTA_ROWS);
+        glDispatchCompute(1, y1 - y0, 1);
+
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        glUniform1i(SAT_PATCH_PASS_UNIFORM_LOCATION, SAT_PATCH_PASS_DELTA_COLS);
+        glDispatchCompute(1, x1 - x0, 1);
+
+        // the old SAT was read by the first pass, now it can be written
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        glUniform1i(SAT_PATCH_PASS_UNIFORM_LOCATION, SAT_PATCH_PASS_APPLY);
+        glDispatchCompute((width - x0 + SAT_WORKGROUP_SIZE_X - 1) / SAT_WORKGROUP_SIZE_X, height - y0, 1);
+
+        glBindTextures(SAT_PATCH_COLOR_TEXTURE_BINDING, 1, NULL);
+        glBindImageTextures(SAT_PATCH_SAT_IMAGE_BINDING, 2, NULL);
+        glUseProgram(0);
+
+        return true;
+    }
+
+    // The SATs of the first layerCount layers of colorTO (a GL_TEXTURE_2D_ARRAY if colorIsArray), each pass
+    // dispatched once for all of them.
+    bool ComputeSummedAreaTables(GLuint colorTO, bool colorIsArray, int width, int height, int layerCount, bool rowsSummed)
+    {
+        if (!*mSummedAreaTableUpsweepSP || !*mSummedAreaTableDownsweepSP || !*mTransposeSummedAreaTableSP)
+        {
+            return false;
+        }
+
+        // only the given region of the (possibly larger) SAT needs to be computed.
+        // Anything outside it only receives sums that flow right and down, so it never pollutes the valid region.
+        int satWidth = (width + SAT_WORKGROUP_SIZE_X - 1) & -SAT_WORKGROUP_SIZE_X;
+        int satHeight = (height + SAT_WORKGROUP_SIZE_X - 1) & -SAT_WORKGROUP_SIZE_X;
+
+        enum SATPass {
+            SATPass_Rows,
+            SATPass_Cols,
+            SATPass_Count
+        };
+
+        for (int pass = 0; pass < SATPass_Count; pass++)
+        {
+            // Up-sweep
+            // (already done for the rows by the caller)
+            if (!(pass == SATPass_Rows && rowsSummed))
+            {
+                glUseProgram(*mSummedAreaTableUpsweepSP);
+
+                glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+                if (pass == SATPass_Rows) {
+                    glBindTextures(colorIsArray ? SAT_ARRAY_INPUT_TEXTURE_BINDING : SAT_INPUT_TEXTURE_BINDING, 1, &colorTO);
+                    glBindImageTexture(SAT_OUTPUT_IMAGE_BINDING, mSummedRowsTO, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
+                    glUniform1i(SAT_READ_UINT_INPUT_UNIFORM_LOCATION, 0);
+                    glUniform1i(SAT_READ_ARRAY_INPUT_UNIFORM_LOCATION, colorIsArray);
+                }
+                else if (pass == SATPass_Cols) {
+                    glBindTextures(SAT_UINT_INPUT_TEXTURE_BINDING, 1, &mSummedColsTO);
+                    glBindImageTexture(SAT_OUTPUT_IMAGE_BINDING, mSummedColsTO, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
+                    glUniform1i(SAT_READ_UINT_INPUT_UNIFORM_LOCATION, 1);
+                }
+
+                glUniform1i(SAT_READ_WGSUM_UNIFORM_LOCATION, 0);
+
+                if (pass == SATPass_Rows) {
+                    glDispatchCompute(satWidth / SAT_WORKGROUP_SIZE_X, height, layerCount);
+                }
+                else if (pass == SATPass_Cols) {
+                    glDispatchCompute(satHeight / SAT_WORKGROUP_SIZE_X, width, layerCount);
+                }
+
+                glBindTextures(SAT_INPUT_TEXTURE_BINDING, 3, NULL);
+                glBindImageTextures(SAT_OUTPUT_IMAGE_BINDING, 1, NULL);
+                glUseProgram(0);
+            }
+
+            // Up-sweep WG sums
+            {
+                glUseProgram(*mSummedAreaTableUpsweepSP);
+
+                glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+                if (pass == SATPass_Rows) {
+                    glBindTextures(SAT_UINT_INPUT_TEXTURE_BINDING, 1, &mSummedRowsTO);
+                    glBindImageTexture(SAT_OUTPUT_IMAGE_BINDING, mSummedRowsWGSumsTO, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
+                }
+                else if (pass == SATPass_Cols) {
+                    glBindTextures(SAT_UINT_INPUT_TEXTURE_BINDING, 1, &mSummedColsTO);
+                    glBindImageTexture(SAT_OUTPUT_IMAGE_BINDING, mSummedColsWGSumsTO, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
+                }
+
+                glUniform1i(SAT_READ_UINT_INPUT_UNIFORM_LOCATION, 0);
+                glUniform1i(SAT_READ_WGSUM_UNIFORM_LOCATION, 1);
+
+                if (pass == SATPass_Rows) {
+                    glDispatchCompute(1, height, layerCount);
+                }
+                else if (pass == SATPass_Cols) {
+                    glDispatchCompute(1, width, layerCount);
+                }
+
+                glBindTextures(SAT_UINT_INPUT_TEXTURE_BINDING, 1, NULL);
+                glBindImageTextures(SAT_OUTPUT_IMAGE_BINDING, 1, NULL);
+                glUseProgram(0);
+            }
+
+            // Down-sweep WG sums
+            {
+                glUseProgram(*mSummedAreaTableDownsweepSP);
+
+                glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+                if (pass == SATPass_Rows) {
+                    glBindImageTexture(SAT_OUTPUT_IMAGE_BINDING, mSummedRowsWGSumsTO, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA32UI);
+                }
+                else if (pass == SATPass_Cols) {
+                    glBindImageTexture(SAT_OUTPUT_IMAGE_BINDING, mSummedColsWGSumsTO, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA32UI);
+                }
+
+                glUniform1i(SAT_ADD_WGSUM_UNIFORM_LOCATION, 0);
+                glUniform1i(SAT_INCLUSIVE_UNIFORM_LOCATION, 0);
+
+                if (pass == SATPass_Rows) {
+                    glDispatchCompute(1, height, layerCount);
+                }
+                else if (pass == SATPass_Cols) {
+                    glDispatchCompute(1, width, layerCount);
+                }
+
+                glBindImageTextures(SAT_OUTPUT_IMAGE_BINDING, 1, NULL);
+                glUseProgram(0);
+            }
+
+            // Down-sweep
+            {
+                glUseProgram(*mSummedAreaTableDownsweepSP);
+
+                glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+                if (pass == SATPass_Rows) {
+                    glBindImageTexture(SAT_OUTPUT_IMAGE_BINDING, mSummedRowsTO, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA32UI);
+                    glBindImageTexture(SAT_WGSUMS_IMAGE_BINDING, mSummedRowsWGSumsTO, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA32UI);
+                }
+                else if (pass == SATPass_Cols) {
+                    glBindImageTexture(SAT_OUTPUT_IMAGE_BINDING, mSummedColsTO, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA32UI);
+                    glBindImageTexture(SAT_WGSUMS_IMAGE_BINDING, mSummedColsWGSumsTO, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA32UI);
+                }
+
+                glUniform1i(SAT_ADD_WGSUM_UNIFORM_LOCATION, 1);
+                glUniform1i(SAT_INCLUSIVE_UNIFORM_LOCATION, 1);
+
+                if (pass == SATPass_Rows) {
+                    glDispatchCompute(satWidth / SAT_WORKGROUP_SIZE_X, height, layerCount);
+                }
+                else if (pass == SATPass_Cols) {
+                    glDispatchCompute(satHeight / SAT_WORKGROUP_SIZE_X, width, layerCount);
+                }
+
+                glBindImageTextures(SAT_OUTPUT_IMAGE_BINDING, 1, NULL);
+                glBindImageTextures(SAT_WGSUMS_IMAGE_BINDING, 1, NULL);
+                glUseProgram(0);
+            }
+
+            // Transpose
+            {
+                glUseProgram(*mTransposeSummedAreaTableSP);
+
+                glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+                // the columns are transposed back into the rows' texture, which then holds the SAT
+                if (pass == SATPass_Rows) {
+                    glBindImageTexture(TRANSPOSE_SAT_INPUT_IMAGE_BINDING, mSummedRowsTO, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA32UI);
+                    glBindImageTexture(TRANSPOSE_SAT_OUTPUT_IMAGE_BINDING, mSummedColsTO, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
+                }
+                else if (pass == SATPass_Cols) {
+                    glBindImageTexture(TRANSPOSE_SAT_INPUT_IMAGE_BINDING, mSummedColsTO, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA32UI);
+                    glBindImageTexture(TRANSPOSE_SAT_OUTPUT_IMAGE_BINDING, mSummedRowsTO, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
+                }
+
+                if (pass == SATPass_Rows) {
+                    glDispatchCompute(satWidth / TRANSPOSE_SAT_WORKGROUP_SIZE_X, satHeight / TRANSPOSE_SAT_WORKGROUP_SIZE_X, layerCount);
+                }
+                else if (pass == SATPass_Cols) {
+                    glDispatchCompute(satHeight / TRANSPOSE_SAT_WORKGROUP_SIZE_X, satWidth / TRANSPOSE_SAT_WORKGROUP_SIZE_X, layerCount);
+                }
+
+                glBindImageTextures(TRANSPOSE_SAT_INPUT_IMAGE_BINDING, 1, NULL);
+                glBindImageTextures(TRANSPOSE_SAT_OUTPUT_IMAGE_BINDING, 1, NULL);
+                glUseProgram(0);
+            }
+        }
+
+        return true;
+    }
+
+    bool ApplyBoxFilter(const GLDoFImage& image) override
+    {
+        return DrawBoxFilter(
+            image.ColorTO, image.DepthTO, image.TargetTO, false, image.DepthIsLinear,
+            image.Width, image.Height, 1, &image.ZNear,
+            image.FocusDepth, image.RadiusScale, image.MaxRadius);
+    }
+
+    // The textures are GL_TEXTURE_2D_ARRAYs if layered, and all the layers are drawn at once.
+    bool DrawBoxFilter(
+        GLuint colorTO, GLuint depthTO, GLuint targetTO, bool layered, bool depthIsLinear,
+        int width, int height, int layerCount, const float* zNear,
+        float focusDepth, float radiusScale, int maxRadius)
+    {
+        GLuint program = layered ? *mLayeredDepthOfFieldSP : *mDepthOfFieldSP;
+        if (!program)
+        {
+            return false;
+        }
+
+        // ensure the computed SAT is available to the DoF shader
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, mTargetFBO);
+        if (layered) {
+            glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, targetTO, 0);
+        }
+        else {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, targetTO, 0);
+        }
+        glViewport(0, 0, width, height);
+        glUseProgram(program);
+        glBindVertexArray(mNullVAO);
+        glBindTextures(DOF_SAT_TEXTURE_BINDING, 1, &mSummedRowsTO);
+        glBindTextures(layered ? DOF_DEPTH_ARRAY_TEXTURE_BINDING : DOF_DEPTH_TEXTURE_BINDING, 1, &depthTO);
+        glBindTextures(layered ? DOF_COLOR_ARRAY_TEXTURE_BINDING : DOF_COLOR_TEXTURE_BINDING, 1, &colorTO);
+        glEnable(GL_FRAMEBUFFER_SRGB);
+
+        if (layered) {
+            glUniform1i(BLIT_LAYER_COUNT_UNIFORM_LOCATION, layerCount);
+        }
+        glUniform1i(DOF_READ_ARRAY_INPUTS_UNIFORM_LOCATION, layered);
+        glUniform1fv(DOF_ZNEAR_UNIFORM_LOCATION, layerCount, zNear);
+        glUniform1f(DOF_FOCUS_UNIFORM_LOCATION, focusDepth);
+        glUniform2i(DOF_RENDER_SIZE_UNIFORM_LOCATION, width, height);
+        glUniform1i(DOF_DEPTH_IS_LINEAR_UNIFORM_LOCATION, depthIsLinear);
+        glUniform1f(DOF_RADIUS_SCALE_UNIFORM_LOCATION, radiusScale);
+        glUniform1i(DOF_MAX_RADIUS_UNIFORM_LOCATION, std::min(maxRadius, GLDOF_MAX_EXACT_RADIUS));
+        // in place, the background is already there (and reading the target while rendering to it is undefined)
+        glUniform1i(DOF_COPY_BACKGROUND_UNIFORM_LOCATION, targetTO != colorTO);
+
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        glDisable(GL_FRAMEBUFFER_SRGB);
+        glBindTextures(DOF_SAT_TEXTURE_BINDING, 5, NULL);
+        glBindVertexArray(0);
+        glUseProgram(0);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        return true;
+    }
+};
+
+IGLDepthOfField* NewGLDepthOfField(ShaderSet* shaders)
+{
+    GLDepthOfField* dof = new GLDepthOfField();
+    dof->Init(shaders);
+    return dof;
+}
\ No newline at end of file
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "opengl.h"
+
+class ShaderSet;
+
+// The renderer's depth of field (a summed area table of the color, then the box filter of dof.frag),
+// on textures owned by the caller. Used by the renderer itself, and usable on frames from anywhere else:
+// a batch of images is filtered one after the other with the same SAT, so a context can go through many frames
+// (or a whole video) with a single allocation.
+// Views rendered into the layers of array textures are filtered all together instead, with one dispatch per pass of
+// the SAT and one draw of the box filter for all of them.
+//
+// Needs a GL 4.4 context with clip control, like the viewer's. GL state that it changes (program, framebuffer,
+// VAO, texture and image bindings, viewport, GL_FRAMEBUFFER_SRGB) is left unbound/disabled afterwards.
+
+struct GLDoFImage
+{
+    // GL_TEXTURE_2D. Read with texelFetch, so the blur happens in linear space for sRGB textures.
+    GLuint ColorTO;
+    // GL_TEXTURE_2D, reversed-Z depth like the viewer renders it, or eye space depth (0 for background) if DepthIsLinear
+    GLuint DepthTO;
+    bool DepthIsLinear;
+    // GL_TEXTURE_2D, level 0 is written (sRGB-encoded if it's an sRGB format). Can be ColorTO, to blur in place.
+    GLuint TargetTO;
+    // size of the region at the origin of the three textures that is filtered
+    int Width;
+    int Height;
+
+    float ZNear;
+    // eye space depth of the plane in focus
+    float FocusDepth;
+    // pixels of blur radius per unit of distance from the focus plane
+    float RadiusScale;
+    // in pixels, at most GLDOF_MAX_EXACT_RADIUS
+    int MaxRadius;
+};
+
+// Views in the layers of array textures, like the renderer's multi-view mode renders them.
+struct GLDoFLayeredImage
+{
+    // GL_TEXTURE_2D_ARRAY, one view per layer, with the same contents as GLDoFImage's textures.
+    GLuint ColorTO;
+    GLuint DepthTO;
+    bool DepthIsLinear;
+    // GL_TEXTURE_2D_ARRAY. Can be ColorTO, to blur in place.
+    GLuint TargetTO;
+    int Width;
+    int Height;
+    // the first LayerCount layers are filtered, at most GLDOF_MAX_LAYERS
+    int LayerCount;
+
+    // one per layer
+    const float* ZNear;
+    float FocusDepth;
+    float RadiusScale;
+    int MaxRadius;
+};
+
+// one geometry shader invocation per layer (MULTIVIEW_MAX_VIEWS of the preamble)
+#define GLDOF_MAX_LAYERS 32
+
+// The SAT is unsigned 32-bit and only box sums need to be exact, so a box of (2r+1)^2 texels of 255 must fit in 32 bits.
+#define GLDOF_MAX_EXACT_RADIUS 2047
+
+// the biggest region that PatchSummedAreaTable takes, on each side (a workgroup of the SAT's passes)
+#define GLDOF_MAX_PATCH_SIZE 1024
+
+class IGLDepthOfField
+{
+public:
+    virtual ~IGLDepthOfField() { }
+
+    // Allocates the SAT for maxLayerCount images up to maxWidth x maxHeight.
+    // Apply and ApplyLayered grow it if they're given bigger images, or more layers.
+    virtual void Reserve(int maxWidth, int maxHeight, int maxLayerCount) = 0;
+
+    // Filters the images one after the other, in order. Returns false (doing nothing) if the shaders aren't built.
+    virtual bool Apply(const GLDoFImage* images, int imageCount) = 0;
+
+    // Filters all the layers of the image at once.
+    virtual bool ApplyLayered(const GLDoFLayeredImage& image) = 0;
+
+    // The steps of Apply, for callers that produce part of the SAT themselves, or compute it elsewhere.
+    // Returns false if the shaders aren't built.
+
+    // RGBA32UI GL_TEXTURE_2D_ARRAY of Reserve's size, one SAT per layer. Holds the summed rows first, then the SAT.
+    // The renderer's fused resolve writes the summed rows of its color into layer 0.
+    virtual GLuint GetSummedAreaTableTexture() const = 0;
+    // Sums colorTO into the SAT's layer 0.
+    // If rowsSummed, the rows are already in GetSummedAreaTableTexture and colorTO is unused.
+    virtual bool ComputeSummedAreaTable(GLuint colorTO, int width, int height, bool rowsSummed) = 0;
+    // Turns the SAT of layer 0, computed from an earlier width x height image, into the SAT of colorTO, when colorTO only
+    // differs from that image in the pixels [x0, x1) x [y0, y1), at most GLDOF_MAX_PATCH_SIZE on each side.
+    // The region's change is added to the sums to the lower right of it, instead of summing the whole image again.
+    virtual bool PatchSummedAreaTable(GLuint colorTO, int width, int height, int x0, int y0, int x1, int y1) = 0;
+    // The box filter of the image, from the current SAT (computed from the image's color).
+    virtual bool ApplyBoxFilter(const GLDoFImage& image) = 0;
+};
+
+// Adds the programs to shaders, which compiles them and reloads them on its UpdatePrograms (the caller keeps updating it).
+// shaders needs the viewer's preamble.glsl. If shaders is NULL, the library has its own set, and updates it on each call.
+IGLDepthOfField* NewGLDepthOfField(ShaderSet* shaders);
\ No newline at end of file
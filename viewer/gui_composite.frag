@@ -0,0 +1,11 @@
+// Composites the cached GUI layer over the window.
+// The layer's alpha is premultiplied, so it's blended with (ONE, ONE_MINUS_SRC_ALPHA).
+
+layout(binding = GUI_LAYER_TEXTURE_BINDING) uniform sampler2D GUILayer;
+
+out vec4 FragColor;
+
+void main()
+{
+    FragColor = texelFetch(GUILayer, ivec2(gl_FragCoord.xy), 0);
+}
\ No newline at end of file
@@ -0,0 +1,476 @@
+#include "image_write.h"
+
+#include "thread_pool.h"
+
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+// Not Windows? Assume unix-like.
+#include <sys/types.h>
+#endif
+
+// the offsets of 16K+ images don't fit in a long on every platform
+static bool SeekImageFile(FILE* file, int64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+bool OpenTiledPPM(TiledImageFile& image, const char* filename, int width, int height)
+{
+    image.File = fopen(filename, "wb");
+    if (!image.File)
+    {
+        fprintf(stderr, "fopen(%s): failed\n", filename);
+        return false;
+    }
+
+    image.Width = width;
+    image.Height = height;
+    image.HeaderSize = fprintf(image.File, "P6\n%d %d\n255\n", width, height);
+
+    // write the last byte, so the whole file exists before the tiles arrive
+    int64_t fileSize = image.HeaderSize + (int64_t)width * height * 3;
+    if (!SeekImageFile(image.File, fileSize - 1) || fputc(0, image.File) == EOF)
+    {
+        fprintf(stderr, "Failed to allocate %s\n", filename);
+        fclose(image.File);
+        image.File = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+bool WriteTiledPPMRect(TiledImageFile& image, int x, int y, int width, int height, const uint8_t* rgb, ptrdiff_t rowStride)
+{
+    if (!image.File)
+    {
+        return false;
+    }
+
+    for (int row = 0; row < height; row++)
+    {
+        int64_t offset = image.HeaderSize + ((int64_t)(y + row) * image.Width + x) * 3;
+        if (!SeekImageFile(image.File, offset) ||
+            fwrite(rgb + row * rowStride, 3, width, image.File) != (size_t)width)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool CloseTiledPPM(TiledImageFile& image)
+{
+    if (!image.File)
+    {
+        return false;
+    }
+
+    bool ok = !ferror(image.File);
+    ok = fclose(image.File) == 0 && ok;
+    image.File = NULL;
+    return ok;
+}
+
+namespace
+{
+    // rows per strip of a PNG that is filtered and compressed as one job
+    const int kPNGStripRows = 32;
+
+    struct BitWriter
+    {
+        std::vector<uint8_t>* Out;
+        uint32_t Bits;
+        int BitCount;
+
+        // values are packed starting from their least significant bit
+        void Put(uint32_t value, int count)
+        {
+            Bits |= value << BitCount;
+            BitCount += count;
+            while (BitCount >= 8)
+            {
+                Out->push_back((uint8_t)Bits);
+                Bits >>= 8;
+                BitCount -= 8;
+            }
+        }
+
+        // Huffman codes are packed starting from their most significant bit
+        void PutCode(uint32_t code, int length)
+        {
+            uint32_t reversed = 0;
+            for (int i = 0; i < length; i++)
+            {
+                reversed = (reversed << 1) | ((code >> i) & 1);
+            }
+            Put(reversed, length);
+        }
+
+        void Flush()
+        {
+            if (BitCount > 0)
+            {
+                Out->push_back((uint8_t)Bits);
+                Bits = 0;
+                BitCount = 0;
+            }
+        }
+    };
+
+    const uint16_t kLengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    const uint8_t kLengthExtraBits[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    const uint16_t kDistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    const uint8_t kDistanceExtraBits[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+    // literal/length symbol, with the fixed Huffman codes of deflate
+    void PutSymbol(BitWriter& bw, int symbol)
+    {
+        if (symbol < 144)
+        {
+            bw.PutCode(0x30 + symbol, 8);
+        }
+        else if (symbol < 256)
+        {
+            bw.PutCode(0x190 + symbol - 144, 9);
+        }
+        else if (symbol < 280)
+        {
+            bw.PutCode(symbol - 256, 7);
+        }
+        else
+        {
+            bw.PutCode(0xC0 + symbol - 280, 8);
+        }
+    }
+
+    void PutMatch(BitWriter& bw, int length, int distance)
+    {
+        int lengthCode = 28;
+        while (kLengthBase[lengthCode] > length)
+        {
+            lengthCode--;
+        }
+        PutSymbol(bw, 257 + lengthCode);
+        bw.Put(length - kLengthBase[lengthCode], kLengthExtraBits[lengthCode]);
+
+        int distanceCode = 29;
+        while (kDistanceBase[distanceCode] > distance)
+        {
+            distanceCode--;
+        }
+        bw.PutCode(distanceCode, 5);
+        bw.Put(distance - kDistanceBase[distanceCode], kDistanceExtraBits[distanceCode]);
+    }
+
+    // Compresses the data as a fixed Huffman deflate block, with a greedy LZ77 matcher that only looks inside the data.
+    // Non-final blocks are followed by an empty stored block, which ends them on a byte boundary,
+    // so independently compressed pieces can be concatenated into one stream.
+    void Deflate(const uint8_t* data, int size, bool final, std::vector<uint8_t>& out)
+    {
+        const int kHashBits = 15;
+        const int kWindowSize = 32768;
+        const int kMaxChainLength = 16;
+        const int kMinMatch = 3;
+        const int kMaxMatch = 258;
+
+        std::vector<int> head(1 << kHashBits, -1);
+        std::vector<int> prev(size);
+
+        auto hash = [&](int i)
+        {
+            uint32_t v = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16);
+            return (v * 2654435761u) >> (32 - kHashBits);
+        };
+
+        auto insert = [&](int i)
+        {
+            if (i + kMinMatch <= size)
+            {
+                uint32_t h = hash(i);
+                prev[i] = head[h];
+                head[h] = i;
+            }
+        };
+
+        BitWriter bw = { &out, 0, 0 };
+        bw.Put(final ? 1 : 0, 1);
+        bw.Put(1, 2); // fixed Huffman codes
+
+        int i = 0;
+        while (i < size)
+        {
+            int bestLength = 0;
+            int bestDistance = 0;
+            if (i + kMinMatch <= size)
+            {
+                int maxLength = std::min(kMaxMatch, size - i);
+                int candidate = head[hash(i)];
+                for (int chain = 0; candidate >= 0 && i - candidate <= kWindowSize && chain < kMaxChainLength; chain++)
+                {
+                    int length = 0;
+                    while (length < maxLength && data[candidate + length] == data[i + length])
+                    {
+                        length++;
+                    }
+
+                    if (length > bestLength)
+                    {
+                        bestLength = length;
+                        bestDistance = i - candidate;
+                        if (length == maxLength)
+                        {
+                            break;
+                        }
+                    }
+
+                    candidate = prev[candidate];
+                }
+            }
+
+            if (bestLength >= kMinMatch)
+            {
+                PutMatch(bw, bestLength, bestDistance);
+                for (int j = 0; j < bestLength; j++)
+                {
+                    insert(i + j);
+                }
+                i += bestLength;
+            }
+            else
+            {
+                PutSymbol(bw, data[i]);
+                insert(i);
+                i++;
+            }
+        }
+
+        PutSymbol(bw, 256); // end of block
+
+        if (!final)
+        {
+            bw.Put(0, 1);
+            bw.Put(0, 2); // stored
+            bw.Flush();
+            out.push_back(0x00);
+            out.push_back(0x00);
+            out.push_back(0xFF);
+            out.push_back(0xFF);
+        }
+
+        bw.Flush();
+    }
+
+    uint32_t UpdateCRC32(uint32_t crc, const uint8_t* data, size_t size)
+    {
+        static const std::vector<uint32_t> table = []
+        {
+            std::vector<uint32_t> t(256);
+            for (uint32_t n = 0; n < 256; n++)
+            {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++)
+                {
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                t[n] = c;
+            }
+            return t;
+        }();
+
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++)
+        {
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    uint32_t Adler32(const uint8_t* data, size_t size)
+    {
+        uint32_t a = 1, b = 0;
+        while (size > 0)
+        {
+            // largest number of bytes before b can overflow
+            size_t n = std::min(size, (size_t)5552);
+            for (size_t i = 0; i < n; i++)
+            {
+                a += data[i];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+            data += n;
+            size -= n;
+        }
+        return (b << 16) | a;
+    }
+
+    void PutBigEndian32(std::vector<uint8_t>& out, uint32_t value)
+    {
+        out.push_back((uint8_t)(value >> 24));
+        out.push_back((uint8_t)(value >> 16));
+        out.push_back((uint8_t)(value >> 8));
+        out.push_back((uint8_t)value);
+    }
+
+    bool WritePNGChunk(FILE* file, const char* type, const std::vector<uint8_t>& data)
+    {
+        std::vector<uint8_t> header;
+        PutBigEndian32(header, (uint32_t)data.size());
+        header.insert(header.end(), type, type + 4);
+
+        uint32_t crc = UpdateCRC32(0, &header[4], 4);
+        crc = UpdateCRC32(crc, data.data(), data.size());
+
+        std::vector<uint8_t> footer;
+        PutBigEndian32(footer, crc);
+
+        return fwrite(header.data(), 1, header.size(), file) == header.size() &&
+            fwrite(data.data(), 1, data.size(), file) == data.size() &&
+            fwrite(footer.data(), 1, footer.size(), file) == footer.size();
+    }
+
+    int Paeth(int a, int b, int c)
+    {
+        int p = a + b - c;
+        int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+        if (pa <= pb && pa <= pc)
+        {
+            return a;
+        }
+        return pb <= pc ? b : c;
+    }
+
+    void RGBAToRGBRow(const uint8_t* rgba, int width, uint8_t* rgb)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            rgb[x * 3 + 0] = rgba[x * 4 + 0];
+            rgb[x * 3 + 1] = rgba[x * 4 + 1];
+            rgb[x * 3 + 2] = rgba[x * 4 + 2];
+        }
+    }
+
+    // Filters an RGB row with each of the 5 PNG filters, and keeps the one with the smallest sum of absolute differences.
+    // prev is NULL for the first row.
+    void FilterPNGRow(const uint8_t* row, const uint8_t* prev, int rowSize, uint8_t* out, uint8_t* scratch)
+    {
+        const int bpp = 3;
+
+        int bestSum = -1;
+        for (int filter = 0; filter < 5; filter++)
+        {
+            int sum = 0;
+            for (int i = 0; i < rowSize; i++)
+            {
+                int a = i >= bpp ? row[i - bpp] : 0;
+                int b = prev ? prev[i] : 0;
+                int c = prev && i >= bpp ? prev[i - bpp] : 0;
+
+                int predicted = 0;
+                switch (filter)
+                {
+                case 1: predicted = a; break;
+                case 2: predicted = b; break;
+                case 3: predicted = (a + b) / 2; break;
+                case 4: predicted = Paeth(a, b, c); break;
+                }
+
+                uint8_t filtered = (uint8_t)(row[i] - predicted);
+                scratch[i] = filtered;
+                sum += filtered < 128 ? filtered : 256 - filtered;
+            }
+
+            if (bestSum == -1 || sum < bestSum)
+            {
+                bestSum = sum;
+                out[0] = (uint8_t)filter;
+                memcpy(out + 1, scratch, rowSize);
+            }
+        }
+    }
+}
+
+bool WritePNG(const char* filename, int width, int height, const uint8_t* rgba, ptrdiff_t rowStride)
+{
+    int rowSize = width * 3;
+    size_t filteredRowSize = (size_t)rowSize + 1;
+
+    int numStrips = (height + kPNGStripRows - 1) / kPNGStripRows;
+    std::vector<uint8_t> filtered(filteredRowSize * height);
+    std::vector<std::vector<uint8_t>> compressedStrips(numStrips);
+
+    ParallelFor(numStrips, 1, [&](int stripBegin, int stripEnd)
+    {
+        std::vector<uint8_t> rgb(rowSize * 2);
+        std::vector<uint8_t> scratch(rowSize);
+
+        for (int strip = stripBegin; strip < stripEnd; strip++)
+        {
+            int rowBegin = strip * kPNGStripRows;
+            int rowEnd = std::min(height, rowBegin + kPNGStripRows);
+
+            uint8_t* cur = &rgb[0];
+            uint8_t* prev = &rgb[rowSize];
+
+            // filters read the row above, even if it belongs to the previous strip
+            if (rowBegin > 0)
+            {
+                RGBAToRGBRow(rgba + (rowBegin - 1) * rowStride, width, prev);
+            }
+
+            for (int row = rowBegin; row < rowEnd; row++)
+            {
+                RGBAToRGBRow(rgba + row * rowStride, width, cur);
+                FilterPNGRow(cur, row > 0 ? prev : NULL, rowSize, &filtered[row * filteredRowSize], scratch.data());
+                std::swap(cur, prev);
+            }
+
+            Deflate(&filtered[rowBegin * filteredRowSize], (int)((rowEnd - rowBegin) * filteredRowSize), strip == numStrips - 1, compressedStrips[strip]);
+        }
+    });
+
+    std::vector<uint8_t> idat;
+    idat.push_back(0x78); // deflate, 32K window
+    idat.push_back(0x01); // no preset dictionary, fastest compression level
+    for (const std::vector<uint8_t>& compressed : compressedStrips)
+    {
+        idat.insert(idat.end(), compressed.begin(), compressed.end());
+    }
+    PutBigEndian32(idat, Adler32(filtered.data(), filtered.size()));
+
+    std::vector<uint8_t> ihdr;
+    PutBigEndian32(ihdr, width);
+    PutBigEndian32(ihdr, height);
+    ihdr.push_back(8); // bit depth
+    ihdr.push_back(2); // RGB
+    ihdr.push_back(0); // deflate
+    ihdr.push_back(0); // adaptive filtering
+    ihdr.push_back(0); // not interlaced
+
+    FILE* file = fopen(filename, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "fopen(%s): failed\n", filename);
+        return false;
+    }
+
+    static const uint8_t kSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    bool ok = fwrite(kSignature, 1, sizeof(kSignature), file) == sizeof(kSignature) &&
+        WritePNGChunk(file, "IHDR", ihdr) &&
+        WritePNGChunk(file, "IDAT", idat) &&
+        WritePNGChunk(file, "IEND", std::vector<uint8_t>());
+
+    ok = fclose(file) == 0 && ok;
+    return ok;
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+
+// A binary PPM (P6) image that is written one rectangle at a time.
+// Each row of a rectangle is placed with a seek, so images much larger than memory
+// (or than any texture) can be streamed to disk tile by tile, in any order.
+struct TiledImageFile
+{
+    FILE* File;
+    int Width;
+    int Height;
+    int64_t HeaderSize;
+};
+
+// Creates the file with its final size. Returns false if it couldn't be created.
+bool OpenTiledPPM(TiledImageFile& image, const char* filename, int width, int height);
+
+// Writes the RGB8 pixels of the rectangle at (x, y) (top-left origin) to the file.
+// rgb points to the top row of the rectangle, and rowStride is the distance between rows in bytes.
+// rowStride can be negative, to write bottom-up data (like glReadPixels) without flipping it first.
+bool WriteTiledPPMRect(TiledImageFile& image, int x, int y, int width, int height, const uint8_t* rgb, ptrdiff_t rowStride);
+
+// Returns false if any write to the file failed.
+bool CloseTiledPPM(TiledImageFile& image);
+
+// Writes an RGB8 PNG of the RGBA8 pixels (alpha is dropped).
+// rgba points to the top row of the image, and rowStride can be negative for bottom-up data.
+// Filtering and compression are done in strips of rows in parallel, and joined into a single deflate stream.
+bool WritePNG(const char* filename, int width, int height, const uint8_t* rgba, ptrdiff_t rowStride);
@@ -24,6 +24,165 @@ static int          g_AttribLocationTex = 0, g_AttribLocationProjMtx = 0;
 static int          g_AttribLocationPosition = 0, g_AttribLocationUV = 0, g_AttribLocationColor = 0;
 static unsigned int g_VboHandle = 0, g_VaoHandle = 0, g_ElementsHandle = 0;
 
+// Persistently mapped ring that all the draw lists of a frame are written into (instead of respecifying the buffers with
+// glBufferData for every draw list), split in regions of one frame each. A fence per region keeps the CPU from writing
+// into a region that the GPU is still reading from. Capacities are per region, in vertices and indices.
+static const int    g_RingRegionCount = 3;
+static bool         g_UsePersistentBuffers = true;
+static unsigned int g_RingVboHandle = 0, g_RingVaoHandle = 0, g_RingElementsHandle = 0;
+static ImDrawVert*  g_RingVtxMapped = NULL;
+static ImDrawIdx*   g_RingIdxMapped = NULL;
+static int          g_RingVtxCapacity = 0, g_RingIdxCapacity = 0;
+static GLsync       g_RingFences[g_RingRegionCount] = {};
+static int          g_RingRegion = 0;
+
+static void ImGui_ImplSdlGL3_SetupVertexAttribs()
+{
+    glEnableVertexAttribArray(g_AttribLocationPosition);
+    glEnableVertexAttribArray(g_AttribLocationUV);
+    glEnableVertexAttribArray(g_AttribLocationColor);
+
+#define OFFSETOF(TYPE, ELEMENT) ((size_t)&(((TYPE *)0)->ELEMENT))
+    glVertexAttribPointer(g_AttribLocationPosition, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (GLvoid*)OFFSETOF(ImDrawVert, pos));
+    glVertexAttribPointer(g_AttribLocationUV, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (GLvoid*)OFFSETOF(ImDrawVert, uv));
+    glVertexAttribPointer(g_AttribLocationColor, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ImDrawVert), (GLvoid*)OFFSETOF(ImDrawVert, col));
+#undef OFFSETOF
+}
+
+static void ImGui_ImplSdlGL3_WaitRingRegion(int region)
+{
+    GLsync& fence = g_RingFences[region];
+    if (!fence)
+        return;
+    // Only blocks when the CPU is more than g_RingRegionCount-1 frames ahead of the GPU
+    GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    while (result == GL_TIMEOUT_EXPIRED)
+        result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+    glDeleteSync(fence);
+    fence = 0;
+}
+
+static void ImGui_ImplSdlGL3_DestroyRing()
+{
+    for (int i = 0; i < g_RingRegionCount; i++)
+        ImGui_ImplSdlGL3_WaitRingRegion(i);
+
+    if (g_RingVaoHandle) glDeleteVertexArrays(1, &g_RingVaoHandle);
+    // Deleting a buffer unmaps it
+    if (g_RingVboHandle) glDeleteBuffers(1, &g_RingVboHandle);
+    if (g_RingElementsHandle) glDeleteBuffers(1, &g_RingElementsHandle);
+    g_RingVaoHandle = g_RingVboHandle = g_RingElementsHandle = 0;
+    g_RingVtxMapped = NULL;
+    g_RingIdxMapped = NULL;
+    g_RingVtxCapacity = g_RingIdxCapacity = 0;
+    g_RingRegion = 0;
+}
+
+// Reallocates the ring with regions of at least vtx_count vertices and idx_count indices.
+// Called with the VAO of the ring unbound, since it binds buffers.
+static bool ImGui_ImplSdlGL3_CreateRing(int vtx_count, int idx_count)
+{
+    ImGui_ImplSdlGL3_DestroyRing();
+
+    // Grow in powers of two, so that a GUI that keeps getting bigger only reallocates a few times
+    int vtx_capacity = 4096, idx_capacity = 8192;
+    while (vtx_capacity < vtx_count) vtx_capacity *= 2;
+    while (idx_capacity < idx_count) idx_capacity *= 2;
+
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLsizeiptr vtx_size = (GLsizeiptr)vtx_capacity * g_RingRegionCount * sizeof(ImDrawVert);
+    GLsizeiptr idx_size = (GLsizeiptr)idx_capacity * g_RingRegionCount * sizeof(ImDrawIdx);
+
+    glGenBuffers(1, &g_RingVboHandle);
+    glBindBuffer(GL_ARRAY_BUFFER, g_RingVboHandle);
+    glBufferStorage(GL_ARRAY_BUFFER, vtx_size, NULL, flags);
+    g_RingVtxMapped = (ImDrawVert*)glMapBufferRange(GL_ARRAY_BUFFER, 0, vtx_size, flags);
+
+    glGenVertexArrays(1, &g_RingVaoHandle);
+    glBindVertexArray(g_RingVaoHandle);
+    ImGui_ImplSdlGL3_SetupVertexAttribs();
+
+    // The element buffer binding is part of the VAO's state
+    glGenBuffers(1, &g_RingElementsHandle);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_RingElementsHandle);
+    glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, idx_size, NULL, flags);
+    g_RingIdxMapped = (ImDrawIdx*)glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, idx_size, flags);
+
+    glBindVertexArray(0);
+
+    if (!g_RingVtxMapped || !g_RingIdxMapped)
+    {
+        ImGui_ImplSdlGL3_DestroyRing();
+        return false;
+    }
+
+    g_RingVtxCapacity = vtx_capacity;
+    g_RingIdxCapacity = idx_capacity;
+    return true;
+}
+
+// Writes all the draw lists into the next region of the ring, and draws them with base vertex offsets.
+// Returns false (drawing nothing) if the ring couldn't be allocated.
+static bool ImGui_ImplSdlGL3_RenderDrawListsFromRing(ImDrawData* draw_data, int fb_height)
+{
+    if (draw_data->TotalVtxCount > g_RingVtxCapacity || draw_data->TotalIdxCount > g_RingIdxCapacity)
+    {
+        glBindVertexArray(0);
+        if (!ImGui_ImplSdlGL3_CreateRing(draw_data->TotalVtxCount, draw_data->TotalIdxCount))
+            return false;
+    }
+
+    ImGui_ImplSdlGL3_WaitRingRegion(g_RingRegion);
+
+    const int region_vtx_base = g_RingRegion * g_RingVtxCapacity;
+    const int region_idx_base = g_RingRegion * g_RingIdxCapacity;
+
+    // The mapping is coherent, so the writes are visible to the draws that follow them without a flush
+    int vtx_offset = 0, idx_offset = 0;
+    for (int n = 0; n < draw_data->CmdListsCount; n++)
+    {
+        const ImDrawList* cmd_list = draw_data->CmdLists[n];
+        memcpy(g_RingVtxMapped + region_vtx_base + vtx_offset, cmd_list->VtxBuffer.Data, cmd_list->VtxBuffer.Size * sizeof(ImDrawVert));
+        memcpy(g_RingIdxMapped + region_idx_base + idx_offset, cmd_list->IdxBuffer.Data, cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx));
+        vtx_offset += cmd_list->VtxBuffer.Size;
+        idx_offset += cmd_list->IdxBuffer.Size;
+    }
+
+    glBindVertexArray(g_RingVaoHandle);
+
+    vtx_offset = 0;
+    idx_offset = 0;
+    for (int n = 0; n < draw_data->CmdListsCount; n++)
+    {
+        const ImDrawList* cmd_list = draw_data->CmdLists[n];
+        // Indices of a draw list are relative to its first vertex
+        const GLint base_vertex = (GLint)(region_vtx_base + vtx_offset);
+        const ImDrawIdx* idx_buffer_offset = (const ImDrawIdx*)(intptr_t)((region_idx_base + idx_offset) * sizeof(ImDrawIdx));
+
+        for (const ImDrawCmd* pcmd = cmd_list->CmdBuffer.begin(); pcmd != cmd_list->CmdBuffer.end(); pcmd++)
+        {
+            if (pcmd->UserCallback)
+            {
+                pcmd->UserCallback(cmd_list, pcmd);
+            }
+            else
+            {
+                glBindTexture(GL_TEXTURE_2D, (GLuint)(intptr_t)pcmd->TextureId);
+                glScissor((int)pcmd->ClipRect.x, (int)(fb_height - pcmd->ClipRect.w), (int)(pcmd->ClipRect.z - pcmd->ClipRect.x), (int)(pcmd->ClipRect.w - pcmd->ClipRect.y));
+                glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)pcmd->ElemCount, sizeof(ImDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, idx_buffer_offset, base_vertex);
+            }
+            idx_buffer_offset += pcmd->ElemCount;
+        }
+
+        vtx_offset += cmd_list->VtxBuffer.Size;
+        idx_offset += cmd_list->IdxBuffer.Size;
+    }
+
+    g_RingFences[g_RingRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    g_RingRegion = (g_RingRegion + 1) % g_RingRegionCount;
+    return true;
+}
+
 // This is the main rendering function that you have to implement and provide to ImGui (via setting up 'RenderDrawListsFn' in the ImGuiIO structure)
 // If text or lines are blurry when integrating ImGui in your engine:
 // - in your Render function, try translating your projection matrix by (0.5f,0.5f) or (0.375f,0.375f)
@@ -44,8 +203,10 @@ void ImGui_ImplSdlGL3_RenderDrawLists(ImDrawData* draw_data)
     GLint last_array_buffer; glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &last_array_buffer);
     GLint last_element_array_buffer; glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &last_element_array_buffer);
     GLint last_vertex_array; glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &last_vertex_array);
-    GLint last_blend_src; glGetIntegerv(GL_BLEND_SRC, &last_blend_src);
-    GLint last_blend_dst; glGetIntegerv(GL_BLEND_DST, &last_blend_dst);
+    GLint last_blend_src_rgb; glGetIntegerv(GL_BLEND_SRC_RGB, &last_blend_src_rgb);
+    GLint last_blend_dst_rgb; glGetIntegerv(GL_BLEND_DST_RGB, &last_blend_dst_rgb);
+    GLint last_blend_src_alpha; glGetIntegerv(GL_BLEND_SRC_ALPHA, &last_blend_src_alpha);
+    GLint last_blend_dst_alpha; glGetIntegerv(GL_BLEND_DST_ALPHA, &last_blend_dst_alpha);
     GLint last_blend_equation_rgb; glGetIntegerv(GL_BLEND_EQUATION_RGB, &last_blend_equation_rgb);
     GLint last_blend_equation_alpha; glGetIntegerv(GL_BLEND_EQUATION_ALPHA, &last_blend_equation_alpha);
     GLint last_viewport[4]; glGetIntegerv(GL_VIEWPORT, last_viewport);
@@ -57,7 +218,8 @@ void ImGui_ImplSdlGL3_RenderDrawLists(ImDrawData* draw_data)
     // Setup render state: alpha-blending enabled, no face culling, no depth testing, scissor enabled
     glEnable(GL_BLEND);
     glBlendEquation(GL_FUNC_ADD);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    // Alpha is accumulated as coverage, so rendering into a transparent target gives a premultiplied alpha layer
+    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
     glDisable(GL_CULL_FACE);
     glDisable(GL_DEPTH_TEST);
     glEnable(GL_SCISSOR_TEST);
@@ -75,9 +237,13 @@ void ImGui_ImplSdlGL3_RenderDrawLists(ImDrawData* draw_data)
     glUseProgram(g_ShaderHandle);
     glUniform1i(g_AttribLocationTex, 0);
     glUniformMatrix4fv(g_AttribLocationProjMtx, 1, GL_FALSE, &ortho_projection[0][0]);
-    glBindVertexArray(g_VaoHandle);
 
-    for (int n = 0; n < draw_data->CmdListsCount; n++)
+    // Falls back to respecifying the buffers of each draw list if the ring is disabled, or can't be allocated
+    bool drawn = g_UsePersistentBuffers && ImGui_ImplSdlGL3_RenderDrawListsFromRing(draw_data, fb_height);
+    if (!drawn)
+        glBindVertexArray(g_VaoHandle);
+
+    for (int n = 0; !drawn && n < draw_data->CmdListsCount; n++)
     {
         const ImDrawList* cmd_list = draw_data->CmdLists[n];
         const ImDrawIdx* idx_buffer_offset = 0;
@@ -112,7 +278,7 @@ void ImGui_ImplSdlGL3_RenderDrawLists(ImDrawData* draw_data)
     glBindBuffer(GL_ARRAY_BUFFER, last_array_buffer);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, last_element_array_buffer);
     glBlendEquationSeparate(last_blend_equation_rgb, last_blend_equation_alpha);
-    glBlendFunc(last_blend_src, last_blend_dst);
+    glBlendFuncSeparate(last_blend_src_rgb, last_blend_dst_rgb, last_blend_src_alpha, last_blend_dst_alpha);
     if (last_enable_blend) glEnable(GL_BLEND); else glDisable(GL_BLEND);
     if (last_enable_cull_face) glEnable(GL_CULL_FACE); else glDisable(GL_CULL_FACE);
     if (last_enable_depth_test) glEnable(GL_DEPTH_TEST); else glDisable(GL_DEPTH_TEST);
@@ -120,6 +286,18 @@ void ImGui_ImplSdlGL3_RenderDrawLists(ImDrawData* draw_data)
     glViewport(last_viewport[0], last_viewport[1], (GLsizei)last_viewport[2], (GLsizei)last_viewport[3]);
 }
 
+void ImGui_ImplSdlGL3_SetUsePersistentBuffers(bool enable)
+{
+    if (!enable)
+        ImGui_ImplSdlGL3_DestroyRing();
+    g_UsePersistentBuffers = enable;
+}
+
+bool ImGui_ImplSdlGL3_GetUsePersistentBuffers()
+{
+    return g_UsePersistentBuffers;
+}
+
 static const char* ImGui_ImplSdlGL3_GetClipboardText()
 {
     return SDL_GetClipboardText();
@@ -252,15 +430,7 @@ bool ImGui_ImplSdlGL3_CreateDeviceObjects()
     glGenVertexArrays(1, &g_VaoHandle);
     glBindVertexArray(g_VaoHandle);
     glBindBuffer(GL_ARRAY_BUFFER, g_VboHandle);
-    glEnableVertexAttribArray(g_AttribLocationPosition);
-    glEnableVertexAttribArray(g_AttribLocationUV);
-    glEnableVertexAttribArray(g_AttribLocationColor);
-
-#define OFFSETOF(TYPE, ELEMENT) ((size_t)&(((TYPE *)0)->ELEMENT))
-    glVertexAttribPointer(g_AttribLocationPosition, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (GLvoid*)OFFSETOF(ImDrawVert, pos));
-    glVertexAttribPointer(g_AttribLocationUV, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (GLvoid*)OFFSETOF(ImDrawVert, uv));
-    glVertexAttribPointer(g_AttribLocationColor, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ImDrawVert), (GLvoid*)OFFSETOF(ImDrawVert, col));
-#undef OFFSETOF
+    ImGui_ImplSdlGL3_SetupVertexAttribs();
 
     ImGui_ImplSdlGL3_CreateFontsTexture();
 
@@ -278,6 +448,7 @@ void    ImGui_ImplSdlGL3_InvalidateDeviceObjects()
     if (g_VboHandle) glDeleteBuffers(1, &g_VboHandle);
     if (g_ElementsHandle) glDeleteBuffers(1, &g_ElementsHandle);
     g_VaoHandle = g_VboHandle = g_ElementsHandle = 0;
+    ImGui_ImplSdlGL3_DestroyRing();
 
     glDetachShader(g_ShaderHandle, g_VertHandle);
     glDeleteShader(g_VertHandle);
@@ -17,3 +17,7 @@ IMGUI_API bool        ImGui_ImplSdlGL3_ProcessEvent(SDL_Event* event);
 // Use if you want to reset your rendering device without losing ImGui state.
 IMGUI_API void        ImGui_ImplSdlGL3_InvalidateDeviceObjects();
 IMGUI_API bool        ImGui_ImplSdlGL3_CreateDeviceObjects();
+
+// Draw lists are written into a persistently mapped ring (the default), or into buffers respecified for each of them.
+IMGUI_API void        ImGui_ImplSdlGL3_SetUsePersistentBuffers(bool enable);
+IMGUI_API bool        ImGui_ImplSdlGL3_GetUsePersistentBuffers();
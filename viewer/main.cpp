@@ -4,6 +4,10 @@
 #include "renderer.h"
 // Simulation - the "Controller"
 #include "simulation.h"
+// Batch rendering of job lists, instead of the interactive viewer
+#include "batch.h"
+// Batch rendering spread over worker processes
+#include "farm.h"
 
 #include "mysdl_dpi.h"
 
@@ -14,6 +18,7 @@
 #include <SDL.h>
 
 #include <cstdio>
+#include <cstring>
 
 void GLAPIENTRY DebugCallbackGL(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *message, const void *userParam)
 {
@@ -23,94 +28,184 @@ void GLAPIENTRY DebugCallbackGL(GLenum source, GLenum type, GLuint id, GLenum se
 extern "C"
 int main(int argc, char* argv[])
 {
-    if (MySDL_SetProcessDpiAware())
+    // viewer --batch jobs.txt
+    // viewer --farm <worker count> jobs.txt
+    // viewer --farm-worker <socket> (started by --farm)
+    // viewer --compare-renderers diff.ppm (renders the initial view with the GL and software renderers)
+    // --software selects the software renderer. With --batch and --farm, it runs without a window or GL.
+    const char* batchJobList = NULL;
+    const char* farmJobList = NULL;
+    int farmWorkerCount = 0;
+    int farmWorkerSocket = -1;
+    bool softwareRenderer = false;
+    const char* compareDiffFilename = NULL;
+    for (int i = 1; i < argc; i++)
     {
-        fprintf(stderr, "MySDL_SetProcessDpiAware: %s\n", SDL_GetError());
+        if (strcmp(argv[i], "--software") == 0)
+        {
+            softwareRenderer = true;
+        }
+        else if (strcmp(argv[i], "--compare-renderers") == 0 && i + 1 < argc)
+        {
+            compareDiffFilename = argv[++i];
+        }
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+        {
+            batchJobList = argv[++i];
+        }
+        else if (strcmp(argv[i], "--farm") == 0 && i + 2 < argc)
+        {
+            farmWorkerCount = atoi(argv[++i]);
+            farmJobList = argv[++i];
+        }
+        else if (strcmp(argv[i], "--farm-worker") == 0 && i + 1 < argc)
+        {
+            farmWorkerSocket = atoi(argv[++i]);
+        }
     }
 
-    if (SDL_Init(SDL_INIT_VIDEO))
+    // the coordinator only hands out work, it doesn't need a window or GL
+    if (farmJobList)
     {
-        fprintf(stderr, "SDL_Init: %s\n", SDL_GetError());
-        exit(1);
+        int failedJobCount = RunFarmCoordinator(farmJobList, farmWorkerCount, softwareRenderer);
+        return failedJobCount == 0 ? 0 : 1;
     }
 
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 4);
-#ifdef _DEBUG
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
-#endif
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
-
-    SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
-    SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
-    SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8);
-    SDL_GL_SetAttribute(SDL_GL_ALPHA_SIZE, 8);
-    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 0);
-
-    SDL_Window* window = SDL_CreateWindow(
-        "viewer",
-        SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-        1280, 720,
-        SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
-    if (!window)
+    // the comparison needs the GL renderer as its reference
+    if (compareDiffFilename)
     {
-        fprintf(stderr, "SDL_CreateWindow: %s\n", SDL_GetError());
-        exit(1);
+        softwareRenderer = false;
     }
 
-    Uint32 windowID = SDL_GetWindowID(window);
+    bool hiddenWindow = batchJobList || farmWorkerSocket != -1 || compareDiffFilename;
 
-    SDL_GLContext glctx = SDL_GL_CreateContext(window);
-    if (!glctx)
+    // headless render nodes have no GPU (nor display), so the software renderer runs without any window
+    bool headless = softwareRenderer && hiddenWindow;
+
+    SDL_Window* window = NULL;
+    if (!headless)
     {
-        fprintf(stderr, "SDL_GL_CreateContext: %s\n", SDL_GetError());
-        exit(1);
-    }
+        if (MySDL_SetProcessDpiAware())
+        {
+            fprintf(stderr, "MySDL_SetProcessDpiAware: %s\n", SDL_GetError());
+        }
 
-    // Load OpenGL procs
-    OpenGL_Init();
+        if (SDL_Init(SDL_INIT_VIDEO))
+        {
+            fprintf(stderr, "SDL_Init: %s\n", SDL_GetError());
+            exit(1);
+        }
 
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 4);
 #ifdef _DEBUG
-    glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
-    glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, 0, GL_FALSE);
-    glDebugMessageCallback(DebugCallbackGL, 0);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
 #endif
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
 
-    // cure the stupidity
-    {
-        GLint major, minor;
-        glGetIntegerv(GL_MAJOR_VERSION, &major);
-        glGetIntegerv(GL_MINOR_VERSION, &minor);
-        if ((major > 4 || (major == 4 && minor >= 5)) ||
-            SDL_GL_ExtensionSupported("GL_ARB_clip_control"))
+        SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
+        SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
+        SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8);
+        SDL_GL_SetAttribute(SDL_GL_ALPHA_SIZE, 8);
+        SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 0);
+
+        window = SDL_CreateWindow(
+            "viewer",
+            SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+            1280, 720,
+            SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | (hiddenWindow ? SDL_WINDOW_HIDDEN : 0));
+        if (!window)
         {
-            glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+            fprintf(stderr, "SDL_CreateWindow: %s\n", SDL_GetError());
+            exit(1);
         }
-        else
+
+        SDL_GLContext glctx = SDL_GL_CreateContext(window);
+        if (!glctx)
         {
-            fprintf(stderr, "glClipControl required, sorry.\n");
+            fprintf(stderr, "SDL_GL_CreateContext: %s\n", SDL_GetError());
             exit(1);
         }
-    }
 
-    ImGui_ImplSdlGL3_Init(window);
+        // Load OpenGL procs
+        OpenGL_Init();
+
+#ifdef _DEBUG
+        glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+        glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, 0, GL_FALSE);
+        glDebugMessageCallback(DebugCallbackGL, 0);
+#endif
+
+        // cure the stupidity
+        {
+            GLint major, minor;
+            glGetIntegerv(GL_MAJOR_VERSION, &major);
+            glGetIntegerv(GL_MINOR_VERSION, &minor);
+            if ((major > 4 || (major == 4 && minor >= 5)) ||
+                SDL_GL_ExtensionSupported("GL_ARB_clip_control"))
+            {
+                glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+            }
+            else
+            {
+                fprintf(stderr, "glClipControl required, sorry.\n");
+                exit(1);
+            }
+        }
+
+        ImGui_ImplSdlGL3_Init(window);
+    }
 
     Scene scene;
     scene.Init();
+    scene.KeepCPUData = softwareRenderer || compareDiffFilename;
+    scene.NoGL = headless;
 
-    IRenderer* renderer = NewRenderer();
+    IRenderer* renderer = softwareRenderer ? NewSoftwareRenderer() : NewRenderer();
     renderer->Init(&scene);
     
     // Initial resize
+    // Without a window, the size the window would have had, since the blur of stills is relative to it.
+    int initialWidth = 1280, initialHeight = 720;
+    if (window)
     {
-        int initialWidth, initialHeight;
         SDL_GL_GetDrawableSize(window, &initialWidth, &initialHeight);
-        renderer->Resize(initialWidth, initialHeight);
+    }
+    renderer->Resize(initialWidth, initialHeight);
+
+    if (compareDiffFilename)
+    {
+        ISimulation* sim = NewSimulation();
+        sim->Init(&scene, renderer);
+
+        // the simulation only fills in the projection when it updates, like the batch jobs do
+        Camera& mainCamera = scene.Cameras[scene.MainCameraID];
+        mainCamera.Aspect = (float)initialWidth / initialHeight;
+        mainCamera.ZNear = kCameraZNear;
+
+        IRenderer* software = NewSoftwareRenderer();
+        software->Init(&scene);
+        software->Resize(initialWidth, initialHeight);
+
+        return CompareRenderers(renderer, software, initialWidth, initialHeight, compareDiffFilename) ? 0 : 1;
+    }
+
+    if (batchJobList)
+    {
+        int failedJobCount = RunBatch(batchJobList, &scene, renderer);
+        return failedJobCount == 0 ? 0 : 1;
+    }
+
+    if (farmWorkerSocket != -1)
+    {
+        return RunFarmWorker(farmWorkerSocket, &scene, renderer);
     }
 
     ISimulation* sim = NewSimulation();
     sim->Init(&scene, renderer);
 
+    Uint32 windowID = SDL_GetWindowID(window);
+
     while (true)
     {
         SDL_Event ev;
@@ -160,6 +255,8 @@ int main(int argc, char* argv[])
         renderer->Paint();
 
         SDL_GL_SwapWindow(window);
+
+        FlushGLDeletions(scene);
     }
 mainloop_end:
 
@@ -0,0 +1,405 @@
+#include "meshlet.h"
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define MESHLET_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+// cones narrower than this (the cosine of their half angle) can't be culled often enough to be worth testing
+static const float kMinConeCosine = 0.1f;
+
+static inline glm::vec3 LoadPosition(const float* positions, size_t positionStride, uint32_t vertex)
+{
+    const float* p = (const float*)((const uint8_t*)positions + positionStride * vertex);
+    return glm::vec3(p[0], p[1], p[2]);
+}
+
+// Computes the bounds of the meshlet of indexCount indices from firstIndex, and appends it.
+static void AddMeshlet(
+    MeshletSet& meshlets,
+    const float* positions,
+    size_t positionStride,
+    const uint32_t* indices,
+    uint32_t firstIndex,
+    uint32_t indexCount)
+{
+    glm::vec3 minBound(INFINITY), maxBound(-INFINITY);
+    glm::vec3 normalSum(0.0f);
+    for (uint32_t i = firstIndex; i < firstIndex + indexCount; i += 3)
+    {
+        glm::vec3 p[3];
+        for (int v = 0; v < 3; v++)
+        {
+            p[v] = LoadPosition(positions, positionStride, indices[i + v]);
+            minBound = glm::min(minBound, p[v]);
+            maxBound = glm::max(maxBound, p[v]);
+        }
+
+        glm::vec3 n = glm::cross(p[1] - p[0], p[2] - p[0]);
+        float len = glm::length(n);
+        if (len > 0.0f)
+        {
+            normalSum += n / len;
+        }
+    }
+
+    glm::vec3 center = (minBound + maxBound) * 0.5f;
+    float maxDistSq = 0.0f;
+    for (uint32_t i = firstIndex; i < firstIndex + indexCount; i++)
+    {
+        glm::vec3 p = LoadPosition(positions, positionStride, indices[i]);
+        maxDistSq = std::max(maxDistSq, glm::dot(p - center, p - center));
+    }
+    // rounded up, so the float error of the tests never culls a vertex that's just inside
+    float radius = sqrtf(maxDistSq) * 1.0001f;
+
+    glm::vec3 axis(0.0f);
+    float cutoff = 1.0f;
+    float normalSumLen = glm::length(normalSum);
+    if (normalSumLen > 0.0f)
+    {
+        axis = normalSum / normalSumLen;
+
+        float minDot = 1.0f;
+        for (uint32_t i = firstIndex; i < firstIndex + indexCount; i += 3)
+        {
+            glm::vec3 p0 = LoadPosition(positions, positionStride, indices[i + 0]);
+            glm::vec3 p1 = LoadPosition(positions, positionStride, indices[i + 1]);
+            glm::vec3 p2 = LoadPosition(positions, positionStride, indices[i + 2]);
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            float len = glm::length(n);
+            if (len > 0.0f)
+            {
+                minDot = std::min(minDot, glm::dot(n / len, axis));
+            }
+        }
+
+        if (minDot > kMinConeCosine)
+        {
+            cutoff = sqrtf(1.0f - minDot * minDot);
+        }
+    }
+
+    meshlets.FirstIndex.push_back(firstIndex);
+    meshlets.IndexCount.push_back(indexCount);
+    meshlets.CenterX.push_back(center.x);
+    meshlets.CenterY.push_back(center.y);
+    meshlets.CenterZ.push_back(center.z);
+    meshlets.Radius.push_back(radius);
+    meshlets.ConeAxisX.push_back(axis.x);
+    meshlets.ConeAxisY.push_back(axis.y);
+    meshlets.ConeAxisZ.push_back(axis.z);
+    meshlets.ConeCutoff.push_back(cutoff);
+    meshlets.MeshletCount++;
+}
+
+void BuildMeshlets(
+    MeshletSet& meshlets,
+    const float* positions,
+    size_t positionStride,
+    uint32_t vertexCount,
+    const uint32_t* indices,
+    const std::vector<GLDrawElementsIndirectCommand>& drawCommands)
+{
+    meshlets.MeshletCount = 0;
+    meshlets.FirstIndex.clear();
+    meshlets.IndexCount.clear();
+    meshlets.DrawCommandFirstMeshlet.clear();
+    meshlets.CenterX.clear();
+    meshlets.CenterY.clear();
+    meshlets.CenterZ.clear();
+    meshlets.Radius.clear();
+    meshlets.ConeAxisX.clear();
+    meshlets.ConeAxisY.clear();
+    meshlets.ConeAxisZ.clear();
+    meshlets.ConeCutoff.clear();
+
+    // the meshlet that last took each vertex, so a vertex is only counted once per meshlet
+    std::vector<uint32_t> vertexMeshlets(vertexCount, -1);
+
+    for (const GLDrawElementsIndirectCommand& drawCmd : drawCommands)
+    {
+        meshlets.DrawCommandFirstMeshlet.push_back(meshlets.MeshletCount);
+
+        uint32_t meshletFirstIndex = drawCmd.firstIndex;
+        uint32_t meshletVertexCount = 0;
+        uint32_t meshletTriangleCount = 0;
+        for (uint32_t i = drawCmd.firstIndex; i < drawCmd.firstIndex + drawCmd.count; i += 3)
+        {
+            // the meshlet being built is the next one
+            uint32_t newVertexCount = 0;
+            for (int v = 0; v < 3; v++)
+            {
+                uint32_t vertex = indices[i + v];
+                bool repeated = (v > 0 && vertex == indices[i]) || (v > 1 && vertex == indices[i + 1]);
+                if (vertexMeshlets[vertex] != meshlets.MeshletCount && !repeated)
+                {
+                    newVertexCount++;
+                }
+            }
+
+            if (meshletTriangleCount == MESHLET_MAX_TRIANGLES || meshletVertexCount + newVertexCount > MESHLET_MAX_VERTICES)
+            {
+                AddMeshlet(meshlets, positions, positionStride, indices, meshletFirstIndex, i - meshletFirstIndex);
+
+                // all of the triangle's vertices are new to the next meshlet
+                meshletFirstIndex = i;
+                meshletVertexCount = 0;
+                meshletTriangleCount = 0;
+                newVertexCount = 0;
+                for (int v = 0; v < 3; v++)
+                {
+                    uint32_t vertex = indices[i + v];
+                    bool repeated = (v > 0 && vertex == indices[i]) || (v > 1 && vertex == indices[i + 1]);
+                    if (!repeated)
+                    {
+                        newVertexCount++;
+                    }
+                }
+            }
+
+            for (int v = 0; v < 3; v++)
+            {
+                vertexMeshlets[indices[i + v]] = meshlets.MeshletCount;
+            }
+            meshletVertexCount += newVertexCount;
+            meshletTriangleCount++;
+        }
+
+        if (meshletTriangleCount > 0)
+        {
+            AddMeshlet(meshlets, positions, positionStride, indices, meshletFirstIndex, drawCmd.firstIndex + drawCmd.count - meshletFirstIndex);
+        }
+    }
+
+    meshlets.DrawCommandFirstMeshlet.push_back(meshlets.MeshletCount);
+
+    // pad for the batches of 4 (the padding is never visible, it's masked out)
+    meshlets.MeshletCapacity = (meshlets.MeshletCount + 3) & ~3;
+    meshlets.CenterX.resize(meshlets.MeshletCapacity, 0.0f);
+    meshlets.CenterY.resize(meshlets.MeshletCapacity, 0.0f);
+    meshlets.CenterZ.resize(meshlets.MeshletCapacity, 0.0f);
+    meshlets.Radius.resize(meshlets.MeshletCapacity, 0.0f);
+    meshlets.ConeAxisX.resize(meshlets.MeshletCapacity, 0.0f);
+    meshlets.ConeAxisY.resize(meshlets.MeshletCapacity, 0.0f);
+    meshlets.ConeAxisZ.resize(meshlets.MeshletCapacity, 0.0f);
+    meshlets.ConeCutoff.resize(meshlets.MeshletCapacity, 1.0f);
+
+    glm::vec3 minBound(INFINITY), maxBound(-INFINITY);
+    for (uint32_t v = 0; v < vertexCount; v++)
+    {
+        glm::vec3 p = LoadPosition(positions, positionStride, v);
+        minBound = glm::min(minBound, p);
+        maxBound = glm::max(maxBound, p);
+    }
+
+    meshlets.MeshCenter = vertexCount > 0 ? (minBound + maxBound) * 0.5f : glm::vec3(0.0f);
+    float maxDistSq = 0.0f;
+    for (uint32_t v = 0; v < vertexCount; v++)
+    {
+        glm::vec3 p = LoadPosition(positions, positionStride, v);
+        maxDistSq = std::max(maxDistSq, glm::dot(p - meshlets.MeshCenter, p - meshlets.MeshCenter));
+    }
+    meshlets.MeshRadius = sqrtf(maxDistSq) * 1.0001f;
+}
+
+// The planes of the frustum, in object space, normalized so they give distances in object space.
+// The far plane is at infinity (reversed-Z), so there's none.
+static const int kFrustumPlaneCount = 5;
+
+struct CullingFrustum
+{
+    glm::vec4 Planes[kFrustumPlaneCount];
+    // object space eye, for the cone test
+    glm::vec3 Eye;
+    bool CullBackfaces;
+};
+
+static void ExtractFrustum(const glm::mat4& MVP, bool cullBackfaces, CullingFrustum& frustum)
+{
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++)
+    {
+        rows[i] = glm::vec4(MVP[0][i], MVP[1][i], MVP[2][i], MVP[3][i]);
+    }
+
+    // -w <= x <= w, -w <= y <= w, z <= w (the near plane has depth 1)
+    frustum.Planes[0] = rows[3] + rows[0];
+    frustum.Planes[1] = rows[3] - rows[0];
+    frustum.Planes[2] = rows[3] + rows[1];
+    frustum.Planes[3] = rows[3] - rows[1];
+    frustum.Planes[4] = rows[3] - rows[2];
+    for (glm::vec4& plane : frustum.Planes)
+    {
+        plane /= glm::length(glm::vec3(plane));
+    }
+
+    // the eye is the only point that projects to w = 0 with x = y = 0
+    glm::vec4 eye = glm::inverse(MVP) * glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+    frustum.CullBackfaces = cullBackfaces && eye.w != 0.0f;
+    frustum.Eye = frustum.CullBackfaces ? glm::vec3(eye) / eye.w : glm::vec3(0.0f);
+}
+
+#ifndef MESHLET_USE_SSE2
+// bit i is set if meshlet first + i is visible
+static uint32_t CullMeshletBatch(const MeshletSet& meshlets, const CullingFrustum& frustum, uint32_t first)
+{
+    uint32_t visibleMask = 0;
+    for (uint32_t lane = 0; lane < 4; lane++)
+    {
+        uint32_t m = first + lane;
+        glm::vec3 center(meshlets.CenterX[m], meshlets.CenterY[m], meshlets.CenterZ[m]);
+        float radius = meshlets.Radius[m];
+
+        bool visible = true;
+        for (const glm::vec4& plane : frustum.Planes)
+        {
+            visible = visible && glm::dot(glm::vec3(plane), center) + plane.w >= -radius;
+        }
+
+        if (frustum.CullBackfaces)
+        {
+            glm::vec3 toCenter = center - frustum.Eye;
+            glm::vec3 axis(meshlets.ConeAxisX[m], meshlets.ConeAxisY[m], meshlets.ConeAxisZ[m]);
+            visible = visible && glm::dot(toCenter, axis) < meshlets.ConeCutoff[m] * glm::length(toCenter) + radius;
+        }
+
+        visibleMask |= visible ? 1 << lane : 0;
+    }
+    return visibleMask;
+}
+#else
+// same as the scalar version, 4 meshlets at once
+static uint32_t CullMeshletBatch(const MeshletSet& meshlets, const CullingFrustum& frustum, uint32_t first)
+{
+    __m128 cx = _mm_loadu_ps(&meshlets.CenterX[first]);
+    __m128 cy = _mm_loadu_ps(&meshlets.CenterY[first]);
+    __m128 cz = _mm_loadu_ps(&meshlets.CenterZ[first]);
+    __m128 r = _mm_loadu_ps(&meshlets.Radius[first]);
+    __m128 negR = _mm_sub_ps(_mm_setzero_ps(), r);
+
+    __m128 visible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (const glm::vec4& plane : frustum.Planes)
+    {
+        __m128 d = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y))),
+            _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+        visible = _mm_and_ps(visible, _mm_cmpge_ps(d, negR));
+    }
+
+    if (frustum.CullBackfaces)
+    {
+        __m128 vx = _mm_sub_ps(cx, _mm_set1_ps(frustum.Eye.x));
+        __m128 vy = _mm_sub_ps(cy, _mm_set1_ps(frustum.Eye.y));
+        __m128 vz = _mm_sub_ps(cz, _mm_set1_ps(frustum.Eye.z));
+        __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz)));
+        __m128 dotAxis = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(vx, _mm_loadu_ps(&meshlets.ConeAxisX[first])),
+            _mm_mul_ps(vy, _mm_loadu_ps(&meshlets.ConeAxisY[first]))),
+            _mm_mul_ps(vz, _mm_loadu_ps(&meshlets.ConeAxisZ[first])));
+        __m128 limit = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&meshlets.ConeCutoff[first]), len), r);
+        visible = _mm_and_ps(visible, _mm_cmplt_ps(dotAxis, limit));
+    }
+
+    return (uint32_t)_mm_movemask_ps(visible);
+}
+#endif
+
+bool CullMeshlets(
+    const MeshletSet& meshlets,
+    const glm::mat4& MVP,
+    bool cullBackfaces,
+    MeshletDrawList& drawList)
+{
+    uint32_t drawCommandCount = (uint32_t)meshlets.DrawCommandFirstMeshlet.size() - 1;
+
+    drawList.DrawCommandFirstRange.assign(drawCommandCount + 1, 0);
+    drawList.Counts.clear();
+    drawList.Offsets.clear();
+    drawList.VisibleMeshletCount = 0;
+
+    CullingFrustum frustum;
+    ExtractFrustum(MVP, cullBackfaces, frustum);
+
+    // whole mesh first: all out, or all in (then only the cones need a look)
+    bool meshInside = true;
+    for (const glm::vec4& plane : frustum.Planes)
+    {
+        float d = glm::dot(glm::vec3(plane), meshlets.MeshCenter) + plane.w;
+        if (d < -meshlets.MeshRadius)
+        {
+            return false;
+        }
+        meshInside = meshInside && d >= meshlets.MeshRadius;
+    }
+
+    if (meshInside && !frustum.CullBackfaces)
+    {
+        for (uint32_t dc = 0; dc < drawCommandCount; dc++)
+        {
+            drawList.DrawCommandFirstRange[dc] = (uint32_t)drawList.Counts.size();
+
+            uint32_t first = meshlets.DrawCommandFirstMeshlet[dc];
+            uint32_t end = meshlets.DrawCommandFirstMeshlet[dc + 1];
+            if (first != end)
+            {
+                uint32_t firstIndex = meshlets.FirstIndex[first];
+                drawList.Counts.push_back((GLsizei)(meshlets.FirstIndex[end - 1] + meshlets.IndexCount[end - 1] - firstIndex));
+                drawList.Offsets.push_back((const void*)(sizeof(uint32_t) * firstIndex));
+            }
+        }
+        drawList.DrawCommandFirstRange[drawCommandCount] = (uint32_t)drawList.Counts.size();
+        drawList.VisibleMeshletCount = meshlets.MeshletCount;
+        return true;
+    }
+
+    uint32_t dc = 0;
+    bool extendRange = false;
+    for (uint32_t first = 0; first < meshlets.MeshletCount; first += 4)
+    {
+        uint32_t visibleMask = CullMeshletBatch(meshlets, frustum, first);
+
+        uint32_t laneCount = std::min(4u, meshlets.MeshletCount - first);
+        for (uint32_t lane = 0; lane < laneCount; lane++)
+        {
+            uint32_t m = first + lane;
+
+            // ranges don't cross draw commands
+            while (m >= meshlets.DrawCommandFirstMeshlet[dc + 1])
+            {
+                dc++;
+                drawList.DrawCommandFirstRange[dc] = (uint32_t)drawList.Counts.size();
+                extendRange = false;
+            }
+
+            if (!(visibleMask & (1 << lane)))
+            {
+                extendRange = false;
+                continue;
+            }
+
+            if (extendRange)
+            {
+                drawList.Counts.back() += (GLsizei)meshlets.IndexCount[m];
+            }
+            else
+            {
+                drawList.Counts.push_back((GLsizei)meshlets.IndexCount[m]);
+                drawList.Offsets.push_back((const void*)(sizeof(uint32_t) * meshlets.FirstIndex[m]));
+                extendRange = true;
+            }
+            drawList.VisibleMeshletCount++;
+        }
+    }
+
+    while (dc < drawCommandCount)
+    {
+        dc++;
+        drawList.DrawCommandFirstRange[dc] = (uint32_t)drawList.Counts.size();
+    }
+
+    return drawList.VisibleMeshletCount > 0;
+}
\ No newline at end of file
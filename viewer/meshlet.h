@@ -0,0 +1,70 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+// At most this many vertices and triangles per meshlet
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+// A mesh split into meshlets: small clusters of consecutive triangles, each with the bounds to cull it on its own.
+// * Meshlets never cross draw commands (materials), and cover their triangles in order, so the index buffer is
+//   unchanged and a run of visible meshlets is a single range of it.
+// * The bounds are stored structure-of-arrays, in object space, so that 4 meshlets are culled at once with SIMD.
+struct MeshletSet
+{
+    uint32_t MeshletCount;
+    // number of meshlets the bounds arrays are laid out for (multiple of 4)
+    uint32_t MeshletCapacity;
+
+    // per meshlet
+    std::vector<uint32_t> FirstIndex;
+    std::vector<uint32_t> IndexCount;
+    // per draw command of the mesh, its first meshlet (one more than the draw commands, for the end of the last one)
+    std::vector<uint32_t> DrawCommandFirstMeshlet;
+
+    // Bounding sphere
+    std::vector<float> CenterX, CenterY, CenterZ, Radius;
+    // Normal cone: the triangles face away from the axis by at most the angle whose sine is the cutoff.
+    // A cutoff of 1 means that the triangles face too many ways for the meshlet to be backface culled.
+    std::vector<float> ConeAxisX, ConeAxisY, ConeAxisZ, ConeCutoff;
+
+    // bounding sphere of the whole mesh
+    glm::vec3 MeshCenter;
+    float MeshRadius;
+};
+
+// Splits the triangles of each draw command (all of the mesh's) into meshlets, in order.
+// Positions are 3 floats, positionStride bytes apart.
+void BuildMeshlets(
+    MeshletSet& meshlets,
+    const float* positions,
+    size_t positionStride,
+    uint32_t vertexCount,
+    const uint32_t* indices,
+    const std::vector<GLDrawElementsIndirectCommand>& drawCommands);
+
+// The visible parts of a mesh, as the parameters of one glMultiDrawElements per draw command.
+struct MeshletDrawList
+{
+    // per draw command, its first range (one more than the draw commands, for the end of the last one)
+    std::vector<uint32_t> DrawCommandFirstRange;
+    // consecutive visible meshlets are merged into one range
+    std::vector<GLsizei> Counts;
+    std::vector<const void*> Offsets;
+
+    uint32_t VisibleMeshletCount;
+};
+
+// Culls the meshlets of one instance against the frustum of MVP (its object to clip space) and, if cullBackfaces,
+// the ones whose triangles all face away from the eye (with GL_CULL_FACE's default of culling clockwise back faces).
+// MVP has to be a perspective projection (its eye is found from it). Returns false if nothing is visible.
+bool CullMeshlets(
+    const MeshletSet& meshlets,
+    const glm::mat4& MVP,
+    bool cullBackfaces,
+    MeshletDrawList& drawList);
\ No newline at end of file
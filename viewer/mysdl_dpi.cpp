@@ -52,10 +52,9 @@ void MySDL_GetDisplayDPI(int displayIndex, float* hdpi, float* vdpi, float* defa
     static const float kSysDefaultDpi =
 #ifdef __APPLE__
         72.0f;
-#elif defined(_WIN32)
-        96.0f;
 #else
-        static_assert(false, "No system default DPI set for this platform");
+        // Windows, and X11/Wayland's conventional default
+        96.0f;
 #endif
 
     if (SDL_GetDisplayDPI(displayIndex, NULL, hdpi, vdpi))
@@ -0,0 +1,493 @@
+#include "occlusion.h"
+
+#include "thread_pool.h"
+#include "clip_polygon.h"
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define OCCLUSION_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+// Screen tiles, each rasterized by one thread. Multiples of the block size (and the width of 4 pixels).
+static const int kTileWidth = 64;
+static const int kTileHeight = 32;
+static const int kBlockSize = 8;
+
+// Triangles are clipped to this many times the view's extent, so their screen coordinates stay small enough for floats
+static const float kGuardBand = 4.0f;
+
+// triangles smaller than this fraction of the largest face of the mesh's bounds hide too little to be worth drawing
+static const float kMinOccluderTriangleArea = 1.0f / 1024.0f;
+
+void BuildOccluder(
+    OccluderMesh& occluder,
+    const float* positions,
+    size_t positionStride,
+    uint32_t vertexCount,
+    const uint32_t* indices,
+    uint32_t indexCount)
+{
+    auto loadPosition = [&](uint32_t vertex)
+    {
+        const float* p = (const float*)((const uint8_t*)positions + positionStride * vertex);
+        return glm::vec3(p[0], p[1], p[2]);
+    };
+
+    occluder.BoundsMin = glm::vec3(INFINITY);
+    occluder.BoundsMax = glm::vec3(-INFINITY);
+    for (uint32_t i = 0; i < indexCount; i++)
+    {
+        glm::vec3 p = loadPosition(indices[i]);
+        occluder.BoundsMin = glm::min(occluder.BoundsMin, p);
+        occluder.BoundsMax = glm::max(occluder.BoundsMax, p);
+    }
+    occluder.Positions.clear();
+    occluder.Indices.clear();
+    if (indexCount < 3)
+    {
+        occluder.BoundsMin = occluder.BoundsMax = glm::vec3(0.0f);
+        return;
+    }
+
+    glm::vec3 extent = occluder.BoundsMax - occluder.BoundsMin;
+    float minArea = std::max(extent.x * extent.y, std::max(extent.y * extent.z, extent.z * extent.x)) * kMinOccluderTriangleArea;
+
+    struct TriangleArea
+    {
+        float Area;
+        uint32_t FirstIndex;
+    };
+    std::vector<TriangleArea> candidates;
+    for (uint32_t i = 0; i + 2 < indexCount; i += 3)
+    {
+        glm::vec3 p0 = loadPosition(indices[i + 0]);
+        glm::vec3 p1 = loadPosition(indices[i + 1]);
+        glm::vec3 p2 = loadPosition(indices[i + 2]);
+        float area = glm::length(glm::cross(p1 - p0, p2 - p0)) * 0.5f;
+        if (area >= minArea && area > 0.0f)
+        {
+            candidates.push_back(TriangleArea{ area, i });
+        }
+    }
+
+    size_t keptCount = std::min(candidates.size(), (size_t)OCCLUDER_MAX_TRIANGLES);
+    std::partial_sort(candidates.begin(), candidates.begin() + keptCount, candidates.end(),
+        [](const TriangleArea& a, const TriangleArea& b) { return a.Area > b.Area; });
+
+    // the kept triangles' vertices, renumbered
+    std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+    for (size_t t = 0; t < keptCount; t++)
+    {
+        for (int v = 0; v < 3; v++)
+        {
+            uint32_t vertex = indices[candidates[t].FirstIndex + v];
+            if (remap[vertex] == UINT32_MAX)
+            {
+                remap[vertex] = (uint32_t)occluder.Positions.size();
+                occluder.Positions.push_back(loadPosition(vertex));
+            }
+            occluder.Indices.push_back(remap[vertex]);
+        }
+    }
+}
+
+void OcclusionBuffer::Resize(int width, int height)
+{
+    mWidth = width;
+    mHeight = height;
+    mTilesX = (width + kTileWidth - 1) / kTileWidth;
+    mTilesY = (height + kTileHeight - 1) / kTileHeight;
+    mStride = mTilesX * kTileWidth;
+    mBlocksX = mStride / kBlockSize;
+
+    mDepth.assign(mStride * mTilesY * kTileHeight, 0.0f);
+    mBlockDepth.assign(mBlocksX * (mTilesY * kTileHeight / kBlockSize), 0.0f);
+    mBins.resize(mTilesX * mTilesY);
+}
+
+void OcclusionBuffer::Begin(const glm::mat4& VP)
+{
+    mVP = VP;
+    mOccluders.clear();
+}
+
+void OcclusionBuffer::AddOccluder(const OccluderMesh& occluder, const glm::mat4& MW)
+{
+    if (occluder.Indices.empty())
+    {
+        return;
+    }
+
+    QueuedOccluder queued;
+    queued.Mesh = &occluder;
+    queued.MVP = mVP * MW;
+    mOccluders.push_back(queued);
+}
+
+void OcclusionBuffer::SetupOccluder(const QueuedOccluder& occluder, std::vector<Triangle>& triangles) const
+{
+    triangles.clear();
+
+    const OccluderMesh* mesh = occluder.Mesh;
+    std::vector<glm::vec4> clip(mesh->Positions.size());
+    for (size_t v = 0; v < mesh->Positions.size(); v++)
+    {
+        clip[v] = occluder.MVP * glm::vec4(mesh->Positions[v], 1.0f);
+    }
+
+    // the near plane (z <= w, for reversed-Z), and the guard band
+    const glm::vec4 planes[5] = {
+        glm::vec4(0.0f, 0.0f, -1.0f, 1.0f),
+        glm::vec4(1.0f, 0.0f, 0.0f, kGuardBand),
+        glm::vec4(-1.0f, 0.0f, 0.0f, kGuardBand),
+        glm::vec4(0.0f, 1.0f, 0.0f, kGuardBand),
+        glm::vec4(0.0f, -1.0f, 0.0f, kGuardBand)
+    };
+
+    for (size_t i = 0; i + 2 < mesh->Indices.size(); i += 3)
+    {
+        glm::vec4 polygon[2][8];
+        int count = 3;
+        for (int v = 0; v < 3; v++)
+        {
+            polygon[0][v] = clip[mesh->Indices[i + v]];
+        }
+
+        // outside of the view entirely
+        const glm::vec4& c0 = polygon[0][0];
+        const glm::vec4& c1 = polygon[0][1];
+        const glm::vec4& c2 = polygon[0][2];
+        if ((c0.x > c0.w && c1.x > c1.w && c2.x > c2.w) ||
+            (c0.x < -c0.w && c1.x < -c1.w && c2.x < -c2.w) ||
+            (c0.y > c0.w && c1.y > c1.w && c2.y > c2.w) ||
+            (c0.y < -c0.w && c1.y < -c1.w && c2.y < -c2.w) ||
+            (c0.z > c0.w && c1.z > c1.w && c2.z > c2.w))
+        {
+            continue;
+        }
+
+        int current = 0;
+        for (const glm::vec4& plane : planes)
+        {
+            bool allInside = true;
+            for (int v = 0; v < count; v++)
+            {
+                allInside = allInside && dot(plane, polygon[current][v]) >= 0.0f;
+            }
+            if (allInside)
+            {
+                continue;
+            }
+
+            count = ClipPolygon(polygon[current], count, plane, polygon[1 - current]);
+            current = 1 - current;
+            if (count < 3)
+            {
+                break;
+            }
+        }
+
+        glm::vec3 screen[8];
+        for (int v = 0; v < count; v++)
+        {
+            const glm::vec4& c = polygon[current][v];
+            float invW = 1.0f / c.w;
+            screen[v] = glm::vec3(
+                (c.x * invW * 0.5f + 0.5f) * mWidth,
+                (c.y * invW * 0.5f + 0.5f) * mHeight,
+                c.z * invW);
+        }
+
+        // the clipped polygon is convex, as a fan
+        for (int v = 1; v + 1 < count; v++)
+        {
+            glm::vec3 p[3] = { screen[0], screen[v], screen[v + 1] };
+
+            // Only front faces (counter-clockwise on screen) occlude: with backface culling on, the back faces aren't drawn.
+            // Like GL's culling, this goes by the winding on screen, so it also holds for mirrored instances,
+            // whose front faces in object space are the ones that end up clockwise (and are culled by GL).
+            double area2 = ((double)p[1].x - p[0].x) * ((double)p[2].y - p[0].y) - ((double)p[1].y - p[0].y) * ((double)p[2].x - p[0].x);
+            if (area2 <= 0.0)
+            {
+                continue;
+            }
+
+            Triangle tri;
+            float minX = std::min(p[0].x, std::min(p[1].x, p[2].x));
+            float maxX = std::max(p[0].x, std::max(p[1].x, p[2].x));
+            float minY = std::min(p[0].y, std::min(p[1].y, p[2].y));
+            float maxY = std::max(p[0].y, std::max(p[1].y, p[2].y));
+            // pixels whose centers are in the bounds
+            tri.MinX = std::max(0, (int)ceilf(minX - 0.5f));
+            tri.MinY = std::max(0, (int)ceilf(minY - 0.5f));
+            tri.MaxX = std::min(mWidth - 1, (int)floorf(maxX - 0.5f));
+            tri.MaxY = std::min(mHeight - 1, (int)floorf(maxY - 0.5f));
+            if (tri.MinX > tri.MaxX || tri.MinY > tri.MaxY)
+            {
+                continue;
+            }
+
+            // relative to the center of the first pixel, in double so that large triangles keep their precision
+            double originX = tri.MinX + 0.5, originY = tri.MinY + 0.5;
+            double zA = 0.0, zB = 0.0, zC = 0.0;
+            for (int e = 0; e < 3; e++)
+            {
+                int a = (e + 1) % 3, b = (e + 2) % 3;
+                double ax = p[a].x - originX, ay = p[a].y - originY;
+                double bx = p[b].x - originX, by = p[b].y - originY;
+                double edgeA = ay - by;
+                double edgeB = bx - ax;
+                double edgeC = ax * by - bx * ay;
+                tri.A[e] = (float)edgeA;
+                tri.B[e] = (float)edgeB;
+                tri.C[e] = (float)edgeC;
+
+                // edge e is opposite vertex e, so E_e / area2 is its barycentric
+                zA += edgeA * p[e].z;
+                zB += edgeB * p[e].z;
+                zC += edgeC * p[e].z;
+            }
+            tri.ZA = (float)(zA / area2);
+            tri.ZB = (float)(zB / area2);
+            tri.ZC = (float)(zC / area2);
+            tri.ZMax = std::max(p[0].z, std::max(p[1].z, p[2].z));
+
+            triangles.push_back(tri);
+        }
+    }
+}
+
+void OcclusionBuffer::Rasterize()
+{
+    if (mOccluderTriangles.size() < mOccluders.size())
+    {
+        mOccluderTriangles.resize(mOccluders.size());
+    }
+
+    ParallelFor((int)mOccluders.size(), 1, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            SetupOccluder(mOccluders[i], mOccluderTriangles[i]);
+        }
+    });
+
+    mTriangles.clear();
+    for (size_t i = 0; i < mOccluders.size(); i++)
+    {
+        mTriangles.insert(mTriangles.end(), mOccluderTriangles[i].begin(), mOccluderTriangles[i].end());
+    }
+
+    for (std::vector<uint32_t>& bin : mBins)
+    {
+        bin.clear();
+    }
+    for (uint32_t t = 0; t < (uint32_t)mTriangles.size(); t++)
+    {
+        const Triangle& tri = mTriangles[t];
+        for (int tileY = tri.MinY / kTileHeight; tileY <= tri.MaxY / kTileHeight; tileY++)
+        {
+            for (int tileX = tri.MinX / kTileWidth; tileX <= tri.MaxX / kTileWidth; tileX++)
+            {
+                mBins[tileY * mTilesX + tileX].push_back(t);
+            }
+        }
+    }
+
+    ParallelFor(mTilesX * mTilesY, 1, [&](int begin, int end)
+    {
+        for (int tile = begin; tile < end; tile++)
+        {
+            RasterizeTile(tile % mTilesX, tile / mTilesX);
+        }
+    });
+}
+
+#ifdef OCCLUSION_USE_SSE2
+void OcclusionBuffer::RasterizeTriangle(const Triangle& tri, int x0, int y0, int x1, int y1, float* depth, int stride)
+{
+    __m128 laneX = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    __m128 startX = _mm_add_ps(_mm_set1_ps((float)(x0 - tri.MinX)), laneX);
+
+    __m128 a[3], step[3];
+    for (int e = 0; e < 3; e++)
+    {
+        a[e] = _mm_set1_ps(tri.A[e]);
+        step[e] = _mm_set1_ps(tri.A[e] * 4.0f);
+    }
+    __m128 zA = _mm_set1_ps(tri.ZA);
+    __m128 zStep = _mm_set1_ps(tri.ZA * 4.0f);
+    __m128 zMax = _mm_set1_ps(tri.ZMax);
+    __m128 zero = _mm_setzero_ps();
+
+    for (int y = y0; y < y1; y++)
+    {
+        float dy = (float)(y - tri.MinY);
+
+        __m128 edge[3];
+        for (int e = 0; e < 3; e++)
+        {
+            edge[e] = _mm_add_ps(_mm_mul_ps(a[e], startX), _mm_set1_ps(tri.B[e] * dy + tri.C[e]));
+        }
+        __m128 z = _mm_add_ps(_mm_mul_ps(zA, startX), _mm_set1_ps(tri.ZB * dy + tri.ZC));
+
+        float* row = depth + y * stride;
+        for (int x = x0; x < x1; x += 4)
+        {
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edge[0], zero), _mm_cmpge_ps(edge[1], zero)), _mm_cmpge_ps(edge[2], zero));
+            // the pixels outside get a depth of 0 (all bits clear), which never wins against the buffer's
+            __m128 covered = _mm_and_ps(inside, _mm_min_ps(z, zMax));
+            _mm_storeu_ps(row + x, _mm_max_ps(_mm_loadu_ps(row + x), covered));
+
+            for (int e = 0; e < 3; e++)
+            {
+                edge[e] = _mm_add_ps(edge[e], step[e]);
+            }
+            z = _mm_add_ps(z, zStep);
+        }
+    }
+}
+#endif
+
+#ifndef OCCLUSION_USE_SSE2
+void OcclusionBuffer::RasterizeTriangle(const Triangle& tri, int x0, int y0, int x1, int y1, float* depth, int stride)
+{
+    for (int y = y0; y < y1; y++)
+    {
+        float dy = (float)(y - tri.MinY);
+        float* row = depth + y * stride;
+        for (int x = x0; x < x1; x++)
+        {
+            float dx = (float)(x - tri.MinX);
+            bool inside = true;
+            for (int e = 0; e < 3; e++)
+            {
+                inside = inside && tri.A[e] * dx + tri.B[e] * dy + tri.C[e] >= 0.0f;
+            }
+            if (inside)
+            {
+                float z = std::min(tri.ZA * dx + tri.ZB * dy + tri.ZC, tri.ZMax);
+                row[x] = std::max(row[x], z);
+            }
+        }
+    }
+}
+#endif
+
+void OcclusionBuffer::RasterizeTile(int tileX, int tileY)
+{
+    int tileX0 = tileX * kTileWidth, tileY0 = tileY * kTileHeight;
+    int tileX1 = tileX0 + kTileWidth, tileY1 = tileY0 + kTileHeight;
+
+    for (int y = tileY0; y < tileY1; y++)
+    {
+        std::fill(mDepth.begin() + y * mStride + tileX0, mDepth.begin() + y * mStride + tileX1, 0.0f);
+    }
+
+    for (uint32_t t : mBins[tileY * mTilesX + tileX])
+    {
+        const Triangle& tri = mTriangles[t];
+        // whole groups of 4 pixels, the tile's width is a multiple of 4
+        int x0 = std::max(tri.MinX, tileX0) & ~3;
+        int x1 = (std::min(tri.MaxX + 1, tileX1) + 3) & ~3;
+        int y0 = std::max(tri.MinY, tileY0);
+        int y1 = std::min(tri.MaxY + 1, tileY1);
+        RasterizeTriangle(tri, x0, y0, x1, y1, mDepth.data(), mStride);
+    }
+
+    for (int blockY = tileY0 / kBlockSize; blockY < tileY1 / kBlockSize; blockY++)
+    {
+        for (int blockX = tileX0 / kBlockSize; blockX < tileX1 / kBlockSize; blockX++)
+        {
+            float farthest = INFINITY;
+            for (int y = blockY * kBlockSize; y < (blockY + 1) * kBlockSize; y++)
+            {
+                const float* row = &mDepth[y * mStride + blockX * kBlockSize];
+                for (int x = 0; x < kBlockSize; x++)
+                {
+                    farthest = std::min(farthest, row[x]);
+                }
+            }
+            mBlockDepth[blockY * mBlocksX + blockX] = farthest;
+        }
+    }
+}
+
+bool OcclusionBuffer::IsOccluded(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& MW) const
+{
+    if (mWidth == 0)
+    {
+        return false;
+    }
+
+    glm::mat4 MVP = mVP * MW;
+
+    float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+    // the nearest depth of the box
+    float maxZ = 0.0f;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        glm::vec3 p(
+            (corner & 1) ? boundsMax.x : boundsMin.x,
+            (corner & 2) ? boundsMax.y : boundsMin.y,
+            (corner & 4) ? boundsMax.z : boundsMin.z);
+        glm::vec4 c = MVP * glm::vec4(p, 1.0f);
+
+        // in front of the near plane (or behind the eye)
+        if (c.z >= c.w)
+        {
+            return false;
+        }
+
+        float invW = 1.0f / c.w;
+        float x = (c.x * invW * 0.5f + 0.5f) * mWidth;
+        float y = (c.y * invW * 0.5f + 0.5f) * mHeight;
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        maxZ = std::max(maxZ, c.z * invW);
+    }
+
+    if (maxX < 0.0f || maxY < 0.0f || minX > (float)mWidth || minY > (float)mHeight)
+    {
+        return false;
+    }
+
+    // The pixels around the box too: the box can be seen anywhere between them, not just at their centers
+    int x0 = std::max(0, (int)floorf(minX - 0.5f));
+    int y0 = std::max(0, (int)floorf(minY - 0.5f));
+    int x1 = std::min(mWidth - 1, (int)ceilf(maxX - 0.5f));
+    int y1 = std::min(mHeight - 1, (int)ceilf(maxY - 0.5f));
+
+    for (int blockY = y0 / kBlockSize; blockY <= y1 / kBlockSize; blockY++)
+    {
+        for (int blockX = x0 / kBlockSize; blockX <= x1 / kBlockSize; blockX++)
+        {
+            // all of the block is nearer than the box
+            if (maxZ < mBlockDepth[blockY * mBlocksX + blockX])
+            {
+                continue;
+            }
+
+            int bx0 = std::max(x0, blockX * kBlockSize), bx1 = std::min(x1, blockX * kBlockSize + kBlockSize - 1);
+            int by0 = std::max(y0, blockY * kBlockSize), by1 = std::min(y1, blockY * kBlockSize + kBlockSize - 1);
+            for (int y = by0; y <= by1; y++)
+            {
+                const float* row = &mDepth[y * mStride];
+                for (int x = bx0; x <= bx1; x++)
+                {
+                    if (maxZ >= row[x])
+                    {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+// At most this many of a mesh's triangles are kept in its occluder
+#define OCCLUDER_MAX_TRIANGLES 256
+
+// A mesh's stand-in for occlusion culling, made when it's loaded.
+struct OccluderMesh
+{
+    // Bounding box of the whole mesh, in object space. Instances are tested against the occluders with it.
+    glm::vec3 BoundsMin;
+    glm::vec3 BoundsMax;
+
+    // The mesh's largest triangles. They're a subset of its surface, so they never hide anything that the mesh doesn't.
+    // Empty if the mesh has no triangles big enough to be worth drawing as an occluder.
+    std::vector<glm::vec3> Positions;
+    std::vector<uint32_t> Indices;
+};
+
+// Builds the occluder of a mesh. Positions are 3 floats, positionStride bytes apart.
+void BuildOccluder(
+    OccluderMesh& occluder,
+    const float* positions,
+    size_t positionStride,
+    uint32_t vertexCount,
+    const uint32_t* indices,
+    uint32_t indexCount);
+
+// Software occlusion culling: occluders are rasterized on the CPU into a small depth buffer, and boxes that are behind
+// it everywhere they cover are hidden.
+// * Depth is reversed-Z like the renderer's: 1 at the near plane, 0 (what it's cleared to) at infinity.
+// * Only the occluders' front faces are rasterized, so that they never hide anything when backface culling is on.
+// * The buffer is split into tiles that are rasterized in parallel, 4 pixels at a time with SSE2.
+// * Each 8x8 block of pixels also keeps its farthest depth, so most of a box is tested a block at a time.
+// * Pixels are point sampled: a gap between occluders that no pixel center of this buffer falls in isn't seen.
+class OcclusionBuffer
+{
+public:
+    void Resize(int width, int height);
+
+    int GetWidth() const { return mWidth; }
+    int GetHeight() const { return mHeight; }
+
+    // Drops the occluders of the last frame, for a frame seen through VP
+    void Begin(const glm::mat4& VP);
+
+    // Queues the occluder of an instance placed by MW
+    void AddOccluder(const OccluderMesh& occluder, const glm::mat4& MW);
+
+    // Rasterizes the queued occluders, and updates the blocks' depths
+    void Rasterize();
+
+    // Whether the object space box, placed by MW, is behind the occluders wherever it's on screen.
+    // Boxes that cross the near plane, or that are outside the view, are never occluded (frustum culling is left to the caller).
+    bool IsOccluded(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& MW) const;
+
+    // of the last Rasterize
+    int GetOccluderCount() const { return (int)mOccluders.size(); }
+    int GetTriangleCount() const { return (int)mTriangles.size(); }
+
+    // depth of a pixel, bottom-up
+    float GetDepth(int x, int y) const { return mDepth[y * mStride + x]; }
+
+private:
+    struct Triangle
+    {
+        // covers pixels in [MinX, MaxX] x [MinY, MaxY]
+        int MinX, MinY, MaxX, MaxY;
+        // Edge functions, non-negative inside: E(x, y) = A * (x - MinX) + B * (y - MinY) + C, at the center of pixel (x, y)
+        float A[3], B[3], C[3];
+        // depth plane, likewise relative to (MinX, MinY), and the nearest depth of the vertices (the plane's float error can't go past it)
+        float ZA, ZB, ZC;
+        float ZMax;
+    };
+
+    struct QueuedOccluder
+    {
+        const OccluderMesh* Mesh;
+        glm::mat4 MVP;
+    };
+
+    // the viewport, and the buffer rows' length (a multiple of the tile width)
+    int mWidth = 0;
+    int mHeight = 0;
+    int mStride = 0;
+    int mTilesX = 0;
+    int mTilesY = 0;
+    int mBlocksX = 0;
+
+    glm::mat4 mVP;
+
+    std::vector<QueuedOccluder> mOccluders;
+    // per occluder, its set up triangles (reused between frames)
+    std::vector<std::vector<Triangle>> mOccluderTriangles;
+    std::vector<Triangle> mTriangles;
+    // per tile, the triangles that overlap it
+    std::vector<std::vector<uint32_t>> mBins;
+
+    std::vector<float> mDepth;
+    // per 8x8 block, the farthest (smallest) depth of its pixels
+    std::vector<float> mBlockDepth;
+
+    void SetupOccluder(const QueuedOccluder& occluder, std::vector<Triangle>& triangles) const;
+    void RasterizeTile(int tileX, int tileY);
+    // rasterizes the part of the triangle in the pixels [x0, x1) x [y0, y1), with x0 and x1 multiples of 4
+    static void RasterizeTriangle(const Triangle& tri, int x0, int y0, int x1, int y1, float* depth, int stride);
+};
\ No newline at end of file
@@ -1,35 +1,85 @@
 #ifndef PREAMBLE_GLSL
 #define PREAMBLE_GLSL
 
+// Multi-view
+// Views rendered together into the layers of array textures, one geometry shader invocation per view
+// (GL_MAX_GEOMETRY_SHADER_INVOCATIONS is at least 32).
+#define MULTIVIEW_MAX_VIEWS 32
+
 // Blit
 #define BLIT_TEXCOORD_VARYING_LOCATION 0
 
+// blit_layered.geom, past the locations of the fragment shaders it's paired with
+#define BLIT_LAYER_COUNT_UNIFORM_LOCATION 15
+
 // Scene
 #define SCENE_POSITION_ATTRIB_LOCATION 0
 #define SCENE_TEXCOORD_ATTRIB_LOCATION 1
 #define SCENE_NORMAL_ATTRIB_LOCATION 2
 
+#define SCENE_WORLD_POSITION_VARYING_LOCATION 0
+#define SCENE_TEXCOORD_VARYING_LOCATION 1
+#define SCENE_WORLD_NORMAL_VARYING_LOCATION 2
+
 #define SCENE_MW_UNIFORM_LOCATION 0
 #define SCENE_N_MW_UNIFORM_LOCATION 1
 #define SCENE_MVP_UNIFORM_LOCATION 2
-#define SCENE_CAMERAPOS_UNIFORM_LOCATION 3
 #define SCENE_AMBIENT_UNIFORM_LOCATION 4
 #define SCENE_DIFFUSE_UNIFORM_LOCATION 5
 #define SCENE_SPECULAR_UNIFORM_LOCATION 6
 #define SCENE_SHININESS_UNIFORM_LOCATION 7
 #define SCENE_HAS_DIFFUSE_MAP_UNIFORM_LOCATION 8
+#define SCENE_VIEW_COUNT_UNIFORM_LOCATION 9
+// clustered lights, 0 lights without them (the layered pass)
+#define SCENE_LIGHT_COUNT_UNIFORM_LOCATION 10
+#define SCENE_LIGHT_CLUSTER_COUNT_UNIFORM_LOCATION 11
+#define SCENE_LIGHT_SLICE_SCALE_UNIFORM_LOCATION 12
+#define SCENE_ZNEAR_UNIFORM_LOCATION 13
+// arrays of MULTIVIEW_MAX_VIEWS, indexed by layer
+#define SCENE_CAMERAPOS_UNIFORM_LOCATION 16
+#define SCENE_VIEW_PROJECTION_UNIFORM_LOCATION 48
 
 #define SCENE_DIFFUSE_MAP_TEXTURE_BINDING 0
 
+// Clustered lights
+// The view is split in LIGHT_CLUSTER_TILE_SIZE pixel tiles, and each tile in LIGHT_CLUSTER_SLICE_COUNT slices of
+// exponentially increasing depth. The last slice goes to infinity.
+#define LIGHT_CLUSTER_TILE_SIZE 32
+#define LIGHT_CLUSTER_SLICE_COUNT 24
+// lights of a cluster, past which the others are dropped
+#define LIGHT_CLUSTER_MAX_LIGHTS 256
+// the light index lists of all clusters share a buffer of this many indices per cluster
+#define LIGHT_CLUSTER_AVERAGE_LIGHTS 64
+
+// one workgroup per cluster
+#define LIGHT_CULL_WORKGROUP_SIZE 64
+
+#define LIGHT_CULL_VIEW_UNIFORM_LOCATION 0
+#define LIGHT_CULL_UNPROJECT_UNIFORM_LOCATION 4
+#define LIGHT_CULL_RENDER_SIZE_UNIFORM_LOCATION 5
+#define LIGHT_CULL_ZNEAR_UNIFORM_LOCATION 6
+#define LIGHT_CULL_SLICE_SCALE_UNIFORM_LOCATION 7
+#define LIGHT_CULL_LIGHT_COUNT_UNIFORM_LOCATION 8
+#define LIGHT_CULL_INDEX_CAPACITY_UNIFORM_LOCATION 9
+
+// shared by light_cull.comp and scene.frag
+#define LIGHTS_BUFFER_BINDING 0
+#define LIGHT_CLUSTERS_BUFFER_BINDING 1
+#define LIGHT_INDICES_BUFFER_BINDING 2
+#define LIGHT_INDEX_COUNTER_BUFFER_BINDING 3
+
 // SAT
 #define SAT_WORKGROUP_SIZE_X 1024
 
 #define SAT_READ_UINT_INPUT_UNIFORM_LOCATION 0
 #define SAT_READ_WGSUM_UNIFORM_LOCATION 1
 #define SAT_ADD_WGSUM_UNIFORM_LOCATION 2
+#define SAT_READ_ARRAY_INPUT_UNIFORM_LOCATION 3
+#define SAT_INCLUSIVE_UNIFORM_LOCATION 4
 
 #define SAT_INPUT_TEXTURE_BINDING 0
 #define SAT_UINT_INPUT_TEXTURE_BINDING 1
+#define SAT_ARRAY_INPUT_TEXTURE_BINDING 2
 
 #define SAT_OUTPUT_IMAGE_BINDING 0
 #define SAT_WGSUMS_IMAGE_BINDING 1
@@ -40,11 +90,92 @@
 #define TRANSPOSE_SAT_INPUT_IMAGE_BINDING 0
 #define TRANSPOSE_SAT_OUTPUT_IMAGE_BINDING 1
 
+// Patch SAT (workgroups of SAT_WORKGROUP_SIZE_X)
+#define SAT_PATCH_PASS_UNIFORM_LOCATION 0
+#define SAT_PATCH_RECT_MIN_UNIFORM_LOCATION 1
+#define SAT_PATCH_RECT_MAX_UNIFORM_LOCATION 2
+#define SAT_PATCH_RENDER_SIZE_UNIFORM_LOCATION 3
+
+#define SAT_PATCH_PASS_DELTA_ROWS 0
+#define SAT_PATCH_PASS_DELTA_COLS 1
+#define SAT_PATCH_PASS_APPLY 2
+
+#define SAT_PATCH_COLOR_TEXTURE_BINDING 0
+
+#define SAT_PATCH_SAT_IMAGE_BINDING 0
+#define SAT_PATCH_DELTAS_IMAGE_BINDING 1
+
+// Fused resolve
+#define RESOLVE_SAMPLE_COUNT_UNIFORM_LOCATION 0
+#define RESOLVE_ZNEAR_UNIFORM_LOCATION 1
+#define RESOLVE_RENDER_SIZE_UNIFORM_LOCATION 2
+#define RESOLVE_WRITE_SAT_UNIFORM_LOCATION 3
+
+#define RESOLVE_COLOR_TEXTURE_BINDING 0
+#define RESOLVE_DEPTH_TEXTURE_BINDING 1
+
+#define RESOLVE_COLOR_IMAGE_BINDING 0
+#define RESOLVE_LINEAR_DEPTH_IMAGE_BINDING 1
+#define RESOLVE_SAT_IMAGE_BINDING 2
+
 // DOF
-#define DOF_ZNEAR_UNIFORM_LOCATION 0
 #define DOF_FOCUS_UNIFORM_LOCATION 1
+#define DOF_RENDER_SIZE_UNIFORM_LOCATION 2
+#define DOF_DEPTH_IS_LINEAR_UNIFORM_LOCATION 3
+#define DOF_RADIUS_SCALE_UNIFORM_LOCATION 4
+#define DOF_MAX_RADIUS_UNIFORM_LOCATION 5
+#define DOF_COPY_BACKGROUND_UNIFORM_LOCATION 6
+#define DOF_READ_ARRAY_INPUTS_UNIFORM_LOCATION 7
+// array of MULTIVIEW_MAX_VIEWS, indexed by layer
+#define DOF_ZNEAR_UNIFORM_LOCATION 16
 
 #define DOF_SAT_TEXTURE_BINDING 0
 #define DOF_DEPTH_TEXTURE_BINDING 1
+#define DOF_COLOR_TEXTURE_BINDING 2
+#define DOF_DEPTH_ARRAY_TEXTURE_BINDING 3
+#define DOF_COLOR_ARRAY_TEXTURE_BINDING 4
+
+// FXAA
+#define FXAA_RENDER_SIZE_UNIFORM_LOCATION 0
+
+#define FXAA_COLOR_TEXTURE_BINDING 0
+
+// GUI layer
+#define GUI_LAYER_TEXTURE_BINDING 0
+
+// Upscale
+#define UPSCALE_WORKGROUP_SIZE_X 8
+
+#define UPSCALE_INPUT_SIZE_UNIFORM_LOCATION 0
+#define UPSCALE_OUTPUT_SIZE_UNIFORM_LOCATION 1
+#define UPSCALE_SHARPNESS_UNIFORM_LOCATION 2
+
+#define UPSCALE_INPUT_TEXTURE_BINDING 0
+
+#define UPSCALE_OUTPUT_IMAGE_BINDING 0
+
+// Frame export
+#define EXPORT_WORKGROUP_SIZE_X 8
+
+#define EXPORT_ZNEAR_UNIFORM_LOCATION 0
+#define EXPORT_FOCUS_UNIFORM_LOCATION 1
+#define EXPORT_RENDER_SIZE_UNIFORM_LOCATION 2
+#define EXPORT_DEPTH_IS_LINEAR_UNIFORM_LOCATION 3
+#define EXPORT_MAX_RADIUS_UNIFORM_LOCATION 4
+
+#define EXPORT_DEPTH_TEXTURE_BINDING 0
+
+#define EXPORT_LINEAR_DEPTH_IMAGE_BINDING 0
+#define EXPORT_COC_IMAGE_BINDING 1
+
+// Progressive thin-lens accumulation
+#define ACCUMULATE_WORKGROUP_SIZE_X 8
+
+#define ACCUMULATE_SAMPLE_COUNT_UNIFORM_LOCATION 0
+#define ACCUMULATE_ADD_SAMPLE_UNIFORM_LOCATION 1
+#define ACCUMULATE_RENDER_SIZE_UNIFORM_LOCATION 2
+
+#define ACCUMULATE_COLOR_IMAGE_BINDING 0
+#define ACCUMULATE_SUM_IMAGE_BINDING 1
 
 #endif // PREAMBLE_GLSL
\ No newline at end of file
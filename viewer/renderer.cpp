@@ -1,31 +1,98 @@
 #include "renderer.h"
 
 #include "scene.h"
+#include "image_write.h"
+#include "frame_capture.h"
+#include "frame_export.h"
+#include "gl_dof.h"
+#include "frame_arena.h"
 
 #include "preamble.glsl"
 
 #include "imgui.h"
+#include "imgui_impl_sdl_gl3.h"
+
+#include <SDL.h>
 
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #include <cstdio>
 #include <memory>
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <unordered_map>
 
-#define NOMINMAX
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
+// GL_AMD_pinned_memory, isn't in the core profile headers
+#ifndef GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD
+#define GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD 0x9160
+#endif
 
 class Renderer : public IRenderer
 {
 public:
-    const int kSampleCount = 4;
     const int kMaxTextureCount = 32;
 
+    // The render scale is quantized to kRenderScaleSteps steps, so that the resolution doesn't jitter every frame.
+    const int kRenderScaleSteps = 16;
+    const int kMinRenderScaleStep = 8; // 50%
+    // Number of frames to wait after a scale change before trusting the GPU timings again
+    const int kRenderScaleSettleFrames = 8;
+
+    // How often the GUI's numbers that change every frame (timings, progress) are refreshed
+    const float kGUIStatsRefreshSeconds = 0.5f;
+
+    // The SAT is unsigned 32-bit and only box sums need to be exact (see gl_dof.h)
+    const int kMaxExactBlurRadius = GLDOF_MAX_EXACT_RADIUS;
+    // Extra margin around the tiles of stills, for the neighbourhood read by the resolve (FXAA).
+    const int kStillTileResolveMargin = 16;
+    // How far from a pixel the resolve reads: FXAA's edge search reaches 25.5 pixels along an edge (see fxaa.frag).
+    // The incremental SAT patches this much around the changed instances.
+    const int kResolveFootprintRadius = 26;
+
+    // Each timing of the SAT benchmark is averaged over this many runs
+    const int kSATBenchmarkRunCount = 8;
+
+    // Progressive thin-lens DoF stops rendering lens samples once it has this many at most
+    const int kMaxLensSampleCount = 4096;
+
+    // Eye depth where the last slice of the light clusters starts (it goes to infinity).
+    // The slices in front of it get exponentially deeper from the near plane.
+    const float kLightClusterFarDepth = 100.0f;
+
+    // The depth pre-pass is worth its extra geometry pass once the color pass shades this many fragments per pixel
+    // more than it does with it (auto mode).
+    const float kDepthPrePassOverdrawThreshold = 1.25f;
+    // In auto mode, the setting that isn't used is measured for one frame every this many frames.
+    const int kDepthPrePassProbeInterval = 120;
+
+    // Width of the CPU occlusion buffer (its height follows the aspect ratio)
+    const int kOcclusionBufferWidth = 320;
+    // The instances that are largest on screen (by their bounding sphere's angular radius, above this) are the occluders,
+    // up to these many instances and triangles.
+    const float kMinOccluderScreenSize = 0.05f;
+    const int kMaxOccluderCount = 32;
+    const int kMaxOccluderTriangleCount = 4096;
+
+    // Readbacks of captured frames in flight on the GPU. Enough to cover the latency between issuing and finishing a frame.
+    static const int kCaptureRingSize = 4;
+    // Frames waiting for the writer thread
+    const int kCaptureBufferCount = 8;
+
+    // Slots of the frame export's ring, and how many of them can be read back at once.
+    // The others hold published frames, which readers get that many frames to finish with.
+    static const int kExportSlotCount = 6;
+    const int kExportMaxSlotsInFlight = 3;
+
     struct GPUTimestamps
     {
         enum Enum
         {
+            LightCullingStart,
+            LightCullingEnd,
+            DepthPrePassStart,
+            DepthPrePassEnd,
             RenderSceneStart,
             RenderSceneEnd,
             MultisampleResolveStart,
@@ -38,22 +105,27 @@ public:
             SATUploadEnd,
             DOFBlurStart,
             DOFBlurEnd,
-            RenderGUIStart,
-            RenderGUIEnd,
+            UpscaleStart,
+            UpscaleEnd,
             BlitToWindowStart,
             BlitToWindowEnd,
+            RenderGUIStart,
+            RenderGUIEnd,
             Count
         };
 
         static constexpr const char* Names[Count / 2] = {
+            "LightCulling",
+            "DepthPrePass",
             "RenderScene",
             "MultisampleResolve",
             "ReadbackBackbuffer",
             "ComputeSAT",
             "SATUpload",
             "DOfBlur",
-            "RenderGUI",
-            "BlitToWindow"
+            "Upscale",
+            "BlitToWindow",
+            "RenderGUI"
         };
     };
 
@@ -67,13 +139,16 @@ public:
             ComputeSATEnd,
             SATUploadStart,
             SATUploadEnd,
+            OcclusionCullingStart,
+            OcclusionCullingEnd,
             Count
         };
 
         static constexpr const char* Names[Count / 2] = {
             "ReadbackBackbuffer",
             "ComputeSAT",
-            "SATUpload"
+            "SATUpload",
+            "OcclusionCulling"
         };
     };
 
@@ -84,9 +159,62 @@ public:
     ShaderSet mShaders;
     GLuint* mSceneSP;
 
+    // Depth-only pass before the color pass, which then only shades the visible fragments (with GL_EQUAL).
+    // Auto uses it when the fragments shaded per pixel (with GL_ARB_pipeline_statistics_query) show that it helps.
+    enum DepthPrePass
+    {
+        DepthPrePass_Off,
+        DepthPrePass_On,
+        DepthPrePass_Auto,
+        DepthPrePass_Count
+    };
+    int mDepthPrePassMode;
+    GLuint* mDepthPrePassSP;
+    // used by this frame
+    bool mDepthPrePassActive;
+    int mFramesSinceDepthPrePassProbe;
+    bool mHasPipelineStatistics;
+    GLuint mFragmentInvocationsQuery;
+    bool mFragmentInvocationsQueryIssued;
+    bool mFragmentInvocationsQueryWithPrePass;
+    int mFragmentInvocationsQueryPixels;
+    // last measurement of the color pass without and with the pre-pass, 0 until measured
+    float mShadedFragmentsPerPixel[2];
+
+    // Instances are culled per meshlet (on the CPU, against the view's frustum), and only the visible ranges are drawn.
+    // Backface culling also culls the meshlets whose triangles all face away, and enables GL_CULL_FACE to match.
+    // It's off by default: the scene is otherwise drawn two-sided, like the software renderer draws it.
+    bool mEnableMeshletCulling;
+    bool mEnableBackfaceCulling;
+    MeshletDrawList mMeshletDrawList;
+    // of the last color pass
+    int mVisibleMeshletCount;
+    int mTotalMeshletCount;
+
+    // Instances are also culled when they're hidden behind the ones that are biggest on screen, rasterized on the CPU.
+    bool mEnableOcclusionCulling;
+    OcclusionBuffer mOcclusionBuffer;
+    // per instance (in the order they're iterated), whether it's hidden in this frame
+    std::vector<uint8_t> mInstanceOccluded;
+    int mOccludedInstanceCount;
+
+    // containers that only live for a frame allocate from here
+    FrameArena mFrameArena;
+
+    // anti-aliasing
+    int mSampleCount;
+    int mMaxSampleCount;
+    bool mEnableFXAA;
+    GLuint* mFXAASP;
+
+    // size of the rendered region of the backbuffer (scaled)
     int mBackbufferWidth;
     int mBackbufferHeight;
+    // size that the backbuffer textures are allocated with (unscaled)
+    int mMaxBackbufferWidth;
+    int mMaxBackbufferHeight;
     // multi-sampled buffers
+    // (plain 2D textures when rendering with a single sample, then the resolve is a copy or FXAA)
     GLuint mBackbufferFBOMS;
     GLuint mBackbufferColorTOMS;
     GLuint mBackbufferDepthTOMS;
@@ -94,34 +222,259 @@ public:
     GLuint mBackbufferFBOSS;
     GLuint mBackbufferColorTOSS;
     GLuint mBackbufferDepthTOSS;
+    // RGBA8 view of the color, for image stores
+    GLuint mBackbufferColorViewSS;
+    // eye space depth, written by the fused resolve
+    GLuint mBackbufferLinearDepthTO;
+
+    // resolves color, linearizes depth, and up-sweeps the SAT rows in one compute pass
+    bool mEnableFusedResolve;
+    GLuint* mFusedResolveSP;
+    // what the last resolve produced, for the passes that follow it
+    bool mResolvedLinearDepth;
+    bool mResolvedSATRows;
 
     // empty VAO, for attrib-less rendering passes
     GLuint mNullVAO;
 
+    // Clustered lights: the scene's lights are binned into clusters of the view (see the preamble) before the scene
+    // is rendered, and each fragment only shades the lights of its cluster.
+    struct GPULight
+    {
+        glm::vec4 PositionRadius;
+        glm::vec4 ColorSpotScale;
+        glm::vec4 DirectionSpotOffset;
+    };
+    GLuint* mLightCullSP;
+    GLuint mLightsBO;
+    GLuint mLightClustersBO;
+    GLuint mLightIndicesBO;
+    GLuint mLightIndexCounterBO;
+    // in indices, for the clusters of the biggest backbuffer
+    int mLightIndexCapacity;
+    // what the last culling produced, for the scene pass (no lights if culling didn't run)
+    int mCulledLightCount;
+    int mLightClusterCountX;
+    int mLightClusterCountY;
+    float mLightSliceScale;
+    float mLightZNear;
+
     // may be different from backbuffer if scaled
     int mWindowWidth;
     int mWindowHeight;
 
+    // spatial upscaling from backbuffer to window resolution
+    enum Upscaler
+    {
+        Upscaler_Bilinear,
+        Upscaler_EASU,
+        Upscaler_Count
+    };
+    int mUpscaler;
+    float mUpscaleSharpness;
+    GLuint* mUpscaleEASUSP;
+    GLuint* mUpscaleRCASSP;
+    GLuint mUpscaledTO; // EASU output, window-sized
+    GLuint mSharpenedTO; // RCAS output, window-sized, sRGB-encoded
+    GLuint mSharpenedFBO;
+
+    // The GUI is rasterized into a window-sized layer (premultiplied alpha) only when its draw data changes,
+    // and the layer is composited over the window every frame.
+    bool mEnableGUILayer;
+    GLuint* mGUICompositeSP;
+    GLuint mGUILayerTO;
+    GLuint mGUILayerFBO;
+    // hash of the draw data that the layer holds, if valid
+    uint64_t mGUILayerHash;
+    bool mGUILayerValid;
+    // frames since the profiling text was last refreshed, and how many of them redrew the layer
+    int mGUILayerFrameCount;
+    int mGUILayerRedrawCount;
+
+    // The GUI's numbers that change every frame, refreshed every kGUIStatsRefreshSeconds (SDL performance counter of the last refresh)
+    uint64_t mGUIStatsRefreshCounter;
+    ImGuiTextBuffer mProfilingText;
+    ImGuiTextBuffer mThinLensStatusText;
+
     int mSummedAreaTableWidth;
     int mSummedAreaTableHeight;
     bool mUseCPUForSAT;
     glm::u8vec4* mCPUBackbufferReadback;
     glm::uvec4* mCPUSummedAreaTable;
-    GLuint* mSummedAreaTableUpsweepSP;
-    GLuint* mSummedAreaTableDownsweepSP;
-    GLuint* mTransposeSummedAreaTableSP;
-    GLuint mSummedRowsTO, *mSummedAreaTableTO; // aliases
-    GLuint mSummedRowsWGSumsTO;
-    GLuint mSummedColsTO;
-    GLuint mSummedColsWGSumsTO;
+
+    // Incremental SAT: while the view stays the same, the pixels that change from a frame to the next are the ones
+    // covered by the instances that moved or changed material (where they were, and where they are now), so the last
+    // frame's SAT is patched in that region instead of being summed again.
+    bool mEnableIncrementalSAT;
+    // the SAT holds the GPU SAT of the main view's last frame
+    bool mSATHistoryValid;
+    // What the last frame's image depended on, besides the instances and materials.
+    // Zeroed before it's filled, so it's compared with memcmp.
+    struct SATViewState
+    {
+        glm::mat4 V;
+        glm::mat4 P;
+        int Width;
+        int Height;
+        int SampleCount;
+        bool EnableFXAA;
+        bool EnableFusedResolve;
+        bool EnableBackfaceCulling;
+        // change how depth ties resolve and what's drawn, anywhere in the frame
+        bool DepthPrePassActive;
+        bool EnableMeshletCulling;
+        bool EnableOcclusionCulling;
+    } mSATViewState;
+    std::vector<Light> mSATLights;
+    // by instance ID, what it was in the last frame
+    struct InstanceFootprint
+    {
+        uint32_t MeshID;
+        glm::mat4 MW;
+        // pixels [x0, x1) x [y0, y1) of the backbuffer that its bounds covered, with the resolve's margin
+        glm::ivec4 Rect;
+        // last frame it was seen in
+        uint64_t FrameIndex;
+    };
+    std::unordered_map<uint32_t, InstanceFootprint> mInstanceFootprints;
+    // by material ID, how it shaded in the last frame
+    struct MaterialShading
+    {
+        float Ambient[3];
+        float Diffuse[3];
+        float Specular[3];
+        float Shininess;
+        uint32_t DiffuseMapID;
+    };
+    std::unordered_map<uint32_t, MaterialShading> mMaterialShadings;
+    uint64_t mSATFrameIndex;
+    // This frame's pixels that changed since the last, and whether the SAT is patched there (or summed again).
+    // The rect is empty if nothing changed.
+    glm::ivec4 mSATDirtyRect;
+    bool mPatchSAT;
+
+    // Times patching the SAT against summing it, for regions of a few sizes (on the next frame)
+    bool mSATBenchmarkRequested;
+    struct SATBenchmarkResult
+    {
+        int Size;
+        // with the region at the center of the view, and at its top-left (bottom-up), where the whole SAT is patched
+        float CenterPatchMs;
+        float CornerPatchMs;
+    };
+    std::vector<SATBenchmarkResult> mSATBenchmarkResults;
+    float mSATBenchmarkFullMs;
+
+    // Progressive thin-lens DoF: once the main view has stayed the same for some frames, each frame renders it from
+    // another point of the lens (sheared so the focus plane stays put, and jittered within the pixel), and the
+    // backbuffer shows the average of the samples so far, which converges to the lens' true defocus (and antialiasing).
+    // The lens is sized from the SAT's blur (see GetLensRadius), so the samples refine the image rather than replace it.
+    // The SAT's approximation is used again as soon as anything changes.
+    bool mEnableProgressiveDoF;
+    GLuint* mAccumulateSP;
+    // frames that the view has to stay the same for, and the samples to take
+    int mIdleFramesBeforeAccumulating;
+    int mLensSampleCount;
+    // frames that the view has stayed the same for
+    int mIdleFrameCount;
+    // what the samples so far were rendered with
+    float mAccumulatedFocusDepth;
+    // this frame shows the samples' average rather than the SAT's blur
+    bool mAccumulatingDoF;
+    int mAccumulatedSampleCount;
+    // linear RGBA32F sum of the samples, of the backbuffer's maximum size
+    GLuint mAccumulationTO;
+    int mAccumulationWidth;
+    int mAccumulationHeight;
 
     bool mEnableDoF;
-    GLuint* mDepthOfFieldSP;
+    // the GPU SAT and the box filter
+    IGLDepthOfField* mDepthOfField;
     float mFocusDepth;
+    // in pixels at window resolution. Bounds how far the blur reaches, which is the margin tiled stills need.
+    int mMaxBlurRadius;
+
+    // offline still rendering, in tiles, streamed to disk
+    bool mStillRequested;
+    char mStillFilename[256];
+    int mStillWidth;
+    int mStillHeight;
+    int mStillTileSize;
+
+    // Frame capture. The window's image (without the GUI) is read back asynchronously through a ring of PBOs,
+    // and copied to the writer thread once its fence has signaled, so recording never waits on the GPU or the disk.
+    int mCaptureFormat;
+    char mCapturePath[256];
+    int mCaptureFramesPerSecond;
+    IFrameWriter* mFrameWriter; // non-NULL while capturing
+    int mCaptureWidth;
+    int mCaptureHeight;
+    GLuint mCapturePBOs[kCaptureRingSize];
+    GLsync mCaptureFences[kCaptureRingSize];
+    int mCaptureOldestSlot;
+    int mCaptureSlotsInFlight;
+    int mCaptureFramesIssued;
+    // dropped because all PBOs were still being read back
+    int mCaptureFramesDroppedReadback;
+    // dropped because the writer thread had no free buffer
+    int mCaptureFramesDroppedWriter;
+
+    // Frame export to shared memory (see frame_export.h). Like the capture, the frames are read back asynchronously,
+    // but into buffers that wrap the shared memory's slots when GL_AMD_pinned_memory is available, so the readback is
+    // the only copy. Otherwise, each slot has a PBO that's copied into the shared memory once its fence has signaled.
+    bool mEnableFrameExport;
+    char mFrameExportName[64];
+    bool mExportLinearDepth;
+    bool mExportCoC;
+    IFrameExporter* mFrameExporter; // non-NULL while exporting
+    GLuint* mExportSP;
+    GLuint mExportLinearDepthTO;
+    GLuint mExportCoCTO;
+    GLuint mExportFBO;
+    bool mExportPinnedMemory;
+    GLuint mExportBuffers[kExportSlotCount];
+    GLsync mExportFences[kExportSlotCount];
+    struct ExportedFrame
+    {
+        uint64_t FrameIndex;
+        int Width[FrameExportPlane_Count];
+        int Height[FrameExportPlane_Count];
+        float ZNear;
+        float FocusDepth;
+    } mExportedFrames[kExportSlotCount];
+    int mExportOldestSlot;
+    int mExportSlotsInFlight;
+    uint64_t mExportFramesIssued;
+    uint64_t mExportFramesPublished;
+    // dropped because too many readbacks were in flight
+    uint64_t mExportFramesDropped;
+
+    // Multi-view: the scene's cameras side by side in a grid over the window. Each view is rendered into a layer of
+    // array textures, and the scene, the SATs and the DoF each run as a single layered pass for all the views,
+    // rather than the whole pipeline once per view. Single-sampled, at window resolution, without upscaling.
+    bool mEnableMultiView;
+    GLuint* mLayeredSceneSP;
+    // size of each view (a tile of the window's grid), and how many layers the textures have
+    int mMultiViewWidth;
+    int mMultiViewHeight;
+    int mMultiViewLayerCount;
+    GLuint mMultiViewColorTO;
+    GLuint mMultiViewDepthTO;
+    // all the layers, for the layered passes
+    GLuint mMultiViewFBO;
+    // a single layer, for the blits to the window
+    GLuint mMultiViewReadFBO;
+
+    // dynamic resolution
+    bool mEnableDynamicResolution;
+    int mRenderScaleStep;
+    float mTargetGPUFrameTimeMs;
+    float mSmoothedGPUFrameTimeMs;
+    int mFramesSinceRenderScaleChange;
 
     GLuint mGPUTimestampQueries[GPUTimestamps::Count];
     GLuint64 mGPUTimestampQueryResults[GPUTimestamps::Count];
-    LARGE_INTEGER mCPUTimestampQueryResults[CPUTimestamps::Count];
+    uint64_t mCPUTimestampQueryResults[CPUTimestamps::Count];
 
     void Init(Scene* scene) override
     {
@@ -129,56 +482,219 @@ public:
 
         mFirstFrame = true;
 
+        mShaders.SetFrameArena(&mFrameArena);
         mShaders.SetVersion("440");
         mShaders.SetPreambleFile("preamble.glsl");
 
         mSceneSP = mShaders.AddProgramFromExts({ "scene.vert", "scene.frag" });
-        mSummedAreaTableUpsweepSP = mShaders.AddProgramFromExts({ "sat_up.comp" });
-        mSummedAreaTableDownsweepSP = mShaders.AddProgramFromExts({ "sat_down.comp" });
-        mTransposeSummedAreaTableSP = mShaders.AddProgramFromExts({ "sat_transpose.comp" });
-        mDepthOfFieldSP = mShaders.AddProgramFromExts({ "blit.vert", "dof.frag" });
+        mLayeredSceneSP = mShaders.AddProgramFromExts({ "scene.vert", "scene_layered.geom", "scene.frag" });
+        mDepthPrePassSP = mShaders.AddProgramFromExts({ "depth.vert" });
+        mFXAASP = mShaders.AddProgramFromExts({ "blit.vert", "fxaa.frag" });
+        mFusedResolveSP = mShaders.AddProgramFromExts({ "resolve.comp" });
+        mLightCullSP = mShaders.AddProgramFromExts({ "light_cull.comp" });
+        mUpscaleEASUSP = mShaders.AddProgramFromExts({ "upscale_easu.comp" });
+        mUpscaleRCASSP = mShaders.AddProgramFromExts({ "upscale_rcas.comp" });
+        mGUICompositeSP = mShaders.AddProgramFromExts({ "blit.vert", "gui_composite.frag" });
+        mExportSP = mShaders.AddProgramFromExts({ "export.comp" });
+        mAccumulateSP = mShaders.AddProgramFromExts({ "accumulate.comp" });
+
+        mDepthOfField = NewGLDepthOfField(&mShaders);
 
         glGenVertexArrays(1, &mNullVAO);
         glBindVertexArray(mNullVAO);
         glBindVertexArray(0);
 
+        // the sample count of the MSAA backbuffer is limited by both color and depth
+        {
+            GLint maxColorSamples, maxDepthSamples;
+            glGetIntegerv(GL_MAX_COLOR_TEXTURE_SAMPLES, &maxColorSamples);
+            glGetIntegerv(GL_MAX_DEPTH_TEXTURE_SAMPLES, &maxDepthSamples);
+            mMaxSampleCount = std::min(maxColorSamples, maxDepthSamples);
+        }
+        mSampleCount = std::min(4, mMaxSampleCount);
+        mEnableFXAA = true;
+        mEnableFusedResolve = true;
+
         mEnableDoF = true;
+        mEnableIncrementalSAT = true;
         mFocusDepth = 5.0f;
+        mMaxBlurRadius = 64;
+
+        mEnableProgressiveDoF = false;
+        mIdleFramesBeforeAccumulating = 30;
+        mLensSampleCount = 256;
+
+        strcpy(mStillFilename, "still.ppm");
+        mStillWidth = 15360;
+        mStillHeight = 8640;
+        mStillTileSize = 2048;
+
+        mCaptureFormat = CaptureFormat_Y4M;
+        strcpy(mCapturePath, "capture");
+        mCaptureFramesPerSecond = 60;
+
+        strcpy(mFrameExportName, "/dof-frames");
+        mExportLinearDepth = true;
+        mExportCoC = true;
+
+        mEnableDynamicResolution = false;
+        mRenderScaleStep = kRenderScaleSteps;
+        mTargetGPUFrameTimeMs = 1000.0f / 60.0f;
+
+        mUpscaler = Upscaler_EASU;
+        mUpscaleSharpness = 0.8f;
+
+        mDepthPrePassMode = DepthPrePass_Auto;
+        mHasPipelineStatistics = IsExtensionSupported("GL_ARB_pipeline_statistics_query");
+        if (mHasPipelineStatistics)
+        {
+            glGenQueries(1, &mFragmentInvocationsQuery);
+        }
+
+        mEnableGUILayer = true;
+
+        mEnableMeshletCulling = true;
+        mEnableOcclusionCulling = true;
+
+        glGenBuffers(1, &mLightsBO);
+        glGenBuffers(1, &mLightIndexCounterBO);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, mLightIndexCounterBO);
+        glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t), NULL, 0);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
         glGenQueries(GPUTimestamps::Count, &mGPUTimestampQueries[0]);
     }
 
     void Resize(int width, int height) override
     {
+        // the output of a capture has a fixed size
+        if (mFrameWriter)
+        {
+            StopCapture();
+        }
+
+        // the export's slots are sized for the window, so it's recreated (readers see it closed, and reopen it)
+        if (mFrameExporter)
+        {
+            StopFrameExport();
+        }
+
         mWindowWidth = width;
         mWindowHeight = height;
 
-        mBackbufferWidth = mWindowWidth;
-        mBackbufferHeight = mWindowHeight;
-
         // OS X doesn't like it when you delete framebuffers it's using
         // No big deal, this happens implicitly anyways.
         glFinish();
 
+        // Allocate everything at full resolution, so changing the render scale never reallocates.
+        AllocateBackbuffers(mWindowWidth, mWindowHeight);
+
+        ApplyRenderScale();
+
+        // Init upscaling targets
+        {
+            glDeleteTextures(1, &mUpscaledTO);
+            glGenTextures(1, &mUpscaledTO);
+            glBindTexture(GL_TEXTURE_2D, mUpscaledTO);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, mWindowWidth, mWindowHeight);
+            glBindTexture(GL_TEXTURE_2D, 0);
+
+            // Plain RGBA8 rather than SRGB8_ALPHA8, since sRGB formats can't be used for image stores.
+            glDeleteTextures(1, &mSharpenedTO);
+            glGenTextures(1, &mSharpenedTO);
+            glBindTexture(GL_TEXTURE_2D, mSharpenedTO);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, mWindowWidth, mWindowHeight);
+            glBindTexture(GL_TEXTURE_2D, 0);
+
+            glDeleteFramebuffers(1, &mSharpenedFBO);
+            glGenFramebuffers(1, &mSharpenedFBO);
+            glBindFramebuffer(GL_FRAMEBUFFER, mSharpenedFBO);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mSharpenedTO, 0);
+            GLenum fboStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+            if (fboStatus != GL_FRAMEBUFFER_COMPLETE) {
+                fprintf(stderr, "glCheckFramebufferStatus: %x\n", fboStatus);
+            }
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+
+        // Init GUI layer
+        // Plain RGBA8 like the window, so the GUI blends the same as when it's drawn on the window directly.
+        {
+            glDeleteTextures(1, &mGUILayerTO);
+            glGenTextures(1, &mGUILayerTO);
+            glBindTexture(GL_TEXTURE_2D, mGUILayerTO);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, mWindowWidth, mWindowHeight);
+            glBindTexture(GL_TEXTURE_2D, 0);
+
+            glDeleteFramebuffers(1, &mGUILayerFBO);
+            glGenFramebuffers(1, &mGUILayerFBO);
+            glBindFramebuffer(GL_FRAMEBUFFER, mGUILayerFBO);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mGUILayerTO, 0);
+            GLenum fboStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+            if (fboStatus != GL_FRAMEBUFFER_COMPLETE) {
+                fprintf(stderr, "glCheckFramebufferStatus: %x\n", fboStatus);
+            }
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+            mGUILayerValid = false;
+        }
+
+        if (mEnableFrameExport)
+        {
+            StartFrameExport();
+        }
+    }
+
+    // Allocates the backbuffers and the SAT for rendering regions of up to maxWidth x maxHeight.
+    // Normally the window size, but the tiled still rendering allocates them at its tile size instead.
+    void AllocateBackbuffers(int maxWidth, int maxHeight)
+    {
+        mMaxBackbufferWidth = maxWidth;
+        mMaxBackbufferHeight = maxHeight;
+
+        // the SAT may be reallocated with them
+        mSATHistoryValid = false;
+
         // Init multisampled FBO
         {
+            GLenum target = mSampleCount > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+
             glDeleteTextures(1, &mBackbufferColorTOMS);
             glGenTextures(1, &mBackbufferColorTOMS);
-            glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, mBackbufferColorTOMS);
-            glTexStorage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, kSampleCount, GL_SRGB8_ALPHA8, mBackbufferWidth, mBackbufferHeight, GL_TRUE);
-            glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+            glBindTexture(target, mBackbufferColorTOMS);
+            if (mSampleCount > 1)
+            {
+                glTexStorage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, mSampleCount, GL_SRGB8_ALPHA8, mMaxBackbufferWidth, mMaxBackbufferHeight, GL_TRUE);
+            }
+            else
+            {
+                // sampled with filtering by FXAA
+                glTexStorage2D(GL_TEXTURE_2D, 1, GL_SRGB8_ALPHA8, mMaxBackbufferWidth, mMaxBackbufferHeight);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            }
+            glBindTexture(target, 0);
 
             glDeleteTextures(1, &mBackbufferDepthTOMS);
             glGenTextures(1, &mBackbufferDepthTOMS);
-            glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, mBackbufferDepthTOMS);
-            glTexStorage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, kSampleCount, GL_DEPTH_COMPONENT32F, mBackbufferWidth, mBackbufferHeight, GL_TRUE);
-            glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+            glBindTexture(target, mBackbufferDepthTOMS);
+            if (mSampleCount > 1)
+            {
+                glTexStorage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, mSampleCount, GL_DEPTH_COMPONENT32F, mMaxBackbufferWidth, mMaxBackbufferHeight, GL_TRUE);
+            }
+            else
+            {
+                glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, mMaxBackbufferWidth, mMaxBackbufferHeight);
+            }
+            glBindTexture(target, 0);
 
             glDeleteFramebuffers(1, &mBackbufferFBOMS);
             glGenFramebuffers(1, &mBackbufferFBOMS);
             glBindFramebuffer(GL_FRAMEBUFFER, mBackbufferFBOMS);
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, mBackbufferColorTOMS, 0);
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D_MULTISAMPLE, mBackbufferDepthTOMS, 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target, mBackbufferColorTOMS, 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, target, mBackbufferDepthTOMS, 0);
             GLenum fboStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
             if (fboStatus != GL_FRAMEBUFFER_COMPLETE) {
                 fprintf(stderr, "glCheckFramebufferStatus: %x\n", fboStatus);
@@ -191,13 +707,24 @@ public:
             glDeleteTextures(1, &mBackbufferColorTOSS);
             glGenTextures(1, &mBackbufferColorTOSS);
             glBindTexture(GL_TEXTURE_2D, mBackbufferColorTOSS);
-            glTexStorage2D(GL_TEXTURE_2D, 1, GL_SRGB8_ALPHA8, mBackbufferWidth, mBackbufferHeight);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_SRGB8_ALPHA8, mMaxBackbufferWidth, mMaxBackbufferHeight);
             glBindTexture(GL_TEXTURE_2D, 0);
 
             glDeleteTextures(1, &mBackbufferDepthTOSS);
             glGenTextures(1, &mBackbufferDepthTOSS);
             glBindTexture(GL_TEXTURE_2D, mBackbufferDepthTOSS);
-            glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, mBackbufferWidth, mBackbufferHeight);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, mMaxBackbufferWidth, mMaxBackbufferHeight);
+            glBindTexture(GL_TEXTURE_2D, 0);
+
+            // views need a fresh texture name every time
+            glDeleteTextures(1, &mBackbufferColorViewSS);
+            glGenTextures(1, &mBackbufferColorViewSS);
+            glTextureView(mBackbufferColorViewSS, GL_TEXTURE_2D, mBackbufferColorTOSS, GL_RGBA8, 0, 1, 0, 1);
+
+            glDeleteTextures(1, &mBackbufferLinearDepthTO);
+            glGenTextures(1, &mBackbufferLinearDepthTO);
+            glBindTexture(GL_TEXTURE_2D, mBackbufferLinearDepthTO);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, mMaxBackbufferWidth, mMaxBackbufferHeight);
             glBindTexture(GL_TEXTURE_2D, 0);
 
             glDeleteFramebuffers(1, &mBackbufferFBOSS);
@@ -212,519 +739,2552 @@ public:
             glBindFramebuffer(GL_FRAMEBUFFER, 0);
         }
 
+
         // Init summed area table
         {
-            mSummedAreaTableWidth = (mBackbufferWidth + SAT_WORKGROUP_SIZE_X - 1) & -SAT_WORKGROUP_SIZE_X;
-            mSummedAreaTableHeight = (mBackbufferHeight + SAT_WORKGROUP_SIZE_X - 1) & -SAT_WORKGROUP_SIZE_X;
-
-            // The workgroup sums need to be computed in a single workgroup
-            // could generalize this to an arbitrary number of iterations, but meh.
-            assert(mSummedAreaTableWidth / SAT_WORKGROUP_SIZE_X <= SAT_WORKGROUP_SIZE_X);
-            assert(mSummedAreaTableHeight / SAT_WORKGROUP_SIZE_X <= SAT_WORKGROUP_SIZE_X);
+            mSummedAreaTableWidth = (mMaxBackbufferWidth + SAT_WORKGROUP_SIZE_X - 1) & -SAT_WORKGROUP_SIZE_X;
+            mSummedAreaTableHeight = (mMaxBackbufferHeight + SAT_WORKGROUP_SIZE_X - 1) & -SAT_WORKGROUP_SIZE_X;
 
             delete[] mCPUBackbufferReadback;
-            mCPUBackbufferReadback = new glm::u8vec4[mBackbufferWidth * mBackbufferHeight];
+            mCPUBackbufferReadback = new glm::u8vec4[mMaxBackbufferWidth * mMaxBackbufferHeight];
 
             delete[] mCPUSummedAreaTable;
             mCPUSummedAreaTable = new glm::uvec4[mSummedAreaTableWidth * mSummedAreaTableHeight];
 
-            glDeleteTextures(1, &mSummedRowsTO);
-            glGenTextures(1, &mSummedRowsTO);
-            glBindTexture(GL_TEXTURE_2D, mSummedRowsTO);
-            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32UI, mSummedAreaTableWidth, mSummedAreaTableHeight);
-            glBindTexture(GL_TEXTURE_2D, 0);
-
-            mSummedAreaTableTO = &mSummedRowsTO;
-
-            glDeleteTextures(1, &mSummedRowsWGSumsTO);
-            glGenTextures(1, &mSummedRowsWGSumsTO);
-            glBindTexture(GL_TEXTURE_2D, mSummedRowsWGSumsTO);
-            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32UI, mSummedAreaTableWidth / SAT_WORKGROUP_SIZE_X, mSummedAreaTableHeight);
-            glBindTexture(GL_TEXTURE_2D, 0);
-
-            glDeleteTextures(1, &mSummedColsTO);
-            glGenTextures(1, &mSummedColsTO);
-            glBindTexture(GL_TEXTURE_2D, mSummedColsTO);
-            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32UI, mSummedAreaTableHeight, mSummedAreaTableWidth);
-            glBindTexture(GL_TEXTURE_2D, 0);
+            mDepthOfField->Reserve(mMaxBackbufferWidth, mMaxBackbufferHeight, 1);
+        }
 
-            glDeleteTextures(1, &mSummedColsWGSumsTO);
-            glGenTextures(1, &mSummedColsWGSumsTO);
-            glBindTexture(GL_TEXTURE_2D, mSummedColsWGSumsTO);
-            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32UI, mSummedAreaTableHeight / SAT_WORKGROUP_SIZE_X, mSummedAreaTableWidth);
-            glBindTexture(GL_TEXTURE_2D, 0);
+        // Init light clusters
+        {
+            int clusterCount =
+                ((mMaxBackbufferWidth + LIGHT_CLUSTER_TILE_SIZE - 1) / LIGHT_CLUSTER_TILE_SIZE) *
+                ((mMaxBackbufferHeight + LIGHT_CLUSTER_TILE_SIZE - 1) / LIGHT_CLUSTER_TILE_SIZE) *
+                LIGHT_CLUSTER_SLICE_COUNT;
+            mLightIndexCapacity = clusterCount * LIGHT_CLUSTER_AVERAGE_LIGHTS;
+
+            glDeleteBuffers(1, &mLightClustersBO);
+            glGenBuffers(1, &mLightClustersBO);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, mLightClustersBO);
+            glBufferStorage(GL_SHADER_STORAGE_BUFFER, clusterCount * sizeof(glm::uvec2), NULL, 0);
+
+            glDeleteBuffers(1, &mLightIndicesBO);
+            glGenBuffers(1, &mLightIndicesBO);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, mLightIndicesBO);
+            glBufferStorage(GL_SHADER_STORAGE_BUFFER, mLightIndexCapacity * sizeof(uint32_t), NULL, 0);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
         }
     }
 
-    void UpdateGUI()
+    // Picks whether this frame renders with the depth pre-pass.
+    // In auto mode, the color pass is measured with the current choice every frame, and with the other one once in
+    // a while, so both measurements follow the scene.
+    void UpdateDepthPrePass()
     {
-        // Readback last frame's timestamps and display them
-        if (ImGui::Begin("Renderer Profiling") && !mFirstFrame)
+        if (mDepthPrePassMode != DepthPrePass_Auto)
         {
-            ImGui::Text("GPU time");
-            for (int i = 0; i < GPUTimestamps::Count / 2; i++)
-            {
-                if (!mUseCPUForSAT)
-                {
-                    if (i * 2 == GPUTimestamps::ReadbackBackbufferStart ||
-                        i * 2 == GPUTimestamps::SATUploadStart)
-                    {
-                        continue;
-                    }
-                }
-                else
-                {
-                    if (i * 2 == GPUTimestamps::ComputeSATStart)
-                    {
-                        continue;
-                    }
-                }
-
-                glGetQueryObjectui64v(mGPUTimestampQueries[i * 2 + 0], GL_QUERY_RESULT, &mGPUTimestampQueryResults[i * 2 + 0]);
-                glGetQueryObjectui64v(mGPUTimestampQueries[i * 2 + 1], GL_QUERY_RESULT, &mGPUTimestampQueryResults[i * 2 + 1]);
+            mDepthPrePassActive = mDepthPrePassMode == DepthPrePass_On;
+            return;
+        }
 
-                uint64_t ns = mGPUTimestampQueryResults[i * 2 + 1] - mGPUTimestampQueryResults[i * 2 + 0];
-                uint64_t ms = ns / 1000000;
-                ImGui::Text("%s: %d.%d milliseconds", GPUTimestamps::Names[i], ms, ns / 1000 - ms * 1000);
-            }
+        // without the statistics, there's nothing to tell whether it helps
+        if (!mHasPipelineStatistics)
+        {
+            mDepthPrePassActive = false;
+            return;
+        }
 
-            ImGui::Text("\nCPU time");
-            
-            LARGE_INTEGER freq;
-            QueryPerformanceFrequency(&freq);
+        // Held while lens samples accumulate: switching would change the image and start them over
+        if (mAccumulatingDoF)
+        {
+            return;
+        }
 
-            for (int i = 0; i < CPUTimestamps::Count / 2; i++)
-            {
-                if (!mUseCPUForSAT)
-                {
-                    if (i * 2 == CPUTimestamps::ReadbackBackbufferStart ||
-                        i * 2 == CPUTimestamps::ComputeSATStart ||
-                        i * 2 == CPUTimestamps::SATUploadStart)
-                    {
-                        continue;
-                    }
-                }
+        bool choice = mShadedFragmentsPerPixel[0] > mShadedFragmentsPerPixel[1] * kDepthPrePassOverdrawThreshold;
 
-                uint64_t ticks = mCPUTimestampQueryResults[i * 2 + 1].QuadPart - mCPUTimestampQueryResults[i * 2 + 0].QuadPart;
-                uint64_t us = ticks * 1000000 / freq.QuadPart;
-                uint64_t ms = us / 1000;
-                ImGui::Text("%s: %d.%d milliseconds", CPUTimestamps::Names[i], ms, us - ms * 1000);
-            }
+        mFramesSinceDepthPrePassProbe++;
+        if (mFramesSinceDepthPrePassProbe >= kDepthPrePassProbeInterval || mShadedFragmentsPerPixel[!choice] == 0.0f)
+        {
+            mDepthPrePassActive = !choice;
+            mFramesSinceDepthPrePassProbe = 0;
         }
-        ImGui::End();
-
-        if (ImGui::Begin("Renderer"))
+        else
         {
-            ImGui::Checkbox("Enable DoF", &mEnableDoF);
-            ImGui::Checkbox("CPU SAT", &mUseCPUForSAT);
-            ImGui::SliderFloat("Focus Depth", &mFocusDepth, 0.0f, 10.0f);
+            mDepthPrePassActive = choice;
         }
-        ImGui::End();
     }
 
-    void Paint() override
+    void ApplyRenderScale()
     {
-        UpdateGUI();
+        mBackbufferWidth = std::max(1, mMaxBackbufferWidth * mRenderScaleStep / kRenderScaleSteps);
+        mBackbufferHeight = std::max(1, mMaxBackbufferHeight * mRenderScaleStep / kRenderScaleSteps);
+    }
 
-        // Reload any programs
-        mShaders.UpdatePrograms();
+    // Whether the start and end timestamps of GPUTimestamps::Names[pair] are issued, which depends on DoF being on and on where the SAT is computed
+    bool IsGPUTimestampPairIssued(int pair) const
+    {
+        // without DoF, none of the SAT and blur passes run
+        if (!mEnableDoF)
+        {
+            return pair * 2 < GPUTimestamps::ReadbackBackbufferStart || pair * 2 > GPUTimestamps::DOFBlurStart;
+        }
+        else if (!mUseCPUForSAT)
+        {
+            return pair * 2 != GPUTimestamps::ReadbackBackbufferStart && pair * 2 != GPUTimestamps::SATUploadStart;
+        }
+        else
+        {
+            return pair * 2 != GPUTimestamps::ComputeSATStart;
+        }
+    }
 
-        // Render scene
-        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::RenderSceneStart], GL_TIMESTAMP);
-        if (*mSceneSP)
+    void ReadbackTimestamps()
+    {
+        if (mFirstFrame)
         {
-            glBindFramebuffer(GL_FRAMEBUFFER, mBackbufferFBOMS);
-            glViewport(0, 0, mBackbufferWidth, mBackbufferHeight);
+            return;
+        }
 
-            glClearColor(100.0f / 255.0f, 149.0f / 255.0f, 237.0f / 255.0f, 1.0f);
-            glClearDepth(0.0f);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        // Readback last frame's timestamps
+        for (int i = 0; i < GPUTimestamps::Count / 2; i++)
+        {
+            if (!IsGPUTimestampPairIssued(i))
+            {
+                continue;
+            }
 
-            Camera& mainCamera = mScene->Cameras[mScene->MainCameraID];
+            glGetQueryObjectui64v(mGPUTimestampQueries[i * 2 + 0], GL_QUERY_RESULT, &mGPUTimestampQueryResults[i * 2 + 0]);
+            glGetQueryObjectui64v(mGPUTimestampQueries[i * 2 + 1], GL_QUERY_RESULT, &mGPUTimestampQueryResults[i * 2 + 1]);
+        }
+
+        if (mFragmentInvocationsQueryIssued)
+        {
+            GLuint64 invocations;
+            glGetQueryObjectui64v(mFragmentInvocationsQuery, GL_QUERY_RESULT, &invocations);
+            mShadedFragmentsPerPixel[mFragmentInvocationsQueryWithPrePass] = (float)invocations / mFragmentInvocationsQueryPixels;
+            mFragmentInvocationsQueryIssued = false;
+        }
+    }
 
-            glm::vec3 eye = mainCamera.Eye;
-            glm::vec3 up = mainCamera.Up;
+    // Adjusts the render scale one step at a time to keep the GPU frame time under the target.
+    // Uses the timestamps of the last frame, and the new scale takes effect starting from the next frame.
+    void UpdateDynamicResolution()
+    {
+        if (!mEnableDynamicResolution || mFirstFrame)
+        {
+            mFramesSinceRenderScaleChange = 0;
+            return;
+        }
 
-            glm::mat4 V = glm::lookAt(eye, mainCamera.Target, up);
-            glm::mat4 P;
+        // The sum of the passes, rather than the span from the first to the last. Between passes, the GPU can sit idle
+        // waiting for CPU work (occlusion culling, the CPU SAT), which a lower render scale wouldn't make any faster.
+        uint64_t frameNs = 0;
+        for (int i = 0; i < GPUTimestamps::Count / 2; i++)
+        {
+            if (IsGPUTimestampPairIssued(i))
             {
-                float f = 1.0f / tanf(mainCamera.FovY / 2.0f);
-                P = glm::mat4(
-                    f / mainCamera.Aspect, 0.0f, 0.0f, 0.0f,
-                    0.0f, f, 0.0f, 0.0f,
-                    0.0f, 0.0f, 0.0f, -1.0f,
-                    0.0f, 0.0f, mainCamera.ZNear, 0.0f);
+                frameNs += mGPUTimestampQueryResults[i * 2 + 1] - mGPUTimestampQueryResults[i * 2 + 0];
             }
+        }
+        float frameMs = frameNs / 1000000.0f;
 
-            glm::mat4 VP = P * V;
-
-            glUseProgram(*mSceneSP);
+        // the timings right after a scale change still reflect the old scale
+        if (mFramesSinceRenderScaleChange < kRenderScaleSettleFrames)
+        {
+            mFramesSinceRenderScaleChange++;
+            mSmoothedGPUFrameTimeMs = frameMs;
+            return;
+        }
 
-            glUniform3fv(SCENE_CAMERAPOS_UNIFORM_LOCATION, 1, value_ptr(eye));
+        mSmoothedGPUFrameTimeMs += (frameMs - mSmoothedGPUFrameTimeMs) * 0.1f;
 
-            glEnable(GL_DEPTH_TEST);
-            glDepthFunc(GL_GREATER);
-            glEnable(GL_FRAMEBUFFER_SRGB);
-            for (uint32_t instanceID : mScene->Instances)
+        int newStep = mRenderScaleStep;
+        if (mSmoothedGPUFrameTimeMs > mTargetGPUFrameTimeMs)
+        {
+            newStep = std::max(kMinRenderScaleStep, mRenderScaleStep - 1);
+        }
+        else
+        {
+            // only scale up if the frame is predicted to still fit in the budget, assuming cost proportional to pixel count.
+            float growth = (float)(mRenderScaleStep + 1) / mRenderScaleStep;
+            if (mSmoothedGPUFrameTimeMs * growth * growth < mTargetGPUFrameTimeMs * 0.95f)
             {
-                const Instance* instance = &mScene->Instances[instanceID];
-                const Mesh* mesh = &mScene->Meshes[instance->MeshID];
-                const Transform* transform = &mScene->Transforms[instance->TransformID];
+                newStep = std::min(kRenderScaleSteps, mRenderScaleStep + 1);
+            }
+        }
 
-                glm::mat4 MW;
-                MW = translate(-transform->RotationOrigin) * MW;
-                MW = mat4_cast(transform->Rotation) * MW;
-                MW = translate(transform->RotationOrigin) * MW;
-                MW = scale(transform->Scale) * MW;
-                MW = translate(transform->Translation) * MW;
+        if (newStep != mRenderScaleStep)
+        {
+            mRenderScaleStep = newStep;
+            mFramesSinceRenderScaleChange = 0;
+        }
+    }
 
-                glm::mat3 N_MW;
-                N_MW = mat3_cast(transform->Rotation) * N_MW;
-                N_MW = glm::mat3(scale(1.0f / transform->Scale)) * N_MW;
+    void UpdateProfilingText()
+    {
+        mProfilingText.clear();
 
-                glm::mat4 MVP = VP * MW;
+        mProfilingText.append("GPU time\n");
+        for (int i = 0; i < GPUTimestamps::Count / 2; i++)
+        {
+            if (!IsGPUTimestampPairIssued(i))
+            {
+                continue;
+            }
 
-                glUniformMatrix4fv(SCENE_MW_UNIFORM_LOCATION, 1, GL_FALSE, value_ptr(MW));
-                glUniformMatrix3fv(SCENE_N_MW_UNIFORM_LOCATION, 1, GL_FALSE, value_ptr(N_MW));
-                glUniformMatrix4fv(SCENE_MVP_UNIFORM_LOCATION, 1, GL_FALSE, value_ptr(MVP));
+            uint64_t ns = mGPUTimestampQueryResults[i * 2 + 1] - mGPUTimestampQueryResults[i * 2 + 0];
+            uint64_t ms = ns / 1000000;
+            mProfilingText.append("%s: %d.%d milliseconds\n", GPUTimestamps::Names[i], (int)ms, (int)(ns / 1000 - ms * 1000));
+        }
 
-                glBindVertexArray(mesh->MeshVAO);
-                for (size_t meshDrawIdx = 0; meshDrawIdx < mesh->DrawCommands.size(); meshDrawIdx++)
-                {
-                    const GLDrawElementsIndirectCommand* drawCmd = &mesh->DrawCommands[meshDrawIdx];
-                    const Material* material = &mScene->Materials[mesh->MaterialIDs[meshDrawIdx]];
+        mProfilingText.append("Lights: %d (%dx%dx%d clusters)\n", mCulledLightCount, mLightClusterCountX, mLightClusterCountY, LIGHT_CLUSTER_SLICE_COUNT);
+        mProfilingText.append("Meshlets: %d of %d\n", mVisibleMeshletCount, mTotalMeshletCount);
+        if (mEnableOcclusionCulling)
+        {
+            mProfilingText.append("Occlusion: %d instances hidden by %d occluders (%d triangles)\n",
+                mOccludedInstanceCount, mOcclusionBuffer.GetOccluderCount(), mOcclusionBuffer.GetTriangleCount());
+        }
+        if (mEnableDoF && !mUseCPUForSAT)
+        {
+            if (!mPatchSAT)
+            {
+                mProfilingText.append("SAT: summed\n");
+            }
+            else if (mSATDirtyRect.x < mSATDirtyRect.z && mSATDirtyRect.y < mSATDirtyRect.w)
+            {
+                mProfilingText.append("SAT: patched %dx%d pixels at (%d, %d)\n",
+                    mSATDirtyRect.z - mSATDirtyRect.x, mSATDirtyRect.w - mSATDirtyRect.y, mSATDirtyRect.x, mSATDirtyRect.y);
+            }
+            else
+            {
+                mProfilingText.append("SAT: unchanged\n");
+            }
+        }
+        if (!mSATBenchmarkResults.empty())
+        {
+            mProfilingText.append("SAT benchmark: summed in %.3f ms, patched in\n", mSATBenchmarkFullMs);
+            for (const SATBenchmarkResult& result : mSATBenchmarkResults)
+            {
+                mProfilingText.append("  %4dx%-4d %.3f ms (center) %.3f ms (corner)\n", result.Size, result.Size, result.CenterPatchMs, result.CornerPatchMs);
+            }
+        }
+        mProfilingText.append("Frame arena: %d KB (%d KB at most, %d KB capacity)\n",
+            (int)(mFrameArena.GetLastFrameUsage() / 1024), (int)(mFrameArena.GetHighWaterMark() / 1024),
+            (int)(mFrameArena.GetCapacity() / 1024));
+        if (mHasPipelineStatistics)
+        {
+            mProfilingText.append("Shaded fragments per pixel: %.2f without depth pre-pass, %.2f with\n",
+                mShadedFragmentsPerPixel[0], mShadedFragmentsPerPixel[1]);
+        }
+        else
+        {
+            mProfilingText.append("Shaded fragments per pixel: needs GL_ARB_pipeline_statistics_query\n");
+        }
 
-                    glActiveTexture(GL_TEXTURE0 + SCENE_DIFFUSE_MAP_TEXTURE_BINDING);
-                    if (material->DiffuseMapID == -1)
-                    {
-                        glBindTexture(GL_TEXTURE_2D, 0);
-                        glUniform1i(SCENE_HAS_DIFFUSE_MAP_UNIFORM_LOCATION, 0);
-                    }
-                    else
-                    {
-                        const DiffuseMap* diffuseMap = &mScene->DiffuseMaps[material->DiffuseMapID];
-                        glBindTexture(GL_TEXTURE_2D, diffuseMap->DiffuseMapTO);
-                        glUniform1i(SCENE_HAS_DIFFUSE_MAP_UNIFORM_LOCATION, 1);
-                    }
+        mProfilingText.append("\nCPU time\n");
 
-                    glUniform3fv(SCENE_AMBIENT_UNIFORM_LOCATION, 1, material->Ambient);
-                    glUniform3fv(SCENE_DIFFUSE_UNIFORM_LOCATION, 1, material->Diffuse);
-                    glUniform3fv(SCENE_SPECULAR_UNIFORM_LOCATION, 1, material->Specular);
-                    glUniform1f(SCENE_SHININESS_UNIFORM_LOCATION, material->Shininess);
+        uint64_t freq = SDL_GetPerformanceFrequency();
 
-                    glDrawElementsInstancedBaseVertexBaseInstance(
-                        GL_TRIANGLES,
-                        drawCmd->count,
-                        GL_UNSIGNED_INT, (GLvoid*)(sizeof(uint32_t) * drawCmd->firstIndex),
-                        drawCmd->primCount,
-                        drawCmd->baseVertex,
-                        drawCmd->baseInstance);
+        for (int i = 0; i < CPUTimestamps::Count / 2; i++)
+        {
+            if (!mUseCPUForSAT || !mEnableDoF)
+            {
+                if (i * 2 == CPUTimestamps::ReadbackBackbufferStart ||
+                    i * 2 == CPUTimestamps::ComputeSATStart ||
+                    i * 2 == CPUTimestamps::SATUploadStart)
+                {
+                    continue;
                 }
-                glBindVertexArray(0);
             }
-            glBindTextures(0, kMaxTextureCount, NULL);
-            glDisable(GL_FRAMEBUFFER_SRGB);
-            glDepthFunc(GL_LESS);
-            glDisable(GL_DEPTH_TEST);
-            glUseProgram(0);
+            if (!mEnableOcclusionCulling && i * 2 == CPUTimestamps::OcclusionCullingStart)
+            {
+                continue;
+            }
 
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            uint64_t ticks = mCPUTimestampQueryResults[i * 2 + 1] - mCPUTimestampQueryResults[i * 2 + 0];
+            uint64_t us = ticks * 1000000 / freq;
+            uint64_t ms = us / 1000;
+            mProfilingText.append("%s: %d.%d milliseconds\n", CPUTimestamps::Names[i], (int)ms, (int)(us - ms * 1000));
         }
-        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::RenderSceneEnd], GL_TIMESTAMP);
 
-        // resolve multisampled backbuffer to singlesampled backbuffer
-        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::MultisampleResolveStart], GL_TIMESTAMP);
+        if (mEnableGUILayer)
         {
-            glBindFramebuffer(GL_READ_FRAMEBUFFER, mBackbufferFBOMS);
-            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mBackbufferFBOSS);
-            glBlitFramebuffer(
-                0, 0, mBackbufferWidth, mBackbufferHeight,
-                0, 0, mBackbufferWidth, mBackbufferHeight,
-                GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_NEAREST);
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            mProfilingText.append("GUI layer: redrawn in %d of the last %d frames\n", mGUILayerRedrawCount, mGUILayerFrameCount);
         }
-        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::MultisampleResolveEnd], GL_TIMESTAMP);
+        mGUILayerRedrawCount = 0;
+        mGUILayerFrameCount = 0;
+    }
 
-        if (mEnableDoF)
+    void UpdateGUI()
+    {
+        // Numbers that change every frame are refreshed a few times a second instead. Between refreshes the GUI
+        // stays the same, so they don't make the cached GUI layer redraw every frame.
+        uint64_t now = SDL_GetPerformanceCounter();
+        bool refreshStats = now - mGUIStatsRefreshCounter >= (uint64_t)(kGUIStatsRefreshSeconds * SDL_GetPerformanceFrequency());
+        if (refreshStats)
+        {
+            mGUIStatsRefreshCounter = now;
+        }
+
+        // Display last frame's timestamps
+        if (ImGui::Begin("Renderer Profiling") && !mFirstFrame)
         {
-            // Compute SAT for the rendered image
-            if (mUseCPUForSAT)
+            if (refreshStats || mProfilingText.empty())
             {
-                // Dumb CPU SAT. Mainly used as a reference.
+                UpdateProfilingText();
+            }
+            ImGui::TextUnformatted(mProfilingText.begin(), mProfilingText.end());
 
-                // Readback backbuffer to SAT-ify it
-                QueryPerformanceCounter(&mCPUTimestampQueryResults[CPUTimestamps::ReadbackBackbufferStart]);
-                glQueryCounter(mGPUTimestampQueries[GPUTimestamps::ReadbackBackbufferStart], GL_TIMESTAMP);
+            // to compare the GUI's two ways of streaming its vertices in RenderGUI's timings
+            bool persistentGUIBuffers = ImGui_ImplSdlGL3_GetUsePersistentBuffers();
+            if (ImGui::Checkbox("Persistent GUI Buffers", &persistentGUIBuffers))
+            {
+                ImGui_ImplSdlGL3_SetUsePersistentBuffers(persistentGUIBuffers);
+            }
+
+            ImGui::Checkbox("Cached GUI Layer", &mEnableGUILayer);
+        }
+        ImGui::End();
+
+        if (ImGui::Begin("Renderer"))
+        {
+            // changing the sample count reallocates the backbuffer
+            const char* sampleCountNames[] = { "1x", "2x", "4x", "8x" };
+            int sampleCountIndex = mSampleCount == 8 ? 3 : mSampleCount == 4 ? 2 : mSampleCount == 2 ? 1 : 0;
+            if (ImGui::Combo("MSAA", &sampleCountIndex, sampleCountNames, sizeof(sampleCountNames) / sizeof(*sampleCountNames)))
+            {
+                int newSampleCount = std::min(1 << sampleCountIndex, mMaxSampleCount);
+                if (newSampleCount != mSampleCount)
+                {
+                    mSampleCount = newSampleCount;
+                    Resize(mWindowWidth, mWindowHeight);
+                }
+            }
+            if (mSampleCount == 1)
+            {
+                ImGui::Checkbox("FXAA", &mEnableFXAA);
+            }
+            else
+            {
+                ImGui::Checkbox("Fused Resolve", &mEnableFusedResolve);
+            }
+
+            ImGui::Checkbox("Enable DoF", &mEnableDoF);
+            ImGui::Checkbox("CPU SAT", &mUseCPUForSAT);
+            if (!mUseCPUForSAT)
+            {
+                ImGui::Checkbox("Incremental SAT", &mEnableIncrementalSAT);
+                ImGui::SameLine();
+                if (ImGui::Button("Benchmark"))
+                {
+                    mSATBenchmarkRequested = true;
+                }
+            }
+            ImGui::SliderFloat("Focus Depth", &mFocusDepth, 0.0f, 10.0f);
+            ImGui::SliderInt("Max Blur Radius", &mMaxBlurRadius, 1, 256);
+
+            ImGui::Checkbox("Progressive Thin Lens", &mEnableProgressiveDoF);
+            if (mEnableProgressiveDoF)
+            {
+                ImGui::SliderInt("Idle Frames", &mIdleFramesBeforeAccumulating, 1, 120);
+                ImGui::SliderInt("Lens Samples", &mLensSampleCount, 1, kMaxLensSampleCount);
+                if (refreshStats || mThinLensStatusText.empty())
+                {
+                    mThinLensStatusText.clear();
+                    if (mAccumulatingDoF)
+                    {
+                        mThinLensStatusText.append("Thin lens: %d of %d samples", mAccumulatedSampleCount, mLensSampleCount);
+                    }
+                    else
+                    {
+                        mThinLensStatusText.append("Thin lens: idle for %d of %d frames", mIdleFrameCount, mIdleFramesBeforeAccumulating);
+                    }
+                }
+                ImGui::TextUnformatted(mThinLensStatusText.begin(), mThinLensStatusText.end());
+            }
+
+            ImGui::Checkbox("Dynamic Resolution", &mEnableDynamicResolution);
+            if (mEnableDynamicResolution)
+            {
+                ImGui::SliderFloat("Target GPU Time (ms)", &mTargetGPUFrameTimeMs, 4.0f, 50.0f);
+            }
+            else
+            {
+                ImGui::SliderInt("Render Scale", &mRenderScaleStep, kMinRenderScaleStep, kRenderScaleSteps, "%.0f/16");
+            }
+            ImGui::Text("Render Resolution: %dx%d (%d%%)", mBackbufferWidth, mBackbufferHeight, mRenderScaleStep * 100 / kRenderScaleSteps);
+
+            const char* upscalerNames[Upscaler_Count] = { "Bilinear", "EASU + RCAS" };
+            ImGui::Combo("Upscaler", &mUpscaler, upscalerNames, Upscaler_Count);
+            if (mUpscaler == Upscaler_EASU)
+            {
+                ImGui::SliderFloat("Sharpness", &mUpscaleSharpness, 0.0f, 1.0f);
+            }
+
+            const char* depthPrePassNames[DepthPrePass_Count] = { "Off", "On", "Auto" };
+            ImGui::Combo("Depth Pre-Pass", &mDepthPrePassMode, depthPrePassNames, DepthPrePass_Count);
+            if (mDepthPrePassMode == DepthPrePass_Auto)
+            {
+                ImGui::Text("Depth Pre-Pass: %s", mDepthPrePassActive ? "on" : "off");
+            }
+
+            ImGui::Checkbox("Meshlet Culling", &mEnableMeshletCulling);
+            ImGui::Checkbox("Backface Culling", &mEnableBackfaceCulling);
+            ImGui::Checkbox("Occlusion Culling", &mEnableOcclusionCulling);
+        }
+        ImGui::End();
+
+        if (ImGui::Begin("Multi-View"))
+        {
+            ImGui::Checkbox("Enable", &mEnableMultiView);
+            ImGui::Text("Views: %d (the scene's cameras)", (int)mScene->Cameras.size());
+
+            if (ImGui::Button("Add Camera") && mScene->Cameras.size() < MULTIVIEW_MAX_VIEWS)
+            {
+                // around the main camera's target, spread by the golden angle so any number of them covers the circle
+                const Camera& mainCamera = mScene->Cameras[mScene->MainCameraID];
+                Camera camera = mainCamera;
+                float angle = 2.39996323f * mScene->Cameras.size();
+                glm::mat4 orbit = translate(mainCamera.Target) * rotate(angle, mainCamera.Up) * translate(-mainCamera.Target);
+                camera.Eye = glm::vec3(orbit * glm::vec4(mainCamera.Eye, 1.0f));
+                mScene->Cameras.insert(camera);
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Remove Camera"))
+            {
+                uint32_t lastCameraID = (uint32_t)-1;
+                for (uint32_t cameraID : mScene->Cameras)
+                {
+                    if (cameraID != mScene->MainCameraID)
+                    {
+                        lastCameraID = cameraID;
+                    }
+                }
+                if (lastCameraID != (uint32_t)-1)
+                {
+                    mScene->Cameras.erase(lastCameraID);
+                }
+            }
+
+            if (mEnableMultiView)
+            {
+                ImGui::Text("View Resolution: %dx%d", mMultiViewWidth, mMultiViewHeight);
+                if (mFrameExporter)
+                {
+                    ImGui::Text("(the frame export is paused)");
+                }
+            }
+        }
+        ImGui::End();
+
+        if (ImGui::Begin("Offline Still"))
+        {
+            ImGui::InputText("File (.ppm/.png)", mStillFilename, sizeof(mStillFilename));
+            ImGui::InputInt("Width", &mStillWidth);
+            ImGui::InputInt("Height", &mStillHeight);
+            ImGui::InputInt("Tile Size", &mStillTileSize);
+            mStillWidth = std::max(1, mStillWidth);
+            mStillHeight = std::max(1, mStillHeight);
+            mStillTileSize = std::max(64, mStillTileSize);
+
+            // rendered at the start of the next frame
+            if (ImGui::Button("Render Still"))
+            {
+                mStillRequested = true;
+            }
+        }
+        ImGui::End();
+
+        if (ImGui::Begin("Capture"))
+        {
+            if (!mFrameWriter)
+            {
+                const char* captureFormatNames[CaptureFormat_Count] = { "Y4M", "Raw RGBA", "PNG Sequence" };
+                ImGui::Combo("Format", &mCaptureFormat, captureFormatNames, CaptureFormat_Count);
+                ImGui::InputText("Path", mCapturePath, sizeof(mCapturePath));
+                ImGui::InputInt("FPS", &mCaptureFramesPerSecond);
+                mCaptureFramesPerSecond = std::max(1, mCaptureFramesPerSecond);
+
+                if (ImGui::Button("Start Recording"))
+                {
+                    StartCapture();
+                }
+            }
+            else
+            {
+                if (ImGui::Button("Stop Recording"))
+                {
+                    StopCapture();
+                }
+            }
+
+            if (mCaptureFramesIssued > 0)
+            {
+                ImGui::Text("Frames: %d, written: %d", mCaptureFramesIssued, mFrameWriter ? mFrameWriter->GetFramesWritten() : mCaptureFramesIssued - mCaptureFramesDroppedReadback - mCaptureFramesDroppedWriter);
+                ImGui::Text("Dropped: %d (readback busy), %d (writer busy)", mCaptureFramesDroppedReadback, mCaptureFramesDroppedWriter);
+            }
+        }
+        ImGui::End();
+
+        if (ImGui::Begin("Frame Export"))
+        {
+            if (!mFrameExporter)
+            {
+                ImGui::InputText("Shared Memory", mFrameExportName, sizeof(mFrameExportName));
+                ImGui::Checkbox("Linear Depth", &mExportLinearDepth);
+                ImGui::Checkbox("CoC", &mExportCoC);
+            }
+
+            if (ImGui::Checkbox("Export", &mEnableFrameExport))
+            {
+                if (mEnableFrameExport)
+                {
+                    StartFrameExport();
+                }
+                else if (mFrameExporter)
+                {
+                    StopFrameExport();
+                }
+            }
+
+            if (mFrameExporter)
+            {
+                ImGui::Text("Readback: %s", mExportPinnedMemory ? "into shared memory (pinned)" : "PBO + copy");
+                ImGui::Text("Published: %llu, dropped: %llu", (unsigned long long)mExportFramesPublished, (unsigned long long)mExportFramesDropped);
+            }
+        }
+        ImGui::End();
+    }
+
+    void GetCameraMatrices(float aspect, glm::vec3* eye, glm::mat4* V, glm::mat4* P)
+    {
+        GetCameraMatrices(mScene->Cameras[mScene->MainCameraID], aspect, eye, V, P);
+    }
+
+    static void GetCameraMatrices(const Camera& camera, float aspect, glm::vec3* eye, glm::mat4* V, glm::mat4* P)
+    {
+        *eye = camera.Eye;
+        glm::vec3 up = camera.Up;
+
+        *V = glm::lookAt(*eye, camera.Target, up);
+
+        float f = 1.0f / tanf(camera.FovY / 2.0f);
+        *P = glm::mat4(
+            f / aspect, 0.0f, 0.0f, 0.0f,
+            0.0f, f, 0.0f, 0.0f,
+            0.0f, 0.0f, 0.0f, -1.0f,
+            0.0f, 0.0f, camera.ZNear, 0.0f);
+    }
+
+    static glm::mat4 GetInstanceMW(const Transform* transform)
+    {
+        glm::mat4 MW;
+        MW = translate(-transform->RotationOrigin) * MW;
+        MW = mat4_cast(transform->Rotation) * MW;
+        MW = translate(transform->RotationOrigin) * MW;
+        MW = scale(transform->Scale) * MW;
+        MW = translate(transform->Translation) * MW;
+        return MW;
+    }
+
+    // Pixels [x0, x1) x [y0, y1) of the backbuffer that the mesh's bounds cover through MVP, with the resolve's margin.
+    // All of them if the bounds reach behind the eye, and none if they're off the view.
+    glm::ivec4 GetMeshScreenRect(const Mesh& mesh, const glm::mat4& MVP) const
+    {
+        const OccluderMesh& occluder = mesh.Occluder;
+
+        glm::vec2 ndcMin(1e30f), ndcMax(-1e30f);
+        for (int i = 0; i < 8; i++)
+        {
+            glm::vec4 corner = MVP * glm::vec4(
+                (i & 1) ? occluder.BoundsMax.x : occluder.BoundsMin.x,
+                (i & 2) ? occluder.BoundsMax.y : occluder.BoundsMin.y,
+                (i & 4) ? occluder.BoundsMax.z : occluder.BoundsMin.z,
+                1.0f);
+            if (corner.w <= 0.0f)
+            {
+                return glm::ivec4(0, 0, mBackbufferWidth, mBackbufferHeight);
+            }
+
+            glm::vec2 ndc = glm::vec2(corner) / corner.w;
+            ndcMin = min(ndcMin, ndc);
+            ndcMax = max(ndcMax, ndc);
+        }
+
+        // the corners in front of the near plane project outside of the part that's drawn, so this is conservative
+        glm::vec2 size = glm::vec2(mBackbufferWidth, mBackbufferHeight);
+        glm::vec2 pixelMin = glm::floor((glm::clamp(ndcMin, -2.0f, 2.0f) * 0.5f + 0.5f) * size);
+        glm::vec2 pixelMax = glm::ceil((glm::clamp(ndcMax, -2.0f, 2.0f) * 0.5f + 0.5f) * size);
+        glm::ivec4 rect(
+            std::max(0, (int)pixelMin.x - kResolveFootprintRadius),
+            std::max(0, (int)pixelMin.y - kResolveFootprintRadius),
+            std::min(mBackbufferWidth, (int)pixelMax.x + kResolveFootprintRadius),
+            std::min(mBackbufferHeight, (int)pixelMax.y + kResolveFootprintRadius));
+        if (rect.x >= rect.z || rect.y >= rect.w)
+        {
+            return glm::ivec4(0);
+        }
+        return rect;
+    }
+
+    // Finds the pixels of the main view that changed since the last frame (from the instances that moved, appeared,
+    // went away, or whose materials changed) and decides whether the SAT is patched there, which needs the rest of the
+    // view to be the same as in the last frame. Lights that change are left to a full SAT, since they reach any pixel.
+    // Returns whether anything that the image depends on changed since the last frame.
+    bool UpdateSATDirtyRect(const glm::mat4& V, const glm::mat4& P)
+    {
+        mSATFrameIndex++;
+
+        glm::mat4 VP = P * V;
+
+        glm::ivec4 dirtyRect(0);
+        auto addDirtyRect = [&](const glm::ivec4& rect)
+        {
+            if (rect.x >= rect.z || rect.y >= rect.w)
+            {
+                return;
+            }
+            if (dirtyRect.x >= dirtyRect.z)
+            {
+                dirtyRect = rect;
+            }
+            else
+            {
+                dirtyRect = glm::ivec4(glm::min(glm::ivec2(dirtyRect), glm::ivec2(rect)), glm::max(glm::ivec2(dirtyRect.z, dirtyRect.w), glm::ivec2(rect.z, rect.w)));
+            }
+        };
+
+        std::vector<uint32_t, FrameAllocator<uint32_t>> changedMaterialIDs((FrameAllocator<uint32_t>(&mFrameArena)));
+        for (uint32_t materialID : mScene->Materials)
+        {
+            const Material& material = mScene->Materials[materialID];
+
+            MaterialShading shading;
+            memcpy(shading.Ambient, material.Ambient, sizeof(shading.Ambient));
+            memcpy(shading.Diffuse, material.Diffuse, sizeof(shading.Diffuse));
+            memcpy(shading.Specular, material.Specular, sizeof(shading.Specular));
+            shading.Shininess = material.Shininess;
+            shading.DiffuseMapID = material.DiffuseMapID;
+
+            auto found = mMaterialShadings.find(materialID);
+            if (found == mMaterialShadings.end() || memcmp(&found->second, &shading, sizeof(shading)) != 0)
+            {
+                changedMaterialIDs.push_back(materialID);
+                mMaterialShadings[materialID] = shading;
+            }
+        }
+        if (mMaterialShadings.size() != mScene->Materials.size())
+        {
+            for (auto it = mMaterialShadings.begin(); it != mMaterialShadings.end();)
+            {
+                it = mScene->Materials.contains(it->first) ? std::next(it) : mMaterialShadings.erase(it);
+            }
+        }
+
+        for (uint32_t instanceID : mScene->Instances)
+        {
+            const Instance* instance = &mScene->Instances[instanceID];
+            const Mesh* mesh = &mScene->Meshes[instance->MeshID];
+            const Transform* transform = &mScene->Transforms[instance->TransformID];
+
+            glm::mat4 MW = GetInstanceMW(transform);
+            glm::ivec4 rect = GetMeshScreenRect(*mesh, VP * MW);
+
+            auto found = mInstanceFootprints.find(instanceID);
+            if (found == mInstanceFootprints.end())
+            {
+                addDirtyRect(rect);
+                mInstanceFootprints[instanceID] = InstanceFootprint{ instance->MeshID, MW, rect, mSATFrameIndex };
+                continue;
+            }
+
+            InstanceFootprint& footprint = found->second;
+            bool changed = footprint.MeshID != instance->MeshID || footprint.MW != MW;
+            for (size_t i = 0; i < changedMaterialIDs.size() && !changed; i++)
+            {
+                changed = std::find(mesh->MaterialIDs.begin(), mesh->MaterialIDs.end(), changedMaterialIDs[i]) != mesh->MaterialIDs.end();
+            }
+            if (changed)
+            {
+                addDirtyRect(footprint.Rect);
+                addDirtyRect(rect);
+            }
+
+            footprint = InstanceFootprint{ instance->MeshID, MW, rect, mSATFrameIndex };
+        }
+
+        // the instances that went away uncover what they hid
+        if (mInstanceFootprints.size() != mScene->Instances.size())
+        {
+            for (auto it = mInstanceFootprints.begin(); it != mInstanceFootprints.end();)
+            {
+                if (it->second.FrameIndex != mSATFrameIndex)
+                {
+                    addDirtyRect(it->second.Rect);
+                    it = mInstanceFootprints.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+
+        SATViewState viewState;
+        memset((void*)&viewState, 0, sizeof(viewState));
+        viewState.V = V;
+        viewState.P = P;
+        viewState.Width = mBackbufferWidth;
+        viewState.Height = mBackbufferHeight;
+        viewState.SampleCount = mSampleCount;
+        viewState.EnableFXAA = mEnableFXAA;
+        viewState.EnableFusedResolve = mEnableFusedResolve;
+        viewState.EnableBackfaceCulling = mEnableBackfaceCulling;
+        viewState.DepthPrePassActive = mDepthPrePassActive;
+        viewState.EnableMeshletCulling = mEnableMeshletCulling;
+        viewState.EnableOcclusionCulling = mEnableOcclusionCulling;
+        bool sameView = memcmp(&viewState, &mSATViewState, sizeof(viewState)) == 0;
+        mSATViewState = viewState;
+
+        bool sameLights = mSATLights.size() == mScene->Lights.size();
+        size_t lightIndex = 0;
+        mSATLights.resize(mScene->Lights.size());
+        for (uint32_t lightID : mScene->Lights)
+        {
+            const Light& light = mScene->Lights[lightID];
+            Light& lastLight = mSATLights[lightIndex++];
+            sameLights = sameLights &&
+                light.Position == lastLight.Position && light.Color == lastLight.Color && light.Radius == lastLight.Radius &&
+                light.IsSpot == lastLight.IsSpot && light.Direction == lastLight.Direction &&
+                light.SpotCosInner == lastLight.SpotCosInner && light.SpotCosOuter == lastLight.SpotCosOuter;
+            lastLight = light;
+        }
+
+        mSATDirtyRect = dirtyRect;
+        mPatchSAT = mEnableIncrementalSAT && mEnableDoF && !mUseCPUForSAT && mSATHistoryValid && sameView && sameLights &&
+            dirtyRect.z - dirtyRect.x <= GLDOF_MAX_PATCH_SIZE && dirtyRect.w - dirtyRect.y <= GLDOF_MAX_PATCH_SIZE;
+
+        return !sameView || !sameLights || (dirtyRect.x < dirtyRect.z && dirtyRect.y < dirtyRect.w);
+    }
+
+    // Rasterizes the instances that are biggest in VP's view as occluders, and flags the instances hidden behind them
+    void CullOccludedInstances(const glm::mat4& VP)
+    {
+        mCPUTimestampQueryResults[CPUTimestamps::OcclusionCullingStart] = SDL_GetPerformanceCounter();
+
+        mInstanceOccluded.assign(mScene->Instances.size(), 0);
+        mOccludedInstanceCount = 0;
+
+        if (mEnableOcclusionCulling)
+        {
+            int height = std::max(1, (kOcclusionBufferWidth * mBackbufferHeight + mBackbufferWidth / 2) / mBackbufferWidth);
+            if (mOcclusionBuffer.GetWidth() != kOcclusionBufferWidth || mOcclusionBuffer.GetHeight() != height)
+            {
+                mOcclusionBuffer.Resize(kOcclusionBufferWidth, height);
+            }
+            mOcclusionBuffer.Begin(VP);
+
+            struct OccluderCandidate
+            {
+                float ScreenSize;
+                uint32_t InstanceIndex;
+            };
+            std::vector<OccluderCandidate, FrameAllocator<OccluderCandidate>> candidates((FrameAllocator<OccluderCandidate>(&mFrameArena)));
+            std::vector<glm::mat4, FrameAllocator<glm::mat4>> instanceMWs((FrameAllocator<glm::mat4>(&mFrameArena)));
+            std::vector<const OccluderMesh*, FrameAllocator<const OccluderMesh*>> instanceOccluders((FrameAllocator<const OccluderMesh*>(&mFrameArena)));
+            instanceMWs.reserve(mScene->Instances.size());
+            instanceOccluders.reserve(mScene->Instances.size());
+
+            for (uint32_t instanceID : mScene->Instances)
+            {
+                const Instance* instance = &mScene->Instances[instanceID];
+                const Mesh* mesh = &mScene->Meshes[instance->MeshID];
+                const Transform* transform = &mScene->Transforms[instance->TransformID];
+                const OccluderMesh* occluder = &mesh->Occluder;
+
+                glm::mat4 MW = GetInstanceMW(transform);
+                uint32_t instanceIndex = (uint32_t)instanceMWs.size();
+                instanceMWs.push_back(MW);
+                instanceOccluders.push_back(occluder);
+
+                if (occluder->Indices.empty())
+                {
+                    continue;
+                }
+
+                // the bounding sphere's angular radius, or more when the eye is inside of it
+                glm::vec3 scale = glm::abs(transform->Scale);
+                float radius = length((occluder->BoundsMax - occluder->BoundsMin) * 0.5f) * std::max(scale.x, std::max(scale.y, scale.z));
+                glm::vec4 center = VP * MW * glm::vec4((occluder->BoundsMin + occluder->BoundsMax) * 0.5f, 1.0f);
+                if (center.w < -radius)
+                {
+                    continue;
+                }
+                float screenSize = radius / std::max(center.w, radius);
+                if (screenSize >= kMinOccluderScreenSize)
+                {
+                    candidates.push_back(OccluderCandidate{ screenSize, instanceIndex });
+                }
+            }
+
+            std::sort(candidates.begin(), candidates.end(), [](const OccluderCandidate& a, const OccluderCandidate& b)
+            {
+                return a.ScreenSize > b.ScreenSize;
+            });
+
+            // the occluders are drawn (they'd be tested against themselves)
+            std::vector<uint8_t, FrameAllocator<uint8_t>> isOccluder(instanceMWs.size(), 0, FrameAllocator<uint8_t>(&mFrameArena));
+            int occluderCount = 0, occluderTriangleCount = 0;
+            for (const OccluderCandidate& candidate : candidates)
+            {
+                const OccluderMesh* occluder = instanceOccluders[candidate.InstanceIndex];
+                int triangleCount = (int)occluder->Indices.size() / 3;
+                if (occluderCount == kMaxOccluderCount || occluderTriangleCount + triangleCount > kMaxOccluderTriangleCount)
+                {
+                    continue;
+                }
+
+                mOcclusionBuffer.AddOccluder(*occluder, instanceMWs[candidate.InstanceIndex]);
+                isOccluder[candidate.InstanceIndex] = 1;
+                occluderCount++;
+                occluderTriangleCount += triangleCount;
+            }
+
+            mOcclusionBuffer.Rasterize();
+
+            for (uint32_t i = 0; i < (uint32_t)instanceMWs.size(); i++)
+            {
+                const OccluderMesh* occluder = instanceOccluders[i];
+                if (!isOccluder[i] && mOcclusionBuffer.IsOccluded(occluder->BoundsMin, occluder->BoundsMax, instanceMWs[i]))
+                {
+                    mInstanceOccluded[i] = 1;
+                    mOccludedInstanceCount++;
+                }
+            }
+        }
+
+        mCPUTimestampQueryResults[CPUTimestamps::OcclusionCullingEnd] = SDL_GetPerformanceCounter();
+    }
+
+    // Draws all the instances with the scene program that's bound. VP is unused by the layered program.
+    // If depthOnly, only the positions are drawn, without materials, for the depth pre-pass program.
+    // If cull, only the meshlets visible in VP are drawn (with meshlet culling), of the instances that
+    // CullOccludedInstances didn't find hidden (with occlusion culling).
+    void DrawSceneInstances(const glm::mat4& VP, bool depthOnly, bool cull)
+    {
+        bool cullMeshlets = cull && mEnableMeshletCulling;
+        bool cullOccluded = cull && mEnableOcclusionCulling;
+
+        if (mEnableBackfaceCulling)
+        {
+            glEnable(GL_CULL_FACE);
+        }
+
+        if (!depthOnly)
+        {
+            mVisibleMeshletCount = 0;
+            mTotalMeshletCount = 0;
+        }
+
+        uint32_t instanceIndex = 0;
+        for (uint32_t instanceID : mScene->Instances)
+        {
+            const Instance* instance = &mScene->Instances[instanceID];
+            const Mesh* mesh = &mScene->Meshes[instance->MeshID];
+            const Transform* transform = &mScene->Transforms[instance->TransformID];
+
+            bool occluded = cullOccluded && instanceIndex < mInstanceOccluded.size() && mInstanceOccluded[instanceIndex];
+            instanceIndex++;
+
+            glm::mat4 MW = GetInstanceMW(transform);
+
+            glm::mat3 N_MW;
+            N_MW = mat3_cast(transform->Rotation) * N_MW;
+            N_MW = glm::mat3(scale(1.0f / transform->Scale)) * N_MW;
+
+            glm::mat4 MVP = VP * MW;
+
+            if (!depthOnly)
+            {
+                mTotalMeshletCount += (int)mesh->Meshlets.MeshletCount;
+            }
+
+            if (occluded)
+            {
+                continue;
+            }
+
+            if (cullMeshlets)
+            {
+                // mirrored instances have their winding flipped, so their cones would cull the front faces
+                bool cullBackfaces = mEnableBackfaceCulling && glm::determinant(glm::mat3(MW)) > 0.0f;
+                if (!CullMeshlets(mesh->Meshlets, MVP, cullBackfaces, mMeshletDrawList))
+                {
+                    continue;
+                }
+
+                if (!depthOnly)
+                {
+                    mVisibleMeshletCount += (int)mMeshletDrawList.VisibleMeshletCount;
+                }
+            }
+            else if (!depthOnly)
+            {
+                mVisibleMeshletCount += (int)mesh->Meshlets.MeshletCount;
+            }
+
+            if (depthOnly)
+            {
+                glUniformMatrix4fv(SCENE_MVP_UNIFORM_LOCATION, 1, GL_FALSE, value_ptr(MVP));
+
+                glBindVertexArray(mesh->DepthVAO);
+                for (size_t meshDrawIdx = 0; meshDrawIdx < mesh->DrawCommands.size(); meshDrawIdx++)
+                {
+                    DrawMeshCommand(mesh, meshDrawIdx, cullMeshlets);
+                }
+                glBindVertexArray(0);
+                continue;
+            }
+
+            glUniformMatrix4fv(SCENE_MW_UNIFORM_LOCATION, 1, GL_FALSE, value_ptr(MW));
+            glUniformMatrix3fv(SCENE_N_MW_UNIFORM_LOCATION, 1, GL_FALSE, value_ptr(N_MW));
+            glUniformMatrix4fv(SCENE_MVP_UNIFORM_LOCATION, 1, GL_FALSE, value_ptr(MVP));
+
+            glBindVertexArray(mesh->MeshVAO);
+            for (size_t meshDrawIdx = 0; meshDrawIdx < mesh->DrawCommands.size(); meshDrawIdx++)
+            {
+                if (cullMeshlets && mMeshletDrawList.DrawCommandFirstRange[meshDrawIdx] == mMeshletDrawList.DrawCommandFirstRange[meshDrawIdx + 1])
+                {
+                    continue;
+                }
+
+                const Material* material = &mScene->Materials[mesh->MaterialIDs[meshDrawIdx]];
+
+                glActiveTexture(GL_TEXTURE0 + SCENE_DIFFUSE_MAP_TEXTURE_BINDING);
+                if (material->DiffuseMapID == kNoDiffuseMap)
+                {
+                    glBindTexture(GL_TEXTURE_2D, 0);
+                    glUniform1i(SCENE_HAS_DIFFUSE_MAP_UNIFORM_LOCATION, 0);
+                }
+                else
+                {
+                    const DiffuseMap* diffuseMap = &mScene->DiffuseMaps[material->DiffuseMapID];
+                    glBindTexture(GL_TEXTURE_2D, diffuseMap->DiffuseMapTO);
+                    glUniform1i(SCENE_HAS_DIFFUSE_MAP_UNIFORM_LOCATION, 1);
+                }
+
+                glUniform3fv(SCENE_AMBIENT_UNIFORM_LOCATION, 1, material->Ambient);
+                glUniform3fv(SCENE_DIFFUSE_UNIFORM_LOCATION, 1, material->Diffuse);
+                glUniform3fv(SCENE_SPECULAR_UNIFORM_LOCATION, 1, material->Specular);
+                glUniform1f(SCENE_SHININESS_UNIFORM_LOCATION, material->Shininess);
+
+                DrawMeshCommand(mesh, meshDrawIdx, cullMeshlets);
+            }
+            glBindVertexArray(0);
+        }
+
+        glDisable(GL_CULL_FACE);
+    }
+
+    // Draws one of the mesh's draw commands, or only its visible ranges (from the last CullMeshlets) if culled.
+    void DrawMeshCommand(const Mesh* mesh, size_t meshDrawIdx, bool culled)
+    {
+        if (culled)
+        {
+            uint32_t firstRange = mMeshletDrawList.DrawCommandFirstRange[meshDrawIdx];
+            uint32_t rangeCount = mMeshletDrawList.DrawCommandFirstRange[meshDrawIdx + 1] - firstRange;
+            if (rangeCount > 0)
+            {
+                glMultiDrawElements(
+                    GL_TRIANGLES,
+                    &mMeshletDrawList.Counts[firstRange],
+                    GL_UNSIGNED_INT, &mMeshletDrawList.Offsets[firstRange],
+                    rangeCount);
+            }
+            return;
+        }
+
+        const GLDrawElementsIndirectCommand* drawCmd = &mesh->DrawCommands[meshDrawIdx];
+        glDrawElementsInstancedBaseVertexBaseInstance(
+            GL_TRIANGLES,
+            drawCmd->count,
+            GL_UNSIGNED_INT, (GLvoid*)(sizeof(uint32_t) * drawCmd->firstIndex),
+            drawCmd->primCount,
+            drawCmd->baseVertex,
+            drawCmd->baseInstance);
+    }
+
+    // Uploads the scene's lights, and bins them into the clusters of the view for the scene pass.
+    void CullLights(const glm::mat4& V, const glm::mat4& P)
+    {
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::LightCullingStart], GL_TIMESTAMP);
+        mCulledLightCount = 0;
+        if (*mLightCullSP && !mScene->Lights.empty())
+        {
+            std::vector<GPULight, FrameAllocator<GPULight>> lightUploads((FrameAllocator<GPULight>(&mFrameArena)));
+            lightUploads.reserve(mScene->Lights.size());
+            for (uint32_t lightID : mScene->Lights)
+            {
+                const Light& light = mScene->Lights[lightID];
+
+                // the spot falloff is clamp(cos * scale + offset, 0, 1), which is always 1 for point lights
+                float spotScale = 0.0f, spotOffset = 1.0f;
+                if (light.IsSpot)
+                {
+                    spotScale = 1.0f / std::max(light.SpotCosInner - light.SpotCosOuter, 1e-4f);
+                    spotOffset = -light.SpotCosOuter * spotScale;
+                }
+
+                GPULight gpuLight;
+                gpuLight.PositionRadius = glm::vec4(light.Position, light.Radius);
+                gpuLight.ColorSpotScale = glm::vec4(light.Color, spotScale);
+                gpuLight.DirectionSpotOffset = glm::vec4(light.IsSpot ? normalize(light.Direction) : glm::vec3(0.0f), spotOffset);
+                lightUploads.push_back(gpuLight);
+            }
+
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, mLightsBO);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, lightUploads.size() * sizeof(GPULight), lightUploads.data(), GL_STREAM_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, mLightIndexCounterBO);
+            glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+            mCulledLightCount = (int)lightUploads.size();
+            mLightClusterCountX = (mBackbufferWidth + LIGHT_CLUSTER_TILE_SIZE - 1) / LIGHT_CLUSTER_TILE_SIZE;
+            mLightClusterCountY = (mBackbufferHeight + LIGHT_CLUSTER_TILE_SIZE - 1) / LIGHT_CLUSTER_TILE_SIZE;
+            // P[3][2] is the near plane of the reversed-Z infinite projection (also for the sub-frusta of stills' tiles)
+            mLightZNear = P[3][2];
+            mLightSliceScale = LIGHT_CLUSTER_SLICE_COUNT / logf(kLightClusterFarDepth / mLightZNear);
+
+            glUseProgram(*mLightCullSP);
+
+            GLuint buffers[] = { mLightsBO, mLightClustersBO, mLightIndicesBO, mLightIndexCounterBO };
+            glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, LIGHTS_BUFFER_BINDING, 4, buffers);
+
+            glUniformMatrix4fv(LIGHT_CULL_VIEW_UNIFORM_LOCATION, 1, GL_FALSE, value_ptr(V));
+            glUniform4f(LIGHT_CULL_UNPROJECT_UNIFORM_LOCATION, 1.0f / P[0][0], 1.0f / P[1][1], P[2][0], P[2][1]);
+            glUniform2i(LIGHT_CULL_RENDER_SIZE_UNIFORM_LOCATION, mBackbufferWidth, mBackbufferHeight);
+            glUniform1f(LIGHT_CULL_ZNEAR_UNIFORM_LOCATION, mLightZNear);
+            glUniform1f(LIGHT_CULL_SLICE_SCALE_UNIFORM_LOCATION, mLightSliceScale);
+            glUniform1i(LIGHT_CULL_LIGHT_COUNT_UNIFORM_LOCATION, mCulledLightCount);
+            glUniform1ui(LIGHT_CULL_INDEX_CAPACITY_UNIFORM_LOCATION, mLightIndexCapacity);
+
+            glDispatchCompute(mLightClusterCountX, mLightClusterCountY, LIGHT_CLUSTER_SLICE_COUNT);
+
+            glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, LIGHTS_BUFFER_BINDING, 4, NULL);
+            glUseProgram(0);
+
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        }
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::LightCullingEnd], GL_TIMESTAMP);
+    }
+
+    void RenderScene(const glm::mat4& V, const glm::mat4& P, const glm::vec3& eye)
+    {
+        CullLights(V, P);
+
+        glm::mat4 VP = P * V;
+        CullOccludedInstances(VP);
+        bool depthPrePass = mDepthPrePassActive && *mDepthPrePassSP && *mSceneSP;
+
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::DepthPrePassStart], GL_TIMESTAMP);
+        if (depthPrePass)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, mBackbufferFBOMS);
+            glViewport(0, 0, mBackbufferWidth, mBackbufferHeight);
+
+            glClearDepth(0.0f);
+            glClear(GL_DEPTH_BUFFER_BIT);
+
+            glUseProgram(*mDepthPrePassSP);
+
+            glEnable(GL_DEPTH_TEST);
+            glDepthFunc(GL_GREATER);
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            DrawSceneInstances(VP, true, true);
+
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glDepthFunc(GL_LESS);
+            glDisable(GL_DEPTH_TEST);
+            glUseProgram(0);
+
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::DepthPrePassEnd], GL_TIMESTAMP);
+
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::RenderSceneStart], GL_TIMESTAMP);
+        if (*mSceneSP)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, mBackbufferFBOMS);
+            glViewport(0, 0, mBackbufferWidth, mBackbufferHeight);
+
+            glClearColor(100.0f / 255.0f, 149.0f / 255.0f, 237.0f / 255.0f, 1.0f);
+            if (depthPrePass)
+            {
+                glClear(GL_COLOR_BUFFER_BIT);
+            }
+            else
+            {
+                glClearDepth(0.0f);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            }
+
+            glUseProgram(*mSceneSP);
+
+            glUniform3fv(SCENE_CAMERAPOS_UNIFORM_LOCATION, 1, value_ptr(eye));
+
+            glUniform1i(SCENE_LIGHT_COUNT_UNIFORM_LOCATION, mCulledLightCount);
+            if (mCulledLightCount > 0)
+            {
+                glUniform3i(SCENE_LIGHT_CLUSTER_COUNT_UNIFORM_LOCATION, mLightClusterCountX, mLightClusterCountY, LIGHT_CLUSTER_SLICE_COUNT);
+                glUniform1f(SCENE_LIGHT_SLICE_SCALE_UNIFORM_LOCATION, mLightSliceScale);
+                glUniform1f(SCENE_ZNEAR_UNIFORM_LOCATION, mLightZNear);
+
+                GLuint buffers[] = { mLightsBO, mLightClustersBO, mLightIndicesBO };
+                glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, LIGHTS_BUFFER_BINDING, 3, buffers);
+            }
+
+            glEnable(GL_DEPTH_TEST);
+            if (depthPrePass)
+            {
+                // the depth is final, only the fragments that made it are shaded
+                glDepthFunc(GL_EQUAL);
+                glDepthMask(GL_FALSE);
+            }
+            else
+            {
+                glDepthFunc(GL_GREATER);
+            }
+            glEnable(GL_FRAMEBUFFER_SRGB);
+
+            if (mHasPipelineStatistics)
+            {
+                glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, mFragmentInvocationsQuery);
+            }
+
+            DrawSceneInstances(VP, false, true);
+
+            if (mHasPipelineStatistics)
+            {
+                glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+                mFragmentInvocationsQueryIssued = true;
+                mFragmentInvocationsQueryWithPrePass = depthPrePass;
+                mFragmentInvocationsQueryPixels = mBackbufferWidth * mBackbufferHeight;
+            }
+
+            glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, LIGHTS_BUFFER_BINDING, 3, NULL);
+            glBindTextures(0, kMaxTextureCount, NULL);
+            glDisable(GL_FRAMEBUFFER_SRGB);
+            glDepthMask(GL_TRUE);
+            glDepthFunc(GL_LESS);
+            glDisable(GL_DEPTH_TEST);
+            glUseProgram(0);
+
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::RenderSceneEnd], GL_TIMESTAMP);
+    }
+
+    // resolve multisampled backbuffer to singlesampled backbuffer
+    void ResolveBackbuffer()
+    {
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::MultisampleResolveStart], GL_TIMESTAMP);
+        mResolvedLinearDepth = mSampleCount > 1 && mEnableFusedResolve && *mFusedResolveSP;
+        // a patched SAT is still the last frame's, and so is the SAT while lens samples are accumulated
+        mResolvedSATRows = mResolvedLinearDepth && mEnableDoF && !mUseCPUForSAT && !mPatchSAT && !mAccumulatingDoF;
+        if (mResolvedLinearDepth)
+        {
+            glUseProgram(*mFusedResolveSP);
+
+            glBindTextures(RESOLVE_COLOR_TEXTURE_BINDING, 1, &mBackbufferColorTOMS);
+            glBindTextures(RESOLVE_DEPTH_TEXTURE_BINDING, 1, &mBackbufferDepthTOMS);
+            glBindImageTexture(RESOLVE_COLOR_IMAGE_BINDING, mBackbufferColorViewSS, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+            glBindImageTexture(RESOLVE_LINEAR_DEPTH_IMAGE_BINDING, mBackbufferLinearDepthTO, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+            glBindImageTexture(RESOLVE_SAT_IMAGE_BINDING, mDepthOfField->GetSummedAreaTableTexture(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
+
+            Camera& mainCamera = mScene->Cameras[mScene->MainCameraID];
+
+            glUniform1i(RESOLVE_SAMPLE_COUNT_UNIFORM_LOCATION, mSampleCount);
+            glUniform1f(RESOLVE_ZNEAR_UNIFORM_LOCATION, mainCamera.ZNear);
+            glUniform2i(RESOLVE_RENDER_SIZE_UNIFORM_LOCATION, mBackbufferWidth, mBackbufferHeight);
+            glUniform1i(RESOLVE_WRITE_SAT_UNIFORM_LOCATION, mResolvedSATRows);
+
+            int satWidth = (mBackbufferWidth + SAT_WORKGROUP_SIZE_X - 1) & -SAT_WORKGROUP_SIZE_X;
+            glDispatchCompute(satWidth / SAT_WORKGROUP_SIZE_X, mBackbufferHeight, 1);
+
+            glBindTextures(RESOLVE_COLOR_TEXTURE_BINDING, 2, NULL);
+            glBindImageTextures(RESOLVE_COLOR_IMAGE_BINDING, 3, NULL);
+            glUseProgram(0);
+
+            // the resolved color is consumed by texture fetches, framebuffer reads and pixel reads downstream
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        }
+        else if (mSampleCount == 1 && mEnableFXAA && *mFXAASP)
+        {
+            // FXAA writes the color, so only the depth needs to be copied
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, mBackbufferFBOMS);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mBackbufferFBOSS);
+            glBlitFramebuffer(
+                0, 0, mBackbufferWidth, mBackbufferHeight,
+                0, 0, mBackbufferWidth, mBackbufferHeight,
+                GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+            glBindFramebuffer(GL_FRAMEBUFFER, mBackbufferFBOSS);
+            glViewport(0, 0, mBackbufferWidth, mBackbufferHeight);
+            glUseProgram(*mFXAASP);
+            glBindVertexArray(mNullVAO);
+            glBindTextures(FXAA_COLOR_TEXTURE_BINDING, 1, &mBackbufferColorTOMS);
+            glEnable(GL_FRAMEBUFFER_SRGB);
+
+            glUniform2i(FXAA_RENDER_SIZE_UNIFORM_LOCATION, mBackbufferWidth, mBackbufferHeight);
+
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+
+            glDisable(GL_FRAMEBUFFER_SRGB);
+            glBindTextures(FXAA_COLOR_TEXTURE_BINDING, 1, NULL);
+            glBindVertexArray(0);
+            glUseProgram(0);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+        else
+        {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, mBackbufferFBOMS);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mBackbufferFBOSS);
+            glBlitFramebuffer(
+                0, 0, mBackbufferWidth, mBackbufferHeight,
+                0, 0, mBackbufferWidth, mBackbufferHeight,
+                GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::MultisampleResolveEnd], GL_TIMESTAMP);
+    }
+
+    // Compute SAT for the rendered image
+    void ComputeSAT()
+    {
+        if (mUseCPUForSAT)
+        {
+            // Dumb CPU SAT. Mainly used as a reference.
+
+            // Readback backbuffer to SAT-ify it
+            mCPUTimestampQueryResults[CPUTimestamps::ReadbackBackbufferStart] = SDL_GetPerformanceCounter();
+            glQueryCounter(mGPUTimestampQueries[GPUTimestamps::ReadbackBackbufferStart], GL_TIMESTAMP);
+            {
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, mBackbufferFBOSS);
+                glReadPixels(0, 0, mBackbufferWidth, mBackbufferHeight, GL_RGBA, GL_UNSIGNED_BYTE, &mCPUBackbufferReadback[0]);
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+            }
+            glQueryCounter(mGPUTimestampQueries[GPUTimestamps::ReadbackBackbufferEnd], GL_TIMESTAMP);
+            mCPUTimestampQueryResults[CPUTimestamps::ReadbackBackbufferEnd] = SDL_GetPerformanceCounter();
+
+            mCPUTimestampQueryResults[CPUTimestamps::ComputeSATStart] = SDL_GetPerformanceCounter();
+            
+            // sum the rows
+            for (int row = 0; row < mBackbufferHeight; row++)
+            {
+                glm::uvec4 first = glm::uvec4(mCPUBackbufferReadback[row * mBackbufferWidth + 0]);
+                first = glm::uvec4(pow(glm::vec4(first) / 255.0f, glm::vec4(2.2f)) * 255.0f);
+                mCPUSummedAreaTable[row * mSummedAreaTableWidth + 0] = first;
+
+                for (int col = 1; col < mBackbufferWidth; col++)
+                {
+                    glm::uvec4 readback = glm::uvec4(mCPUBackbufferReadback[row * mBackbufferWidth + col]);
+                    readback = glm::uvec4(pow(glm::vec4(readback) / 255.0f, glm::vec4(2.2f)) * 255.0f);
+                    mCPUSummedAreaTable[row * mSummedAreaTableWidth + col] = readback + mCPUSummedAreaTable[row * mSummedAreaTableWidth + (col - 1)];
+                }
+            }
+
+            // sum the columns (gross memory access...)
+            for (int col = 0; col < mBackbufferWidth; col++)
+            {
+                for (int row = 1; row < mBackbufferHeight; row++)
+                {
+                    mCPUSummedAreaTable[row * mSummedAreaTableWidth + col] += mCPUSummedAreaTable[(row - 1) * mSummedAreaTableWidth + col];
+                }
+            }
+            mCPUTimestampQueryResults[CPUTimestamps::ComputeSATEnd] = SDL_GetPerformanceCounter();
+
+            // Upload SAT back to GPU
+            mCPUTimestampQueryResults[CPUTimestamps::SATUploadStart] = SDL_GetPerformanceCounter();
+            glQueryCounter(mGPUTimestampQueries[GPUTimestamps::SATUploadStart], GL_TIMESTAMP);
+            {
+                glBindTexture(GL_TEXTURE_2D_ARRAY, mDepthOfField->GetSummedAreaTableTexture());
+                for (int row = 0; row < mBackbufferHeight; row++)
+                {
+                    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, row, 0, mBackbufferWidth, 1, 1, GL_RGBA_INTEGER, GL_UNSIGNED_INT, &mCPUSummedAreaTable[row * mSummedAreaTableWidth]);
+                }
+                glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+            }
+            glQueryCounter(mGPUTimestampQueries[GPUTimestamps::SATUploadEnd], GL_TIMESTAMP);
+            mCPUTimestampQueryResults[CPUTimestamps::SATUploadEnd] = SDL_GetPerformanceCounter();
+        }
+        else
+        {
+            // GPU SAT
+            glQueryCounter(mGPUTimestampQueries[GPUTimestamps::ComputeSATStart], GL_TIMESTAMP);
+            if (!mPatchSAT || !mDepthOfField->PatchSummedAreaTable(
+                mBackbufferColorTOSS, mBackbufferWidth, mBackbufferHeight,
+                mSATDirtyRect.x, mSATDirtyRect.y, mSATDirtyRect.z, mSATDirtyRect.w))
+            {
+                // the rows may already be summed by the fused resolve
+                mDepthOfField->ComputeSummedAreaTable(mBackbufferColorTOSS, mBackbufferWidth, mBackbufferHeight, mResolvedSATRows);
+            }
+            glQueryCounter(mGPUTimestampQueries[GPUTimestamps::ComputeSATEnd], GL_TIMESTAMP);
+        }
+    }
+
+    // The radical inverse of index in base (a Halton sequence), in [0, 1)
+    static float Halton(int index, int base)
+    {
+        float result = 0.0f;
+        float digitScale = 1.0f / base;
+        for (; index > 0; index /= base)
+        {
+            result += (index % base) * digitScale;
+            digitScale /= base;
+        }
+        return result;
+    }
+
+    // The radius of the thin lens in scene units, for the blur of ApplyDepthOfField(radiusScale) in the backbuffer.
+    // A point at depth d is spread over a disc of radius * f * (height / 2) * |d - F| / (F * d) pixels (f = P[1][1]), and
+    // the box filter over half-widths of |d - F| * radiusScale pixels. The lens is sized so that, at the focus plane, the
+    // disc's radius grows with depth as fast as the box's half-width. Away from it, the lens' blur grows with |d - F| / d
+    // instead of |d - F|, so it's smaller than the box's far behind the focus plane, and isn't capped.
+    float GetLensRadius(float radiusScale) const
+    {
+        const Camera& mainCamera = mScene->Cameras[mScene->MainCameraID];
+        float f = 1.0f / tanf(mainCamera.FovY / 2.0f);
+        float focusDepth = std::max(mFocusDepth, mainCamera.ZNear);
+        return radiusScale * focusDepth * focusDepth / (f * mBackbufferHeight * 0.5f);
+    }
+
+    // The main camera seen from a point of its lens: moved by lensOffset (in the view's plane, in scene units), and
+    // sheared so that the focus plane projects where it does from the lens' center, and offset by jitter pixels.
+    void GetLensSampleMatrices(const glm::vec2& lensOffset, const glm::vec2& jitter, glm::vec3* eye, glm::mat4* V, glm::mat4* P)
+    {
+        Camera& mainCamera = mScene->Cameras[mScene->MainCameraID];
+        GetCameraMatrices(mainCamera.Aspect, eye, V, P);
+
+        *V = translate(glm::vec3(-lensOffset, 0.0f)) * *V;
+        *eye = glm::vec3(inverse(*V)[3]);
+
+        // clip x and y get a multiple of w (-z in the view), which is what the lens offset takes away at the focus depth.
+        // The jitter is a constant offset after the division by w.
+        float focusDepth = std::max(mFocusDepth, mainCamera.ZNear);
+        (*P)[2][0] -= (*P)[0][0] * lensOffset.x / focusDepth + jitter.x * 2.0f / mBackbufferWidth;
+        (*P)[2][1] -= (*P)[1][1] * lensOffset.y / focusDepth + jitter.y * 2.0f / mBackbufferHeight;
+    }
+
+    // Adds the lens sample in the backbuffer to the sum (if addSample), and replaces the backbuffer with the average
+    void AccumulateLensSample(bool addSample)
+    {
+        if (mAccumulationWidth != mMaxBackbufferWidth || mAccumulationHeight != mMaxBackbufferHeight)
+        {
+            mAccumulationWidth = mMaxBackbufferWidth;
+            mAccumulationHeight = mMaxBackbufferHeight;
+
+            glDeleteTextures(1, &mAccumulationTO);
+            glGenTextures(1, &mAccumulationTO);
+            glBindTexture(GL_TEXTURE_2D, mAccumulationTO);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, mAccumulationWidth, mAccumulationHeight);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+
+        glUseProgram(*mAccumulateSP);
+
+        // the backbuffer may have been written by the resolve's image stores
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+        glBindImageTexture(ACCUMULATE_COLOR_IMAGE_BINDING, mBackbufferColorViewSS, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA8);
+        glBindImageTexture(ACCUMULATE_SUM_IMAGE_BINDING, mAccumulationTO, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+        glUniform1i(ACCUMULATE_SAMPLE_COUNT_UNIFORM_LOCATION, mAccumulatedSampleCount);
+        glUniform1i(ACCUMULATE_ADD_SAMPLE_UNIFORM_LOCATION, addSample);
+        glUniform2i(ACCUMULATE_RENDER_SIZE_UNIFORM_LOCATION, mBackbufferWidth, mBackbufferHeight);
+
+        glDispatchCompute(
+            (mBackbufferWidth + ACCUMULATE_WORKGROUP_SIZE_X - 1) / ACCUMULATE_WORKGROUP_SIZE_X,
+            (mBackbufferHeight + ACCUMULATE_WORKGROUP_SIZE_X - 1) / ACCUMULATE_WORKGROUP_SIZE_X,
+            1);
+
+        glBindImageTextures(ACCUMULATE_COLOR_IMAGE_BINDING, 2, NULL);
+        glUseProgram(0);
+
+        // the average is consumed by texture fetches, framebuffer reads and pixel reads downstream
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+
+    // Times patching the SAT against summing it again, for square regions of growing size, and prints the results.
+    // Done right after the SAT of the backbuffer is computed: the image is the same, so the patches leave it as it is.
+    // Waits for the GPU after each run.
+    void BenchmarkSAT()
+    {
+        GLuint queries[2];
+        glGenQueries(2, queries);
+
+        auto timeRuns = [&](const std::function<void()>& run)
+        {
+            GLuint64 totalNs = 0;
+            for (int i = 0; i < kSATBenchmarkRunCount; i++)
+            {
+                glQueryCounter(queries[0], GL_TIMESTAMP);
+                run();
+                glQueryCounter(queries[1], GL_TIMESTAMP);
+
+                GLuint64 start, end;
+                glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &start);
+                glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &end);
+                totalNs += end - start;
+            }
+            return totalNs / 1000000.0f / kSATBenchmarkRunCount;
+        };
+
+        int width = mBackbufferWidth, height = mBackbufferHeight;
+
+        mSATBenchmarkFullMs = timeRuns([&] {
+            mDepthOfField->ComputeSummedAreaTable(mBackbufferColorTOSS, width, height, false);
+        });
+        printf("SAT benchmark at %dx%d: summed in %.3f ms\n", width, height, mSATBenchmarkFullMs);
+
+        mSATBenchmarkResults.clear();
+        int maxSize = std::min(GLDOF_MAX_PATCH_SIZE, std::min(width, height));
+        for (int size = 16; size <= maxSize; size *= 2)
+        {
+            SATBenchmarkResult result;
+            result.Size = size;
+
+            int x0 = (width - size) / 2, y0 = (height - size) / 2;
+            result.CenterPatchMs = timeRuns([&] {
+                mDepthOfField->PatchSummedAreaTable(mBackbufferColorTOSS, width, height, x0, y0, x0 + size, y0 + size);
+            });
+            result.CornerPatchMs = timeRuns([&] {
+                mDepthOfField->PatchSummedAreaTable(mBackbufferColorTOSS, width, height, 0, 0, size, size);
+            });
+
+            printf("  %dx%d region: patched in %.3f ms (center), %.3f ms (corner)\n", size, size, result.CenterPatchMs, result.CornerPatchMs);
+            mSATBenchmarkResults.push_back(result);
+        }
+
+        glDeleteQueries(2, queries);
+    }
+
+    // Apply DoF-blur to scene
+    // radiusScale scales the blur radius relative to the window, for rendering at a different resolution.
+    void ApplyDepthOfField(float radiusScale)
+    {
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::DOFBlurStart], GL_TIMESTAMP);
+
+        Camera& mainCamera = mScene->Cameras[mScene->MainCameraID];
+
+        // in place, on the SAT computed from the backbuffer's color
+        GLDoFImage image;
+        image.ColorTO = mBackbufferColorTOSS;
+        image.DepthTO = mResolvedLinearDepth ? mBackbufferLinearDepthTO : mBackbufferDepthTOSS;
+        image.DepthIsLinear = mResolvedLinearDepth;
+        image.TargetTO = mBackbufferColorTOSS;
+        image.Width = mBackbufferWidth;
+        image.Height = mBackbufferHeight;
+        image.ZNear = mainCamera.ZNear;
+        image.FocusDepth = mFocusDepth;
+        image.RadiusScale = radiusScale;
+        image.MaxRadius = GetMaxBlurRadius(radiusScale);
+
+        mDepthOfField->ApplyBoxFilter(image);
+
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::DOFBlurEnd], GL_TIMESTAMP);
+    }
+
+    void StartCapture()
+    {
+        mCaptureWidth = mWindowWidth;
+        mCaptureHeight = mWindowHeight;
+
+        mFrameWriter = NewFrameWriter((CaptureFormat)mCaptureFormat, mCapturePath, mCaptureWidth, mCaptureHeight, mCaptureFramesPerSecond, kCaptureBufferCount);
+        if (!mFrameWriter)
+        {
+            return;
+        }
+
+        glGenBuffers(kCaptureRingSize, mCapturePBOs);
+        for (int i = 0; i < kCaptureRingSize; i++)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, mCapturePBOs[i]);
+            glBufferStorage(GL_PIXEL_PACK_BUFFER, mCaptureWidth * mCaptureHeight * 4, NULL, GL_MAP_READ_BIT);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        mCaptureOldestSlot = 0;
+        mCaptureSlotsInFlight = 0;
+        mCaptureFramesIssued = 0;
+        mCaptureFramesDroppedReadback = 0;
+        mCaptureFramesDroppedWriter = 0;
+    }
+
+    void StopCapture()
+    {
+        // the readbacks in flight are still part of the recording
+        while (mCaptureSlotsInFlight > 0)
+        {
+            glClientWaitSync(mCaptureFences[mCaptureOldestSlot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            ReceiveCapturedFrame();
+        }
+
+        glDeleteBuffers(kCaptureRingSize, mCapturePBOs);
+
+        // waits for the writer to finish the queued frames
+        bool failed = mFrameWriter->HasFailed();
+        delete mFrameWriter;
+        mFrameWriter = NULL;
+
+        printf("Capture: %d frames, %d dropped (%d readback busy, %d writer busy)%s\n",
+            mCaptureFramesIssued,
+            mCaptureFramesDroppedReadback + mCaptureFramesDroppedWriter,
+            mCaptureFramesDroppedReadback, mCaptureFramesDroppedWriter,
+            failed ? ", writing to disk failed" : "");
+    }
+
+    // Copies the oldest readback in the ring to the writer. Its fence must have signaled.
+    void ReceiveCapturedFrame()
+    {
+        int slot = mCaptureOldestSlot;
+
+        glDeleteSync(mCaptureFences[slot]);
+        mCaptureFences[slot] = 0;
+
+        uint8_t* frame = mFrameWriter->AcquireFrame();
+        if (frame)
+        {
+            size_t frameSize = mCaptureWidth * mCaptureHeight * 4;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, mCapturePBOs[slot]);
+            void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frameSize, GL_MAP_READ_BIT);
+            memcpy(frame, mapped, frameSize);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+            mFrameWriter->SubmitFrame(frame);
+        }
+        else
+        {
+            mCaptureFramesDroppedWriter++;
+        }
+
+        mCaptureOldestSlot = (mCaptureOldestSlot + 1) % kCaptureRingSize;
+        mCaptureSlotsInFlight--;
+    }
+
+    // Hands the finished readbacks to the writer, and starts reading back the window's current image.
+    void CaptureFrame()
+    {
+        while (mCaptureSlotsInFlight > 0)
+        {
+            GLenum status = glClientWaitSync(mCaptureFences[mCaptureOldestSlot], 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            {
+                break;
+            }
+            ReceiveCapturedFrame();
+        }
+
+        mCaptureFramesIssued++;
+
+        // never wait for the GPU, the frame is lost instead
+        if (mCaptureSlotsInFlight == kCaptureRingSize)
+        {
+            mCaptureFramesDroppedReadback++;
+            return;
+        }
+
+        int slot = (mCaptureOldestSlot + mCaptureSlotsInFlight) % kCaptureRingSize;
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, mCapturePBOs[slot]);
+        glReadPixels(0, 0, mCaptureWidth, mCaptureHeight, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        mCaptureFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        mCaptureSlotsInFlight++;
+    }
+
+    static bool IsExtensionSupported(const char* name)
+    {
+        GLint numExtensions;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+        for (GLint i = 0; i < numExtensions; i++)
+        {
+            if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void StartFrameExport()
+    {
+        uint32_t planeMask = FRAME_EXPORT_PLANE_BIT(FrameExportPlane_Color);
+        if (mExportLinearDepth)
+        {
+            planeMask |= FRAME_EXPORT_PLANE_BIT(FrameExportPlane_LinearDepth);
+        }
+        if (mExportCoC)
+        {
+            planeMask |= FRAME_EXPORT_PLANE_BIT(FrameExportPlane_CoC);
+        }
+
+        // the depth planes are at render resolution, which is at most the window's
+        int maxWidth[FrameExportPlane_Count] = { mWindowWidth, mMaxBackbufferWidth, mMaxBackbufferWidth };
+        int maxHeight[FrameExportPlane_Count] = { mWindowHeight, mMaxBackbufferHeight, mMaxBackbufferHeight };
+
+        mFrameExporter = NewFrameExporter(mFrameExportName, planeMask, kExportSlotCount, maxWidth, maxHeight);
+        if (!mFrameExporter)
+        {
+            mEnableFrameExport = false;
+            return;
+        }
+
+        size_t slotSize = mFrameExporter->GetSlotSize();
+
+        glGenBuffers(kExportSlotCount, mExportBuffers);
+
+        // Let GL write the readbacks straight into the shared memory
+        mExportPinnedMemory = IsExtensionSupported("GL_AMD_pinned_memory");
+        if (mExportPinnedMemory)
+        {
+            while (glGetError() != GL_NO_ERROR);
+
+            for (int i = 0; i < kExportSlotCount; i++)
+            {
+                glBindBuffer(GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD, mExportBuffers[i]);
+                glBufferData(GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD, slotSize, mFrameExporter->GetSlotData(i), GL_STREAM_READ);
+            }
+            glBindBuffer(GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD, 0);
+
+            // the driver can refuse to pin the memory
+            if (glGetError() != GL_NO_ERROR)
+            {
+                mExportPinnedMemory = false;
+                glDeleteBuffers(kExportSlotCount, mExportBuffers);
+                glGenBuffers(kExportSlotCount, mExportBuffers);
+            }
+        }
+
+        if (!mExportPinnedMemory)
+        {
+            for (int i = 0; i < kExportSlotCount; i++)
+            {
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, mExportBuffers[i]);
+                glBufferStorage(GL_PIXEL_PACK_BUFFER, slotSize, NULL, GL_CLIENT_STORAGE_BIT);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+
+        if (mExportLinearDepth || mExportCoC)
+        {
+            glGenTextures(1, &mExportLinearDepthTO);
+            glBindTexture(GL_TEXTURE_2D, mExportLinearDepthTO);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, mMaxBackbufferWidth, mMaxBackbufferHeight);
+            glBindTexture(GL_TEXTURE_2D, 0);
+
+            glGenTextures(1, &mExportCoCTO);
+            glBindTexture(GL_TEXTURE_2D, mExportCoCTO);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, mMaxBackbufferWidth, mMaxBackbufferHeight);
+            glBindTexture(GL_TEXTURE_2D, 0);
+
+            // for reading them back
+            glGenFramebuffers(1, &mExportFBO);
+            glBindFramebuffer(GL_FRAMEBUFFER, mExportFBO);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mExportLinearDepthTO, 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, mExportCoCTO, 0);
+            GLenum fboStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+            if (fboStatus != GL_FRAMEBUFFER_COMPLETE) {
+                fprintf(stderr, "glCheckFramebufferStatus: %x\n", fboStatus);
+            }
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+
+        mExportOldestSlot = 0;
+        mExportSlotsInFlight = 0;
+        mExportFramesIssued = 0;
+        mExportFramesPublished = 0;
+        mExportFramesDropped = 0;
+    }
+
+    void StopFrameExport()
+    {
+        while (mExportSlotsInFlight > 0)
+        {
+            glClientWaitSync(mExportFences[mExportOldestSlot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            PublishExportedFrame();
+        }
+
+        // the pinned buffers must be gone before the shared memory is unmapped
+        glDeleteBuffers(kExportSlotCount, mExportBuffers);
+        glDeleteFramebuffers(1, &mExportFBO);
+        glDeleteTextures(1, &mExportLinearDepthTO);
+        glDeleteTextures(1, &mExportCoCTO);
+        mExportFBO = 0;
+        mExportLinearDepthTO = 0;
+        mExportCoCTO = 0;
+
+        delete mFrameExporter;
+        mFrameExporter = NULL;
+    }
+
+    // Publishes the oldest readback in the ring. Its fence must have signaled.
+    void PublishExportedFrame()
+    {
+        int slot = mExportOldestSlot;
+        const ExportedFrame& frame = mExportedFrames[slot];
+
+        glDeleteSync(mExportFences[slot]);
+        mExportFences[slot] = 0;
+
+        if (!mExportPinnedMemory)
+        {
+            uint8_t* slotData = mFrameExporter->GetSlotData(slot);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, mExportBuffers[slot]);
+            for (int plane = 0; plane < FrameExportPlane_Count; plane++)
+            {
+                size_t offset = mFrameExporter->GetPlaneOffset((FrameExportPlane)plane);
+                size_t size = (size_t)frame.Width[plane] * frame.Height[plane] * 4;
+                if (size > 0)
+                {
+                    glGetBufferSubData(GL_PIXEL_PACK_BUFFER, offset, size, slotData + offset);
+                }
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+
+        mFrameExporter->PublishFrame(slot, frame.FrameIndex, frame.Width, frame.Height, frame.ZNear, frame.FocusDepth);
+        mExportFramesPublished++;
+
+        mExportOldestSlot = (mExportOldestSlot + 1) % kExportSlotCount;
+        mExportSlotsInFlight--;
+    }
+
+    // Publishes the finished readbacks, and starts reading back the window's current image and the depth planes.
+    void ExportFrame()
+    {
+        while (mExportSlotsInFlight > 0)
+        {
+            GLenum status = glClientWaitSync(mExportFences[mExportOldestSlot], 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            {
+                break;
+            }
+            PublishExportedFrame();
+        }
+
+        uint64_t frameIndex = mExportFramesIssued++;
+
+        // never wait for the GPU, and leave the published slots alone for the readers
+        if (mExportSlotsInFlight == kExportMaxSlotsInFlight)
+        {
+            mExportFramesDropped++;
+            return;
+        }
+
+        int slot = (mExportOldestSlot + mExportSlotsInFlight) % kExportSlotCount;
+        mFrameExporter->BeginFrame(slot);
+
+        Camera& mainCamera = mScene->Cameras[mScene->MainCameraID];
+
+        ExportedFrame& frame = mExportedFrames[slot];
+        frame = ExportedFrame();
+        frame.FrameIndex = frameIndex;
+        frame.ZNear = mainCamera.ZNear;
+        frame.FocusDepth = mFocusDepth;
+        frame.Width[FrameExportPlane_Color] = mWindowWidth;
+        frame.Height[FrameExportPlane_Color] = mWindowHeight;
+
+        bool exportDepth = (mExportLinearDepth || mExportCoC) && *mExportSP;
+        if (exportDepth)
+        {
+            glUseProgram(*mExportSP);
+
+            glBindTextures(EXPORT_DEPTH_TEXTURE_BINDING, 1, mResolvedLinearDepth ? &mBackbufferLinearDepthTO : &mBackbufferDepthTOSS);
+            glBindImageTexture(EXPORT_LINEAR_DEPTH_IMAGE_BINDING, mExportLinearDepthTO, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+            glBindImageTexture(EXPORT_COC_IMAGE_BINDING, mExportCoCTO, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+            glUniform1f(EXPORT_ZNEAR_UNIFORM_LOCATION, mainCamera.ZNear);
+            glUniform1f(EXPORT_FOCUS_UNIFORM_LOCATION, mFocusDepth);
+            glUniform2i(EXPORT_RENDER_SIZE_UNIFORM_LOCATION, mBackbufferWidth, mBackbufferHeight);
+            glUniform1i(EXPORT_DEPTH_IS_LINEAR_UNIFORM_LOCATION, mResolvedLinearDepth);
+            glUniform1i(EXPORT_MAX_RADIUS_UNIFORM_LOCATION, mEnableDoF ? GetMaxBlurRadius(1.0f) : 0);
+
+            glDispatchCompute(
+                (mBackbufferWidth + EXPORT_WORKGROUP_SIZE_X - 1) / EXPORT_WORKGROUP_SIZE_X,
+                (mBackbufferHeight + EXPORT_WORKGROUP_SIZE_X - 1) / EXPORT_WORKGROUP_SIZE_X,
+                1);
+
+            glBindTextures(EXPORT_DEPTH_TEXTURE_BINDING, 1, NULL);
+            glBindImageTextures(EXPORT_LINEAR_DEPTH_IMAGE_BINDING, 2, NULL);
+            glUseProgram(0);
+
+            // ensure the image stores are visible to the readbacks
+            glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+        }
+
+        // each plane lands at its offset in the slot
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, mExportBuffers[slot]);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glReadPixels(0, 0, mWindowWidth, mWindowHeight, GL_RGBA, GL_UNSIGNED_BYTE,
+            (void*)mFrameExporter->GetPlaneOffset(FrameExportPlane_Color));
+
+        if (exportDepth)
+        {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, mExportFBO);
+            if (mExportLinearDepth)
+            {
+                glReadBuffer(GL_COLOR_ATTACHMENT0);
+                glReadPixels(0, 0, mBackbufferWidth, mBackbufferHeight, GL_RED, GL_FLOAT,
+                    (void*)mFrameExporter->GetPlaneOffset(FrameExportPlane_LinearDepth));
+                frame.Width[FrameExportPlane_LinearDepth] = mBackbufferWidth;
+                frame.Height[FrameExportPlane_LinearDepth] = mBackbufferHeight;
+            }
+            if (mExportCoC)
+            {
+                glReadBuffer(GL_COLOR_ATTACHMENT1);
+                glReadPixels(0, 0, mBackbufferWidth, mBackbufferHeight, GL_RED, GL_FLOAT,
+                    (void*)mFrameExporter->GetPlaneOffset(FrameExportPlane_CoC));
+                frame.Width[FrameExportPlane_CoC] = mBackbufferWidth;
+                frame.Height[FrameExportPlane_CoC] = mBackbufferHeight;
+            }
+            glReadBuffer(GL_COLOR_ATTACHMENT0);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        }
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        mExportFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        mExportSlotsInFlight++;
+    }
+
+    int GetMaxBlurRadius(float radiusScale) const
+    {
+        return std::min((int)(mMaxBlurRadius * radiusScale), kMaxExactBlurRadius);
+    }
+
+    // Renders a rectangle (GL's bottom-up convention) of the main camera's view at width x height, which can be far beyond
+    // the texture size limits. The rectangle is split into tiles rendered with sub-frustum projections. Each tile is rendered
+    // with a margin of the maximum blur radius around it, so its SAT/DoF sees the same neighbourhood as a full-size render
+    // would, and the tiles (and rectangles) join seamlessly.
+    // After each tile, readTile(x, y, w, h, readX, readY) reads the tile at (x, y) of the image from (readX, readY) of mBackbufferFBOSS.
+    bool RenderStillTiles(
+        int width, int height,
+        int rectX, int rectY, int rectWidth, int rectHeight,
+        int tileSize,
+        const std::function<bool(int x, int y, int w, int h, int readX, int readY)>& readTile)
+    {
+        // also called outside of Paint (batch rendering)
+        mShaders.UpdatePrograms();
+
+        // the tiles' SATs replace the main view's
+        mSATHistoryValid = false;
+        mPatchSAT = false;
+
+        // blur radii scale with the image, so the still looks like the window at a higher resolution
+        float radiusScale = (float)height / mWindowHeight;
+
+        int margin = kStillTileResolveMargin;
+        if (mEnableDoF)
+        {
+            margin += GetMaxBlurRadius(radiusScale);
+        }
+
+        GLint maxTextureSize;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+        tileSize = std::min(tileSize, (int)maxTextureSize - 2 * margin);
+        if (tileSize < 1)
+        {
+            fprintf(stderr, "RenderStill: blur radius too large for the texture size limit\n");
+            return false;
+        }
+
+        // The backbuffers are reallocated at the size of a tile with its margins.
+        // They are restored to the window size by the next Paint, so consecutive stills of the same size don't reallocate.
+        int tileBackbufferWidth = std::min(width, tileSize + 2 * margin);
+        int tileBackbufferHeight = std::min(height, tileSize + 2 * margin);
+        if (mMaxBackbufferWidth != tileBackbufferWidth || mMaxBackbufferHeight != tileBackbufferHeight)
+        {
+            glFinish();
+            AllocateBackbuffers(tileBackbufferWidth, tileBackbufferHeight);
+        }
+
+        int windowBackbufferWidth = mBackbufferWidth;
+        int windowBackbufferHeight = mBackbufferHeight;
+
+        glm::vec3 eye;
+        glm::mat4 V, P;
+        GetCameraMatrices((float)width / height, &eye, &V, &P);
+
+        bool ok = true;
+        for (int tileY = rectY; tileY < rectY + rectHeight && ok; tileY += tileSize)
+        {
+            for (int tileX = rectX; tileX < rectX + rectWidth && ok; tileX += tileSize)
+            {
+                // the tile, and the region rendered for it.
+                // The region is clamped to the image, so the blur is clamped at the image's edges like in a full-size render.
+                int x0 = tileX, x1 = std::min(rectX + rectWidth, tileX + tileSize);
+                int y0 = tileY, y1 = std::min(rectY + rectHeight, tileY + tileSize);
+                int rx0 = std::max(0, x0 - margin), rx1 = std::min(width, x1 + margin);
+                int ry0 = std::max(0, y0 - margin), ry1 = std::min(height, y1 + margin);
+
+                // Sub-frustum of the region: scales and translates clip space so that the region's NDC range becomes [-1,1]
+                glm::mat4 S;
+                S[0][0] = (float)width / (rx1 - rx0);
+                S[1][1] = (float)height / (ry1 - ry0);
+                S[3][0] = -(float)(rx0 + rx1 - width) / (rx1 - rx0);
+                S[3][1] = -(float)(ry0 + ry1 - height) / (ry1 - ry0);
+
+                mBackbufferWidth = rx1 - rx0;
+                mBackbufferHeight = ry1 - ry0;
+
+                RenderScene(V, S * P, eye);
+
+                ResolveBackbuffer();
+
+                if (mEnableDoF)
                 {
-                    glBindFramebuffer(GL_READ_FRAMEBUFFER, mBackbufferFBOSS);
-                    glReadPixels(0, 0, mBackbufferWidth, mBackbufferHeight, GL_RGBA, GL_UNSIGNED_BYTE, &mCPUBackbufferReadback[0]);
-                    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+                    ComputeSAT();
+                    ApplyDepthOfField(radiusScale);
                 }
-                glQueryCounter(mGPUTimestampQueries[GPUTimestamps::ReadbackBackbufferEnd], GL_TIMESTAMP);
-                QueryPerformanceCounter(&mCPUTimestampQueryResults[CPUTimestamps::ReadbackBackbufferEnd]);
 
-                QueryPerformanceCounter(&mCPUTimestampQueryResults[CPUTimestamps::ComputeSATStart]);
-                
-                // sum the rows
-                for (int row = 0; row < mBackbufferHeight; row++)
-                {
-                    glm::uvec4 first = glm::uvec4(mCPUBackbufferReadback[row * mBackbufferWidth + 0]);
-                    first = glm::uvec4(pow(glm::vec4(first) / 255.0f, glm::vec4(2.2f)) * 255.0f);
-                    mCPUSummedAreaTable[row * mSummedAreaTableWidth + 0] = first;
+                // read back only the tile, without its margin
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, mBackbufferFBOSS);
+                ok = readTile(x0, y0, x1 - x0, y1 - y0, x0 - rx0, y0 - ry0);
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+            }
+        }
+
+        mBackbufferWidth = windowBackbufferWidth;
+        mBackbufferHeight = windowBackbufferHeight;
+
+        return ok;
+    }
+
+    // PPM stills are streamed to disk as the tiles finish, so memory is bounded by the tile size.
+    bool RenderStill(const char* filename, int width, int height, int tileSize) override
+    {
+        // PNGs can't be written in pieces, so they are assembled in memory (bottom-up RGBA) and compressed at the end.
+        size_t filenameLength = strlen(filename);
+        bool png = filenameLength >= 4 && strcmp(filename + filenameLength - 4, ".png") == 0;
+
+        bool ok;
+        if (png)
+        {
+            uint8_t* imagePixels = new uint8_t[(size_t)width * height * 4];
+            ok = RenderStillRect(width, height, 0, 0, width, height, tileSize, imagePixels) &&
+                WritePNG(filename, width, height, imagePixels + (size_t)(height - 1) * width * 4, -(ptrdiff_t)width * 4);
+            delete[] imagePixels;
+        }
+        else
+        {
+            TiledImageFile image;
+            if (!OpenTiledPPM(image, filename, width, height))
+            {
+                return false;
+            }
 
-                    for (int col = 1; col < mBackbufferWidth; col++)
-                    {
-                        glm::uvec4 readback = glm::uvec4(mCPUBackbufferReadback[row * mBackbufferWidth + col]);
-                        readback = glm::uvec4(pow(glm::vec4(readback) / 255.0f, glm::vec4(2.2f)) * 255.0f);
-                        mCPUSummedAreaTable[row * mSummedAreaTableWidth + col] = readback + mCPUSummedAreaTable[row * mSummedAreaTableWidth + (col - 1)];
-                    }
-                }
+            std::vector<uint8_t> tilePixels;
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
 
-                // sum the columns (gross memory access...)
-                for (int col = 0; col < mBackbufferWidth; col++)
-                {
-                    for (int row = 1; row < mBackbufferHeight; row++)
-                    {
-                        mCPUSummedAreaTable[row * mSummedAreaTableWidth + col] += mCPUSummedAreaTable[(row - 1) * mSummedAreaTableWidth + col];
-                    }
-                }
-                QueryPerformanceCounter(&mCPUTimestampQueryResults[CPUTimestamps::ComputeSATEnd]);
+            ok = RenderStillTiles(width, height, 0, 0, width, height, tileSize, [&](int x, int y, int w, int h, int readX, int readY)
+            {
+                tilePixels.resize(w * h * 3);
+                glReadPixels(readX, readY, w, h, GL_RGB, GL_UNSIGNED_BYTE, tilePixels.data());
 
-                // Upload SAT back to GPU
-                QueryPerformanceCounter(&mCPUTimestampQueryResults[CPUTimestamps::SATUploadStart]);
-                glQueryCounter(mGPUTimestampQueries[GPUTimestamps::SATUploadStart], GL_TIMESTAMP);
-                {
-                    glBindTexture(GL_TEXTURE_2D, *mSummedAreaTableTO);
-                    for (int row = 0; row < mBackbufferHeight; row++)
-                    {
-                        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row, mBackbufferWidth, 1, GL_RGBA_INTEGER, GL_UNSIGNED_INT, &mCPUSummedAreaTable[row * mSummedAreaTableWidth]);
-                    }
-                    glBindTexture(GL_TEXTURE_2D, 0);
-                }
-                glQueryCounter(mGPUTimestampQueries[GPUTimestamps::SATUploadEnd], GL_TIMESTAMP);
-                QueryPerformanceCounter(&mCPUTimestampQueryResults[CPUTimestamps::SATUploadEnd]);
+                // the readback is bottom-up, so write it starting from its last row
+                return WriteTiledPPMRect(image, x, height - (y + h), w, h, &tilePixels[(h - 1) * w * 3], -(ptrdiff_t)w * 3);
+            });
+
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+            ok = CloseTiledPPM(image) && ok;
+        }
+
+        if (ok)
+        {
+            printf("Rendered %dx%d still to %s\n", width, height, filename);
+        }
+        else
+        {
+            fprintf(stderr, "RenderStill: failed to write %s\n", filename);
+        }
+
+        return ok;
+    }
+
+    bool RenderStillRect(int width, int height, int rectX, int rectY, int rectWidth, int rectHeight, int tileSize, uint8_t* rgba) override
+    {
+        glPixelStorei(GL_PACK_ROW_LENGTH, rectWidth);
+
+        bool ok = RenderStillTiles(width, height, rectX, rectY, rectWidth, rectHeight, tileSize, [&](int x, int y, int w, int h, int readX, int readY)
+        {
+            glReadPixels(readX, readY, w, h, GL_RGBA, GL_UNSIGNED_BYTE, rgba + ((size_t)(y - rectY) * rectWidth + (x - rectX)) * 4);
+            return true;
+        });
+
+        glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+
+        return ok;
+    }
+
+    // The main camera's view, from the scene to the window
+    void RenderMainView()
+    {
+        // the SAT may have been sized for multi-view's views
+        mDepthOfField->Reserve(mMaxBackbufferWidth, mMaxBackbufferHeight, 1);
+
+        // Render scene
+        {
+            Camera& mainCamera = mScene->Cameras[mScene->MainCameraID];
+
+            glm::vec3 eye;
+            glm::mat4 V, P;
+            GetCameraMatrices(mainCamera.Aspect, &eye, &V, &P);
+
+            // the lens samples so far are of the same image if nothing changed
+            // (the lens radius follows the focus depth and the projection)
+            bool changed = UpdateSATDirtyRect(V, P) || mFocusDepth != mAccumulatedFocusDepth;
+            mAccumulatedFocusDepth = mFocusDepth;
+            mIdleFrameCount = changed ? 0 : mIdleFrameCount + 1;
+
+            bool wasAccumulating = mAccumulatingDoF;
+            mAccumulatingDoF = mEnableProgressiveDoF && mEnableDoF && *mAccumulateSP && mIdleFrameCount >= mIdleFramesBeforeAccumulating;
+            if (!mAccumulatingDoF || !wasAccumulating)
+            {
+                mAccumulatedSampleCount = 0;
+            }
+
+            if (!mAccumulatingDoF)
+            {
+                RenderScene(V, P, eye);
+            }
+            else if (mAccumulatedSampleCount < mLensSampleCount)
+            {
+                // a low-discrepancy sequence: the samples so far cover the lens and the pixel evenly, however many there are
+                int index = mAccumulatedSampleCount + 1;
+                float lensAngle = 2.0f * 3.14159265f * Halton(index, 5);
+                glm::vec2 lensOffset = GetLensRadius(1.0f) * sqrtf(Halton(index, 7)) * glm::vec2(cosf(lensAngle), sinf(lensAngle));
+                glm::vec2 jitter = glm::vec2(Halton(index, 2), Halton(index, 3)) - 0.5f;
+
+                GetLensSampleMatrices(lensOffset, jitter, &eye, &V, &P);
+                RenderScene(V, P, eye);
+            }
+        }
+
+        if (mAccumulatingDoF)
+        {
+            // Samples are rendered until there are enough, then the average is only written to the backbuffer again
+            // (stills may have used it in the meantime).
+            bool addSample = mAccumulatedSampleCount < mLensSampleCount;
+            if (addSample)
+            {
+                ResolveBackbuffer();
+                mAccumulatedSampleCount++;
             }
             else
             {
-                // GPU SAT
-                glQueryCounter(mGPUTimestampQueries[GPUTimestamps::ComputeSATStart], GL_TIMESTAMP);
-                if (*mSummedAreaTableUpsweepSP && *mSummedAreaTableDownsweepSP && *mTransposeSummedAreaTableSP)
+                for (int i = GPUTimestamps::LightCullingStart; i <= GPUTimestamps::MultisampleResolveEnd; i++)
                 {
-                    enum SATPass {
-                        SATPass_Rows,
-                        SATPass_Cols,
-                        SATPass_Count
-                    };
-
-                    for (int pass = 0; pass < SATPass_Count; pass++)
-                    {
-                        // Up-sweep
-                        {
-                            glUseProgram(*mSummedAreaTableUpsweepSP);
-
-                            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
-
-                            if (pass == SATPass_Rows) {
-                                glBindTextures(SAT_INPUT_TEXTURE_BINDING, 1, &mBackbufferColorTOSS);
-                                glBindImageTexture(SAT_OUTPUT_IMAGE_BINDING, mSummedRowsTO, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
-                                glUniform1i(SAT_READ_UINT_INPUT_UNIFORM_LOCATION, 0);
-                            }
-                            else if (pass == SATPass_Cols) {
-                                glBindTextures(SAT_UINT_INPUT_TEXTURE_BINDING, 1, &mSummedColsTO);
-                                glBindImageTexture(SAT_OUTPUT_IMAGE_BINDING, mSummedColsTO, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
-                                glUniform1i(SAT_READ_UINT_INPUT_UNIFORM_LOCATION, 1);
-                            }
-
-                            glUniform1i(SAT_READ_WGSUM_UNIFORM_LOCATION, 0);
-
-                            if (pass == SATPass_Rows) {
-                                glDispatchCompute(mSummedAreaTableWidth / SAT_WORKGROUP_SIZE_X, mBackbufferHeight, 1);
-                            }
-                            else if (pass == SATPass_Cols) {
-                                glDispatchCompute(mSummedAreaTableHeight / SAT_WORKGROUP_SIZE_X, mBackbufferWidth, 1);
-                            }
-
-                            glBindTextures(SAT_INPUT_TEXTURE_BINDING, 1, NULL);
-                            glBindImageTextures(SAT_OUTPUT_IMAGE_BINDING, 1, NULL);
-                            glUseProgram(0);
-                        }
-
-                        // Up-sweep WG sums
-                        {
-                            glUseProgram(*mSummedAreaTableUpsweepSP);
-
-                            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
-
-                            if (pass == SATPass_Rows) {
-                                glBindTextures(SAT_UINT_INPUT_TEXTURE_BINDING, 1, &mSummedRowsTO);
-                                glBindImageTexture(SAT_OUTPUT_IMAGE_BINDING, mSummedRowsWGSumsTO, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
-                            }
-                            else if (pass == SATPass_Cols) {
-                                glBindTextures(SAT_UINT_INPUT_TEXTURE_BINDING, 1, &mSummedColsTO);
-                                glBindImageTexture(SAT_OUTPUT_IMAGE_BINDING, mSummedColsWGSumsTO, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
-                            }
-
-                            glUniform1i(SAT_READ_UINT_INPUT_UNIFORM_LOCATION, 0);
-                            glUniform1i(SAT_READ_WGSUM_UNIFORM_LOCATION, 1);
-
-                            if (pass == SATPass_Rows) {
-                                glDispatchCompute(1, mBackbufferHeight, 1);
-                            }
-                            else if (pass == SATPass_Cols) {
-                                glDispatchCompute(1, mBackbufferWidth, 1);
-                            }
-
-                            glBindTextures(SAT_UINT_INPUT_TEXTURE_BINDING, 1, NULL);
-                            glBindImageTextures(SAT_OUTPUT_IMAGE_BINDING, 1, NULL);
-                            glUseProgram(0);
-                        }
-
-                        // Down-sweep WG sums
-                        {
-                            glUseProgram(*mSummedAreaTableDownsweepSP);
-
-                            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-
-                            if (pass == SATPass_Rows) {
-                                glBindImageTexture(SAT_OUTPUT_IMAGE_BINDING, mSummedRowsWGSumsTO, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA32UI);
-                            }
-                            else if (pass == SATPass_Cols) {
-                                glBindImageTexture(SAT_OUTPUT_IMAGE_BINDING, mSummedColsWGSumsTO, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA32UI);
-                            }
-
-                            glUniform1i(SAT_ADD_WGSUM_UNIFORM_LOCATION, 0);
-
-                            if (pass == SATPass_Rows) {
-                                glDispatchCompute(1, mBackbufferHeight, 1);
-                            }
-                            else if (pass == SATPass_Cols) {
-                                glDispatchCompute(1, mBackbufferWidth, 1);
-                            }
-
-                            glBindImageTextures(SAT_OUTPUT_IMAGE_BINDING, 1, NULL);
-                            glUseProgram(0);
-                        }
-
-                        // Down-sweep
-                        {
-                            glUseProgram(*mSummedAreaTableDownsweepSP);
-
-                            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-
-                            if (pass == SATPass_Rows) {
-                                glBindImageTexture(SAT_OUTPUT_IMAGE_BINDING, mSummedRowsTO, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA32UI);
-                                glBindImageTexture(SAT_WGSUMS_IMAGE_BINDING, mSummedRowsWGSumsTO, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA32UI);
-                            }
-                            else if (pass == SATPass_Cols) {
-                                glBindImageTexture(SAT_OUTPUT_IMAGE_BINDING, mSummedColsTO, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA32UI);
-                                glBindImageTexture(SAT_WGSUMS_IMAGE_BINDING, mSummedColsWGSumsTO, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA32UI);
-                            }
-
-                            glUniform1i(SAT_ADD_WGSUM_UNIFORM_LOCATION, 1);
-
-                            if (pass == SATPass_Rows) {
-                                glDispatchCompute(mSummedAreaTableWidth / SAT_WORKGROUP_SIZE_X, mBackbufferHeight, 1);
-                            }
-                            else if (pass == SATPass_Cols) {
-                                glDispatchCompute(mSummedAreaTableHeight / SAT_WORKGROUP_SIZE_X, mBackbufferWidth, 1);
-                            }
-
-                            glBindImageTextures(SAT_OUTPUT_IMAGE_BINDING, 1, NULL);
-                            glBindImageTextures(SAT_WGSUMS_IMAGE_BINDING, 1, NULL);
-                            glUseProgram(0);
-                        }
-
-                        // Transpose
-                        {
-                            glUseProgram(*mTransposeSummedAreaTableSP);
-
-                            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-
-                            if (pass == SATPass_Rows) {
-                                glBindImageTexture(TRANSPOSE_SAT_INPUT_IMAGE_BINDING, mSummedRowsTO, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA32UI);
-                                glBindImageTexture(TRANSPOSE_SAT_OUTPUT_IMAGE_BINDING, mSummedColsTO, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
-                            }
-                            else if (pass == SATPass_Cols) {
-                                glBindImageTexture(TRANSPOSE_SAT_INPUT_IMAGE_BINDING, mSummedColsTO, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA32UI);
-                                glBindImageTexture(TRANSPOSE_SAT_OUTPUT_IMAGE_BINDING, *mSummedAreaTableTO, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
-                            }
-
-                            if (pass == SATPass_Rows) {
-                                glDispatchCompute(mSummedAreaTableWidth / TRANSPOSE_SAT_WORKGROUP_SIZE_X, mSummedAreaTableHeight / TRANSPOSE_SAT_WORKGROUP_SIZE_X, 1);
-                            }
-                            else if (pass == SATPass_Cols) {
-                                glDispatchCompute(mSummedAreaTableHeight / TRANSPOSE_SAT_WORKGROUP_SIZE_X, mSummedAreaTableWidth / TRANSPOSE_SAT_WORKGROUP_SIZE_X, 1);
-                            }
-
-                            glBindImageTextures(TRANSPOSE_SAT_INPUT_IMAGE_BINDING, 1, NULL);
-                            glBindImageTextures(TRANSPOSE_SAT_OUTPUT_IMAGE_BINDING, 1, NULL);
-                            glUseProgram(0);
-                        }
-                    }
+                    glQueryCounter(mGPUTimestampQueries[i], GL_TIMESTAMP);
                 }
-                glQueryCounter(mGPUTimestampQueries[GPUTimestamps::ComputeSATEnd], GL_TIMESTAMP);
             }
 
-            // Apply DoF-blur to scene
+            // no SAT, the average is the blur
+            for (int i = GPUTimestamps::ReadbackBackbufferStart; i <= GPUTimestamps::SATUploadEnd; i++)
+            {
+                glQueryCounter(mGPUTimestampQueries[i], GL_TIMESTAMP);
+            }
             glQueryCounter(mGPUTimestampQueries[GPUTimestamps::DOFBlurStart], GL_TIMESTAMP);
-            if (*mDepthOfFieldSP)
+            AccumulateLensSample(addSample);
+            glQueryCounter(mGPUTimestampQueries[GPUTimestamps::DOFBlurEnd], GL_TIMESTAMP);
+        }
+        else
+        {
+            ResolveBackbuffer();
+        }
+
+        if (mEnableDoF && !mAccumulatingDoF)
+        {
+            ComputeSAT();
+
+            if (mSATBenchmarkRequested && !mUseCPUForSAT)
+            {
+                BenchmarkSAT();
+            }
+            mSATBenchmarkRequested = false;
+
+            ApplyDepthOfField(1.0f);
+        }
+
+        // The next frame's SAT can be patched from this one's.
+        // While accumulating, the SAT is still the one of the last frame before, which had the same image.
+        if (!mAccumulatingDoF)
+        {
+            mSATHistoryValid = mEnableDoF && !mUseCPUForSAT;
+        }
+
+        bool scaled = mWindowWidth != mBackbufferWidth || mWindowHeight != mBackbufferHeight;
+        bool upscale = scaled && mUpscaler == Upscaler_EASU && *mUpscaleEASUSP && *mUpscaleRCASSP;
+
+        // Edge-adaptive upscale + sharpen to window resolution
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::UpscaleStart], GL_TIMESTAMP);
+        if (upscale)
+        {
+            GLuint numGroupsX = (mWindowWidth + UPSCALE_WORKGROUP_SIZE_X - 1) / UPSCALE_WORKGROUP_SIZE_X;
+            GLuint numGroupsY = (mWindowHeight + UPSCALE_WORKGROUP_SIZE_X - 1) / UPSCALE_WORKGROUP_SIZE_X;
+
+            // Upsample
             {
-                // ensure the computed SAT is available to the DoF shader
+                glUseProgram(*mUpscaleEASUSP);
+
                 glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
 
-                glBindFramebuffer(GL_FRAMEBUFFER, mBackbufferFBOSS);
-                glUseProgram(*mDepthOfFieldSP);
-                glBindVertexArray(mNullVAO);
-                glBindTextures(DOF_SAT_TEXTURE_BINDING, 1, &*mSummedAreaTableTO);
-                glBindTextures(DOF_DEPTH_TEXTURE_BINDING, 1, &mBackbufferDepthTOSS);
-                glEnable(GL_FRAMEBUFFER_SRGB);
+                glBindTextures(UPSCALE_INPUT_TEXTURE_BINDING, 1, &mBackbufferColorTOSS);
+                glBindImageTexture(UPSCALE_OUTPUT_IMAGE_BINDING, mUpscaledTO, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+                glUniform2i(UPSCALE_INPUT_SIZE_UNIFORM_LOCATION, mBackbufferWidth, mBackbufferHeight);
+                glUniform2i(UPSCALE_OUTPUT_SIZE_UNIFORM_LOCATION, mWindowWidth, mWindowHeight);
 
-                Camera& mainCamera = mScene->Cameras[mScene->MainCameraID];
+                glDispatchCompute(numGroupsX, numGroupsY, 1);
 
-                glUniform1f(DOF_ZNEAR_UNIFORM_LOCATION, mainCamera.ZNear);
-                glUniform1f(DOF_FOCUS_UNIFORM_LOCATION, mFocusDepth);
-            
-                glDrawArrays(GL_TRIANGLES, 0, 3);
-            
-                glDisable(GL_FRAMEBUFFER_SRGB);
-                glBindTextures(DOF_SAT_TEXTURE_BINDING, 1, NULL);
-                glBindTextures(DOF_DEPTH_TEXTURE_BINDING, 1, NULL);
-                glBindVertexArray(0);
+                glBindTextures(UPSCALE_INPUT_TEXTURE_BINDING, 1, NULL);
+                glBindImageTextures(UPSCALE_OUTPUT_IMAGE_BINDING, 1, NULL);
                 glUseProgram(0);
-                glBindFramebuffer(GL_FRAMEBUFFER, 0);
             }
-            glQueryCounter(mGPUTimestampQueries[GPUTimestamps::DOFBlurEnd], GL_TIMESTAMP);
-        
-        } // endif enable DOF
 
-        // Render GUI
-        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::RenderGUIStart], GL_TIMESTAMP);
+            // Sharpen
+            {
+                glUseProgram(*mUpscaleRCASSP);
+
+                glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+                glBindTextures(UPSCALE_INPUT_TEXTURE_BINDING, 1, &mUpscaledTO);
+                glBindImageTexture(UPSCALE_OUTPUT_IMAGE_BINDING, mSharpenedTO, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+                glUniform2i(UPSCALE_OUTPUT_SIZE_UNIFORM_LOCATION, mWindowWidth, mWindowHeight);
+                glUniform1f(UPSCALE_SHARPNESS_UNIFORM_LOCATION, mUpscaleSharpness);
+
+                glDispatchCompute(numGroupsX, numGroupsY, 1);
+
+                glBindTextures(UPSCALE_INPUT_TEXTURE_BINDING, 1, NULL);
+                glBindImageTextures(UPSCALE_OUTPUT_IMAGE_BINDING, 1, NULL);
+                glUseProgram(0);
+            }
+        }
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::UpscaleEnd], GL_TIMESTAMP);
+
+        // Blit to window's framebuffer
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::BlitToWindowStart], GL_TIMESTAMP);
         {
-            glBindFramebuffer(GL_FRAMEBUFFER, mBackbufferFBOSS);
-            ImGui::Render();
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0); // default FBO
+
+            if (upscale)
+            {
+                // ensure the sharpened image is visible to the blit
+                glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, mSharpenedFBO);
+                glBlitFramebuffer(
+                    0, 0, mWindowWidth, mWindowHeight,
+                    0, 0, mWindowWidth, mWindowHeight,
+                    GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            }
+            else
+            {
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, mBackbufferFBOSS);
+                glBlitFramebuffer(
+                    0, 0, mBackbufferWidth, mBackbufferHeight,
+                    0, 0, mWindowWidth, mWindowHeight,
+                    GL_COLOR_BUFFER_BIT, scaled ? GL_LINEAR : GL_NEAREST);
+            }
+
             glBindFramebuffer(GL_FRAMEBUFFER, 0);
         }
-        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::RenderGUIEnd], GL_TIMESTAMP);
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::BlitToWindowEnd], GL_TIMESTAMP);
+    }
 
-        // Blit to window's framebuffer
+    void AllocateMultiViewTargets(int width, int height, int layerCount)
+    {
+        if (width == mMultiViewWidth && height == mMultiViewHeight && layerCount == mMultiViewLayerCount)
+        {
+            return;
+        }
+
+        mMultiViewWidth = width;
+        mMultiViewHeight = height;
+        mMultiViewLayerCount = layerCount;
+
+        glDeleteTextures(1, &mMultiViewColorTO);
+        glGenTextures(1, &mMultiViewColorTO);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, mMultiViewColorTO);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_SRGB8_ALPHA8, width, height, layerCount);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        glDeleteTextures(1, &mMultiViewDepthTO);
+        glGenTextures(1, &mMultiViewDepthTO);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, mMultiViewDepthTO);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, width, height, layerCount);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        glDeleteFramebuffers(1, &mMultiViewFBO);
+        glGenFramebuffers(1, &mMultiViewFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, mMultiViewFBO);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, mMultiViewColorTO, 0);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mMultiViewDepthTO, 0);
+        GLenum fboStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (fboStatus != GL_FRAMEBUFFER_COMPLETE) {
+            fprintf(stderr, "glCheckFramebufferStatus: %x\n", fboStatus);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        if (!mMultiViewReadFBO)
+        {
+            glGenFramebuffers(1, &mMultiViewReadFBO);
+        }
+    }
+
+    // The main camera first, then the scene's other cameras, in a grid of tiles over the window.
+    // Every timestamp pair is still issued (empty for the passes that multi-view doesn't have), since all of them are read back.
+    void RenderMultiView()
+    {
+        uint32_t cameraIDs[MULTIVIEW_MAX_VIEWS];
+        int viewCount = 0;
+        cameraIDs[viewCount++] = mScene->MainCameraID;
+        for (uint32_t cameraID : mScene->Cameras)
+        {
+            if (cameraID != mScene->MainCameraID && viewCount < MULTIVIEW_MAX_VIEWS)
+            {
+                cameraIDs[viewCount++] = cameraID;
+            }
+        }
+
+        int gridColumns = (int)ceilf(sqrtf((float)viewCount));
+        int gridRows = (viewCount + gridColumns - 1) / gridColumns;
+        int viewWidth = std::max(1, mWindowWidth / gridColumns);
+        int viewHeight = std::max(1, mWindowHeight / gridRows);
+
+        AllocateMultiViewTargets(viewWidth, viewHeight, viewCount);
+        // one SAT per view, at the views' size rather than the window's
+        mSATHistoryValid = false;
+        mPatchSAT = false;
+        mAccumulatingDoF = false;
+        mIdleFrameCount = 0;
+        mDepthOfField->Reserve(viewWidth, viewHeight, viewCount);
+
+        glm::mat4 viewProjections[MULTIVIEW_MAX_VIEWS];
+        glm::vec3 eyes[MULTIVIEW_MAX_VIEWS];
+        float zNears[MULTIVIEW_MAX_VIEWS];
+        for (int viewIdx = 0; viewIdx < viewCount; viewIdx++)
+        {
+            const Camera& camera = mScene->Cameras[cameraIDs[viewIdx]];
+
+            glm::mat4 V, P;
+            GetCameraMatrices(camera, (float)viewWidth / viewHeight, &eyes[viewIdx], &V, &P);
+            viewProjections[viewIdx] = P * V;
+            zNears[viewIdx] = camera.ZNear;
+        }
+
+        // Lights aren't binned for the layered pass, so the views are only lit by their camera's light
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::LightCullingStart], GL_TIMESTAMP);
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::LightCullingEnd], GL_TIMESTAMP);
+        mCulledLightCount = 0;
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::DepthPrePassStart], GL_TIMESTAMP);
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::DepthPrePassEnd], GL_TIMESTAMP);
+
+        // Render all the views in one pass
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::RenderSceneStart], GL_TIMESTAMP);
+        if (*mLayeredSceneSP)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, mMultiViewFBO);
+            glViewport(0, 0, viewWidth, viewHeight);
+
+            // clears all the layers
+            glClearColor(100.0f / 255.0f, 149.0f / 255.0f, 237.0f / 255.0f, 1.0f);
+            glClearDepth(0.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            glUseProgram(*mLayeredSceneSP);
+
+            glUniform1i(SCENE_VIEW_COUNT_UNIFORM_LOCATION, viewCount);
+            glUniformMatrix4fv(SCENE_VIEW_PROJECTION_UNIFORM_LOCATION, viewCount, GL_FALSE, value_ptr(viewProjections[0]));
+            glUniform3fv(SCENE_CAMERAPOS_UNIFORM_LOCATION, viewCount, value_ptr(eyes[0]));
+
+            glEnable(GL_DEPTH_TEST);
+            glDepthFunc(GL_GREATER);
+            glEnable(GL_FRAMEBUFFER_SRGB);
+            DrawSceneInstances(glm::mat4(), false, false);
+
+            glBindTextures(0, kMaxTextureCount, NULL);
+            glDisable(GL_FRAMEBUFFER_SRGB);
+            glDepthFunc(GL_LESS);
+            glDisable(GL_DEPTH_TEST);
+            glUseProgram(0);
+
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::RenderSceneEnd], GL_TIMESTAMP);
+
+        // single-sampled, nothing to resolve
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::MultisampleResolveStart], GL_TIMESTAMP);
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::MultisampleResolveEnd], GL_TIMESTAMP);
+
+        // always on the GPU, the CPU SAT is only a reference for the main view
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::ReadbackBackbufferStart], GL_TIMESTAMP);
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::ReadbackBackbufferEnd], GL_TIMESTAMP);
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::SATUploadStart], GL_TIMESTAMP);
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::SATUploadEnd], GL_TIMESTAMP);
+
+        // The SATs of all the views, then their blur, each pass once for all the layers.
+        // The library does both in one call, so they're timed together as the blur.
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::ComputeSATStart], GL_TIMESTAMP);
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::ComputeSATEnd], GL_TIMESTAMP);
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::DOFBlurStart], GL_TIMESTAMP);
+        if (mEnableDoF)
+        {
+            // the blur keeps its size relative to the view, like it does relative to the window
+            float radiusScale = (float)viewHeight / mWindowHeight;
+
+            GLDoFLayeredImage image;
+            image.ColorTO = mMultiViewColorTO;
+            image.DepthTO = mMultiViewDepthTO;
+            image.DepthIsLinear = false;
+            image.TargetTO = mMultiViewColorTO;
+            image.Width = viewWidth;
+            image.Height = viewHeight;
+            image.LayerCount = viewCount;
+            image.ZNear = zNears;
+            image.FocusDepth = mFocusDepth;
+            image.RadiusScale = radiusScale;
+            image.MaxRadius = GetMaxBlurRadius(radiusScale);
+
+            mDepthOfField->ApplyLayered(image);
+        }
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::DOFBlurEnd], GL_TIMESTAMP);
+
+        // rendered at window resolution
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::UpscaleStart], GL_TIMESTAMP);
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::UpscaleEnd], GL_TIMESTAMP);
+
+        // Blit each view to its tile, the main view at the top left
         glQueryCounter(mGPUTimestampQueries[GPUTimestamps::BlitToWindowStart], GL_TIMESTAMP);
         {
-            glBindFramebuffer(GL_READ_FRAMEBUFFER, mBackbufferFBOSS);
             glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0); // default FBO
-            
-            bool scaled = mWindowWidth != mBackbufferWidth || mWindowHeight != mBackbufferHeight;
-            glBlitFramebuffer(
-                0, 0, mBackbufferWidth, mBackbufferHeight,
-                0, 0, mWindowWidth, mWindowHeight,
-                GL_COLOR_BUFFER_BIT, scaled ? GL_LINEAR : GL_NEAREST);
+
+            // the leftover of the grid, and the last row's empty tiles
+            glClear(GL_COLOR_BUFFER_BIT);
+
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, mMultiViewReadFBO);
+            for (int viewIdx = 0; viewIdx < viewCount; viewIdx++)
+            {
+                int tileX = (viewIdx % gridColumns) * viewWidth;
+                int tileY = mWindowHeight - (viewIdx / gridColumns + 1) * viewHeight;
+
+                glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, mMultiViewColorTO, 0, viewIdx);
+                glBlitFramebuffer(
+                    0, 0, viewWidth, viewHeight,
+                    tileX, tileY, tileX + viewWidth, tileY + viewHeight,
+                    GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            }
+            glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0, 0);
 
             glBindFramebuffer(GL_FRAMEBUFFER, 0);
         }
         glQueryCounter(mGPUTimestampQueries[GPUTimestamps::BlitToWindowEnd], GL_TIMESTAMP);
+    }
+
+    // FNV-1a (over 64-bit words) of everything in the draw data that affects the GUI's pixels.
+    // The contents of user callbacks can't be hashed, so the layer is always redrawn when there are any.
+    static uint64_t HashGUIDrawData(const ImDrawData* drawData, bool* hasUserCallbacks)
+    {
+        const uint64_t kFNVPrime = 0x100000001B3ull;
+        uint64_t hash = 0xCBF29CE484222325ull;
+        auto hashBytes = [&hash, kFNVPrime](const void* data, size_t size)
+        {
+            const uint8_t* bytes = (const uint8_t*)data;
+            size_t i = 0;
+            for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+            {
+                uint64_t word;
+                memcpy(&word, bytes + i, sizeof(uint64_t));
+                hash = (hash ^ word) * kFNVPrime;
+            }
+            for (; i < size; i++)
+            {
+                hash = (hash ^ bytes[i]) * kFNVPrime;
+            }
+        };
+
+        const ImGuiIO& io = ImGui::GetIO();
+        hashBytes(&io.DisplaySize, sizeof(io.DisplaySize));
+        hashBytes(&io.DisplayFramebufferScale, sizeof(io.DisplayFramebufferScale));
+        hashBytes(&drawData->CmdListsCount, sizeof(drawData->CmdListsCount));
+
+        *hasUserCallbacks = false;
+        for (int listIdx = 0; listIdx < drawData->CmdListsCount; listIdx++)
+        {
+            const ImDrawList* cmdList = drawData->CmdLists[listIdx];
+            hashBytes(&cmdList->VtxBuffer.Size, sizeof(cmdList->VtxBuffer.Size));
+            hashBytes(cmdList->VtxBuffer.Data, cmdList->VtxBuffer.Size * sizeof(ImDrawVert));
+            hashBytes(&cmdList->IdxBuffer.Size, sizeof(cmdList->IdxBuffer.Size));
+            hashBytes(cmdList->IdxBuffer.Data, cmdList->IdxBuffer.Size * sizeof(ImDrawIdx));
+
+            for (const ImDrawCmd& cmd : cmdList->CmdBuffer)
+            {
+                if (cmd.UserCallback)
+                {
+                    *hasUserCallbacks = true;
+                }
+                hashBytes(&cmd.ElemCount, sizeof(cmd.ElemCount));
+                hashBytes(&cmd.ClipRect, sizeof(cmd.ClipRect));
+                hashBytes(&cmd.TextureId, sizeof(cmd.TextureId));
+            }
+        }
+
+        return hash;
+    }
+
+    void RenderGUILayer()
+    {
+        // Only builds the draw data: the backend's callback is called below, when the layer needs to be redrawn
+        ImGuiIO& io = ImGui::GetIO();
+        void(*renderDrawLists)(ImDrawData*) = io.RenderDrawListsFn;
+        io.RenderDrawListsFn = NULL;
+        ImGui::Render();
+        io.RenderDrawListsFn = renderDrawLists;
+
+        ImDrawData* drawData = ImGui::GetDrawData();
+        if (!drawData || !renderDrawLists)
+        {
+            return;
+        }
+
+        bool hasUserCallbacks;
+        uint64_t hash = HashGUIDrawData(drawData, &hasUserCallbacks);
+        bool redraw = !mGUILayerValid || hasUserCallbacks || hash != mGUILayerHash;
+        mGUILayerFrameCount++;
+        if (redraw)
+        {
+            mGUILayerRedrawCount++;
+
+            // the backend blends alpha with (ONE, ONE_MINUS_SRC_ALPHA), so the layer ends up premultiplied
+            const float kTransparent[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            glBindFramebuffer(GL_FRAMEBUFFER, mGUILayerFBO);
+            glClearBufferfv(GL_COLOR, 0, kTransparent);
+            renderDrawLists(drawData);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+            mGUILayerHash = hash;
+            mGUILayerValid = true;
+        }
+
+        if (drawData->TotalVtxCount == 0)
+        {
+            return;
+        }
+
+        // Composite over the window
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, mWindowWidth, mWindowHeight);
+        glUseProgram(*mGUICompositeSP);
+        glBindVertexArray(mNullVAO);
+        glBindTextures(GUI_LAYER_TEXTURE_BINDING, 1, &mGUILayerTO);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        glBlendFunc(GL_ONE, GL_ZERO);
+        glDisable(GL_BLEND);
+        glBindTextures(GUI_LAYER_TEXTURE_BINDING, 1, NULL);
+        glBindVertexArray(0);
+        glUseProgram(0);
+    }
+
+    void Paint() override
+    {
+        ReadbackTimestamps();
+
+        // Done before this frame's timestamps are issued, so they don't get mixed with the tiles' timestamps
+        if (mStillRequested)
+        {
+            RenderStill(mStillFilename, mStillWidth, mStillHeight, mStillTileSize);
+            mStillRequested = false;
+        }
+
+        // back from rendering stills at another size
+        if (mMaxBackbufferWidth != mWindowWidth || mMaxBackbufferHeight != mWindowHeight)
+        {
+            glFinish();
+            AllocateBackbuffers(mWindowWidth, mWindowHeight);
+        }
+
+        UpdateGUI();
+
+        UpdateDepthPrePass();
+
+        ApplyRenderScale();
+
+        // Reload any programs. The image may change anywhere with them, so the SAT is summed again,
+        // and the lens samples start over.
+        if (mShaders.UpdatePrograms())
+        {
+            mSATHistoryValid = false;
+            mAccumulatingDoF = false;
+            mIdleFrameCount = 0;
+        }
+
+        if (mEnableMultiView)
+        {
+            RenderMultiView();
+        }
+        else
+        {
+            RenderMainView();
+        }
+
+        // Capture before the GUI is drawn on top
+        if (mFrameWriter)
+        {
+            CaptureFrame();
+        }
+
+        // the export's planes are the main view's backbuffer, which multi-view doesn't render
+        if (mFrameExporter && !mEnableMultiView)
+        {
+            ExportFrame();
+        }
+
+        // Render GUI
+        // Drawn after the blit at window resolution, so it stays sharp regardless of the render scale.
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::RenderGUIStart], GL_TIMESTAMP);
+        if (mEnableGUILayer && *mGUICompositeSP)
+        {
+            RenderGUILayer();
+        }
+        else
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            ImGui::Render();
+            mGUILayerValid = false;
+        }
+        glQueryCounter(mGPUTimestampQueries[GPUTimestamps::RenderGUIEnd], GL_TIMESTAMP);
+
+        // multi-view renders at window resolution, and its timings aren't the main view's (nor are the lens samples')
+        if (!mEnableMultiView && !mAccumulatingDoF)
+        {
+            UpdateDynamicResolution();
+        }
+
+        mFrameArena.EndFrame();
 
         mFirstFrame = false;
     }
 
+    void SetFocusDepth(float focusDepth) override
+    {
+        mFocusDepth = focusDepth;
+    }
+
     int GetRenderWidth() const override
     {
         return mBackbufferWidth;
@@ -743,6 +3303,10 @@ public:
     }
 };
 
+// odr-used by the profiling window, so they need definitions before C++17
+constexpr const char* Renderer::GPUTimestamps::Names[];
+constexpr const char* Renderer::CPUTimestamps::Names[];
+
 IRenderer* NewRenderer()
 {
     return new Renderer();
@@ -12,8 +12,27 @@ public:
     virtual void Resize(int width, int height) = 0;
     virtual void Paint() = 0;
 
+    // Renders the current view to a file in tiles, for resolutions beyond what fits in a texture.
+    // PPM files are streamed to disk tile by tile, PNG files (.png) are assembled in memory first.
+    virtual bool RenderStill(const char* filename, int width, int height, int tileSize) = 0;
+
+    // Renders a rectangle (bottom-up) of a width x height still into rgba, as bottom-up RGBA8 rows of rectWidth pixels.
+    // Rectangles of the same still join seamlessly, so a still can be split across processes.
+    virtual bool RenderStillRect(int width, int height, int rectX, int rectY, int rectWidth, int rectHeight, int tileSize, uint8_t* rgba) = 0;
+
+    virtual void SetFocusDepth(float focusDepth) = 0;
+
     virtual int GetRenderWidth() const = 0;
     virtual int GetRenderHeight() const = 0;
 };
 
-IRenderer* NewRenderer();
\ No newline at end of file
+IRenderer* NewRenderer();
+
+// Multithreaded CPU rasterizer (software_renderer.cpp), for machines without a GPU.
+// Renders the same image as the GL renderer (without MSAA), and doesn't touch GL except to show frames in Paint,
+// so batch and farm rendering can run without a GL context. The scene must be loaded with Scene::KeepCPUData.
+IRenderer* NewSoftwareRenderer();
+
+// Renders the main camera's view at width x height with both renderers, and prints how much they differ.
+// The per-pixel difference is written to diffFilename (PPM), if not NULL.
+bool CompareRenderers(IRenderer* reference, IRenderer* test, int width, int height, const char* diffFilename);
\ No newline at end of file
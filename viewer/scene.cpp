@@ -10,9 +10,13 @@ void Scene::Init()
     DiffuseMaps = packed_freelist<DiffuseMap>(512);
     Materials = packed_freelist<Material>(512);
     Meshes = packed_freelist<Mesh>(512);
-    Transforms = packed_freelist<Transform>(4096);
-    Instances = packed_freelist<Instance>(4096);
+    Transforms = packed_freelist<Transform>(16384);
+    Instances = packed_freelist<Instance>(16384);
     Cameras = packed_freelist<Camera>(32);
+    Lights = packed_freelist<Light>(4096);
+
+    KeepCPUData = false;
+    NoGL = false;
 }
 
 void LoadMeshes(
@@ -45,6 +49,8 @@ void LoadMeshes(
         fprintf(stderr, "tinyobj::LoadObj(%s) warning: %s\n", filename.c_str(), err.c_str());
     }
 
+    LoadedFile& loadedFile = scene.LoadedFiles[filename];
+
     // Add materials to the scene
     std::map<std::string, uint32_t> diffuseMapCache;
     std::vector<uint32_t> newMaterialIDs;
@@ -64,8 +70,9 @@ void LoadMeshes(
         newMaterial.Specular[1] = materialToAdd.specular[1];
         newMaterial.Specular[2] = materialToAdd.specular[2];
         newMaterial.Shininess = materialToAdd.shininess;
+        newMaterial.RefCount = 1;
 
-        newMaterial.DiffuseMapID = -1;
+        newMaterial.DiffuseMapID = kNoDiffuseMap;
 
         if (!materialToAdd.diffuse_texname.empty())
         {
@@ -89,20 +96,33 @@ void LoadMeshes(
                 }
                 else
                 {
-                    float maxAnisotropy;
-                    glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAnisotropy);
-
-                    GLuint newDiffuseMapTO;
-                    glGenTextures(1, &newDiffuseMapTO);
-                    glBindTexture(GL_TEXTURE_2D, newDiffuseMapTO);
-                    glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, x, y, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-                    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, maxAnisotropy);
-                    glGenerateMipmap(GL_TEXTURE_2D);
-                    glBindTexture(GL_TEXTURE_2D, 0);
-
                     DiffuseMap newDiffuseMap;
-                    newDiffuseMap.DiffuseMapTO = newDiffuseMapTO;
+                    newDiffuseMap.DiffuseMapTO = 0;
+                    newDiffuseMap.Width = x;
+                    newDiffuseMap.Height = y;
+                    newDiffuseMap.RefCount = 0;
+
+                    if (!scene.NoGL)
+                    {
+                        float maxAnisotropy;
+                        glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAnisotropy);
+
+                        GLuint newDiffuseMapTO;
+                        glGenTextures(1, &newDiffuseMapTO);
+                        glBindTexture(GL_TEXTURE_2D, newDiffuseMapTO);
+                        glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, x, y, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+                        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+                        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, maxAnisotropy);
+                        glGenerateMipmap(GL_TEXTURE_2D);
+                        glBindTexture(GL_TEXTURE_2D, 0);
+
+                        newDiffuseMap.DiffuseMapTO = newDiffuseMapTO;
+                    }
+
+                    if (scene.KeepCPUData)
+                    {
+                        newDiffuseMap.Pixels.assign(pixels, pixels + (size_t)x * y * 4);
+                    }
                     
                     uint32_t newDiffuseMapID = scene.DiffuseMaps.insert(newDiffuseMap);
 
@@ -115,9 +135,15 @@ void LoadMeshes(
             }
         }
 
+        if (newMaterial.DiffuseMapID != kNoDiffuseMap)
+        {
+            scene.DiffuseMaps[newMaterial.DiffuseMapID].RefCount++;
+        }
+
         uint32_t newMaterialID = scene.Materials.insert(newMaterial);
 
         newMaterialIDs.push_back(newMaterialID);
+        loadedFile.MaterialIDs.push_back(newMaterialID);
     }
 
     // Add meshes (and prototypes) to the scene
@@ -131,110 +157,152 @@ void LoadMeshes(
 
         newMesh.IndexCount = (GLuint)meshToAdd.indices.size();
         newMesh.VertexCount = (GLuint)meshToAdd.positions.size() / 3;
+        newMesh.RefCount = 0;
 
-        if (meshToAdd.positions.empty())
-        {
-            // should never happen
-            newMesh.PositionBO = 0;
-        }
-        else
-        {
-            GLuint newPositionBO;
-            glGenBuffers(1, &newPositionBO);
-            glBindBuffer(GL_ARRAY_BUFFER, newPositionBO);
-            glBufferData(GL_ARRAY_BUFFER, meshToAdd.positions.size() * sizeof(meshToAdd.positions[0]), meshToAdd.positions.data(), GL_STATIC_DRAW);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-            newMesh.PositionBO = newPositionBO;
-        }
-
-        if (meshToAdd.texcoords.empty())
+        if (scene.KeepCPUData)
         {
-            newMesh.TexCoordBO = 0;
+            newMesh.Positions = meshToAdd.positions;
+            newMesh.TexCoords = meshToAdd.texcoords;
+            newMesh.Normals = meshToAdd.normals;
+            newMesh.Indices = meshToAdd.indices;
         }
-        else
-        {
-            GLuint newTexCoordBO;
-            glGenBuffers(1, &newTexCoordBO);
-            glBindBuffer(GL_ARRAY_BUFFER, newTexCoordBO);
-            glBufferData(GL_ARRAY_BUFFER, meshToAdd.texcoords.size() * sizeof(meshToAdd.texcoords[0]), meshToAdd.texcoords.data(), GL_STATIC_DRAW);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-            newMesh.TexCoordBO = newTexCoordBO;
-        }
+        newMesh.MeshVAO = 0;
+        newMesh.DepthVAO = 0;
+        newMesh.PositionBO = 0;
+        newMesh.TexCoordBO = 0;
+        newMesh.NormalBO = 0;
+        newMesh.IndexBO = 0;
 
-        if (meshToAdd.normals.empty())
+        if (!scene.NoGL)
         {
-            newMesh.NormalBO = 0;
-        }
-        else
-        {
-            GLuint newNormalBO;
-            glGenBuffers(1, &newNormalBO);
-            glBindBuffer(GL_ARRAY_BUFFER, newNormalBO);
-            glBufferData(GL_ARRAY_BUFFER, meshToAdd.normals.size() * sizeof(meshToAdd.normals[0]), meshToAdd.normals.data(), GL_STATIC_DRAW);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-            newMesh.NormalBO = newNormalBO;
-        }
+            if (meshToAdd.positions.empty())
+            {
+                // should never happen
+                newMesh.PositionBO = 0;
+            }
+            else
+            {
+                GLuint newPositionBO;
+                glGenBuffers(1, &newPositionBO);
+                glBindBuffer(GL_ARRAY_BUFFER, newPositionBO);
+                glBufferData(GL_ARRAY_BUFFER, meshToAdd.positions.size() * sizeof(meshToAdd.positions[0]), meshToAdd.positions.data(), GL_STATIC_DRAW);
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-        if (meshToAdd.indices.empty())
-        {
-            // should never happen
-            newMesh.IndexBO = 0;
-        }
-        else
-        {
-            GLuint newIndexBO;
-            glGenBuffers(1, &newIndexBO);
-            // Why not bind to GL_ELEMENT_ARRAY_BUFFER?
-            // Because binding to GL_ELEMENT_ARRAY_BUFFER attaches the EBO to the currently bound VAO, which might stomp somebody else's state.
-            glBindBuffer(GL_ARRAY_BUFFER, newIndexBO);
-            glBufferData(GL_ARRAY_BUFFER, meshToAdd.indices.size() * sizeof(meshToAdd.indices[0]), meshToAdd.indices.data(), GL_STATIC_DRAW);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-            newMesh.IndexBO = newIndexBO;
-        }
+                newMesh.PositionBO = newPositionBO;
+            }
 
-        // Hook up VAO
-        {
-            GLuint newMeshVAO;
-            glGenVertexArrays(1, &newMeshVAO);
+            if (meshToAdd.texcoords.empty())
+            {
+                newMesh.TexCoordBO = 0;
+            }
+            else
+            {
+                GLuint newTexCoordBO;
+                glGenBuffers(1, &newTexCoordBO);
+                glBindBuffer(GL_ARRAY_BUFFER, newTexCoordBO);
+                glBufferData(GL_ARRAY_BUFFER, meshToAdd.texcoords.size() * sizeof(meshToAdd.texcoords[0]), meshToAdd.texcoords.data(), GL_STATIC_DRAW);
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-            glBindVertexArray(newMeshVAO);
+                newMesh.TexCoordBO = newTexCoordBO;
+            }
 
-            if (newMesh.PositionBO)
+            if (meshToAdd.normals.empty())
+            {
+                newMesh.NormalBO = 0;
+            }
+            else
             {
-                glBindBuffer(GL_ARRAY_BUFFER, newMesh.PositionBO);
-                glVertexAttribPointer(SCENE_POSITION_ATTRIB_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, 0);
+                GLuint newNormalBO;
+                glGenBuffers(1, &newNormalBO);
+                glBindBuffer(GL_ARRAY_BUFFER, newNormalBO);
+                glBufferData(GL_ARRAY_BUFFER, meshToAdd.normals.size() * sizeof(meshToAdd.normals[0]), meshToAdd.normals.data(), GL_STATIC_DRAW);
                 glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-                glEnableVertexAttribArray(SCENE_POSITION_ATTRIB_LOCATION);
+                newMesh.NormalBO = newNormalBO;
             }
 
-            if (newMesh.TexCoordBO)
+            if (meshToAdd.indices.empty())
             {
-                glBindBuffer(GL_ARRAY_BUFFER, newMesh.TexCoordBO);
-                glVertexAttribPointer(SCENE_TEXCOORD_ATTRIB_LOCATION, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
+                // should never happen
+                newMesh.IndexBO = 0;
+            }
+            else
+            {
+                GLuint newIndexBO;
+                glGenBuffers(1, &newIndexBO);
+                // Why not bind to GL_ELEMENT_ARRAY_BUFFER?
+                // Because binding to GL_ELEMENT_ARRAY_BUFFER attaches the EBO to the currently bound VAO, which might stomp somebody else's state.
+                glBindBuffer(GL_ARRAY_BUFFER, newIndexBO);
+                glBufferData(GL_ARRAY_BUFFER, meshToAdd.indices.size() * sizeof(meshToAdd.indices[0]), meshToAdd.indices.data(), GL_STATIC_DRAW);
                 glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-                glEnableVertexAttribArray(SCENE_TEXCOORD_ATTRIB_LOCATION);
+                newMesh.IndexBO = newIndexBO;
             }
 
-            if (newMesh.NormalBO)
+            // Hook up VAO
             {
-                glBindBuffer(GL_ARRAY_BUFFER, newMesh.NormalBO);
-                glVertexAttribPointer(SCENE_NORMAL_ATTRIB_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, 0);
-                glBindBuffer(GL_ARRAY_BUFFER, 0);
+                GLuint newMeshVAO;
+                glGenVertexArrays(1, &newMeshVAO);
+
+                glBindVertexArray(newMeshVAO);
+
+                if (newMesh.PositionBO)
+                {
+                    glBindBuffer(GL_ARRAY_BUFFER, newMesh.PositionBO);
+                    glVertexAttribPointer(SCENE_POSITION_ATTRIB_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, 0);
+                    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+                    glEnableVertexAttribArray(SCENE_POSITION_ATTRIB_LOCATION);
+                }
+
+                if (newMesh.TexCoordBO)
+                {
+                    glBindBuffer(GL_ARRAY_BUFFER, newMesh.TexCoordBO);
+                    glVertexAttribPointer(SCENE_TEXCOORD_ATTRIB_LOCATION, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
+                    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+                    glEnableVertexAttribArray(SCENE_TEXCOORD_ATTRIB_LOCATION);
+                }
+
+                if (newMesh.NormalBO)
+                {
+                    glBindBuffer(GL_ARRAY_BUFFER, newMesh.NormalBO);
+                    glVertexAttribPointer(SCENE_NORMAL_ATTRIB_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, 0);
+                    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+                    glEnableVertexAttribArray(SCENE_NORMAL_ATTRIB_LOCATION);
+                }
 
-                glEnableVertexAttribArray(SCENE_NORMAL_ATTRIB_LOCATION);
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, newMesh.IndexBO);
+
+                glBindVertexArray(0);
+
+                newMesh.MeshVAO = newMeshVAO;
             }
 
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, newMesh.IndexBO);
+            // Hook up position-only VAO
+            {
+                GLuint newDepthVAO;
+                glGenVertexArrays(1, &newDepthVAO);
+
+                glBindVertexArray(newDepthVAO);
 
-            glBindVertexArray(0);
+                if (newMesh.PositionBO)
+                {
+                    glBindBuffer(GL_ARRAY_BUFFER, newMesh.PositionBO);
+                    glVertexAttribPointer(SCENE_POSITION_ATTRIB_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, 0);
+                    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-            newMesh.MeshVAO = newMeshVAO;
+                    glEnableVertexAttribArray(SCENE_POSITION_ATTRIB_LOCATION);
+                }
+
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, newMesh.IndexBO);
+
+                glBindVertexArray(0);
+
+                newMesh.DepthVAO = newDepthVAO;
+            }
         }
 
         // split mesh into draw calls with different materials
@@ -257,12 +325,17 @@ void LoadMeshes(
 
                 newMesh.DrawCommands.push_back(currDrawCommand);
                 newMesh.MaterialIDs.push_back(currMaterialID);
+                scene.Materials[currMaterialID].RefCount++;
 
                 currMaterialFirstFaceIndex = faceIdx + 1;
             }
         }
 
+        BuildMeshlets(newMesh.Meshlets, meshToAdd.positions.data(), sizeof(float) * 3, newMesh.VertexCount, meshToAdd.indices.data(), newMesh.DrawCommands);
+        BuildOccluder(newMesh.Occluder, meshToAdd.positions.data(), sizeof(float) * 3, newMesh.VertexCount, meshToAdd.indices.data(), (uint32_t)meshToAdd.indices.size());
+
         uint32_t newMeshID = scene.Meshes.insert(newMesh);
+        loadedFile.MeshIDs.push_back(newMeshID);
 
         if (loadedMeshIDs)
         {
@@ -286,8 +359,199 @@ void AddInstance(
     newInstance.TransformID = newTransformID;
 
     uint32_t tmpNewInstanceID = scene.Instances.insert(newInstance);
+    scene.Meshes[newInstance.MeshID].RefCount++;
     if (newInstanceID)
     {
         *newInstanceID = tmpNewInstanceID;
     }
+}
+
+void AddPlacedInstance(
+    Scene& scene,
+    const MeshPlacement& placement,
+    uint32_t* newInstanceID)
+{
+    uint32_t newTransformID = scene.Transforms.insert(placement.Placement);
+
+    Instance newInstance;
+    newInstance.MeshID = placement.MeshID;
+    newInstance.TransformID = newTransformID;
+
+    uint32_t tmpNewInstanceID = scene.Instances.insert(newInstance);
+    scene.Meshes[newInstance.MeshID].RefCount++;
+    if (newInstanceID)
+    {
+        *newInstanceID = tmpNewInstanceID;
+    }
+}
+
+// The batch that collects the GL objects removed during this frame
+static GLDeletionBatch& GetOpenGLDeletionBatch(Scene& scene)
+{
+    if (scene.PendingGLDeletions.empty() || scene.PendingGLDeletions.back().Fence)
+    {
+        scene.PendingGLDeletions.emplace_back();
+        scene.PendingGLDeletions.back().Fence = 0;
+    }
+    return scene.PendingGLDeletions.back();
+}
+
+static void ReleaseDiffuseMap(
+    Scene& scene,
+    uint32_t diffuseMapID)
+{
+    DiffuseMap& diffuseMap = scene.DiffuseMaps[diffuseMapID];
+    if (--diffuseMap.RefCount > 0)
+    {
+        return;
+    }
+
+    if (diffuseMap.DiffuseMapTO)
+    {
+        GetOpenGLDeletionBatch(scene).Textures.push_back(diffuseMap.DiffuseMapTO);
+    }
+
+    scene.DiffuseMaps.erase(diffuseMapID);
+}
+
+static void ReleaseMaterial(
+    Scene& scene,
+    uint32_t materialID)
+{
+    Material& material = scene.Materials[materialID];
+    if (--material.RefCount > 0)
+    {
+        return;
+    }
+
+    if (material.DiffuseMapID != kNoDiffuseMap)
+    {
+        ReleaseDiffuseMap(scene, material.DiffuseMapID);
+    }
+
+    scene.Materials.erase(materialID);
+}
+
+void RemoveInstance(
+    Scene& scene,
+    uint32_t instanceID)
+{
+    Instance& instance = scene.Instances[instanceID];
+    scene.Meshes[instance.MeshID].RefCount--;
+    scene.Transforms.erase(instance.TransformID);
+    scene.Instances.erase(instanceID);
+}
+
+void RemoveMesh(
+    Scene& scene,
+    uint32_t meshID)
+{
+    if (scene.Meshes[meshID].RefCount > 0)
+    {
+        std::vector<uint32_t> instanceIDs;
+        for (uint32_t instanceID : scene.Instances)
+        {
+            if (scene.Instances[instanceID].MeshID == meshID)
+            {
+                instanceIDs.push_back(instanceID);
+            }
+        }
+        for (uint32_t instanceID : instanceIDs)
+        {
+            RemoveInstance(scene, instanceID);
+        }
+    }
+
+    Mesh& mesh = scene.Meshes[meshID];
+
+    // the names are 0 without GL, with nothing to delete
+    for (GLuint bo : { mesh.PositionBO, mesh.TexCoordBO, mesh.NormalBO, mesh.IndexBO })
+    {
+        if (bo)
+        {
+            GetOpenGLDeletionBatch(scene).Buffers.push_back(bo);
+        }
+    }
+    for (GLuint vao : { mesh.MeshVAO, mesh.DepthVAO })
+    {
+        if (vao)
+        {
+            GetOpenGLDeletionBatch(scene).VertexArrays.push_back(vao);
+        }
+    }
+
+    for (uint32_t materialID : mesh.MaterialIDs)
+    {
+        ReleaseMaterial(scene, materialID);
+    }
+
+    scene.Meshes.erase(meshID);
+}
+
+void UnloadFile(
+    Scene& scene,
+    const std::string& filename)
+{
+    auto found = scene.LoadedFiles.find(filename);
+    if (found == scene.LoadedFiles.end())
+    {
+        return;
+    }
+
+    for (uint32_t meshID : found->second.MeshIDs)
+    {
+        // unless it was removed on its own already
+        if (scene.Meshes.contains(meshID))
+        {
+            RemoveMesh(scene, meshID);
+        }
+    }
+
+    // the file's hold on its materials, the last one on those that no mesh used
+    for (uint32_t materialID : found->second.MaterialIDs)
+    {
+        ReleaseMaterial(scene, materialID);
+    }
+
+    scene.LoadedFiles.erase(found);
+}
+
+void FlushGLDeletions(Scene& scene)
+{
+    if (scene.NoGL || scene.PendingGLDeletions.empty())
+    {
+        return;
+    }
+
+    // the objects removed during this frame were last used by the frame before it, if not by this one
+    GLDeletionBatch& newest = scene.PendingGLDeletions.back();
+    if (!newest.Fence)
+    {
+        newest.Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    while (!scene.PendingGLDeletions.empty())
+    {
+        GLDeletionBatch& oldest = scene.PendingGLDeletions.front();
+        if (glClientWaitSync(oldest.Fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+        {
+            break;
+        }
+
+        if (!oldest.Buffers.empty())
+        {
+            glDeleteBuffers((GLsizei)oldest.Buffers.size(), oldest.Buffers.data());
+        }
+        if (!oldest.VertexArrays.empty())
+        {
+            glDeleteVertexArrays((GLsizei)oldest.VertexArrays.size(), oldest.VertexArrays.data());
+        }
+        if (!oldest.Textures.empty())
+        {
+            glDeleteTextures((GLsizei)oldest.Textures.size(), oldest.Textures.data());
+        }
+        glDeleteSync(oldest.Fence);
+
+        scene.PendingGLDeletions.pop_front();
+    }
 }
\ No newline at end of file
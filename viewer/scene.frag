@@ -1,9 +1,15 @@
+layout(location = SCENE_WORLD_POSITION_VARYING_LOCATION)
 in vec3 fWorldPosition;
+
+layout(location = SCENE_TEXCOORD_VARYING_LOCATION)
 in vec2 fTexCoord;
+
+layout(location = SCENE_WORLD_NORMAL_VARYING_LOCATION)
 in vec3 fWorldNormal;
 
+// one per view with scene_layered.geom, which sets gl_Layer (0 without it)
 layout(location = SCENE_CAMERAPOS_UNIFORM_LOCATION)
-uniform vec3 CameraPos;
+uniform vec3 CameraPos[MULTIVIEW_MAX_VIEWS];
 
 layout(location = SCENE_AMBIENT_UNIFORM_LOCATION)
 uniform vec3 Ambient;
@@ -23,6 +29,35 @@ uniform int HasDiffuseMap;
 layout(binding = SCENE_DIFFUSE_MAP_TEXTURE_BINDING)
 uniform sampler2D DiffuseMap;
 
+// Clustered lights, binned by light_cull.comp (same struct)
+struct Light
+{
+    vec4 PositionRadius;
+    vec4 ColorSpotScale;
+    vec4 DirectionSpotOffset;
+};
+
+layout(std430, binding = LIGHTS_BUFFER_BINDING)
+restrict readonly buffer LightBuffer { Light Lights[]; };
+
+layout(std430, binding = LIGHT_CLUSTERS_BUFFER_BINDING)
+restrict readonly buffer ClusterBuffer { uvec2 Clusters[]; };
+
+layout(std430, binding = LIGHT_INDICES_BUFFER_BINDING)
+restrict readonly buffer LightIndexBuffer { uint LightIndices[]; };
+
+layout(location = SCENE_LIGHT_COUNT_UNIFORM_LOCATION)
+uniform int LightCount;
+
+layout(location = SCENE_LIGHT_CLUSTER_COUNT_UNIFORM_LOCATION)
+uniform ivec3 ClusterCount;
+
+layout(location = SCENE_LIGHT_SLICE_SCALE_UNIFORM_LOCATION)
+uniform float SliceScale;
+
+layout(location = SCENE_ZNEAR_UNIFORM_LOCATION)
+uniform float ZNear;
+
 out vec4 FragColor;
 
 void main()
@@ -30,7 +65,7 @@ void main()
     vec3 Ia = vec3(0.1); // ambient light
     vec3 I0 = vec3(1.0); // light 0 intensity
 
-    vec3 V = normalize(CameraPos - fWorldPosition);
+    vec3 V = normalize(CameraPos[gl_Layer] - fWorldPosition);
     vec3 L = V; // Light placed at camera position
     vec3 N = normalize(fWorldNormal);
     vec3 H = normalize(L + V);
@@ -49,9 +84,43 @@ void main()
         diffuseMap = vec3(1.0);
     }
 
-    vec3 diffuse = I0 * diffuseMap * Diffuse * G;
+    vec3 lightsDiffuse = vec3(0.0);
+    vec3 lightsSpecular = vec3(0.0);
+    if (LightCount > 0)
+    {
+        // cluster of the fragment, from its eye depth (reversed-Z infinite projection)
+        ivec2 tile = ivec2(gl_FragCoord.xy) / LIGHT_CLUSTER_TILE_SIZE;
+        float depth = ZNear / gl_FragCoord.z;
+        int slice = clamp(int(log(depth / ZNear) * SliceScale), 0, ClusterCount.z - 1);
+        uvec2 cluster = Clusters[(slice * ClusterCount.y + tile.y) * ClusterCount.x + tile.x];
+
+        for (uint i = 0; i < cluster.y; i++)
+        {
+            Light light = Lights[LightIndices[cluster.x + i]];
+
+            vec3 toLight = light.PositionRadius.xyz - fWorldPosition;
+            float dist = length(toLight);
+            float radius = light.PositionRadius.w;
+            if (dist >= radius)
+            {
+                continue;
+            }
+            vec3 Ll = toLight / dist;
+
+            // inverse square, windowed to reach zero at the radius
+            float window = clamp(1.0 - pow(dist / radius, 4.0), 0.0, 1.0);
+            float attenuation = window * window / (dist * dist + 1.0);
+            float spot = clamp(dot(-Ll, light.DirectionSpotOffset.xyz) * light.ColorSpotScale.w + light.DirectionSpotOffset.w, 0.0, 1.0);
+            vec3 I = light.ColorSpotScale.rgb * (attenuation * spot * spot);
+
+            lightsDiffuse += I * max(0, dot(Ll, N));
+            lightsSpecular += I * pow(max(0, dot(N, normalize(Ll + V))), Shininess);
+        }
+    }
+
+    vec3 diffuse = (I0 * G + lightsDiffuse) * diffuseMap * Diffuse;
 
-    vec3 specular = I0 * Specular * PH;
+    vec3 specular = (I0 * PH + lightsSpecular) * Specular;
 
     vec3 radiance = ambient + diffuse + specular;
 
@@ -2,19 +2,34 @@
 
 #include "opengl.h"
 #include "packed_freelist.h"
+#include "meshlet.h"
+#include "occlusion.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 
 #include <vector>
+#include <deque>
 #include <map>
 #include <string>
+#include <cstdint>
 
 struct DiffuseMap
 {
     GLuint DiffuseMapTO;
+
+    // sRGB RGBA8, bottom-up. Only kept with Scene::KeepCPUData.
+    int Width;
+    int Height;
+    std::vector<uint8_t> Pixels;
+
+    // materials that use it
+    uint32_t RefCount;
 };
 
+// Material::DiffuseMapID of materials without a diffuse map
+const uint32_t kNoDiffuseMap = UINT32_MAX;
+
 struct Material
 {
     std::string Name;
@@ -24,6 +39,9 @@ struct Material
     float Specular[3];
     float Shininess;
     uint32_t DiffuseMapID;
+
+    // draw commands of meshes that use it, plus one held by the file that loaded it until it's unloaded
+    uint32_t RefCount;
 };
 
 struct Mesh
@@ -31,6 +49,8 @@ struct Mesh
     std::string Name;
 
     GLuint MeshVAO;
+    // only the positions, for depth-only passes
+    GLuint DepthVAO;
     GLuint PositionBO;
     GLuint TexCoordBO;
     GLuint NormalBO;
@@ -41,6 +61,21 @@ struct Mesh
 
     std::vector<GLDrawElementsIndirectCommand> DrawCommands;
     std::vector<uint32_t> MaterialIDs;
+
+    // instances of it
+    uint32_t RefCount;
+
+    // The draw commands split into clusters, culled one by one by the renderer.
+    MeshletSet Meshlets;
+
+    // Its bounds, and its largest triangles to hide other instances with.
+    OccluderMesh Occluder;
+
+    // The vertices and indices, for the software renderer. Only kept with Scene::KeepCPUData.
+    std::vector<float> Positions;
+    std::vector<float> TexCoords;
+    std::vector<float> Normals;
+    std::vector<uint32_t> Indices;
 };
 
 struct Transform
@@ -70,6 +105,43 @@ struct Camera
     float ZNear;
 };
 
+// The near plane of the cameras the viewer renders from: interactive, batch jobs and the renderer comparison
+const float kCameraZNear = 0.01f;
+
+// A point light, or a spot light if IsSpot.
+// Any number of them are binned into clusters of the view by the renderer, so each fragment only shades the ones that reach it.
+struct Light
+{
+    glm::vec3 Position;
+    // linear, times the intensity
+    glm::vec3 Color;
+    // distance where the light reaches zero
+    float Radius;
+
+    bool IsSpot;
+    glm::vec3 Direction;
+    // cosines of the angles from Direction where the light starts to fade out, and where it reaches zero
+    float SpotCosInner;
+    float SpotCosOuter;
+};
+
+// What was loaded from a file, to unload it with
+struct LoadedFile
+{
+    std::vector<uint32_t> MeshIDs;
+    std::vector<uint32_t> MaterialIDs;
+};
+
+// GL objects of removed meshes and diffuse maps, waiting for the GPU to be done with the frames that used them
+struct GLDeletionBatch
+{
+    std::vector<GLuint> Buffers;
+    std::vector<GLuint> VertexArrays;
+    std::vector<GLuint> Textures;
+    // signaled after the last frame that could use them, 0 until that frame is submitted
+    GLsync Fence;
+};
+
 class Scene
 {
 public:
@@ -79,9 +151,20 @@ public:
     packed_freelist<Transform> Transforms;
     packed_freelist<Instance> Instances;
     packed_freelist<Camera> Cameras;
+    packed_freelist<Light> Lights;
 
     uint32_t MainCameraID;
 
+    // by file name
+    std::map<std::string, LoadedFile> LoadedFiles;
+    // oldest first. Objects removed since the last FlushGLDeletions are in the last batch, which has no fence yet.
+    std::deque<GLDeletionBatch> PendingGLDeletions;
+
+    // Meshes and diffuse maps loaded from now on also keep their data in memory, for the software renderer.
+    bool KeepCPUData;
+    // There is no GL context (headless software rendering), so nothing is uploaded to GL.
+    bool NoGL;
+
     void Init();
 };
 
@@ -90,7 +173,51 @@ void LoadMeshes(
     const std::string& filename,
     std::vector<uint32_t>* loadedMeshIDs);
 
+// Where a file's node hierarchy places one of its meshes
+struct MeshPlacement
+{
+    uint32_t MeshID;
+    Transform Placement;
+};
+
+// Loads a binary glTF 2.0 file (.glb), with its buffers and images in its binary chunk (or images next to it).
+// Each triangle primitive becomes a mesh, with its material, and the nodes of the default scene become placements
+// of the meshes, to instance with AddPlacedInstance.
+// The accessors are uploaded to GL as they are in the file, only 8 and 16-bit indices are widened.
+void LoadGLB(
+    Scene& scene,
+    const std::string& filename,
+    std::vector<uint32_t>* loadedMeshIDs,
+    std::vector<MeshPlacement>* loadedPlacements);
+
 void AddInstance(
     Scene& scene,
     uint32_t meshID,
-    uint32_t* newInstanceID);
\ No newline at end of file
+    uint32_t* newInstanceID);
+
+// Adds an instance of the placement's mesh, with a transform set to the placement
+void AddPlacedInstance(
+    Scene& scene,
+    const MeshPlacement& placement,
+    uint32_t* newInstanceID);
+
+// Removes an instance and its transform
+void RemoveInstance(
+    Scene& scene,
+    uint32_t instanceID);
+
+// Removes a mesh, and its instances. Its materials (and their diffuse maps) go once nothing else holds them.
+// Its GL objects are deleted by a later FlushGLDeletions, once the GPU is done with them.
+void RemoveMesh(
+    Scene& scene,
+    uint32_t meshID);
+
+// Removes everything that LoadMeshes or LoadGLB loaded from the file: its meshes with their instances, materials and diffuse maps
+void UnloadFile(
+    Scene& scene,
+    const std::string& filename);
+
+// To call once the commands of a frame are submitted (after the swap, or after a still is rendered).
+// The GL objects removed since the last call are fenced after this frame, and the ones whose fence has signaled are
+// deleted. Never waits on the GPU.
+void FlushGLDeletions(Scene& scene);
\ No newline at end of file
@@ -16,10 +16,18 @@ uniform mat4 MVP;
 layout(location = SCENE_N_MW_UNIFORM_LOCATION)
 uniform mat3 N_MW;
 
+layout(location = SCENE_WORLD_POSITION_VARYING_LOCATION)
 out vec3 fWorldPosition;
+
+layout(location = SCENE_TEXCOORD_VARYING_LOCATION)
 out vec2 fTexCoord;
+
+layout(location = SCENE_WORLD_NORMAL_VARYING_LOCATION)
 out vec3 fWorldNormal;
 
+// same as depth.vert, for the GL_EQUAL test after the depth pre-pass
+invariant gl_Position;
+
 void main()
 {
     gl_Position = MVP * Position;
@@ -0,0 +1,1062 @@
+#include "scene.h"
+
+#include "preamble.glsl"
+
+#include "stb_image.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// The file, mapped read-only for the duration of the load
+struct MappedFile
+{
+    const uint8_t* Data;
+    size_t Size;
+#ifdef _WIN32
+    HANDLE File;
+    HANDLE Mapping;
+#endif
+};
+
+static bool MapFile(const char* filename, MappedFile& mapped)
+{
+    mapped.Data = NULL;
+    mapped.Size = 0;
+
+#ifdef _WIN32
+    mapped.File = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (mapped.File == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mapped.File, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(mapped.File);
+        return false;
+    }
+
+    mapped.Mapping = CreateFileMappingA(mapped.File, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapped.Mapping)
+    {
+        CloseHandle(mapped.File);
+        return false;
+    }
+
+    mapped.Data = (const uint8_t*)MapViewOfFile(mapped.Mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!mapped.Data)
+    {
+        CloseHandle(mapped.Mapping);
+        CloseHandle(mapped.File);
+        return false;
+    }
+    mapped.Size = (size_t)size.QuadPart;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+
+    mapped.Data = (const uint8_t*)data;
+    mapped.Size = (size_t)st.st_size;
+#endif
+
+    return true;
+}
+
+static void UnmapFile(MappedFile& mapped)
+{
+#ifdef _WIN32
+    UnmapViewOfFile(mapped.Data);
+    CloseHandle(mapped.Mapping);
+    CloseHandle(mapped.File);
+#else
+    munmap((void*)mapped.Data, mapped.Size);
+#endif
+    mapped.Data = NULL;
+    mapped.Size = 0;
+}
+
+// Just enough JSON for glTF's JSON chunk
+struct JsonValue
+{
+    enum ValueType
+    {
+        Null,
+        Bool,
+        Number,
+        String,
+        Array,
+        Object
+    };
+
+    ValueType Type;
+    bool BoolValue;
+    double NumberValue;
+    std::string StringValue;
+    std::vector<JsonValue> Elements;
+    std::vector<std::pair<std::string, JsonValue>> Members;
+
+    JsonValue() : Type(Null), BoolValue(false), NumberValue(0.0) { }
+
+    // NULL if it's not an object or doesn't have the member
+    const JsonValue* Find(const char* key) const
+    {
+        for (const std::pair<std::string, JsonValue>& member : Members)
+        {
+            if (member.first == key)
+            {
+                return &member.second;
+            }
+        }
+        return NULL;
+    }
+
+    double GetNumber(const char* key, double defaultValue) const
+    {
+        const JsonValue* value = Find(key);
+        return value && value->Type == Number ? value->NumberValue : defaultValue;
+    }
+
+    // glTF's references to other objects, -1 if there's none
+    int GetIndex(const char* key) const
+    {
+        return (int)GetNumber(key, -1.0);
+    }
+
+    std::string GetString(const char* key) const
+    {
+        const JsonValue* value = Find(key);
+        return value && value->Type == String ? value->StringValue : std::string();
+    }
+
+    // the elements of an array member, or none
+    const std::vector<JsonValue>& GetArray(const char* key) const
+    {
+        static const std::vector<JsonValue> empty;
+        const JsonValue* value = Find(key);
+        return value && value->Type == Array ? value->Elements : empty;
+    }
+};
+
+struct JsonParser
+{
+    const char* Curr;
+    const char* End;
+
+    void SkipWhitespace()
+    {
+        while (Curr < End && (*Curr == ' ' || *Curr == '\t' || *Curr == '\n' || *Curr == '\r'))
+        {
+            Curr++;
+        }
+    }
+
+    bool Expect(char c)
+    {
+        SkipWhitespace();
+        if (Curr < End && *Curr == c)
+        {
+            Curr++;
+            return true;
+        }
+        return false;
+    }
+
+    bool ParseString(std::string& str)
+    {
+        if (!Expect('"'))
+        {
+            return false;
+        }
+
+        str.clear();
+        while (Curr < End && *Curr != '"')
+        {
+            char c = *Curr++;
+            if (c != '\\')
+            {
+                str += c;
+                continue;
+            }
+
+            if (Curr == End)
+            {
+                return false;
+            }
+
+            c = *Curr++;
+            switch (c)
+            {
+            case 'b': str += '\b'; break;
+            case 'f': str += '\f'; break;
+            case 'n': str += '\n'; break;
+            case 'r': str += '\r'; break;
+            case 't': str += '\t'; break;
+            case 'u':
+            {
+                // to UTF-8. Surrogate pairs aren't combined, names and URIs don't need them.
+                if (End - Curr < 4)
+                {
+                    return false;
+                }
+                char hex[5] = { Curr[0], Curr[1], Curr[2], Curr[3], '\0' };
+                unsigned codepoint = (unsigned)strtoul(hex, NULL, 16);
+                Curr += 4;
+                if (codepoint < 0x80)
+                {
+                    str += (char)codepoint;
+                }
+                else if (codepoint < 0x800)
+                {
+                    str += (char)(0xC0 | (codepoint >> 6));
+                    str += (char)(0x80 | (codepoint & 0x3F));
+                }
+                else
+                {
+                    str += (char)(0xE0 | (codepoint >> 12));
+                    str += (char)(0x80 | ((codepoint >> 6) & 0x3F));
+                    str += (char)(0x80 | (codepoint & 0x3F));
+                }
+                break;
+            }
+            default: str += c; break;
+            }
+        }
+
+        return Expect('"');
+    }
+
+    bool ParseValue(JsonValue& value, int depth)
+    {
+        // glTF nests a handful of levels, this only stops malicious files from blowing the stack
+        if (depth > 64)
+        {
+            return false;
+        }
+
+        SkipWhitespace();
+        if (Curr == End)
+        {
+            return false;
+        }
+
+        if (*Curr == '{')
+        {
+            Curr++;
+            value.Type = JsonValue::Object;
+            if (Expect('}'))
+            {
+                return true;
+            }
+            do
+            {
+                value.Members.emplace_back();
+                if (!ParseString(value.Members.back().first) || !Expect(':') ||
+                    !ParseValue(value.Members.back().second, depth + 1))
+                {
+                    return false;
+                }
+            } while (Expect(','));
+            return Expect('}');
+        }
+        else if (*Curr == '[')
+        {
+            Curr++;
+            value.Type = JsonValue::Array;
+            if (Expect(']'))
+            {
+                return true;
+            }
+            do
+            {
+                value.Elements.emplace_back();
+                if (!ParseValue(value.Elements.back(), depth + 1))
+                {
+                    return false;
+                }
+            } while (Expect(','));
+            return Expect(']');
+        }
+        else if (*Curr == '"')
+        {
+            value.Type = JsonValue::String;
+            return ParseString(value.StringValue);
+        }
+        else if (End - Curr >= 4 && strncmp(Curr, "true", 4) == 0)
+        {
+            Curr += 4;
+            value.Type = JsonValue::Bool;
+            value.BoolValue = true;
+            return true;
+        }
+        else if (End - Curr >= 5 && strncmp(Curr, "false", 5) == 0)
+        {
+            Curr += 5;
+            value.Type = JsonValue::Bool;
+            value.BoolValue = false;
+            return true;
+        }
+        else if (End - Curr >= 4 && strncmp(Curr, "null", 4) == 0)
+        {
+            Curr += 4;
+            value.Type = JsonValue::Null;
+            return true;
+        }
+        else
+        {
+            // the chunk was copied into a null-terminated string, so strtod stops in time
+            char* numberEnd;
+            value.Type = JsonValue::Number;
+            value.NumberValue = strtod(Curr, &numberEnd);
+            if (numberEnd == Curr)
+            {
+                return false;
+            }
+            Curr = numberEnd;
+            return true;
+        }
+    }
+};
+
+#define GLB_MAGIC 0x46546C67 // "glTF"
+#define GLB_CHUNK_JSON 0x4E4F534A // "JSON"
+#define GLB_CHUNK_BIN 0x004E4942 // "BIN\0"
+
+// An accessor resolved to where its elements are in the binary chunk
+struct GLBAccessor
+{
+    const uint8_t* Data;
+    // bytes from one element to the next
+    size_t Stride;
+    // bytes of one element
+    size_t ElementSize;
+    uint32_t Count;
+    GLenum ComponentType;
+    int ComponentCount;
+    bool Normalized;
+};
+
+static int ComponentSize(GLenum componentType)
+{
+    switch (componentType)
+    {
+    case GL_BYTE: case GL_UNSIGNED_BYTE: return 1;
+    case GL_SHORT: case GL_UNSIGNED_SHORT: return 2;
+    case GL_UNSIGNED_INT: case GL_FLOAT: return 4;
+    default: return 0;
+    }
+}
+
+static int ComponentCount(const std::string& type)
+{
+    if (type == "SCALAR") return 1;
+    if (type == "VEC2") return 2;
+    if (type == "VEC3") return 3;
+    if (type == "VEC4") return 4;
+    return 0;
+}
+
+static bool ResolveAccessor(
+    const JsonValue& gltf,
+    const uint8_t* bin, size_t binSize,
+    int accessorIndex,
+    GLBAccessor& accessor)
+{
+    const std::vector<JsonValue>& accessors = gltf.GetArray("accessors");
+    const std::vector<JsonValue>& bufferViews = gltf.GetArray("bufferViews");
+    if (accessorIndex < 0 || accessorIndex >= (int)accessors.size())
+    {
+        return false;
+    }
+
+    const JsonValue& acc = accessors[accessorIndex];
+    int viewIndex = acc.GetIndex("bufferView");
+    // sparse accessors and accessors without a view (all zeros) aren't supported
+    if (viewIndex < 0 || viewIndex >= (int)bufferViews.size() || acc.Find("sparse"))
+    {
+        return false;
+    }
+
+    const JsonValue& view = bufferViews[viewIndex];
+    // the only buffer is the binary chunk
+    if (view.GetIndex("buffer") != 0 || !bin)
+    {
+        return false;
+    }
+
+    accessor.ComponentType = (GLenum)acc.GetIndex("componentType");
+    accessor.ComponentCount = ComponentCount(acc.GetString("type"));
+    accessor.Count = (uint32_t)acc.GetNumber("count", 0.0);
+    accessor.Normalized = acc.Find("normalized") && acc.Find("normalized")->BoolValue;
+    accessor.ElementSize = (size_t)ComponentSize(accessor.ComponentType) * accessor.ComponentCount;
+    if (accessor.ElementSize == 0 || accessor.Count == 0)
+    {
+        return false;
+    }
+
+    size_t viewOffset = (size_t)view.GetNumber("byteOffset", 0.0);
+    size_t viewLength = (size_t)view.GetNumber("byteLength", 0.0);
+    size_t byteStride = (size_t)view.GetNumber("byteStride", 0.0);
+    size_t accessorOffset = (size_t)acc.GetNumber("byteOffset", 0.0);
+    accessor.Stride = byteStride ? byteStride : accessor.ElementSize;
+
+    size_t accessorLength = accessor.Stride * (accessor.Count - 1) + accessor.ElementSize;
+    if (viewOffset + viewLength > binSize || accessorOffset + accessorLength > viewLength)
+    {
+        return false;
+    }
+
+    accessor.Data = bin + viewOffset + accessorOffset;
+    return true;
+}
+
+// bytes from the first element to the end of the last
+static size_t AccessorLength(const GLBAccessor& accessor)
+{
+    return accessor.Stride * (accessor.Count - 1) + accessor.ElementSize;
+}
+
+// Reads the accessor as floats, normalizing integers if it's normalized. Only for the CPU copies of the data.
+static void ReadAccessorFloats(const GLBAccessor& accessor, std::vector<float>& floats)
+{
+    floats.resize((size_t)accessor.Count * accessor.ComponentCount);
+    for (uint32_t i = 0; i < accessor.Count; i++)
+    {
+        const uint8_t* element = accessor.Data + accessor.Stride * i;
+        for (int c = 0; c < accessor.ComponentCount; c++)
+        {
+            float value = 0.0f;
+            switch (accessor.ComponentType)
+            {
+            case GL_FLOAT: memcpy(&value, element + c * 4, 4); break;
+            case GL_UNSIGNED_BYTE: value = element[c] / (accessor.Normalized ? 255.0f : 1.0f); break;
+            case GL_UNSIGNED_SHORT: { uint16_t v; memcpy(&v, element + c * 2, 2); value = v / (accessor.Normalized ? 65535.0f : 1.0f); break; }
+            case GL_BYTE: value = accessor.Normalized ? fmaxf((int8_t)element[c] / 127.0f, -1.0f) : (int8_t)element[c]; break;
+            case GL_SHORT: { int16_t v; memcpy(&v, element + c * 2, 2); value = accessor.Normalized ? fmaxf(v / 32767.0f, -1.0f) : v; break; }
+            }
+            floats[(size_t)i * accessor.ComponentCount + c] = value;
+        }
+    }
+}
+
+// Uploads the accessor's bytes as they are, and points the attribute of the bound VAO at them
+static GLuint UploadAttribute(const GLBAccessor& accessor, GLuint attribLocation)
+{
+    GLuint newBO;
+    glGenBuffers(1, &newBO);
+    glBindBuffer(GL_ARRAY_BUFFER, newBO);
+    glBufferData(GL_ARRAY_BUFFER, AccessorLength(accessor), accessor.Data, GL_STATIC_DRAW);
+    glVertexAttribPointer(attribLocation, accessor.ComponentCount, accessor.ComponentType, accessor.Normalized, (GLsizei)accessor.Stride, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glEnableVertexAttribArray(attribLocation);
+    return newBO;
+}
+
+// The transform of a node relative to its parent
+static glm::mat4 NodeMatrix(const JsonValue& node)
+{
+    const std::vector<JsonValue>& matrix = node.GetArray("matrix");
+    if (matrix.size() == 16)
+    {
+        glm::mat4 M;
+        for (int i = 0; i < 16; i++)
+        {
+            // column-major, like glm
+            glm::value_ptr(M)[i] = (float)matrix[i].NumberValue;
+        }
+        return M;
+    }
+
+    const std::vector<JsonValue>& t = node.GetArray("translation");
+    const std::vector<JsonValue>& r = node.GetArray("rotation");
+    const std::vector<JsonValue>& s = node.GetArray("scale");
+
+    glm::mat4 M;
+    if (t.size() == 3)
+    {
+        M = glm::translate(M, glm::vec3((float)t[0].NumberValue, (float)t[1].NumberValue, (float)t[2].NumberValue));
+    }
+    if (r.size() == 4)
+    {
+        // glTF's quaternions are x, y, z, w
+        M = M * glm::mat4_cast(glm::quat((float)r[3].NumberValue, (float)r[0].NumberValue, (float)r[1].NumberValue, (float)r[2].NumberValue));
+    }
+    if (s.size() == 3)
+    {
+        M = glm::scale(M, glm::vec3((float)s[0].NumberValue, (float)s[1].NumberValue, (float)s[2].NumberValue));
+    }
+    return M;
+}
+
+// Decomposes a node's world matrix into the renderer's translation * scale * rotation.
+// Exact for the usual uniform scales. A non-uniform scale under a rotation (which can shear) is approximated.
+static Transform MatrixToTransform(const glm::mat4& M)
+{
+    glm::mat3 A(M);
+
+    // the scale is applied after the rotation, so it's the length of the rows
+    glm::vec3 scale(
+        glm::length(glm::vec3(A[0][0], A[1][0], A[2][0])),
+        glm::length(glm::vec3(A[0][1], A[1][1], A[2][1])),
+        glm::length(glm::vec3(A[0][2], A[1][2], A[2][2])));
+    if (glm::determinant(A) < 0.0f)
+    {
+        scale.x = -scale.x;
+    }
+
+    glm::mat3 R;
+    for (int row = 0; row < 3; row++)
+    {
+        for (int col = 0; col < 3; col++)
+        {
+            R[col][row] = scale[row] != 0.0f ? A[col][row] / scale[row] : (row == col ? 1.0f : 0.0f);
+        }
+    }
+
+    Transform transform;
+    transform.Scale = scale;
+    transform.RotationOrigin = glm::vec3(0.0f);
+    transform.Rotation = glm::normalize(glm::quat_cast(R));
+    transform.Translation = glm::vec3(M[3]);
+    return transform;
+}
+
+static void PlaceNode(
+    const JsonValue& gltf,
+    int nodeIndex,
+    const glm::mat4& parentMatrix,
+    const std::vector<std::vector<uint32_t>>& gltfMeshMeshIDs,
+    int depth,
+    std::vector<MeshPlacement>* loadedPlacements)
+{
+    const std::vector<JsonValue>& nodes = gltf.GetArray("nodes");
+    // the depth also stops cycles (invalid, but they'd never end)
+    if (nodeIndex < 0 || nodeIndex >= (int)nodes.size() || depth > 64)
+    {
+        return;
+    }
+
+    const JsonValue& node = nodes[nodeIndex];
+    glm::mat4 worldMatrix = parentMatrix * NodeMatrix(node);
+
+    int meshIndex = node.GetIndex("mesh");
+    if (meshIndex >= 0 && meshIndex < (int)gltfMeshMeshIDs.size() && loadedPlacements)
+    {
+        Transform placement = MatrixToTransform(worldMatrix);
+        for (uint32_t meshID : gltfMeshMeshIDs[meshIndex])
+        {
+            MeshPlacement newPlacement;
+            newPlacement.MeshID = meshID;
+            newPlacement.Placement = placement;
+            loadedPlacements->push_back(newPlacement);
+        }
+    }
+
+    for (const JsonValue& child : node.GetArray("children"))
+    {
+        PlaceNode(gltf, (int)child.NumberValue, worldMatrix, gltfMeshMeshIDs, depth + 1, loadedPlacements);
+    }
+}
+
+// Loads the image of a glTF texture (embedded in the binary chunk, or a file next to the .glb) as a diffuse map.
+// Returns kNoDiffuseMap if it can't be loaded.
+static uint32_t LoadGLBDiffuseMap(
+    Scene& scene,
+    const JsonValue& gltf,
+    const uint8_t* bin, size_t binSize,
+    const std::string& basepath,
+    int imageIndex)
+{
+    const std::vector<JsonValue>& images = gltf.GetArray("images");
+    const std::vector<JsonValue>& bufferViews = gltf.GetArray("bufferViews");
+    if (imageIndex < 0 || imageIndex >= (int)images.size())
+    {
+        return kNoDiffuseMap;
+    }
+
+    const JsonValue& image = images[imageIndex];
+
+    // glTF's texture coordinates start at the top of the image, so it's loaded top row first (unlike OBJ's)
+    int x, y, comp;
+    stbi_uc* pixels = NULL;
+    int viewIndex = image.GetIndex("bufferView");
+    if (viewIndex >= 0 && viewIndex < (int)bufferViews.size())
+    {
+        const JsonValue& view = bufferViews[viewIndex];
+        size_t viewOffset = (size_t)view.GetNumber("byteOffset", 0.0);
+        size_t viewLength = (size_t)view.GetNumber("byteLength", 0.0);
+        if (bin && view.GetIndex("buffer") == 0 && viewOffset + viewLength <= binSize)
+        {
+            pixels = stbi_load_from_memory(bin + viewOffset, (int)viewLength, &x, &y, &comp, 4);
+        }
+    }
+    else if (!image.GetString("uri").empty() && image.GetString("uri").compare(0, 5, "data:") != 0)
+    {
+        std::string filename = basepath + image.GetString("uri");
+        pixels = stbi_load(filename.c_str(), &x, &y, &comp, 4);
+    }
+
+    if (!pixels)
+    {
+        fprintf(stderr, "LoadGLB: image %d: %s\n", imageIndex, stbi_failure_reason() ? stbi_failure_reason() : "unsupported");
+        return kNoDiffuseMap;
+    }
+
+    DiffuseMap newDiffuseMap;
+    newDiffuseMap.DiffuseMapTO = 0;
+    newDiffuseMap.Width = x;
+    newDiffuseMap.Height = y;
+    newDiffuseMap.RefCount = 0;
+
+    if (!scene.NoGL)
+    {
+        float maxAnisotropy;
+        glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAnisotropy);
+
+        GLuint newDiffuseMapTO;
+        glGenTextures(1, &newDiffuseMapTO);
+        glBindTexture(GL_TEXTURE_2D, newDiffuseMapTO);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, x, y, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, maxAnisotropy);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        newDiffuseMap.DiffuseMapTO = newDiffuseMapTO;
+    }
+
+    if (scene.KeepCPUData)
+    {
+        newDiffuseMap.Pixels.assign(pixels, pixels + (size_t)x * y * 4);
+    }
+
+    stbi_image_free(pixels);
+
+    return scene.DiffuseMaps.insert(newDiffuseMap);
+}
+
+// Maps a metallic-roughness material onto the renderer's Blinn-Phong material
+static Material ConvertGLBMaterial(const JsonValue& material, uint32_t diffuseMapID)
+{
+    Material newMaterial;
+    newMaterial.Name = material.GetString("name");
+
+    glm::vec4 baseColor(1.0f);
+    float metallic = 1.0f;
+    float roughness = 1.0f;
+    const JsonValue* pbr = material.Find("pbrMetallicRoughness");
+    if (pbr)
+    {
+        const std::vector<JsonValue>& factor = pbr->GetArray("baseColorFactor");
+        if (factor.size() == 4)
+        {
+            baseColor = glm::vec4((float)factor[0].NumberValue, (float)factor[1].NumberValue, (float)factor[2].NumberValue, (float)factor[3].NumberValue);
+        }
+        metallic = (float)pbr->GetNumber("metallicFactor", 1.0);
+        roughness = (float)pbr->GetNumber("roughnessFactor", 1.0);
+    }
+
+    // metals have no diffuse, and reflect with their color. Dielectrics reflect 4%.
+    glm::vec3 diffuse = glm::vec3(baseColor) * (1.0f - metallic);
+    glm::vec3 specular = glm::mix(glm::vec3(0.04f), glm::vec3(baseColor), metallic);
+    // the Blinn-Phong exponent with about the same highlight as the GGX roughness
+    float alpha = roughness * roughness;
+    float shininess = glm::clamp(2.0f / fmaxf(alpha * alpha, 1e-4f) - 2.0f, 1.0f, 10000.0f);
+
+    for (int i = 0; i < 3; i++)
+    {
+        newMaterial.Ambient[i] = diffuse[i];
+        newMaterial.Diffuse[i] = diffuse[i];
+        newMaterial.Specular[i] = specular[i];
+    }
+    newMaterial.Shininess = shininess;
+    newMaterial.DiffuseMapID = diffuseMapID;
+    // held by the file
+    newMaterial.RefCount = 1;
+
+    return newMaterial;
+}
+
+void LoadGLB(
+    Scene& scene,
+    const std::string& filename,
+    std::vector<uint32_t>* loadedMeshIDs,
+    std::vector<MeshPlacement>* loadedPlacements)
+{
+    // images that aren't embedded are next to the .glb
+    std::string basepath = filename;
+    size_t last_slash = basepath.find_last_of("/");
+    if (last_slash == std::string::npos)
+        basepath = "./";
+    else
+        basepath = basepath.substr(0, last_slash + 1);
+
+    MappedFile mapped;
+    if (!MapFile(filename.c_str(), mapped))
+    {
+        fprintf(stderr, "LoadGLB(%s): can't open the file\n", filename.c_str());
+        return;
+    }
+
+    // 12 bytes of header, then chunks of 8 bytes of header and their data (padded to 4 bytes)
+    uint32_t header[3] = {};
+    if (mapped.Size >= sizeof(header))
+    {
+        memcpy(header, mapped.Data, sizeof(header));
+    }
+    if (header[0] != GLB_MAGIC || header[1] != 2 || header[2] > mapped.Size)
+    {
+        fprintf(stderr, "LoadGLB(%s): not a binary glTF 2.0 file\n", filename.c_str());
+        UnmapFile(mapped);
+        return;
+    }
+
+    const uint8_t* json = NULL;
+    size_t jsonSize = 0;
+    const uint8_t* bin = NULL;
+    size_t binSize = 0;
+    for (size_t offset = sizeof(header); offset + 8 <= header[2]; )
+    {
+        uint32_t chunkHeader[2];
+        memcpy(chunkHeader, mapped.Data + offset, sizeof(chunkHeader));
+        if (chunkHeader[0] > header[2] - offset - 8)
+        {
+            break;
+        }
+
+        if (chunkHeader[1] == GLB_CHUNK_JSON && !json)
+        {
+            json = mapped.Data + offset + 8;
+            jsonSize = chunkHeader[0];
+        }
+        else if (chunkHeader[1] == GLB_CHUNK_BIN && !bin)
+        {
+            bin = mapped.Data + offset + 8;
+            binSize = chunkHeader[0];
+        }
+
+        offset += 8 + ((chunkHeader[0] + 3) & ~3u);
+    }
+
+    JsonValue gltf;
+    std::string jsonText(json ? (const char*)json : "", jsonSize);
+    JsonParser parser = { jsonText.c_str(), jsonText.c_str() + jsonText.size() };
+    if (!json || !parser.ParseValue(gltf, 0) || gltf.Type != JsonValue::Object)
+    {
+        fprintf(stderr, "LoadGLB(%s): invalid JSON chunk\n", filename.c_str());
+        UnmapFile(mapped);
+        return;
+    }
+
+    LoadedFile& loadedFile = scene.LoadedFiles[filename];
+
+    // Add materials to the scene, and a default one for primitives without
+    std::map<int, uint32_t> imageDiffuseMaps;
+    std::vector<uint32_t> newMaterialIDs;
+    for (const JsonValue& materialToAdd : gltf.GetArray("materials"))
+    {
+        uint32_t diffuseMapID = kNoDiffuseMap;
+
+        const JsonValue* pbr = materialToAdd.Find("pbrMetallicRoughness");
+        const JsonValue* baseColorTexture = pbr ? pbr->Find("baseColorTexture") : NULL;
+        int textureIndex = baseColorTexture ? baseColorTexture->GetIndex("index") : -1;
+        const std::vector<JsonValue>& textures = gltf.GetArray("textures");
+        if (textureIndex >= 0 && textureIndex < (int)textures.size())
+        {
+            int imageIndex = textures[textureIndex].GetIndex("source");
+            auto cachedImage = imageDiffuseMaps.find(imageIndex);
+            if (cachedImage != end(imageDiffuseMaps))
+            {
+                diffuseMapID = cachedImage->second;
+            }
+            else
+            {
+                diffuseMapID = LoadGLBDiffuseMap(scene, gltf, bin, binSize, basepath, imageIndex);
+                imageDiffuseMaps.emplace(imageIndex, diffuseMapID);
+            }
+        }
+
+        if (diffuseMapID != kNoDiffuseMap)
+        {
+            scene.DiffuseMaps[diffuseMapID].RefCount++;
+        }
+
+        newMaterialIDs.push_back(scene.Materials.insert(ConvertGLBMaterial(materialToAdd, diffuseMapID)));
+        loadedFile.MaterialIDs.push_back(newMaterialIDs.back());
+    }
+
+    uint32_t defaultMaterialID = (uint32_t)-1;
+
+    // Add meshes to the scene, one per triangle primitive
+    std::vector<std::vector<uint32_t>> gltfMeshMeshIDs;
+    for (const JsonValue& meshToAdd : gltf.GetArray("meshes"))
+    {
+        gltfMeshMeshIDs.emplace_back();
+
+        const std::vector<JsonValue>& primitives = meshToAdd.GetArray("primitives");
+        for (size_t primitiveIdx = 0; primitiveIdx < primitives.size(); primitiveIdx++)
+        {
+            const JsonValue& primitive = primitives[primitiveIdx];
+
+            // only triangle lists (the default)
+            if (primitive.GetIndex("mode") != -1 && primitive.GetIndex("mode") != GL_TRIANGLES)
+            {
+                continue;
+            }
+
+            const JsonValue* attributes = primitive.Find("attributes");
+            GLBAccessor positions, texCoords, normals, indices;
+            bool hasPositions = attributes && ResolveAccessor(gltf, bin, binSize, attributes->GetIndex("POSITION"), positions);
+            bool hasTexCoords = attributes && ResolveAccessor(gltf, bin, binSize, attributes->GetIndex("TEXCOORD_0"), texCoords);
+            bool hasNormals = attributes && ResolveAccessor(gltf, bin, binSize, attributes->GetIndex("NORMAL"), normals);
+            bool hasIndices = ResolveAccessor(gltf, bin, binSize, primitive.GetIndex("indices"), indices);
+
+            if (!hasPositions || positions.ComponentType != GL_FLOAT || positions.ComponentCount != 3)
+            {
+                fprintf(stderr, "LoadGLB(%s): mesh %s: primitive %d has no float positions, skipped\n",
+                    filename.c_str(), meshToAdd.GetString("name").c_str(), (int)primitiveIdx);
+                continue;
+            }
+
+            hasTexCoords = hasTexCoords && texCoords.ComponentCount == 2 && texCoords.Count == positions.Count;
+            hasNormals = hasNormals && normals.ComponentCount == 3 && normals.Count == positions.Count;
+            if (!hasNormals)
+            {
+                fprintf(stderr, "LoadGLB(%s): mesh %s: primitive %d has no normals\n",
+                    filename.c_str(), meshToAdd.GetString("name").c_str(), (int)primitiveIdx);
+            }
+
+            // 32-bit indices are used as they are, narrower ones are widened (the renderer draws 32-bit indices)
+            std::vector<uint32_t> widenedIndices;
+            const uint32_t* indexData;
+            uint32_t indexCount;
+            if (hasIndices && indices.ComponentType == GL_UNSIGNED_INT && indices.Stride == 4)
+            {
+                indexData = (const uint32_t*)indices.Data;
+                indexCount = indices.Count;
+            }
+            else
+            {
+                // and primitives without indices are indexed in order
+                indexCount = hasIndices ? indices.Count : positions.Count;
+                widenedIndices.resize(indexCount);
+                for (uint32_t i = 0; i < indexCount; i++)
+                {
+                    const uint8_t* element = hasIndices ? indices.Data + indices.Stride * i : NULL;
+                    if (!hasIndices)
+                        widenedIndices[i] = i;
+                    else if (indices.ComponentType == GL_UNSIGNED_BYTE)
+                        widenedIndices[i] = *element;
+                    else if (indices.ComponentType == GL_UNSIGNED_SHORT)
+                        widenedIndices[i] = (uint32_t)element[0] | ((uint32_t)element[1] << 8);
+                    else
+                        memcpy(&widenedIndices[i], element, 4);
+                }
+                indexData = widenedIndices.data();
+            }
+
+            // drop the incomplete triangle at the end, and out of range indices
+            indexCount -= indexCount % 3;
+            bool indicesValid = true;
+            for (uint32_t i = 0; i < indexCount; i++)
+            {
+                indicesValid = indicesValid && indexData[i] < positions.Count;
+            }
+            if (!indicesValid || indexCount == 0)
+            {
+                fprintf(stderr, "LoadGLB(%s): mesh %s: primitive %d has invalid indices, skipped\n",
+                    filename.c_str(), meshToAdd.GetString("name").c_str(), (int)primitiveIdx);
+                continue;
+            }
+
+            Mesh newMesh;
+
+            newMesh.Name = meshToAdd.GetString("name");
+            if (primitives.size() > 1)
+            {
+                newMesh.Name += "/" + std::to_string(primitiveIdx);
+            }
+
+            newMesh.IndexCount = indexCount;
+            newMesh.RefCount = 0;
+            newMesh.VertexCount = positions.Count;
+
+            if (scene.KeepCPUData)
+            {
+                ReadAccessorFloats(positions, newMesh.Positions);
+                if (hasTexCoords)
+                {
+                    ReadAccessorFloats(texCoords, newMesh.TexCoords);
+                }
+                if (hasNormals)
+                {
+                    ReadAccessorFloats(normals, newMesh.Normals);
+                }
+                newMesh.Indices.assign(indexData, indexData + indexCount);
+            }
+
+            newMesh.MeshVAO = 0;
+            newMesh.DepthVAO = 0;
+            newMesh.PositionBO = 0;
+            newMesh.TexCoordBO = 0;
+            newMesh.NormalBO = 0;
+            newMesh.IndexBO = 0;
+
+            if (!scene.NoGL)
+            {
+                GLuint newMeshVAO;
+                glGenVertexArrays(1, &newMeshVAO);
+                glBindVertexArray(newMeshVAO);
+
+                newMesh.PositionBO = UploadAttribute(positions, SCENE_POSITION_ATTRIB_LOCATION);
+                if (hasTexCoords)
+                {
+                    newMesh.TexCoordBO = UploadAttribute(texCoords, SCENE_TEXCOORD_ATTRIB_LOCATION);
+                }
+                if (hasNormals)
+                {
+                    newMesh.NormalBO = UploadAttribute(normals, SCENE_NORMAL_ATTRIB_LOCATION);
+                }
+
+                GLuint newIndexBO;
+                glGenBuffers(1, &newIndexBO);
+                // binding the EBO attaches it to the VAO, which is the one being set up
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, newIndexBO);
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(uint32_t), indexData, GL_STATIC_DRAW);
+                newMesh.IndexBO = newIndexBO;
+
+                glBindVertexArray(0);
+                newMesh.MeshVAO = newMeshVAO;
+
+                // position-only VAO, on the same buffers
+                GLuint newDepthVAO;
+                glGenVertexArrays(1, &newDepthVAO);
+                glBindVertexArray(newDepthVAO);
+
+                glBindBuffer(GL_ARRAY_BUFFER, newMesh.PositionBO);
+                glVertexAttribPointer(SCENE_POSITION_ATTRIB_LOCATION, 3, GL_FLOAT, GL_FALSE, (GLsizei)positions.Stride, 0);
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+                glEnableVertexAttribArray(SCENE_POSITION_ATTRIB_LOCATION);
+
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, newMesh.IndexBO);
+
+                glBindVertexArray(0);
+                newMesh.DepthVAO = newDepthVAO;
+            }
+
+            int materialIndex = primitive.GetIndex("material");
+            uint32_t materialID;
+            if (materialIndex >= 0 && materialIndex < (int)newMaterialIDs.size())
+            {
+                materialID = newMaterialIDs[materialIndex];
+            }
+            else
+            {
+                if (defaultMaterialID == (uint32_t)-1)
+                {
+                    JsonValue defaultMaterial;
+                    defaultMaterial.Type = JsonValue::Object;
+                    defaultMaterialID = scene.Materials.insert(ConvertGLBMaterial(defaultMaterial, kNoDiffuseMap));
+                    loadedFile.MaterialIDs.push_back(defaultMaterialID);
+                }
+                materialID = defaultMaterialID;
+            }
+
+            GLDrawElementsIndirectCommand drawCommand;
+            drawCommand.count = indexCount;
+            drawCommand.primCount = 1;
+            drawCommand.firstIndex = 0;
+            drawCommand.baseVertex = 0;
+            drawCommand.baseInstance = 0;
+            newMesh.DrawCommands.push_back(drawCommand);
+            newMesh.MaterialIDs.push_back(materialID);
+            scene.Materials[materialID].RefCount++;
+
+            BuildMeshlets(newMesh.Meshlets, (const float*)positions.Data, positions.Stride, newMesh.VertexCount, indexData, newMesh.DrawCommands);
+            BuildOccluder(newMesh.Occluder, (const float*)positions.Data, positions.Stride, newMesh.VertexCount, indexData, indexCount);
+
+            uint32_t newMeshID = scene.Meshes.insert(newMesh);
+            gltfMeshMeshIDs.back().push_back(newMeshID);
+            loadedFile.MeshIDs.push_back(newMeshID);
+
+            if (loadedMeshIDs)
+            {
+                loadedMeshIDs->push_back(newMeshID);
+            }
+        }
+    }
+
+    // Place the meshes with the nodes of the default scene (or of the first one, or all root nodes without scenes)
+    const std::vector<JsonValue>& scenes = gltf.GetArray("scenes");
+    int sceneIndex = gltf.GetIndex("scene");
+    if (sceneIndex < 0 || sceneIndex >= (int)scenes.size())
+    {
+        sceneIndex = scenes.empty() ? -1 : 0;
+    }
+
+    if (sceneIndex != -1)
+    {
+        for (const JsonValue& rootNode : scenes[sceneIndex].GetArray("nodes"))
+        {
+            PlaceNode(gltf, (int)rootNode.NumberValue, glm::mat4(), gltfMeshMeshIDs, 0, loadedPlacements);
+        }
+    }
+    else
+    {
+        const std::vector<JsonValue>& nodes = gltf.GetArray("nodes");
+        std::vector<bool> isChild(nodes.size());
+        for (const JsonValue& node : nodes)
+        {
+            for (const JsonValue& child : node.GetArray("children"))
+            {
+                if (child.NumberValue >= 0 && child.NumberValue < nodes.size())
+                {
+                    isChild[(size_t)child.NumberValue] = true;
+                }
+            }
+        }
+
+        for (size_t nodeIdx = 0; nodeIdx < nodes.size(); nodeIdx++)
+        {
+            if (!isChild[nodeIdx])
+            {
+                PlaceNode(gltf, (int)nodeIdx, glm::mat4(), gltfMeshMeshIDs, 0, loadedPlacements);
+            }
+        }
+    }
+
+    UnmapFile(mapped);
+}
\ No newline at end of file
@@ -53,12 +53,22 @@ static uint64_t GetShaderFileTimestamp(const char* filename)
         return 0;
     }
 
+#ifdef __APPLE__
     timestamp = fileStat.st_mtimespec.tv_sec;
+#else
+    timestamp = fileStat.st_mtim.tv_sec;
+#endif
 #endif
 
     return timestamp;
 }
 
+// The "file name" number of a #line directive, which has to be non-negative (Mesa rejects negative ones).
+static int32_t HashShaderName(const std::string& name)
+{
+    return (int32_t)(std::hash<std::string>()(name) & 0x7FFFFFFF);
+}
+
 static std::string ShaderStringFromFile(const char* filename)
 {
     std::ifstream fs(filename);
@@ -111,7 +121,7 @@ GLuint* ShaderSet::AddProgram(const std::vector<std::pair<std::string, GLenum>>&
         if (!foundShader->second.Handle)
         {
             foundShader->second.Handle = glCreateShader(shaderNameType.second);
-            foundShader->second.HashName = (int32_t)std::hash<std::string>()(shaderNameType.first);
+            foundShader->second.HashName = HashShaderName(shaderNameType.first);
         }
         shaderNameTypes.push_back(&foundShader->first);
     }
@@ -137,10 +147,17 @@ GLuint* ShaderSet::AddProgram(const std::vector<std::pair<std::string, GLenum>>&
     return &foundProgram->second.PublicHandle;
 }
 
-void ShaderSet::UpdatePrograms()
+void ShaderSet::SetFrameArena(FrameArena* arena)
+{
+    mFrameArena = arena;
+}
+
+bool ShaderSet::UpdatePrograms()
 {
     // find all shaders with updated timestamps
-    std::set<std::pair<const ShaderNameTypePair, Shader>*> updatedShaders;
+    typedef std::pair<const ShaderNameTypePair, Shader>* UpdatedShader;
+    std::set<UpdatedShader, std::less<UpdatedShader>, FrameAllocator<UpdatedShader>> updatedShaders(
+        (std::less<UpdatedShader>()), FrameAllocator<UpdatedShader>(mFrameArena));
     for (std::pair<const ShaderNameTypePair, Shader>& shader : mShaders)
     {
         uint64_t timestamp = GetShaderFileTimestamp(shader.first.Name.c_str());
@@ -158,7 +175,7 @@ void ShaderSet::UpdatePrograms()
         // the #line directive also allows specifying a "file name" number, which makes it possible to identify which file the error came from.
         std::string version = "#version " + mVersion + "\n";
         
-        std::string preamble_hash = std::to_string((int32_t)std::hash<std::string>()("preamble"));
+        std::string preamble_hash = std::to_string(HashShaderName("preamble"));
         std::string premable = "#line 1 " + preamble_hash + "\n" + 
                                mPreamble + "\n";
         
@@ -250,7 +267,7 @@ void ShaderSet::UpdatePrograms()
             std::string log_s = log.data();
 
             // replace all filename hashes in the error messages with actual filenames
-            std::string preamble_hash = std::to_string((int32_t)std::hash<std::string>()("preamble"));
+            std::string preamble_hash = std::to_string(HashShaderName("preamble"));
             for (size_t found_preamble; (found_preamble = log_s.find(preamble_hash)) != std::string::npos;) {
                 log_s.replace(found_preamble, preamble_hash.size(), "preamble");
             }
@@ -304,6 +321,8 @@ void ShaderSet::UpdatePrograms()
             }
         }
     }
+
+    return !updatedShaders.empty();
 }
 
 void ShaderSet::SetPreambleFile(const std::string& preambleFilename)
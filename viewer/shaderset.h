@@ -3,6 +3,9 @@
 // Replace with your own GL header include
 #include "opengl.h"
 
+#include "frame_arena.h"
+
+#include <string>
 #include <vector>
 #include <utility>
 #include <map>
@@ -50,6 +53,8 @@ class ShaderSet
     std::map<ShaderNameTypePair, Shader> mShaders;
     // allows looking up the program that represents a linked set of shaders
     std::map<std::vector<const ShaderNameTypePair*>, Program> mPrograms;
+    // for the temporaries of UpdatePrograms, or the heap if NULL
+    FrameArena* mFrameArena = NULL;
 
 public:
     ShaderSet() = default;
@@ -73,8 +78,12 @@ public:
     // eg: AddProgram({ {"foo.vert", GL_VERTEX_SHADER}, {"bar.frag", GL_FRAGMENT_SHADER} });
     GLuint* AddProgram(const std::vector<std::pair<std::string, GLenum>>& typedShaders);
 
-    // Polls the timestamps of all the shaders and recompiles/relinks them if they changed
-    void UpdatePrograms();
+    // Polls the timestamps of all the shaders and recompiles/relinks them if they changed.
+    // Returns whether any shader changed (so programs may now draw differently).
+    bool UpdatePrograms();
+
+    // Allocates the temporaries of UpdatePrograms from the arena (which must outlive the set), since it's called every frame
+    void SetFrameArena(FrameArena* arena);
 
     // Convenience to add shaders based on extension file naming conventions
     // vertex shader: .vert
@@ -2,6 +2,8 @@
 
 #include "scene.h"
 #include "renderer.h"
+#include "animation.h"
+#include "thread_pool.h"
 
 #define ARCBALL_CAMERA_IMPLEMENTATION
 #include "arcball_camera.h"
@@ -11,9 +13,14 @@
 #include <SDL.h>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <random>
+
 class Simulation : public ISimulation
 {
 public:
+    const int kMaxAnimatedInstances = 8192;
+    const int kAnimationKeyCount = 8;
+
     Scene* mScene;
     IRenderer* mRenderer;
 
@@ -24,6 +31,26 @@ public:
     int mLastMouseY;
     int mAccumulatedMouseWheel;
 
+    // animation stress test: lots of independently animated cubes
+    std::vector<uint32_t> mCubeMeshIDs;
+    Animation mAnimation;
+    float mAnimationTimeSeconds;
+    int mAnimationSpawnCount;
+    std::mt19937 mAnimationRNG;
+    float mAnimationEvaluateMs;
+
+    // dynamic lights stress test: point and spot lights circling around the scene
+    struct OrbitingLight
+    {
+        uint32_t LightID;
+        glm::vec3 Center;
+        float OrbitRadius;
+        float AngularSpeed;
+        float Phase;
+    };
+    std::vector<OrbitingLight> mOrbitingLights;
+    int mLightSpawnCount;
+
     void Init(Scene* scene, IRenderer* renderer) override
     {
         mScene = scene;
@@ -37,6 +64,7 @@ public:
 
         loadedMeshIDs.clear();
         LoadMeshes(*mScene, "assets/cube/cube.obj", &loadedMeshIDs);
+        mCubeMeshIDs = loadedMeshIDs;
         for (uint32_t loadedMeshID : loadedMeshIDs)
         {
             uint32_t newInstanceID;
@@ -90,6 +118,127 @@ public:
         mainCamera.Up = normalize(cross(across, mainCamera.Target - mainCamera.Eye));
         mainCamera.FovY = glm::radians(70.0f);
         mScene->MainCameraID = mScene->Cameras.insert(mainCamera);
+
+        InitAnimation(mAnimation, kAnimationKeyCount, 4.0f, kMaxAnimatedInstances);
+        mAnimationTimeSeconds = 0.0f;
+        mAnimationSpawnCount = 1000;
+        mAnimationRNG.seed(1337);
+
+        mLightSpawnCount = 200;
+    }
+
+    // Adds lights of random colors, a third of them spots pointing down, each on its own circle around the scene.
+    void SpawnLights(int count)
+    {
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        std::uniform_real_distribution<float> positive(0.0f, 1.0f);
+
+        for (int i = 0; i < count; i++)
+        {
+            if (mScene->Lights.size() == mScene->Lights.capacity())
+            {
+                return;
+            }
+
+            Light light;
+            light.Position = glm::vec3(0.0f);
+            light.Color = glm::vec3(positive(mAnimationRNG), positive(mAnimationRNG), positive(mAnimationRNG)) * 3.0f;
+            light.Radius = 1.5f + positive(mAnimationRNG) * 2.0f;
+            light.IsSpot = i % 3 == 0;
+            light.Direction = normalize(glm::vec3(unit(mAnimationRNG) * 0.3f, -1.0f, unit(mAnimationRNG) * 0.3f));
+            light.SpotCosInner = cosf(glm::radians(20.0f));
+            light.SpotCosOuter = cosf(glm::radians(30.0f));
+
+            OrbitingLight orbit;
+            orbit.LightID = mScene->Lights.insert(light);
+            orbit.Center = glm::vec3(unit(mAnimationRNG), 0.5f + positive(mAnimationRNG) * 2.5f, unit(mAnimationRNG));
+            orbit.OrbitRadius = 1.0f + positive(mAnimationRNG) * 8.0f;
+            orbit.AngularSpeed = unit(mAnimationRNG) * 0.6f;
+            orbit.Phase = positive(mAnimationRNG) * glm::two_pi<float>();
+            mOrbitingLights.push_back(orbit);
+        }
+    }
+
+    void RemoveLights()
+    {
+        for (const OrbitingLight& orbit : mOrbitingLights)
+        {
+            mScene->Lights.erase(orbit.LightID);
+        }
+        mOrbitingLights.clear();
+    }
+
+    // Adds small cubes scattered above the floor, each with its own random keyframed wobble.
+    void SpawnAnimatedCubes(int count)
+    {
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        std::uniform_real_distribution<float> speed(0.5f, 1.5f);
+
+        for (int i = 0; i < count; i++)
+        {
+            glm::vec3 basePosition = glm::vec3(unit(mAnimationRNG) * 8.0f, 3.0f + unit(mAnimationRNG) * 1.5f, unit(mAnimationRNG) * 8.0f);
+
+            for (uint32_t cubeMeshID : mCubeMeshIDs)
+            {
+                if (mAnimation.TrackCount == mAnimation.TrackCapacity ||
+                    mScene->Instances.size() == mScene->Instances.capacity())
+                {
+                    return;
+                }
+
+                uint32_t newInstanceID;
+                AddInstance(*mScene, cubeMeshID, &newInstanceID);
+                uint32_t newTransformID = mScene->Instances[newInstanceID].TransformID;
+                mScene->Transforms[newTransformID].Scale = glm::vec3(0.1f);
+
+                uint32_t trackIndex = AddAnimationTrack(mAnimation, newTransformID, unit(mAnimationRNG) * mAnimation.Duration, speed(mAnimationRNG));
+                for (uint32_t key = 0; key < mAnimation.KeyCount; key++)
+                {
+                    glm::vec3 translation = basePosition + glm::vec3(unit(mAnimationRNG), unit(mAnimationRNG), unit(mAnimationRNG)) * 0.5f;
+                    glm::quat rotation = normalize(glm::quat(unit(mAnimationRNG), unit(mAnimationRNG), unit(mAnimationRNG), unit(mAnimationRNG)));
+                    SetAnimationKey(mAnimation, trackIndex, key, translation, rotation);
+                }
+            }
+        }
+    }
+
+    void UpdateGUI()
+    {
+        if (ImGui::Begin("Animation"))
+        {
+            ImGui::SliderInt("Spawn Count", &mAnimationSpawnCount, 1, 4000);
+            if (ImGui::Button("Spawn Animated Cubes"))
+            {
+                SpawnAnimatedCubes(mAnimationSpawnCount);
+            }
+
+            ImGui::Text("Animated instances: %u / %u", mAnimation.TrackCount, mAnimation.TrackCapacity);
+            if (mAnimation.TrackCount > 0)
+            {
+                ImGui::Text("Evaluate: %.3f milliseconds (%.1f ns per instance, %d threads)",
+                    mAnimationEvaluateMs,
+                    mAnimationEvaluateMs * 1000000.0f / mAnimation.TrackCount,
+                    GetParallelThreadCount());
+            }
+        }
+        ImGui::End();
+
+        if (ImGui::Begin("Lights"))
+        {
+            ImGui::SliderInt("Spawn Count", &mLightSpawnCount, 1, 1000);
+            if (ImGui::Button("Spawn Lights"))
+            {
+                SpawnLights(mLightSpawnCount);
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Remove Lights"))
+            {
+                RemoveLights();
+            }
+
+            ImGui::Text("Lights: %u / %u", (uint32_t)mScene->Lights.size(), (uint32_t)mScene->Lights.capacity());
+        }
+        ImGui::End();
     }
 
     void HandleEvent(const SDL_Event& ev) override
@@ -138,7 +287,29 @@ public:
             0);
 
         mainCamera.Aspect = (float)mRenderer->GetRenderWidth() / mRenderer->GetRenderHeight();
-        mainCamera.ZNear = 0.01f;
+        mainCamera.ZNear = kCameraZNear;
+
+        // update animated transforms
+        mAnimationTimeSeconds += dtSec;
+        if (mAnimation.TrackCount > 0)
+        {
+            Uint64 evaluateStart = SDL_GetPerformanceCounter();
+            EvaluateAnimation(mAnimation, *mScene, mAnimationTimeSeconds);
+            Uint64 evaluateEnd = SDL_GetPerformanceCounter();
+
+            float evaluateMs = (evaluateEnd - evaluateStart) * 1000.0f / SDL_GetPerformanceFrequency();
+            // smoothed, so the number is readable
+            mAnimationEvaluateMs += (evaluateMs - mAnimationEvaluateMs) * 0.05f;
+        }
+
+        // move the lights along their circles
+        for (const OrbitingLight& orbit : mOrbitingLights)
+        {
+            float angle = orbit.Phase + mAnimationTimeSeconds * orbit.AngularSpeed;
+            mScene->Lights[orbit.LightID].Position = orbit.Center + glm::vec3(cosf(angle), 0.0f, sinf(angle)) * orbit.OrbitRadius;
+        }
+
+        UpdateGUI();
 
         mFirstUpdate = false;
 
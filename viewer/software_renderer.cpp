@@ -0,0 +1,1047 @@
+#include "renderer.h"
+
+#include "scene.h"
+#include "image_write.h"
+#include "thread_pool.h"
+#include "cpu_dof.h"
+#include "clip_polygon.h"
+
+#include "imgui.h"
+
+#include <glm/gtx/transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <SDL.h>
+
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SOFTWARE_RENDERER_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    // Side of the screen tiles that triangles are binned into. Each tile is rasterized and shaded by one thread.
+    const int kTileSize = 64;
+    // Vertex positions are snapped to 1/16 pixel, so the edge functions can be evaluated exactly in integers.
+    const int kSubpixelBits = 4;
+    const int kSubpixelScale = 1 << kSubpixelBits;
+    // Triangles are set up and binned in chunks of this many. Each chunk has its own bins, so binning needs no locks,
+    // and the tiles walk the chunks in order, which keeps the draw order (equal depths resolve like on the GPU).
+    const int kTriangleChunkSize = 1024;
+
+    // Edge function values beyond this are far enough from the edge that they can't change sign within a tile
+    const int64_t kTrivialEdgeDistance = (int64_t)1 << 30;
+
+    struct ClipVertex
+    {
+        glm::vec4 Clip;
+        glm::vec3 World;
+        glm::vec3 Normal;
+        glm::vec2 TexCoord;
+    };
+
+    ClipVertex LerpVertex(const ClipVertex& a, const ClipVertex& b, float t)
+    {
+        ClipVertex v;
+        v.Clip = a.Clip + (b.Clip - a.Clip) * t;
+        v.World = a.World + (b.World - a.World) * t;
+        v.Normal = a.Normal + (b.Normal - a.Normal) * t;
+        v.TexCoord = a.TexCoord + (b.TexCoord - a.TexCoord) * t;
+        return v;
+    }
+
+    // a draw command of an instance
+    struct SoftwareDraw
+    {
+        int FirstTriangle; // in the frame's triangle numbering
+        int TriangleCount;
+        const uint32_t* Indices;
+        int BaseVertex; // into the transformed vertices
+        uint32_t MaterialID;
+    };
+
+    struct SetupTriangle
+    {
+        // pixels covered are [MinX, MaxX) x [MinY, MaxY)
+        int MinX, MinY, MaxX, MaxY;
+
+        // Edge functions in subpixels, E(x, y) = A * x + B * y + C, positive inside.
+        // Edge i is opposite vertex i, so E_i / Area2 is vertex i's screen space barycentric.
+        int64_t A[3], B[3], C[3];
+        // -1 for edges that don't own the pixels exactly on them (fill rule), 0 for those that do
+        int32_t Bias[3];
+        double InvArea2;
+
+        // depth plane in pixels: Z = ZA * x + ZB * y + ZC (x, y at pixel centers)
+        float ZA, ZB, ZC;
+
+        float InvW[3];
+        glm::vec3 World[3];
+        glm::vec3 Normal[3];
+        glm::vec2 TexCoord[3];
+        uint32_t MaterialID;
+    };
+
+    float SRGBToLinear(float c)
+    {
+        return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    uint8_t LinearToSRGB8(float c)
+    {
+        c = std::min(std::max(c, 0.0f), 1.0f);
+        c = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+        return (uint8_t)(c * 255.0f + 0.5f);
+    }
+}
+
+class SoftwareRenderer : public IRenderer
+{
+public:
+    // same limits as the GL renderer, so stills match
+    const int kMaxExactBlurRadius = 2047;
+
+    Scene* mScene;
+
+    int mWindowWidth;
+    int mWindowHeight;
+
+    bool mEnableDoF;
+    float mFocusDepth;
+    int mMaxBlurRadius;
+
+    // Render target of the last RenderRegion: bottom-up rows (like GL), sRGB-encoded color, reversed-Z depth
+    int mWidth;
+    int mHeight;
+    std::vector<uint8_t> mColor;
+    std::vector<float> mDepth;
+
+    ICPUDepthOfField* mDepthOfField;
+
+    // per frame: transformed vertices of all instances, their draws, and the set up triangles and bins of each chunk
+    std::vector<ClipVertex> mVertices;
+    std::vector<SoftwareDraw> mDraws;
+    std::vector<std::vector<SetupTriangle>> mChunkTriangles;
+    std::vector<std::vector<uint32_t>> mBins; // [chunk * tileCount + tile]
+    int mTilesX;
+    int mTilesY;
+
+    // sRGB-encoded byte to linear
+    float mSRGBToLinear[256];
+
+    // presenting in the viewer's window
+    GLuint mPresentTO;
+    GLuint mPresentFBO;
+    int mPresentWidth;
+    int mPresentHeight;
+
+    float mRasterMs;
+    float mDepthOfFieldMs;
+    int mLastTriangleCount;
+
+    void Init(Scene* scene) override
+    {
+        mScene = scene;
+
+        mEnableDoF = true;
+        mFocusDepth = 5.0f;
+        mMaxBlurRadius = 64;
+
+        mDepthOfField = NewCPUDepthOfField();
+
+        for (int i = 0; i < 256; i++)
+        {
+            mSRGBToLinear[i] = SRGBToLinear(i / 255.0f);
+        }
+    }
+
+    void Resize(int width, int height) override
+    {
+        mWindowWidth = width;
+        mWindowHeight = height;
+    }
+
+    static double GetMilliseconds(Uint64 start, Uint64 end)
+    {
+        return (double)(end - start) * 1000.0 / SDL_GetPerformanceFrequency();
+    }
+
+    void GetCameraMatrices(float aspect, glm::vec3* eye, glm::mat4* V, glm::mat4* P)
+    {
+        Camera& mainCamera = mScene->Cameras[mScene->MainCameraID];
+
+        *eye = mainCamera.Eye;
+        glm::vec3 up = mainCamera.Up;
+
+        *V = glm::lookAt(*eye, mainCamera.Target, up);
+
+        float f = 1.0f / tanf(mainCamera.FovY / 2.0f);
+        *P = glm::mat4(
+            f / aspect, 0.0f, 0.0f, 0.0f,
+            0.0f, f, 0.0f, 0.0f,
+            0.0f, 0.0f, 0.0f, -1.0f,
+            0.0f, 0.0f, mainCamera.ZNear, 0.0f);
+    }
+
+    // Transforms the vertices of every instance, like scene.vert, and lists the draws.
+    void TransformVertices(const glm::mat4& VP)
+    {
+        mDraws.clear();
+
+        struct InstanceVertices
+        {
+            const Mesh* SourceMesh;
+            glm::mat4 MW;
+            glm::mat3 N_MW;
+            int BaseVertex;
+        };
+        std::vector<InstanceVertices> instances;
+
+        int vertexCount = 0;
+        int triangleCount = 0;
+        for (uint32_t instanceID : mScene->Instances)
+        {
+            const Instance* instance = &mScene->Instances[instanceID];
+            const Mesh* mesh = &mScene->Meshes[instance->MeshID];
+            const Transform* transform = &mScene->Transforms[instance->TransformID];
+
+            // the scene wasn't loaded with KeepCPUData
+            if (mesh->Positions.empty())
+            {
+                continue;
+            }
+
+            InstanceVertices iv;
+            iv.SourceMesh = mesh;
+
+            glm::mat4 MW;
+            MW = translate(-transform->RotationOrigin) * MW;
+            MW = mat4_cast(transform->Rotation) * MW;
+            MW = translate(transform->RotationOrigin) * MW;
+            MW = scale(transform->Scale) * MW;
+            MW = translate(transform->Translation) * MW;
+            iv.MW = MW;
+
+            glm::mat3 N_MW;
+            N_MW = mat3_cast(transform->Rotation) * N_MW;
+            N_MW = glm::mat3(scale(1.0f / transform->Scale)) * N_MW;
+            iv.N_MW = N_MW;
+
+            iv.BaseVertex = vertexCount;
+            vertexCount += (int)mesh->Positions.size() / 3;
+            instances.push_back(iv);
+
+            for (size_t meshDrawIdx = 0; meshDrawIdx < mesh->DrawCommands.size(); meshDrawIdx++)
+            {
+                const GLDrawElementsIndirectCommand* drawCmd = &mesh->DrawCommands[meshDrawIdx];
+
+                SoftwareDraw draw;
+                draw.FirstTriangle = triangleCount;
+                draw.TriangleCount = drawCmd->count / 3;
+                draw.Indices = &mesh->Indices[drawCmd->firstIndex];
+                draw.BaseVertex = iv.BaseVertex + drawCmd->baseVertex;
+                draw.MaterialID = mesh->MaterialIDs[meshDrawIdx];
+                mDraws.push_back(draw);
+
+                triangleCount += draw.TriangleCount;
+            }
+        }
+
+        mVertices.resize(vertexCount);
+        mLastTriangleCount = triangleCount;
+
+        ParallelFor((int)instances.size(), 1, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+            {
+                const InstanceVertices& iv = instances[i];
+                const Mesh* mesh = iv.SourceMesh;
+                glm::mat4 MVP = VP * iv.MW;
+
+                int meshVertexCount = (int)mesh->Positions.size() / 3;
+                bool hasTexCoords = !mesh->TexCoords.empty();
+                bool hasNormals = !mesh->Normals.empty();
+                for (int v = 0; v < meshVertexCount; v++)
+                {
+                    glm::vec4 position(mesh->Positions[v * 3 + 0], mesh->Positions[v * 3 + 1], mesh->Positions[v * 3 + 2], 1.0f);
+
+                    ClipVertex& out = mVertices[iv.BaseVertex + v];
+                    out.Clip = MVP * position;
+                    out.World = glm::vec3(iv.MW * position);
+                    out.TexCoord = hasTexCoords ? glm::vec2(mesh->TexCoords[v * 2 + 0], mesh->TexCoords[v * 2 + 1]) : glm::vec2(0.0f);
+                    out.Normal = hasNormals ? iv.N_MW * glm::vec3(mesh->Normals[v * 3 + 0], mesh->Normals[v * 3 + 1], mesh->Normals[v * 3 + 2]) : glm::vec3(0.0f);
+                }
+            }
+        });
+    }
+
+    // Projects a triangle to the screen and computes its edge functions. Returns false if it covers no pixels.
+    bool SetupTriangleForRaster(const ClipVertex& v0, const ClipVertex& v1, const ClipVertex& v2, uint32_t materialID, SetupTriangle* tri)
+    {
+        const ClipVertex* v[3] = { &v0, &v1, &v2 };
+
+        int64_t x[3], y[3];
+        float z[3];
+        for (int i = 0; i < 3; i++)
+        {
+            float invW = 1.0f / v[i]->Clip.w;
+            float sx = (v[i]->Clip.x * invW * 0.5f + 0.5f) * mWidth;
+            float sy = (v[i]->Clip.y * invW * 0.5f + 0.5f) * mHeight;
+            // clipping can leave vertices a rounding error outside of the viewport
+            x[i] = std::min(std::max((int64_t)lrintf(sx * kSubpixelScale), (int64_t)0), (int64_t)mWidth * kSubpixelScale);
+            y[i] = std::min(std::max((int64_t)lrintf(sy * kSubpixelScale), (int64_t)0), (int64_t)mHeight * kSubpixelScale);
+            z[i] = v[i]->Clip.z * invW;
+            tri->InvW[i] = invW;
+        }
+
+        int64_t area2 = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+        if (area2 == 0)
+        {
+            return false;
+        }
+
+        // no face culling (like the GL renderer), so clockwise triangles are flipped to counter-clockwise
+        int order[3] = { 0, 1, 2 };
+        if (area2 < 0)
+        {
+            std::swap(order[1], order[2]);
+            area2 = -area2;
+        }
+
+        int64_t ox[3], oy[3];
+        float oz[3], oinvW[3];
+        for (int i = 0; i < 3; i++)
+        {
+            ox[i] = x[order[i]];
+            oy[i] = y[order[i]];
+            oz[i] = z[order[i]];
+            oinvW[i] = tri->InvW[order[i]];
+            tri->World[i] = v[order[i]]->World;
+            tri->Normal[i] = v[order[i]]->Normal;
+            tri->TexCoord[i] = v[order[i]]->TexCoord;
+        }
+
+        // pixel centers are at (16x + 8, 16y + 8) subpixels
+        int64_t minX = std::min(ox[0], std::min(ox[1], ox[2]));
+        int64_t maxX = std::max(ox[0], std::max(ox[1], ox[2]));
+        int64_t minY = std::min(oy[0], std::min(oy[1], oy[2]));
+        int64_t maxY = std::max(oy[0], std::max(oy[1], oy[2]));
+        tri->MinX = (int)std::max((int64_t)0, (minX - kSubpixelScale / 2 + kSubpixelScale - 1) >> kSubpixelBits);
+        tri->MinY = (int)std::max((int64_t)0, (minY - kSubpixelScale / 2 + kSubpixelScale - 1) >> kSubpixelBits);
+        tri->MaxX = (int)std::min((int64_t)mWidth, ((maxX - kSubpixelScale / 2) >> kSubpixelBits) + 1);
+        tri->MaxY = (int)std::min((int64_t)mHeight, ((maxY - kSubpixelScale / 2) >> kSubpixelBits) + 1);
+        if (tri->MinX >= tri->MaxX || tri->MinY >= tri->MaxY)
+        {
+            return false;
+        }
+
+        for (int i = 0; i < 3; i++)
+        {
+            int a = (i + 1) % 3, b = (i + 2) % 3;
+            tri->A[i] = oy[a] - oy[b];
+            tri->B[i] = ox[b] - ox[a];
+            tri->C[i] = ox[a] * oy[b] - ox[b] * oy[a];
+            // Fill rule: of two triangles sharing an edge, the edge has opposite directions, so exactly one owns it
+            bool ownsEdge = tri->A[i] > 0 || (tri->A[i] == 0 && tri->B[i] > 0);
+            tri->Bias[i] = ownsEdge ? 0 : -1;
+            tri->InvW[i] = oinvW[i];
+        }
+        tri->InvArea2 = 1.0 / (double)area2;
+
+        // NDC depth is linear in screen space. The plane is anchored at the first covered pixel, for precision.
+        double za = 0.0, zb = 0.0;
+        for (int i = 0; i < 3; i++)
+        {
+            za += (double)tri->A[i] * oz[i];
+            zb += (double)tri->B[i] * oz[i];
+        }
+        za *= tri->InvArea2 * kSubpixelScale;
+        zb *= tri->InvArea2 * kSubpixelScale;
+        double cx = tri->MinX * kSubpixelScale + kSubpixelScale / 2;
+        double cy = tri->MinY * kSubpixelScale + kSubpixelScale / 2;
+        double zAtMin = 0.0;
+        for (int i = 0; i < 3; i++)
+        {
+            zAtMin += ((double)tri->A[i] * cx + (double)tri->B[i] * cy + (double)tri->C[i]) * tri->InvArea2 * oz[i];
+        }
+        tri->ZA = (float)za;
+        tri->ZB = (float)zb;
+        tri->ZC = (float)(zAtMin - za * tri->MinX - zb * tri->MinY);
+
+        tri->MaterialID = materialID;
+        return true;
+    }
+
+    // Clips, sets up and bins the triangles of a chunk.
+    void SetupChunk(int chunk)
+    {
+        std::vector<SetupTriangle>& triangles = mChunkTriangles[chunk];
+        triangles.clear();
+        int tileCount = mTilesX * mTilesY;
+        for (int tile = 0; tile < tileCount; tile++)
+        {
+            mBins[chunk * tileCount + tile].clear();
+        }
+
+        // reversed-Z with an infinite far plane: only the near plane (w >= z) and the sides clip
+        static const glm::vec4 planes[5] = {
+            glm::vec4(0.0f, 0.0f, -1.0f, 1.0f),
+            glm::vec4(1.0f, 0.0f, 0.0f, 1.0f),
+            glm::vec4(-1.0f, 0.0f, 0.0f, 1.0f),
+            glm::vec4(0.0f, 1.0f, 0.0f, 1.0f),
+            glm::vec4(0.0f, -1.0f, 0.0f, 1.0f)
+        };
+
+        int begin = chunk * kTriangleChunkSize;
+        int end = std::min(begin + kTriangleChunkSize, mLastTriangleCount);
+
+        // the draw containing the first triangle
+        int drawIndex = (int)(std::upper_bound(mDraws.begin(), mDraws.end(), begin,
+            [](int t, const SoftwareDraw& d) { return t < d.FirstTriangle; }) - mDraws.begin()) - 1;
+
+        for (int t = begin; t < end; t++)
+        {
+            while (t >= mDraws[drawIndex].FirstTriangle + mDraws[drawIndex].TriangleCount)
+            {
+                drawIndex++;
+            }
+            const SoftwareDraw& draw = mDraws[drawIndex];
+            const uint32_t* indices = draw.Indices + (t - draw.FirstTriangle) * 3;
+            const ClipVertex* v[3] = {
+                &mVertices[draw.BaseVertex + indices[0]],
+                &mVertices[draw.BaseVertex + indices[1]],
+                &mVertices[draw.BaseVertex + indices[2]]
+            };
+
+            // trivial accept and reject
+            int outsideAll = 0x1F, outsideAny = 0;
+            for (int i = 0; i < 3; i++)
+            {
+                int outside = 0;
+                for (int p = 0; p < 5; p++)
+                {
+                    if (dot(planes[p], v[i]->Clip) < 0.0f)
+                    {
+                        outside |= 1 << p;
+                    }
+                }
+                outsideAll &= outside;
+                outsideAny |= outside;
+            }
+            if (outsideAll)
+            {
+                continue;
+            }
+
+            ClipVertex polygon[2][9];
+            int polygonCount = 3;
+            int current = 0;
+            polygon[0][0] = *v[0];
+            polygon[0][1] = *v[1];
+            polygon[0][2] = *v[2];
+            for (int p = 0; p < 5 && polygonCount >= 3; p++)
+            {
+                if (outsideAny & (1 << p))
+                {
+                    polygonCount = ClipPolygon(polygon[current], polygonCount, planes[p], polygon[1 - current]);
+                    current = 1 - current;
+                }
+            }
+
+            // triangle fan of the clipped polygon
+            for (int i = 1; i + 1 < polygonCount; i++)
+            {
+                SetupTriangle tri;
+                if (!SetupTriangleForRaster(polygon[current][0], polygon[current][i], polygon[current][i + 1], draw.MaterialID, &tri))
+                {
+                    continue;
+                }
+
+                uint32_t triIndex = (uint32_t)triangles.size();
+                triangles.push_back(tri);
+
+                for (int tileY = tri.MinY / kTileSize; tileY <= (tri.MaxY - 1) / kTileSize; tileY++)
+                {
+                    for (int tileX = tri.MinX / kTileSize; tileX <= (tri.MaxX - 1) / kTileSize; tileX++)
+                    {
+                        mBins[chunk * tileCount + tileY * mTilesX + tileX].push_back(triIndex);
+                    }
+                }
+            }
+        }
+    }
+
+    // Depth tests a triangle's pixels in the tile [x0, x1) x [y0, y1), keeping the nearest triangle of each pixel.
+    static void RasterizeTriangle(const SetupTriangle& tri, int x0, int y0, int x1, int y1, float* tileDepth, const SetupTriangle** tileTriangles)
+    {
+        int tx0 = std::max(x0, tri.MinX), tx1 = std::min(x1, tri.MaxX);
+        int ty0 = std::max(y0, tri.MinY), ty1 = std::min(y1, tri.MaxY);
+        if (tx0 >= tx1 || ty0 >= ty1)
+        {
+            return;
+        }
+
+        // Edge functions at the first pixel. Within the tile they change by less than kTrivialEdgeDistance,
+        // so they either fit in 32 bits, or the edge doesn't matter (or rejects the whole tile).
+        int32_t e0[3], stepX[3], stepY[3];
+        bool testEdge[3];
+        for (int i = 0; i < 3; i++)
+        {
+            int64_t e = tri.A[i] * (tx0 * kSubpixelScale + kSubpixelScale / 2) + tri.B[i] * (ty0 * kSubpixelScale + kSubpixelScale / 2) + tri.C[i] + tri.Bias[i];
+            if (e < -kTrivialEdgeDistance)
+            {
+                return;
+            }
+            testEdge[i] = e <= kTrivialEdgeDistance;
+            e0[i] = testEdge[i] ? (int32_t)e : 0;
+            stepX[i] = testEdge[i] ? (int32_t)(tri.A[i] * kSubpixelScale) : 0;
+            stepY[i] = testEdge[i] ? (int32_t)(tri.B[i] * kSubpixelScale) : 0;
+        }
+
+        for (int y = ty0; y < ty1; y++)
+        {
+            int32_t rowE[3];
+            for (int i = 0; i < 3; i++)
+            {
+                rowE[i] = e0[i] + stepY[i] * (y - ty0);
+            }
+            float rowZ = tri.ZA * tx0 + tri.ZB * y + tri.ZC;
+
+            float* depthRow = tileDepth + (y - y0) * kTileSize - x0;
+            const SetupTriangle** triangleRow = tileTriangles + (y - y0) * kTileSize - x0;
+
+            int x = tx0;
+#ifdef SOFTWARE_RENDERER_SSE2
+            // 4 pixels at a time
+            __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+            __m128i minusOne = _mm_set1_epi32(-1);
+            __m128i e[3], step4[3];
+            for (int i = 0; i < 3; i++)
+            {
+                e[i] = _mm_add_epi32(_mm_set1_epi32(rowE[i]), _mm_setr_epi32(0, stepX[i], stepX[i] * 2, stepX[i] * 3));
+                step4[i] = _mm_set1_epi32(stepX[i] * 4);
+            }
+            __m128 z = _mm_add_ps(_mm_set1_ps(rowZ), _mm_mul_ps(_mm_cvtepi32_ps(lane), _mm_set1_ps(tri.ZA)));
+            __m128 zStep4 = _mm_set1_ps(tri.ZA * 4.0f);
+
+            for (; x + 4 <= tx1; x += 4)
+            {
+                __m128i inside = _mm_and_si128(_mm_and_si128(
+                    _mm_cmpgt_epi32(e[0], minusOne),
+                    _mm_cmpgt_epi32(e[1], minusOne)),
+                    _mm_cmpgt_epi32(e[2], minusOne));
+
+                if (_mm_movemask_epi8(inside))
+                {
+                    __m128 oldZ = _mm_loadu_ps(depthRow + x);
+                    __m128 closer = _mm_and_ps(_mm_castsi128_ps(inside), _mm_cmpgt_ps(z, oldZ));
+                    int mask = _mm_movemask_ps(closer);
+                    if (mask)
+                    {
+                        _mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(closer, z), _mm_andnot_ps(closer, oldZ)));
+                        for (int i = 0; i < 4; i++)
+                        {
+                            if (mask & (1 << i))
+                            {
+                                triangleRow[x + i] = &tri;
+                            }
+                        }
+                    }
+                }
+
+                for (int i = 0; i < 3; i++)
+                {
+                    e[i] = _mm_add_epi32(e[i], step4[i]);
+                }
+                z = _mm_add_ps(z, zStep4);
+            }
+#endif
+            // the remaining pixels (all of them without SSE2)
+            for (; x < tx1; x++)
+            {
+                int dx = x - tx0;
+                if (rowE[0] + stepX[0] * dx >= 0 && rowE[1] + stepX[1] * dx >= 0 && rowE[2] + stepX[2] * dx >= 0)
+                {
+                    float z = rowZ + tri.ZA * dx;
+                    if (z > depthRow[x])
+                    {
+                        depthRow[x] = z;
+                        triangleRow[x] = &tri;
+                    }
+                }
+            }
+        }
+    }
+
+    // Bilinear filtering of an sRGB diffuse map with repeat wrapping, in linear space.
+    glm::vec3 SampleDiffuseMap(const DiffuseMap& map, glm::vec2 uv) const
+    {
+        float fx = uv.x * map.Width - 0.5f;
+        float fy = uv.y * map.Height - 0.5f;
+        float flx = floorf(fx), fly = floorf(fy);
+        float tx = fx - flx, ty = fy - fly;
+        int x0 = (int)flx, y0 = (int)fly;
+
+        auto wrap = [](int i, int n) { i %= n; return i < 0 ? i + n : i; };
+        int xs[2] = { wrap(x0, map.Width), wrap(x0 + 1, map.Width) };
+        int ys[2] = { wrap(y0, map.Height), wrap(y0 + 1, map.Height) };
+
+        glm::vec3 texels[4];
+        for (int j = 0; j < 2; j++)
+        {
+            for (int i = 0; i < 2; i++)
+            {
+                const uint8_t* p = &map.Pixels[((size_t)ys[j] * map.Width + xs[i]) * 4];
+                texels[j * 2 + i] = glm::vec3(mSRGBToLinear[p[0]], mSRGBToLinear[p[1]], mSRGBToLinear[p[2]]);
+            }
+        }
+
+        return glm::mix(glm::mix(texels[0], texels[1], tx), glm::mix(texels[2], texels[3], tx), ty);
+    }
+
+    // Same lighting as scene.frag
+    glm::vec3 Shade(const SetupTriangle& tri, int x, int y, const glm::vec3& eye) const
+    {
+        int64_t px = x * kSubpixelScale + kSubpixelScale / 2;
+        int64_t py = y * kSubpixelScale + kSubpixelScale / 2;
+
+        // perspective-correct barycentrics
+        float w[3];
+        float wsum = 0.0f;
+        for (int i = 0; i < 3; i++)
+        {
+            double e = (double)(tri.A[i] * px + tri.B[i] * py + tri.C[i]);
+            w[i] = (float)(e * tri.InvArea2) * tri.InvW[i];
+            wsum += w[i];
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            w[i] /= wsum;
+        }
+
+        glm::vec3 worldPosition = tri.World[0] * w[0] + tri.World[1] * w[1] + tri.World[2] * w[2];
+        glm::vec3 worldNormal = tri.Normal[0] * w[0] + tri.Normal[1] * w[1] + tri.Normal[2] * w[2];
+        glm::vec2 texCoord = tri.TexCoord[0] * w[0] + tri.TexCoord[1] * w[1] + tri.TexCoord[2] * w[2];
+
+        const Material& material = mScene->Materials[tri.MaterialID];
+
+        glm::vec3 Ia = glm::vec3(0.1f); // ambient light
+        glm::vec3 I0 = glm::vec3(1.0f); // light 0 intensity
+
+        glm::vec3 V = normalize(eye - worldPosition);
+        glm::vec3 L = V; // Light placed at camera position
+        glm::vec3 N = normalize(worldNormal);
+        glm::vec3 H = normalize(L + V);
+        float G = std::max(0.0f, dot(L, N));
+        float PH = powf(std::max(0.0f, dot(N, H)), material.Shininess);
+
+        glm::vec3 ambient = Ia * glm::make_vec3(material.Ambient);
+
+        glm::vec3 diffuseMap = glm::vec3(1.0f);
+        if (material.DiffuseMapID != kNoDiffuseMap)
+        {
+            const DiffuseMap& map = mScene->DiffuseMaps[material.DiffuseMapID];
+            if (!map.Pixels.empty())
+            {
+                diffuseMap = SampleDiffuseMap(map, texCoord);
+            }
+        }
+
+        glm::vec3 diffuse = I0 * diffuseMap * glm::make_vec3(material.Diffuse) * G;
+
+        glm::vec3 specular = I0 * glm::make_vec3(material.Specular) * PH;
+
+        return ambient + diffuse + specular;
+    }
+
+    // Renders the scene into mColor and mDepth at width x height, with the given projection.
+    void RenderRegion(const glm::mat4& V, const glm::mat4& P, const glm::vec3& eye, int width, int height)
+    {
+        mWidth = width;
+        mHeight = height;
+        mColor.resize((size_t)width * height * 4);
+        mDepth.resize((size_t)width * height);
+
+        TransformVertices(P * V);
+
+        mTilesX = (width + kTileSize - 1) / kTileSize;
+        mTilesY = (height + kTileSize - 1) / kTileSize;
+        int tileCount = mTilesX * mTilesY;
+        int chunkCount = (mLastTriangleCount + kTriangleChunkSize - 1) / kTriangleChunkSize;
+        if ((int)mChunkTriangles.size() < chunkCount)
+        {
+            mChunkTriangles.resize(chunkCount);
+        }
+        mBins.resize(std::max(mBins.size(), (size_t)chunkCount * tileCount));
+
+        ParallelFor(chunkCount, 1, [&](int begin, int end)
+        {
+            for (int chunk = begin; chunk < end; chunk++)
+            {
+                SetupChunk(chunk);
+            }
+        });
+
+        // the clear color is written without sRGB encoding, like glClear with GL_FRAMEBUFFER_SRGB disabled
+        const uint8_t clearColor[4] = { 100, 149, 237, 255 };
+
+        ParallelFor(tileCount, 1, [&](int begin, int end)
+        {
+            // visibility buffer: nearest depth and triangle of each pixel, shaded once all triangles are in
+            float tileDepth[kTileSize * kTileSize];
+            const SetupTriangle* tileTriangles[kTileSize * kTileSize];
+
+            for (int tile = begin; tile < end; tile++)
+            {
+                int x0 = (tile % mTilesX) * kTileSize, x1 = std::min(x0 + kTileSize, mWidth);
+                int y0 = (tile / mTilesX) * kTileSize, y1 = std::min(y0 + kTileSize, mHeight);
+
+                std::fill(tileDepth, tileDepth + kTileSize * kTileSize, 0.0f);
+                std::fill(tileTriangles, tileTriangles + kTileSize * kTileSize, (const SetupTriangle*)NULL);
+
+                for (int chunk = 0; chunk < chunkCount; chunk++)
+                {
+                    const std::vector<SetupTriangle>& triangles = mChunkTriangles[chunk];
+                    for (uint32_t triIndex : mBins[chunk * tileCount + tile])
+                    {
+                        RasterizeTriangle(triangles[triIndex], x0, y0, x1, y1, tileDepth, tileTriangles);
+                    }
+                }
+
+                for (int y = y0; y < y1; y++)
+                {
+                    for (int x = x0; x < x1; x++)
+                    {
+                        int i = (y - y0) * kTileSize + (x - x0);
+                        size_t pixel = (size_t)y * mWidth + x;
+                        uint8_t* color = &mColor[pixel * 4];
+
+                        mDepth[pixel] = tileDepth[i];
+                        if (!tileTriangles[i])
+                        {
+                            memcpy(color, clearColor, 4);
+                            continue;
+                        }
+
+                        glm::vec3 radiance = Shade(*tileTriangles[i], x, y, eye);
+                        color[0] = LinearToSRGB8(radiance.r);
+                        color[1] = LinearToSRGB8(radiance.g);
+                        color[2] = LinearToSRGB8(radiance.b);
+                        color[3] = 255;
+                    }
+                }
+            }
+        });
+    }
+
+    int GetMaxBlurRadius(float radiusScale) const
+    {
+        return std::min((int)(mMaxBlurRadius * radiusScale), kMaxExactBlurRadius);
+    }
+
+    // Same SAT-based blur as sat_*.comp and dof.frag, on mColor
+    void ApplyDepthOfField(float radiusScale)
+    {
+        CPUDoFParameters params;
+        InitCPUDoFParameters(params);
+        params.FocusDepth = mFocusDepth;
+        params.RadiusScale = radiusScale;
+        params.MaxRadius = GetMaxBlurRadius(radiusScale);
+        params.DepthIsLinear = false;
+        params.ZNear = mScene->Cameras[mScene->MainCameraID].ZNear;
+        params.SRGB = true;
+
+        // in place: rows are only finished once everything they read is in the library's ring
+        int width = mWidth;
+        mDepthOfField->Begin(params, width, mHeight, [&](int firstRow, int rowCount, const uint8_t* rgba, ptrdiff_t rowStride)
+        {
+            for (int i = 0; i < rowCount; i++)
+            {
+                memcpy(&mColor[(size_t)(firstRow + i) * width * 4], rgba + rowStride * i, (size_t)width * 4);
+            }
+        });
+        mDepthOfField->PushRows(mColor.data(), (ptrdiff_t)width * 4, mDepth.data(), (ptrdiff_t)width * sizeof(float), mHeight);
+    }
+
+    // Same tiling as the GL renderer's RenderStillTiles, so stills of both renderers (and rectangles of a still) match.
+    // readTile(x, y, w, h, readX, readY) reads the tile at (x, y) of the image from (readX, readY) of mColor.
+    bool RenderStillTiles(
+        int width, int height,
+        int rectX, int rectY, int rectWidth, int rectHeight,
+        int tileSize,
+        const std::function<bool(int x, int y, int w, int h, int readX, int readY)>& readTile)
+    {
+        float radiusScale = (float)height / mWindowHeight;
+
+        int margin = mEnableDoF ? GetMaxBlurRadius(radiusScale) : 0;
+
+        glm::vec3 eye;
+        glm::mat4 V, P;
+        GetCameraMatrices((float)width / height, &eye, &V, &P);
+
+        bool ok = true;
+        for (int tileY = rectY; tileY < rectY + rectHeight && ok; tileY += tileSize)
+        {
+            for (int tileX = rectX; tileX < rectX + rectWidth && ok; tileX += tileSize)
+            {
+                int x0 = tileX, x1 = std::min(rectX + rectWidth, tileX + tileSize);
+                int y0 = tileY, y1 = std::min(rectY + rectHeight, tileY + tileSize);
+                int rx0 = std::max(0, x0 - margin), rx1 = std::min(width, x1 + margin);
+                int ry0 = std::max(0, y0 - margin), ry1 = std::min(height, y1 + margin);
+
+                glm::mat4 S;
+                S[0][0] = (float)width / (rx1 - rx0);
+                S[1][1] = (float)height / (ry1 - ry0);
+                S[3][0] = -(float)(rx0 + rx1 - width) / (rx1 - rx0);
+                S[3][1] = -(float)(ry0 + ry1 - height) / (ry1 - ry0);
+
+                RenderRegion(V, S * P, eye, rx1 - rx0, ry1 - ry0);
+
+                if (mEnableDoF)
+                {
+                    ApplyDepthOfField(radiusScale);
+                }
+
+                ok = readTile(x0, y0, x1 - x0, y1 - y0, x0 - rx0, y0 - ry0);
+            }
+        }
+
+        return ok;
+    }
+
+    bool RenderStill(const char* filename, int width, int height, int tileSize) override
+    {
+        size_t filenameLength = strlen(filename);
+        bool png = filenameLength >= 4 && strcmp(filename + filenameLength - 4, ".png") == 0;
+
+        bool ok;
+        if (png)
+        {
+            uint8_t* imagePixels = new uint8_t[(size_t)width * height * 4];
+            ok = RenderStillRect(width, height, 0, 0, width, height, tileSize, imagePixels) &&
+                WritePNG(filename, width, height, imagePixels + (size_t)(height - 1) * width * 4, -(ptrdiff_t)width * 4);
+            delete[] imagePixels;
+        }
+        else
+        {
+            TiledImageFile image;
+            if (!OpenTiledPPM(image, filename, width, height))
+            {
+                return false;
+            }
+
+            std::vector<uint8_t> tilePixels;
+            ok = RenderStillTiles(width, height, 0, 0, width, height, tileSize, [&](int x, int y, int w, int h, int readX, int readY)
+            {
+                tilePixels.resize(w * h * 3);
+                for (int row = 0; row < h; row++)
+                {
+                    for (int col = 0; col < w; col++)
+                    {
+                        memcpy(&tilePixels[(row * w + col) * 3], &mColor[((size_t)(readY + row) * mWidth + readX + col) * 4], 3);
+                    }
+                }
+
+                // bottom-up, so write it starting from its last row
+                return WriteTiledPPMRect(image, x, height - (y + h), w, h, &tilePixels[(h - 1) * w * 3], -(ptrdiff_t)w * 3);
+            });
+
+            ok = CloseTiledPPM(image) && ok;
+        }
+
+        if (ok)
+        {
+            printf("Rendered %dx%d still to %s\n", width, height, filename);
+        }
+        else
+        {
+            fprintf(stderr, "RenderStill: failed to write %s\n", filename);
+        }
+
+        return ok;
+    }
+
+    bool RenderStillRect(int width, int height, int rectX, int rectY, int rectWidth, int rectHeight, int tileSize, uint8_t* rgba) override
+    {
+        return RenderStillTiles(width, height, rectX, rectY, rectWidth, rectHeight, tileSize, [&](int x, int y, int w, int h, int readX, int readY)
+        {
+            for (int row = 0; row < h; row++)
+            {
+                memcpy(
+                    rgba + ((size_t)(y - rectY + row) * rectWidth + (x - rectX)) * 4,
+                    &mColor[((size_t)(readY + row) * mWidth + readX) * 4],
+                    (size_t)w * 4);
+            }
+            return true;
+        });
+    }
+
+    void UpdateGUI()
+    {
+        if (ImGui::Begin("Software Renderer"))
+        {
+            ImGui::Text("%d triangles, %d threads", mLastTriangleCount, GetParallelThreadCount());
+            ImGui::Text("Rasterize + shade: %.2f milliseconds", mRasterMs);
+            ImGui::Text("DoF: %.2f milliseconds", mDepthOfFieldMs);
+
+            ImGui::Checkbox("Enable DoF", &mEnableDoF);
+            ImGui::SliderFloat("Focus Depth", &mFocusDepth, 0.0f, 10.0f);
+            ImGui::SliderInt("Max Blur Radius", &mMaxBlurRadius, 1, 256);
+        }
+        ImGui::End();
+    }
+
+    void Paint() override
+    {
+        UpdateGUI();
+
+        Camera& mainCamera = mScene->Cameras[mScene->MainCameraID];
+
+        glm::vec3 eye;
+        glm::mat4 V, P;
+        GetCameraMatrices(mainCamera.Aspect, &eye, &V, &P);
+
+        Uint64 rasterStart = SDL_GetPerformanceCounter();
+        RenderRegion(V, P, eye, mWindowWidth, mWindowHeight);
+        Uint64 rasterEnd = SDL_GetPerformanceCounter();
+        if (mEnableDoF)
+        {
+            ApplyDepthOfField(1.0f);
+        }
+        Uint64 dofEnd = SDL_GetPerformanceCounter();
+
+        mRasterMs = (float)GetMilliseconds(rasterStart, rasterEnd);
+        mDepthOfFieldMs = (float)GetMilliseconds(rasterEnd, dofEnd);
+
+        // GL is only used to show the image (and the GUI)
+        if (mPresentWidth != mWindowWidth || mPresentHeight != mWindowHeight)
+        {
+            mPresentWidth = mWindowWidth;
+            mPresentHeight = mWindowHeight;
+
+            glDeleteTextures(1, &mPresentTO);
+            glGenTextures(1, &mPresentTO);
+            glBindTexture(GL_TEXTURE_2D, mPresentTO);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, mPresentWidth, mPresentHeight);
+            glBindTexture(GL_TEXTURE_2D, 0);
+
+            glDeleteFramebuffers(1, &mPresentFBO);
+            glGenFramebuffers(1, &mPresentFBO);
+            glBindFramebuffer(GL_FRAMEBUFFER, mPresentFBO);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mPresentTO, 0);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+
+        glBindTexture(GL_TEXTURE_2D, mPresentTO);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, mWidth, mHeight, GL_RGBA, GL_UNSIGNED_BYTE, mColor.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, mPresentFBO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(
+            0, 0, mWidth, mHeight,
+            0, 0, mWindowWidth, mWindowHeight,
+            GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        ImGui::Render();
+    }
+
+    void SetFocusDepth(float focusDepth) override
+    {
+        mFocusDepth = focusDepth;
+    }
+
+    int GetRenderWidth() const override
+    {
+        return mWindowWidth;
+    }
+
+    int GetRenderHeight() const override
+    {
+        return mWindowHeight;
+    }
+
+    void* operator new(size_t sz)
+    {
+        void* mem = ::operator new(sz);
+        memset(mem, 0, sz);
+        return mem;
+    }
+};
+
+IRenderer* NewSoftwareRenderer()
+{
+    return new SoftwareRenderer();
+}
+
+bool CompareRenderers(IRenderer* reference, IRenderer* test, int width, int height, const char* diffFilename)
+{
+    std::vector<uint8_t> referencePixels((size_t)width * height * 4);
+    std::vector<uint8_t> testPixels((size_t)width * height * 4);
+
+    if (!reference->RenderStillRect(width, height, 0, 0, width, height, std::max(width, height), referencePixels.data()) ||
+        !test->RenderStillRect(width, height, 0, 0, width, height, std::max(width, height), testPixels.data()))
+    {
+        fprintf(stderr, "CompareRenderers: rendering failed\n");
+        return false;
+    }
+
+    // differences per pixel (max over the channels), shown as an image where brighter means more different
+    std::vector<uint8_t> diff((size_t)width * height * 4);
+    double squaredErrorSum = 0.0;
+    int maxDifference = 0;
+    int differingPixels = 0;
+    const int kDifferenceThreshold = 8;
+    for (size_t i = 0; i < (size_t)width * height; i++)
+    {
+        int pixelDifference = 0;
+        for (int c = 0; c < 3; c++)
+        {
+            int d = abs((int)referencePixels[i * 4 + c] - (int)testPixels[i * 4 + c]);
+            squaredErrorSum += (double)d * d;
+            pixelDifference = std::max(pixelDifference, d);
+        }
+        maxDifference = std::max(maxDifference, pixelDifference);
+        if (pixelDifference > kDifferenceThreshold)
+        {
+            differingPixels++;
+        }
+
+        uint8_t shown = (uint8_t)std::min(255, pixelDifference * 8);
+        diff[i * 4 + 0] = shown;
+        diff[i * 4 + 1] = shown;
+        diff[i * 4 + 2] = shown;
+        diff[i * 4 + 3] = 255;
+    }
+
+    double mse = squaredErrorSum / ((double)width * height * 3);
+    double psnr = mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY;
+    printf("CompareRenderers: %dx%d, PSNR %.2f dB, max difference %d, %.3f%% of pixels differ by more than %d\n",
+        width, height, psnr, maxDifference, 100.0 * differingPixels / ((double)width * height), kDifferenceThreshold);
+
+    bool ok = true;
+    if (diffFilename)
+    {
+        TiledImageFile image;
+        ok = OpenTiledPPM(image, diffFilename, width, height);
+        if (ok)
+        {
+            std::vector<uint8_t> rgb((size_t)width * height * 3);
+            for (size_t i = 0; i < (size_t)width * height; i++)
+            {
+                memcpy(&rgb[i * 3], &diff[i * 4], 3);
+            }
+            ok = WriteTiledPPMRect(image, 0, 0, width, height, &rgb[(size_t)(height - 1) * width * 3], -(ptrdiff_t)width * 3);
+            ok = CloseTiledPPM(image) && ok;
+        }
+    }
+
+    return ok;
+}
\ No newline at end of file
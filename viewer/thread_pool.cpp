@@ -0,0 +1,156 @@
+#include "thread_pool.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+namespace
+{
+    struct ParallelForJob
+    {
+        const std::function<void(int, int)>* Fn;
+        int Count;
+        int ChunkSize;
+        std::atomic<int> NextChunk;
+        std::atomic<int> ChunksRemaining;
+        // workers currently holding a pointer to this job (protected by JobMutex)
+        int ActiveWorkers;
+    };
+
+    struct ThreadPool
+    {
+        std::vector<std::thread> Workers;
+
+        // protects CurrentJob and JobGeneration
+        std::mutex JobMutex;
+        std::condition_variable JobAvailable;
+        std::condition_variable JobDone;
+        ParallelForJob* CurrentJob = nullptr;
+        uint64_t JobGeneration = 0;
+
+        // only one ParallelFor can be in flight at a time.
+        // Other threads that submit meanwhile run their loop by themselves instead of waiting for it.
+        std::mutex SubmitMutex;
+    };
+
+    ThreadPool* gThreadPool;
+    std::once_flag gThreadPoolInitFlag;
+
+    thread_local bool tInsideParallelFor = false;
+
+    // runs chunks of the job until there are none left
+    void RunChunks(ParallelForJob* job)
+    {
+        int numChunks = (job->Count + job->ChunkSize - 1) / job->ChunkSize;
+        for (int chunk; (chunk = job->NextChunk.fetch_add(1)) < numChunks;)
+        {
+            int begin = chunk * job->ChunkSize;
+            int end = std::min(job->Count, begin + job->ChunkSize);
+            (*job->Fn)(begin, end);
+
+            job->ChunksRemaining.fetch_sub(1);
+        }
+    }
+
+    void WorkerMain(ThreadPool* pool)
+    {
+        tInsideParallelFor = true;
+
+        uint64_t lastGeneration = 0;
+        while (true)
+        {
+            ParallelForJob* job;
+            {
+                std::unique_lock<std::mutex> lock(pool->JobMutex);
+                pool->JobAvailable.wait(lock, [&] { return pool->JobGeneration != lastGeneration && pool->CurrentJob; });
+                lastGeneration = pool->JobGeneration;
+                job = pool->CurrentJob;
+                job->ActiveWorkers++;
+            }
+
+            RunChunks(job);
+
+            {
+                std::lock_guard<std::mutex> lock(pool->JobMutex);
+                job->ActiveWorkers--;
+                pool->JobDone.notify_all();
+            }
+        }
+    }
+
+    void InitThreadPool()
+    {
+        gThreadPool = new ThreadPool();
+
+        int numWorkers = (int)std::thread::hardware_concurrency() - 1;
+        for (int i = 0; i < numWorkers; i++)
+        {
+            gThreadPool->Workers.emplace_back(WorkerMain, gThreadPool);
+            // the pool lives for the duration of the program
+            gThreadPool->Workers.back().detach();
+        }
+    }
+}
+
+int GetParallelThreadCount()
+{
+    std::call_once(gThreadPoolInitFlag, InitThreadPool);
+    return (int)gThreadPool->Workers.size() + 1;
+}
+
+void ParallelFor(int count, int chunkSize, const std::function<void(int begin, int end)>& fn)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    chunkSize = std::max(1, chunkSize);
+
+    std::call_once(gThreadPoolInitFlag, InitThreadPool);
+
+    // not worth waking up the workers (or not allowed to)
+    if (count <= chunkSize || tInsideParallelFor || gThreadPool->Workers.empty())
+    {
+        fn(0, count);
+        return;
+    }
+
+    // don't block behind another thread's loop (eg. the main thread behind the capture writer)
+    std::unique_lock<std::mutex> submitLock(gThreadPool->SubmitMutex, std::try_to_lock);
+    if (!submitLock.owns_lock())
+    {
+        fn(0, count);
+        return;
+    }
+
+    ParallelForJob job;
+    job.Fn = &fn;
+    job.Count = count;
+    job.ChunkSize = chunkSize;
+    job.NextChunk = 0;
+    job.ChunksRemaining = (count + chunkSize - 1) / chunkSize;
+    job.ActiveWorkers = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(gThreadPool->JobMutex);
+        gThreadPool->CurrentJob = &job;
+        gThreadPool->JobGeneration++;
+    }
+    gThreadPool->JobAvailable.notify_all();
+
+    // help out, then wait for the stragglers
+    tInsideParallelFor = true;
+    RunChunks(&job);
+    tInsideParallelFor = false;
+
+    {
+        std::unique_lock<std::mutex> lock(gThreadPool->JobMutex);
+        // the job lives on this stack frame, so wait until no worker references it anymore
+        gThreadPool->JobDone.wait(lock, [&] { return job.ChunksRemaining.load() == 0 && job.ActiveWorkers == 0; });
+        gThreadPool->CurrentJob = nullptr;
+    }
+}
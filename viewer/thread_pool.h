@@ -0,0 +1,14 @@
+#pragma once
+
+#include <functional>
+
+// Persistent pool of worker threads for data-parallel loops.
+// Workers are started on first use, with one worker per hardware thread (minus the caller).
+
+// Number of threads that participate in a ParallelFor, including the calling thread.
+int GetParallelThreadCount();
+
+// Calls fn(begin, end) for consecutive chunks of [0, count), with at most chunkSize elements per chunk.
+// Chunks are distributed dynamically over the workers and the calling thread. Returns when all chunks are done.
+// Nested calls (from inside fn), and calls made while another thread's ParallelFor is running, run serially on the calling thread.
+void ParallelFor(int count, int chunkSize, const std::function<void(int begin, int end)>& fn);